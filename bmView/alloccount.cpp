@@ -0,0 +1,99 @@
+#include "alloccount.h"
+
+#ifdef BMVIEW_ALLOC_COUNT
+namespace {
+	std::atomic<quint64> g_uiTotal{ 0 };
+	thread_local quint64 tl_uiLocal = 0;
+
+	void* allocate(std::size_t szBytes)
+	{
+		g_uiTotal.fetch_add(1, std::memory_order_relaxed);
+		++tl_uiLocal;
+		return std::malloc(szBytes ? szBytes : 1);
+	}
+}
+
+bool CAllocCounter::enabled()
+{
+	return true;
+}
+
+quint64 CAllocCounter::total()
+{
+	return g_uiTotal.load(std::memory_order_relaxed);
+}
+
+quint64 CAllocCounter::local()
+{
+	return tl_uiLocal;
+}
+
+//Replacements of the global allocation functions. Aligned new keeps the default pair
+void* operator new(std::size_t szBytes)
+{
+	if (auto p = allocate(szBytes))
+		return p;
+
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t szBytes)
+{
+	return operator new(szBytes);
+}
+
+void* operator new(std::size_t szBytes, const std::nothrow_t&) noexcept
+{
+	return allocate(szBytes);
+}
+
+void* operator new[](std::size_t szBytes, const std::nothrow_t&) noexcept
+{
+	return allocate(szBytes);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+	std::free(p);
+}
+#else
+bool CAllocCounter::enabled()
+{
+	return false;
+}
+
+quint64 CAllocCounter::total()
+{
+	return 0;
+}
+
+quint64 CAllocCounter::local()
+{
+	return 0;
+}
+#endif
@@ -0,0 +1,12 @@
+#pragma once
+
+//Heap allocations made through operator new, so hot paths can be checked for churn. The global operator new is only
+//replaced in builds with BMVIEW_ALLOC_COUNT defined (Debug), elsewhere the counters stay 0
+class CAllocCounter {
+public:
+	static bool enabled();
+	//All threads since start
+	static quint64 total();
+	//Calling thread only
+	static quint64 local();
+};
@@ -0,0 +1,785 @@
+#include "bench.h"
+#include "spatial.h"
+#include "geotex.h"
+#include "tilemap.h"
+#include "camera.h"
+#include "offscreen.h"
+#include "stats.h"
+#include "consts.h"
+#include "feed.h"
+#include "livelayer.h"
+#include "dataset.h"
+#include "heatmap.h"
+
+namespace {
+	//Features are spread over a city-sized area, as overlays usually are
+	std::vector<TSpatialItem> makeItems(const size_t& szCount, std::mt19937& rng)
+	{
+		std::uniform_real_distribution<double> dPos(0.0, 0.002), dStep(-0.00001, 0.00001);
+		std::vector<TSpatialItem> vItems(szCount);
+		for (size_t i = 0; i < szCount; ++i) {
+			auto& item = vItems[i];
+			item.uiFeature = (uint)i;
+			item.dbX0 = item.dbX1 = 0.6 + dPos(rng);
+			item.dbY0 = item.dbY1 = 0.3 + dPos(rng);
+
+			//Every fourth item is a polyline segment
+			if (0 == (i % 4)) {
+				item.dbX1 += dStep(rng);
+				item.dbY1 += dStep(rng);
+			}
+		}
+
+		return vItems;
+	}
+
+	//Nanoseconds per call, inputs are prepared by the caller so only the call itself is timed
+	template <typename Fn> double measure(const size_t& szCount, Fn fn)
+	{
+		QElapsedTimer timer;
+		timer.start();
+		for (size_t i = 0; i < szCount; ++i)
+			fn(i);
+
+		return (double)timer.nsecsElapsed() / szCount;
+	}
+
+	//Lower is better for everything timed, sizes and counts are only informational
+	bool isTiming(const QString& sUnit)
+	{
+		return sUnit.startsWith("ns") || sUnit.startsWith("us") || sUnit.startsWith("ms");
+	}
+
+	//A view without a window: the tile map only needs the camera and the viewport
+	class CBenchRenderer : public IGlobalRenderer {
+	public:
+		CBenchRenderer(const QSize& qsSize, const QPointF& qpCenter, const uint& uiZoomLevel)
+			: m_qsSize(qsSize), m_qpCenter(qpCenter), m_uiZoomLevel(uiZoomLevel)
+		{
+			m_pCamera->setViewport(qsSize);
+			m_pCamera->setPosition({ 0.f, 0.f, -1000.f });
+		}
+	protected: //IGlobalRenderer
+		void init() override {}
+		uint getZoomLevel() override { return m_uiZoomLevel; }
+		QPointF getCenter() override { return m_qpCenter; }
+		uint getWidth() override { return m_qsSize.width(); }
+		uint getHeight() override { return m_qsSize.height(); }
+		void repaint() override {}
+		QVector3D screenToWorld(const int& nX, const int& nY) override { return m_pCamera->screenToWorld(QPointF(nX, nY)); }
+		QMatrix4x4 getWorldMatrix() override { return m_pCamera->getWorldMatrix(); }
+		ICameraPtr getCamera() override { return m_pCamera; }
+		IOverlayLayerPtr getOverlay() override { return nullptr; }
+		IHeatmapLayerPtr getHeatmap() override { return nullptr; }
+		ILiveLayerPtr getLiveLayer() override { return nullptr; }
+		IDatasetLayerPtr getDatasetLayer() override { return nullptr; }
+	private:
+		ICameraPtr m_pCamera = std::make_shared<CCamera>();
+		QSize m_qsSize;
+		QPointF m_qpCenter;
+		uint m_uiZoomLevel;
+	};
+}
+
+CBenchmark::CBenchmark(const QString& sFilter, const QString& sJson, const QString& sBaseline)
+	: m_sFilter(sFilter), m_sJson(sJson), m_sBaseline(sBaseline)
+{
+}
+
+int CBenchmark::run()
+{
+	//First: GL resources are created once per process
+	if (enabled("startup"))
+		benchStartup();
+
+	if (enabled("spatial"))
+		benchSpatialIndex();
+
+	if (enabled("geo"))
+		benchGeoMath();
+
+	if (enabled("quadkey"))
+		benchQuadKeys();
+
+	if (enabled("ring"))
+		benchCircularBuffer();
+
+	if (enabled("tilemap"))
+		benchTileMap();
+
+	if (enabled("camera"))
+		benchCamera();
+
+	if (enabled("decode"))
+		benchDecode();
+
+	if (enabled("feed"))
+		benchFeed();
+
+	if (enabled("dataset"))
+		benchDataset();
+
+	if (enabled("heatmap"))
+		benchHeatmap();
+
+	if (!m_sBaseline.isEmpty())
+		compare();
+
+	if (!m_sJson.isEmpty() && !write())
+		return 1;
+
+	if (0 != m_uiFailed)
+		qWarning().noquote() << QString("%1 check(s) failed").arg(m_uiFailed);
+
+	return (0 == m_uiFailed) ? 0 : 1;
+}
+
+bool CBenchmark::enabled(const QString& sName) const
+{
+	return m_sFilter.isEmpty() || ("all" == m_sFilter) || sName.startsWith(m_sFilter) || m_sFilter.startsWith(sName);
+}
+
+void CBenchmark::report(const QString& sName, const double& dbValue, const QString& sUnit)
+{
+	qInfo().noquote() << QString("%1: %2 %3").arg(sName, -40).arg(dbValue, 0, 'f', 3).arg(sUnit);
+	m_qjResults.append(QJsonObject{ { "name", sName }, { "value", dbValue }, { "unit", sUnit } });
+}
+
+void CBenchmark::check(const QString& sName, const bool& bPassed, const QString& sDetails)
+{
+	if (!bPassed) {
+		++m_uiFailed;
+		qWarning().noquote() << QString("%1: FAILED %2").arg(sName, -40).arg(sDetails);
+	}
+
+	m_qjChecks.append(QJsonObject{ { "name", sName }, { "passed", bPassed }, { "details", sDetails } });
+}
+
+void CBenchmark::compare()
+{
+	QFile file(m_sBaseline);
+	if (!file.open(QIODevice::ReadOnly)) {
+		qWarning() << "Baseline can't be read:" << m_sBaseline;
+		return;
+	}
+
+	std::map<QString, double> mBaseline;
+	for (const auto& it : QJsonDocument::fromJson(file.readAll()).object()["results"].toArray()) {
+		auto qjResult = it.toObject();
+		mBaseline[qjResult["name"].toString()] = qjResult["value"].toDouble();
+	}
+
+	//Timings are noisy, so a slower run is only reported and does not fail the benchmark
+	for (const auto& it : m_qjResults) {
+		auto qjResult = it.toObject();
+		auto sName = qjResult["name"].toString();
+		auto itBase = mBaseline.find(sName);
+		if ((mBaseline.end() == itBase) || (itBase->second <= 0.0) || !isTiming(qjResult["unit"].toString()))
+			continue;
+
+		double dbChange = (qjResult["value"].toDouble() / itBase->second - 1.0) * 100.0;
+		auto sLine = QString("%1: %2%").arg(sName, -40).arg(dbChange, 0, 'f', 1);
+		if (dbChange > 10.0)
+			qWarning().noquote() << sLine << "slower than the baseline";
+		else
+			qInfo().noquote() << sLine;
+	}
+}
+
+bool CBenchmark::write()
+{
+	QJsonObject qjRoot{ { "results", m_qjResults }, { "checks", m_qjChecks }, { "failed", (int)m_uiFailed } };
+	auto qbData = QJsonDocument(qjRoot).toJson();
+
+	QFile file(m_sJson);
+	bool bOpen = ("-" == m_sJson) ? file.open(stdout, QIODevice::WriteOnly) : file.open(QIODevice::WriteOnly);
+	if (!bOpen || (file.write(qbData) != qbData.size())) {
+		qWarning() << "Benchmark results can't be written:" << m_sJson;
+		return false;
+	}
+
+	return true;
+}
+
+void CBenchmark::benchSpatialIndex()
+{
+	std::mt19937 rng(42);
+	const size_t szQueries = 10000;
+
+	for (size_t szCount : { 10000u, 100000u, 1000000u, 4000000u }) {
+		auto vItems = makeItems(szCount, rng);
+		auto sPrefix = QString("spatial.%1").arg(szCount);
+
+		//0) Bulk build
+		ISpatialIndexPtr pIndex = std::make_shared<CQuadIndex>();
+		QElapsedTimer timer;
+		timer.start();
+		pIndex->build(vItems);
+		report(sPrefix + ".build", timer.nsecsElapsed() / 1e6, "ms");
+		report(sPrefix + ".memory", (double)pIndex->memory() / szCount, "bytes/feature");
+
+		//1) Viewport-sized boxes, about 1% of the area
+		std::uniform_real_distribution<double> dPos(0.6, 0.602), dPosY(0.3, 0.302);
+		size_t szFound = 0;
+		std::vector<uint> vResult;
+		timer.restart();
+		for (size_t i = 0; i < szQueries; ++i) {
+			vResult.clear();
+			pIndex->query(QRectF(dPos(rng), dPosY(rng), 0.0002, 0.0002), vResult);
+			szFound += vResult.size();
+		}
+		report(sPrefix + ".query", timer.nsecsElapsed() / 1e3 / szQueries, "us");
+		report(sPrefix + ".query.found", (double)szFound / szQueries, "features");
+
+		//2) Picking: a few pixels at a street zoom level
+		timer.restart();
+		for (size_t i = 0; i < szQueries; ++i)
+			pIndex->nearest(QPointF(dPos(rng), dPosY(rng)), 0.000001);
+		report(sPrefix + ".nearest", timer.nsecsElapsed() / 1e3 / szQueries, "us");
+
+		//3) Incremental update of 1%
+		auto vDelta = makeItems(szCount / 100, rng);
+		for (auto& it : vDelta)
+			it.uiFeature += (uint)szCount;
+
+		timer.restart();
+		pIndex->insert(vDelta);
+		report(sPrefix + ".insert", timer.nsecsElapsed() / 1e6, "ms");
+	}
+}
+
+void CBenchmark::benchGeoMath()
+{
+	IGeoMathPtr pMath = std::make_shared<CBingGeoMath>();
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<double> dLat(-85.0, 85.0), dLon(-180.0, 180.0);
+	const size_t szCount = 1000000;
+
+	for (uint uiZoom : { 1u, 12u, 23u }) {
+		auto sPrefix = QString("geo.z%1").arg(uiZoom);
+		auto uiSize = pMath->getMapSize(uiZoom);
+		std::uniform_int_distribution<int> dPix(0, (int)(uiSize - 1));
+
+		std::vector<std::pair<double, double>> vWgs(szCount), vWgsOut(szCount);
+		std::vector<std::pair<int, int>> vPix(szCount), vPixOut(szCount);
+		for (size_t i = 0; i < szCount; ++i) {
+			vWgs[i] = { dLat(rng), dLon(rng) };
+			vPix[i] = { dPix(rng), dPix(rng) };
+		}
+
+		//0) Conversions
+		report(sPrefix + ".wgs2pix", measure(szCount, [&](const size_t& i) {
+			vPixOut[i] = pMath->wgs2pix(vWgs[i].first, vWgs[i].second, uiZoom);
+		}), "ns");
+
+		report(sPrefix + ".pix2wgs", measure(szCount, [&](const size_t& i) {
+			vWgsOut[i] = pMath->pix2wgs(vPix[i].first, vPix[i].second, uiZoom);
+		}), "ns");
+
+		//1) A pixel comes back exactly, a coordinate within the pixel it fell into
+		size_t szPixFailed = 0, szWgsFailed = 0;
+		double dbPixel = 360.0 / uiSize;
+		for (size_t i = 0; i < szCount; ++i) {
+			if (pMath->wgs2pix(vWgsOut[i].first, vWgsOut[i].second, uiZoom) != vPix[i])
+				++szPixFailed;
+
+			auto spWgs = pMath->pix2wgs(vPixOut[i].first, vPixOut[i].second, uiZoom);
+			if ((std::abs(spWgs.first - vWgs[i].first) > dbPixel) || (std::abs(spWgs.second - vWgs[i].second) > dbPixel))
+				++szWgsFailed;
+		}
+
+		check(sPrefix + ".pix.roundtrip", 0 == szPixFailed, QString("%1 of %2").arg(szPixFailed).arg(szCount));
+		check(sPrefix + ".wgs.roundtrip", 0 == szWgsFailed, QString("%1 of %2").arg(szWgsFailed).arg(szCount));
+
+		//2) Edges of the world clip to the first and the last pixel
+		auto spMin = pMath->wgs2pix(90.0, -180.0, uiZoom);
+		auto spMax = pMath->wgs2pix(-90.0, 180.0, uiZoom);
+		int nLast = (int)(uiSize - 1);
+		check(sPrefix + ".edges", (std::make_pair(0, 0) == spMin) && (std::make_pair(nLast, nLast) == spMax),
+			QString("(%1, %2) (%3, %4)").arg(spMin.first).arg(spMin.second).arg(spMax.first).arg(spMax.second));
+	}
+}
+
+void CBenchmark::benchQuadKeys()
+{
+	IGeoMathPtr pMath = std::make_shared<CBingGeoMath>();
+	std::mt19937 rng(42);
+	const size_t szCount = 1000000;
+
+	for (uint uiZoom : { 1u, 8u, 16u, 23u }) {
+		auto sPrefix = QString("quadkey.z%1").arg(uiZoom);
+		std::uniform_int_distribution<int> dTile(0, pMath->getTileIndexRange(uiZoom));
+
+		std::vector<std::pair<int, int>> vTiles(szCount);
+		for (auto& it : vTiles)
+			it = { dTile(rng), dTile(rng) };
+
+		//0) Conversions
+		std::vector<QString> vKeys(szCount);
+		report(sPrefix + ".tile2quad", measure(szCount, [&](const size_t& i) {
+			vKeys[i] = pMath->tile2quad(vTiles[i].first, vTiles[i].second, uiZoom);
+		}), "ns");
+
+		std::vector<std::tuple<int, int, uint>> vOut(szCount);
+		report(sPrefix + ".quad2tile", measure(szCount, [&](const size_t& i) {
+			vOut[i] = pMath->quad2tile(vKeys[i]);
+		}), "ns");
+
+		//1) Round trip
+		size_t szFailed = 0;
+		for (size_t i = 0; i < szCount; ++i) {
+			if (std::make_tuple(vTiles[i].first, vTiles[i].second, uiZoom) != vOut[i])
+				++szFailed;
+		}
+
+		check(sPrefix + ".roundtrip", 0 == szFailed, QString("%1 of %2").arg(szFailed).arg(szCount));
+	}
+
+	//2) Edge cases: the root, the four tiles of level 1, digit order and the last tile of the deepest level
+	check("quadkey.root", pMath->tile2quad(0, 0, 0).isEmpty() && (std::make_tuple(0, 0, 0u) == pMath->quad2tile(QString())));
+
+	const char* szLevel1[] = { "0", "1", "2", "3" };
+	bool bLevel1 = true;
+	for (int i = 0; i < 4; ++i) {
+		bLevel1 &= (szLevel1[i] == pMath->tile2quad(i % 2, i / 2, 1));
+		bLevel1 &= (std::make_tuple(i % 2, i / 2, 1u) == pMath->quad2tile(szLevel1[i]));
+	}
+	check("quadkey.level1", bLevel1);
+
+	check("quadkey.order", ("213" == pMath->tile2quad(3, 5, 3)) && (std::make_tuple(3, 5, 3u) == pMath->quad2tile("213")),
+		pMath->tile2quad(3, 5, 3));
+
+	int nMax = pMath->getTileIndexRange(23);
+	check("quadkey.max", (QString(23, '3') == pMath->tile2quad(nMax, nMax, 23)) && (QString(23, '1') == pMath->tile2quad(nMax, 0, 23))
+		&& (std::make_tuple(nMax, nMax, 23u) == pMath->quad2tile(QString(23, '3'))));
+}
+
+void CBenchmark::benchCircularBuffer()
+{
+	//Tiles are only registered, a ring shift invalidates them but no texture is ever requested
+	for (size_t szTiles : { 10u, 64u, 256u }) {
+		std::vector<ITilePtr> vTiles;
+		ITileCircularBufferPtr pRing = std::make_shared<CTileCircularBuffer>(false);
+		for (size_t i = 0; i < szTiles; ++i) {
+			vTiles.push_back(std::make_shared<CTile>(nullptr));
+			pRing->addLast(vTiles.back()->handle());
+		}
+		pRing->rebuild();
+
+		std::vector<THandle> vStart(pRing->begin(), pRing->end());
+		for (uint uiShift : { 1u, (uint)szTiles / 2 }) {
+			auto sPrefix = QString("ring.%1.shift%2").arg(szTiles).arg(uiShift);
+
+			//0) Back and forth, an even count leaves the ring as it was
+			const size_t szCount = 100000;
+			report(sPrefix, measure(szCount, [&](const size_t& i) {
+				(0 == (i % 2)) ? (*pRing >> uiShift) : (*pRing << uiShift);
+			}), "ns");
+
+			//1) Same order, and every tile knows its place again
+			bool bPassed = std::equal(vStart.begin(), vStart.end(), pRing->begin(), pRing->end());
+			for (size_t i = 0; bPassed && (i < szTiles); ++i)
+				bPassed = (i == pRing->at(i)->getIndex().first);
+
+			check(sPrefix + ".order", bPassed);
+		}
+	}
+}
+
+void CBenchmark::benchTileMap()
+{
+	if (!CBingGeoTextureProvider::get()->getMetadata()->valid()) {
+		qWarning() << "No imagery metadata, tile map benchmark is skipped";
+		return;
+	}
+
+	const uint uiZoom = 12;
+	IGlobalRendererPtr pRenderer = std::make_shared<CBenchRenderer>(QSize(1920, 1080), QPointF(55.75, 37.62), uiZoom);
+	auto pCamera = pRenderer->getCamera();
+	ITileMapPtr pMap = std::make_shared<CTileMap>(pRenderer);
+	pMap->init();
+
+	//0) Geometry is rebuilt on every resize
+	report("tilemap.rebuild", measure(10000, [&](const size_t&) { pMap->rebuild(); }) / 1e3, "us");
+	pMap->detail(uiZoom);
+
+	report("tilemap.cull", measure(10000, [&](const size_t&) { pMap->cull(pCamera->getWorldMatrix()); }) / 1e3, "us");
+
+	//1) Diagonal pans from sub-tile drags, which only cull, to flicks that shift several rows and columns
+	auto transform = pMap->getMercatorTransform();
+	auto qvStart = pCamera->getPosition();
+	float fPixel = pCamera->screenToWorld(QPointF(1, 0)).x() - pCamera->screenToWorld(QPointF(0, 0)).x();
+	const size_t szSteps = 200, szRounds = 5;
+
+	for (int nDelta : { 1, 16, 256, 1024 }) {
+		auto sPrefix = QString("tilemap.move.%1px").arg(nDelta);
+		float fStep = nDelta * fPixel;
+
+		report(sPrefix, measure(2 * szSteps * szRounds, [&](const size_t& i) {
+			//There and back, every round ends where it started
+			size_t szStep = i % (2 * szSteps);
+			float fOffset = fStep * (float)((szStep < szSteps) ? szStep + 1 : 2 * szSteps - szStep - 1);
+			pCamera->setPosition({ qvStart.x() + fOffset, qvStart.y() + fOffset / 2.f, qvStart.z() });
+			pMap->move();
+		}) / 1e3, "us");
+
+		//2) However the grid got shifted, mercator coordinates still land on the same world point
+		auto moved = pMap->getMercatorTransform();
+		double dbTolerance = 0.01 * transform.dbScaleX / std::pow(2.0, uiZoom);
+		check(sPrefix + ".transform", moved.bValid && (std::abs(moved.dbOriginX - transform.dbOriginX) < dbTolerance)
+			&& (std::abs(moved.dbOriginY - transform.dbOriginY) < dbTolerance)
+			&& (std::abs(moved.dbScaleX - transform.dbScaleX) < dbTolerance),
+			QString("origin moved by %1, %2").arg(moved.dbOriginX - transform.dbOriginX).arg(moved.dbOriginY - transform.dbOriginY));
+	}
+}
+
+void CBenchmark::benchCamera()
+{
+	ICameraPtr pCamera = std::make_shared<CCamera>();
+	pCamera->setViewport({ 1920, 1080 });
+	pCamera->setPosition({ 0.f, 0.f, -1000.f });
+
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<double> dX(0.0, 1920.0), dY(0.0, 1080.0);
+
+	for (size_t szPoints : { 1u, 64u, 4096u, 65536u }) {
+		auto sPrefix = QString("camera.%1").arg(szPoints);
+		std::vector<QPointF> vScreen(szPoints);
+		for (auto& it : vScreen)
+			it = { dX(rng), dY(rng) };
+
+		//0) One batch against a call per point, both per point
+		std::vector<QVector3D> vWorld;
+		size_t szRepeat = std::max<size_t>(1, 1000000 / szPoints);
+		report(sPrefix + ".screenToWorld.batch", measure(szRepeat, [&](const size_t&) {
+			pCamera->screenToWorld(vScreen, vWorld);
+		}) / szPoints, "ns/point");
+
+		report(sPrefix + ".screenToWorld", measure(szRepeat, [&](const size_t&) {
+			for (const auto& it : vScreen)
+				m_dbSink = m_dbSink + pCamera->screenToWorld(it).x();
+		}) / szPoints, "ns/point");
+	}
+
+	//1) Through the map plane and back lands on the pixel centre
+	size_t szFailed = 0;
+	const size_t szCount = 10000;
+	for (size_t i = 0; i < szCount; ++i) {
+		QPointF qpScreen(std::floor(dX(rng)), std::floor(dY(rng)));
+		auto qvHit = pCamera->screenToPlane(qpScreen);
+		if (!qvHit) {
+			++szFailed;
+			continue;
+		}
+
+		auto qpBack = pCamera->worldToScreen(*qvHit) - qpScreen - QPointF(0.5, 0.5);
+		if ((std::abs(qpBack.x()) > 0.05) || (std::abs(qpBack.y()) > 0.05))
+			++szFailed;
+	}
+
+	check("camera.plane.roundtrip", 0 == szFailed, QString("%1 of %2").arg(szFailed).arg(szCount));
+}
+
+void CBenchmark::benchStartup()
+{
+	//0) Fresh renderer: context, tile program and buffers, one frame read back. Tiles are not waited for
+	TStaticMapJob job;
+	job.qpCenter = QPointF(55.75, 37.62);
+	job.qsSize = QSize(256, 256);
+	job.nTimeout = -1;
+
+	QElapsedTimer timer;
+	timer.start();
+	auto img = COffscreenRenderer::renderStaticMap(job);
+	double dbFirstFrame = timer.nsecsElapsed() / 1e6;
+	if (img.isNull()) {
+		qWarning() << "startup: no OpenGL context, skipped";
+		return;
+	}
+
+	report("startup.first_frame", dbFirstFrame, "ms");
+
+	//1) Its parts. A warm start loads the programs from the shader disk cache, run it twice to compare
+	auto pStats = CStatistics::get();
+	report("startup.programs", pStats->value("startup.programs.us") / 1e3, "ms");
+	report("startup.buffers", pStats->value("startup.buffers.us") / 1e3, "ms");
+}
+
+void CBenchmark::benchDecode()
+{
+	std::mt19937 rng(42);
+	std::uniform_int_distribution<int> dNoise(0, 31);
+
+	for (int nSize : { 256, 512 }) {
+		//A gradient with noise compresses about as well as aerial imagery
+		QImage img(nSize, nSize, QImage::Format_RGB32);
+		for (int y = 0; y < nSize; ++y) {
+			auto pLine = reinterpret_cast<QRgb*>(img.scanLine(y));
+			for (int x = 0; x < nSize; ++x)
+				pLine[x] = qRgb((x * 224 / nSize) + dNoise(rng), (y * 224 / nSize) + dNoise(rng), 96 + dNoise(rng));
+		}
+
+		for (const char* szFormat : { "png", "jpg" }) {
+			auto sPrefix = QString("decode.%1.%2").arg(szFormat).arg(nSize);
+			QByteArray qbData;
+			QBuffer buffer(&qbData);
+			buffer.open(QIODevice::WriteOnly);
+			img.save(&buffer, szFormat, 85);
+			buffer.close();
+			report(sPrefix + ".size", qbData.size(), "bytes");
+
+			//0) Same steps as a fetched tile: the format is sniffed, the image is mirrored for GL
+			QImage decoded;
+			report(sPrefix, measure(200, [&](const size_t&) {
+				QBuffer input(&qbData);
+				input.open(QIODevice::ReadOnly);
+				decoded = QImageReader(&input).read().mirrored();
+			}) / 1e3, "us");
+
+			//1) PNG is lossless, JPEG only has to keep the size
+			bool bPassed = (decoded.size() == img.size());
+			if (bPassed && (0 == qstrcmp(szFormat, "png")))
+				bPassed = (decoded.mirrored().convertToFormat(QImage::Format_RGB32) == img);
+
+			check(sPrefix + ".roundtrip", bPassed);
+		}
+	}
+}
+
+void CBenchmark::benchFeed()
+{
+	//0) Ten seconds of 10000 objects at 100k reports/s, as the replay generator writes them
+	CFeedGenerator generator({ QPointF(55.60, 37.40), QPointF(55.90, 37.80) }, 10000, 100000);
+	auto qbLog = generator.next(10000);
+	report("feed.log.size", qbLog.size(), "bytes");
+
+	//1) Same path as the feed thread: lines parsed into batches, batches handed to a live layer. No frame takes them
+	ILiveLayerPtr pLayer = std::make_shared<CLiveLayer>();
+	std::vector<TFeedUpdate> vBatch;
+	vBatch.reserve(gszFeedBatch);
+	size_t szLines = 0, szParsed = 0;
+
+	QElapsedTimer timer;
+	timer.start();
+	for (int nPos = 0; nPos < qbLog.size();) {
+		auto nEnd = qbLog.indexOf('\n', nPos);
+		if (nEnd < 0)
+			nEnd = qbLog.size();
+
+		TFeedUpdate update;
+		++szLines;
+		if (CObjectFeed::parse(qbLog.constData() + nPos, nEnd - nPos, update)) {
+			++szParsed;
+			vBatch.push_back(update);
+			if (vBatch.size() >= gszFeedBatch) {
+				pLayer->update(vBatch);
+				vBatch.clear();
+			}
+		}
+
+		nPos = nEnd + 1;
+	}
+
+	pLayer->update(vBatch);
+	double dbSeconds = timer.nsecsElapsed() / 1e9;
+
+	report("feed.ingest", dbSeconds * 1e9 / std::max<size_t>(szParsed, 1), "ns");
+	report("feed.rate", szParsed / std::max(dbSeconds, 1e-9), "updates/s");
+	check("feed.parse", (szParsed == szLines) && (szLines == 1000000), QString("%1 of %2").arg(szParsed).arg(szLines));
+}
+
+void CBenchmark::benchDataset()
+{
+	//0) A million weighted points over a city as CSV, in a directory that goes with the benchmark
+	QTemporaryDir dir;
+	if (!dir.isValid()) {
+		check("dataset.dir", false, dir.errorString());
+		return;
+	}
+
+	const size_t szPoints = 1000000;
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<double> dLat(55.60, 55.90), dLon(37.40, 37.80);
+	QByteArray qbCsv("lat,lon,weight\n");
+	qbCsv.reserve((int)(szPoints * 32));
+	for (size_t i = 0; i < szPoints; ++i) {
+		qbCsv.append(QByteArray::number(dLat(rng), 'f', 7)).append(',')
+			.append(QByteArray::number(dLon(rng), 'f', 7)).append(',')
+			.append(QByteArray::number((int)(i % 10))).append('\n');
+	}
+
+	auto qsInput = dir.filePath("points.csv"), qsOutput = dir.filePath("points.bmp");
+	QFile csv(qsInput);
+	if (!csv.open(QIODevice::WriteOnly) || (csv.write(qbCsv) != qbCsv.size())) {
+		check("dataset.csv", false, qsInput);
+		return;
+	}
+
+	csv.close();
+	report("dataset.csv.size", qbCsv.size(), "bytes");
+
+	//1) Import: parse, sort and write
+	QElapsedTimer timer;
+	timer.start();
+	bool bImported = (0 == CDatasetImporter(qsInput, qsOutput).run());
+	double dbSeconds = timer.nsecsElapsed() / 1e9;
+	check("dataset.import", bImported);
+	if (!bImported)
+		return;
+
+	report("dataset.import", dbSeconds * 1000.0, "ms");
+	report("dataset.import.rate", szPoints / std::max(dbSeconds, 1e-9), "points/s");
+
+	//2) Opening only maps the file
+	timer.restart();
+	auto pDataset = CPointDataset::open(qsOutput);
+	report("dataset.open", timer.nsecsElapsed() / 1e6, "ms");
+	if (!pDataset) {
+		check("dataset.open", false, qsOutput);
+		return;
+	}
+
+	check("dataset.size", pDataset->size() == szPoints, QString("%1 of %2").arg(pDataset->size()).arg(szPoints));
+	check("dataset.weights", pDataset->weights() != nullptr);
+
+	//3) Ranges of a view of a tenth of the area across, as a frame asks for them
+	auto qrBounds = pDataset->bounds();
+	QRectF qrView(qrBounds.center(), qrBounds.size() / 10.0);
+	std::vector<std::pair<size_t, size_t>> vRanges;
+	const int nQueries = 1000;
+	timer.restart();
+	for (int i = 0; i < nQueries; ++i)
+		pDataset->ranges(qrView.translated(qrBounds.width() * (i % 10) / 100.0, 0.0), gszDatasetMaxPoints, vRanges);
+
+	report("dataset.ranges", timer.nsecsElapsed() / 1e3 / nQueries, "us");
+
+	//4) Every point of the view has to be in the ranges, and they are sorted and apart
+	pDataset->ranges(qrView, gszDatasetMaxPoints, vRanges);
+	size_t szInRanges = 0, szInView = 0;
+	bool bOrdered = true;
+	for (size_t i = 0; i < vRanges.size(); ++i) {
+		szInRanges += vRanges[i].second - vRanges[i].first;
+		bOrdered &= (vRanges[i].first < vRanges[i].second) && (!i || (vRanges[i - 1].second < vRanges[i].first));
+	}
+
+	auto pPositions = pDataset->positions();
+	bool bCovered = true;
+	for (size_t i = 0; i < pDataset->size(); ++i) {
+		QPointF qpMerc((double)pPositions[4 * i] + pPositions[4 * i + 2], (double)pPositions[4 * i + 1] + pPositions[4 * i + 3]);
+		if (!qrView.contains(qpMerc))
+			continue;
+
+		++szInView;
+		auto it = std::upper_bound(vRanges.begin(), vRanges.end(), std::make_pair(i, std::numeric_limits<size_t>::max()));
+		bCovered &= (it != vRanges.begin()) && (i < std::prev(it)->second);
+	}
+
+	report("dataset.ranges.points", (double)szInRanges, "points");
+	check("dataset.ranges", bOrdered && bCovered, QString("%1 in view, %2 in %3 ranges").arg(szInView).arg(szInRanges).arg(vRanges.size()));
+
+	//5) Keys keep positions to a 2^31 grid
+	bool bRoundTrip = true;
+	std::uniform_real_distribution<double> dMerc(0.0, 1.0);
+	for (int i = 0; i < 100000; ++i) {
+		double dbX = dMerc(rng), dbY = dMerc(rng);
+		auto spMerc = CPointDataset::merc(CPointDataset::key(dbX, dbY));
+		bRoundTrip &= (std::abs(spMerc.first - dbX) <= 1.0 / 2147483648.0) && (std::abs(spMerc.second - dbY) <= 1.0 / 2147483648.0);
+	}
+
+	check("dataset.roundtrip", bRoundTrip);
+}
+
+void CBenchmark::benchHeatmap()
+{
+	//0) A context of its own with a full HD target, blending as a view sets it
+	QOpenGLContext context;
+	context.setShareContext(QOpenGLContext::globalShareContext());
+	context.setFormat(QSurfaceFormat::defaultFormat());
+	QOffscreenSurface surface;
+	if (context.create()) {
+		surface.setFormat(context.format());
+		surface.create();
+	}
+
+	if (!surface.isValid() || !context.makeCurrent(&surface)) {
+		qWarning() << "heatmap: no OpenGL context, skipped";
+		return;
+	}
+
+	const QSize qsSize(1920, 1080);
+	auto* pFunc = context.extraFunctions();
+	{
+		QOpenGLFramebufferObject fbo(qsSize, QOpenGLFramebufferObject::CombinedDepthStencil);
+		fbo.bind();
+		pFunc->glViewport(0, 0, qsSize.width(), qsSize.height());
+		pFunc->glEnable(GL_BLEND);
+		pFunc->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+		ICameraPtr pCamera = std::make_shared<CCamera>();
+		pCamera->setViewport(qsSize);
+		pCamera->setPosition({ 0.f, 0.f, -1000.f });
+		auto qvStart = pCamera->getPosition();
+		float fPixel = pCamera->screenToWorld(QPointF(1, 0)).x() - pCamera->screenToWorld(QPointF(0, 0)).x();
+
+		//1) The city the points are spread over fills the screen
+		auto pMath = CBingGeoTextureProvider::get()->getMath();
+		auto spTopLeft = pMath->wgs2merc(55.90, 37.40), spBottomRight = pMath->wgs2merc(55.60, 37.80);
+		auto qvTopLeft = pCamera->screenToWorld(QPointF(0, 0));
+		auto qvBottomRight = pCamera->screenToWorld(QPointF(qsSize.width(), qsSize.height()));
+		TMercatorTransform transform;
+		transform.dbScaleX = (qvBottomRight.x() - qvTopLeft.x()) / (spBottomRight.first - spTopLeft.first);
+		transform.dbScaleY = (qvBottomRight.y() - qvTopLeft.y()) / (spBottomRight.second - spTopLeft.second);
+		transform.dbOriginX = qvTopLeft.x() - spTopLeft.first * transform.dbScaleX;
+		transform.dbOriginY = qvTopLeft.y() - spTopLeft.second * transform.dbScaleY;
+		transform.bValid = true;
+
+		auto pStats = CStatistics::get();
+		std::mt19937 rng(11);
+		std::uniform_real_distribution<double> dLat(55.60, 55.90), dLon(37.40, 37.80);
+		for (size_t szPoints : { 1000000u, 10000000u }) {
+			auto sPrefix = QString("heatmap.%1").arg(szPoints);
+			std::vector<QPointF> vPoints(szPoints);
+			for (auto& it : vPoints)
+				it = { dLat(rng), dLon(rng) };
+
+			IHeatmapLayerPtr pLayer = std::make_shared<CHeatmapLayer>();
+			pLayer->initGL();
+			pLayer->addPoints(vPoints, 1.f);
+			std::vector<QPointF>().swap(vPoints);
+
+			//2) First frame uploads and splats everything. Frames are waited for, the GPU time is what is measured
+			pCamera->setPosition(qvStart);
+			auto frame = [&]() {
+				pLayer->draw(pCamera->getWorldMatrix(), transform, qsSize);
+				pFunc->glFinish();
+			};
+
+			QElapsedTimer timer;
+			timer.start();
+			frame();
+			report(sPrefix + ".first", timer.nsecsElapsed() / 1e6, "ms");
+
+			//3) Still camera: the density texture is only composed again
+			const size_t szStill = 100, szMoving = 50;
+			auto nFull = pStats->value("heatmap.splats.full");
+			report(sPrefix + ".still", measure(szStill, [&](const size_t&) { frame(); }) / 1e6, "ms");
+			check(sPrefix + ".still.splats", pStats->value("heatmap.splats.full") == nFull,
+				QString("%1 full splats").arg(pStats->value("heatmap.splats.full") - nFull));
+
+			//4) Panning a few pixels a frame: every point is splatted again
+			nFull = pStats->value("heatmap.splats.full");
+			report(sPrefix + ".moving", measure(szMoving, [&](const size_t& i) {
+				pCamera->setPosition({ qvStart.x() + 4.f * fPixel * (i + 1), qvStart.y(), qvStart.z() });
+				frame();
+			}) / 1e6, "ms");
+			report(sPrefix + ".moving.splats", (double)(pStats->value("heatmap.splats.full") - nFull) / szMoving, "splats/frame");
+
+			//5) GL objects of the layer go while its context is current
+			pLayer.reset();
+		}
+
+		fbo.release();
+	}
+
+	context.doneCurrent();
+}
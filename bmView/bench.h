@@ -0,0 +1,36 @@
+#pragma once
+#include "intfs.h"
+
+class CBenchmark {
+public:
+	//Results are logged, and written as JSON when sJson is set ("-" is stdout). A JSON file of an earlier run is the baseline
+	explicit CBenchmark(const QString& sFilter, const QString& sJson = QString(), const QString& sBaseline = QString());
+	//Non-zero if a correctness check failed
+	int run();
+private:
+	QString m_sFilter;
+	QString m_sJson;
+	QString m_sBaseline;
+	QJsonArray m_qjResults;
+	QJsonArray m_qjChecks;
+	uint m_uiFailed = 0;
+	//Keeps the optimiser from dropping the measured calls
+	volatile double m_dbSink = 0.0;
+private:
+	bool enabled(const QString& sName) const;
+	void report(const QString& sName, const double& dbValue, const QString& sUnit);
+	void check(const QString& sName, const bool& bPassed, const QString& sDetails = QString());
+	void compare();
+	bool write();
+	void benchStartup();
+	void benchSpatialIndex();
+	void benchGeoMath();
+	void benchQuadKeys();
+	void benchCircularBuffer();
+	void benchTileMap();
+	void benchCamera();
+	void benchDecode();
+	void benchFeed();
+	void benchDataset();
+	void benchHeatmap();
+};
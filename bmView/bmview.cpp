@@ -1,20 +1,50 @@
 #include "bmview.h"
 #include "consts.h"
+#include "stats.h"
+#include "overlay.h"
+#include "heatmap.h"
+#include "livelayer.h"
+#include "datasetlayer.h"
+#include "sched.h"
+#include "camera.h"
+#include "alloccount.h"
+#include "quadmap.h"
+#include "trace.h"
 
 bmView::bmView(QWidget *parent)
 	: QOpenGLWidget(parent)
 {
 	ui.setupUi(this);
+	setMouseTracking(true);
+	m_pCamera = std::make_shared<CCamera>();
+	m_StartTimer.start();
 
 	connect(this, &bmView::updateRenderer, this, &bmView::onRendererUpdate);
+	connect(&m_LiveTimer, &QTimer::timeout, this, &bmView::onLiveCheck);
+	m_LiveTimer.start(1000);
 }
 
 void bmView::init()
 {
 	auto pRender = std::dynamic_pointer_cast<IGlobalRenderer>(shared_from_this());
-	m_pTiles = std::make_shared<CTileMap>(pRender);
+	if (CQuadTileMap::enabled())
+		m_pTiles = std::make_shared<CQuadTileMap>(pRender);
+	else
+		m_pTiles = std::make_shared<CTileMap>(pRender);
+	m_pOverlay = std::make_shared<COverlayLayer>();
+	m_pHeatmap = std::make_shared<CHeatmapLayer>();
+	m_pLive = std::make_shared<CLiveLayer>();
+	m_pDataset = std::make_shared<CDatasetLayer>();
 	
-	this->showMaximized();
+	if (!parentWidget())
+		this->showMaximized();
+}
+
+void bmView::setStart(const QPointF& qpCenter, const uint& uiZoomLevel)
+{
+	//The tile grid is laid out around getCenter(), which reads lat/lon off the camera position
+	m_qvStart = QVector3D((float)(qpCenter.x() * 1000.0), (float)(qpCenter.y() * 1000.0), m_qvStart.z());
+	m_uiZoomLevel = std::min(std::max(uiZoomLevel, 2u), 18u);
 }
 
 void bmView::initializeGL()
@@ -25,12 +55,15 @@ void bmView::initializeGL()
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	m_qvCameraPos = { 55948.87f, 54734.17f, -1000.f };
-	m_camera.setToIdentity();
-	m_camera.translate(m_qvCameraPos);
+	m_pCamera->setPosition(m_qvStart);
+	m_pCamera->setViewport(size());
 	
 	m_pTiles->init();
 	m_pTiles->initGL();
+	m_pOverlay->initGL();
+	m_pHeatmap->initGL();
+	m_pLive->initGL();
+	m_pDataset->initGL();
 
 	m_pTiles->move();
 	m_pTiles->detail(m_uiZoomLevel);
@@ -38,26 +71,60 @@ void bmView::initializeGL()
 
 void bmView::paintGL()
 {
+	CTraceScope frame("frame");
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	if (!m_pTiles)
 		return;
 
-	double dbScale = -1.f * m_qvCameraPos.z() / (gfMaxPerspective - gfMinPerspective);
-	auto qmWorld = m_proj * m_camera;
+	//Steady state panning over loaded tiles should not touch the heap. The whole frame counts: move, cull,
+	//the deliveries and the layers
+	bool bMoved = m_bMoved;
+	auto uiLocal = CAllocCounter::local();
+	auto uiTotal = CAllocCounter::total();
+	if (m_bMoved) {
+		m_bMoved = false;
+		CTraceScope move("move");
+		m_pTiles->move();
+	}
+
+	const auto& qmWorld = m_pCamera->getWorldMatrix();
 
 	m_pTiles->draw(qmWorld);
+	auto transform = m_pTiles->getMercatorTransform();
+	m_pHeatmap->draw(qmWorld, transform, size());
+	m_pDataset->draw(qmWorld, transform, size());
+	m_pOverlay->draw(qmWorld, transform, size());
+	m_pLive->draw(qmWorld, transform, size());
+
+	if (bMoved && CAllocCounter::enabled()) {
+		static CStatCounter statGui("alloc.pan.gui");
+		static CStatCounter statAll("alloc.pan.all");
+		statGui.set(CAllocCounter::local() - uiLocal);
+		statAll.set(CAllocCounter::total() - uiTotal);
+	}
+
+	if (m_bFirstFrame) {
+		m_bFirstFrame = false;
+		CStatistics::get()->set("startup.first_frame.ms", m_StartTimer.elapsed());
+	}
+
+	//Live objects move between their reports, so the next frame is due right away
+	if (m_pLive->animating())
+		update();
 }
 
 void bmView::resizeGL(int width, int height)
 {
-	m_proj.setToIdentity();
-	m_proj.perspective(45.0f, GLfloat(width) / height, gfMinPerspective, gfMaxPerspective);
+	m_pCamera->setViewport({ width, height });
 	m_pTiles->rebuild();
 }
 
 void bmView::mousePressEvent(QMouseEvent* event)
 {
 	m_qpLastPos = event->pos();
+
+	if (auto uiFeature = pickFeature(event->pos()))
+		emit featurePicked(*uiFeature);
 }
 
 void bmView::mouseMoveEvent(QMouseEvent* event)
@@ -66,22 +133,25 @@ void bmView::mouseMoveEvent(QMouseEvent* event)
 		return;
 
 	if (event->buttons() & Qt::LeftButton) {
-		auto qvPrev = screenToWorld(m_qpLastPos.x(), m_qpLastPos.y());
-		auto qvNow = screenToWorld(event->x(), event->y());
+		//A 1000 Hz mouse delivers many events per frame: the camera follows each, tiles only the last
+		m_vScreen.assign({ QPointF(m_qpLastPos), QPointF(event->pos()) });
+		m_pCamera->screenToWorld(m_vScreen, m_vWorld);
 
-		auto dx = (qvNow.x() - qvPrev.x());
-		auto dy = (qvNow.y() - qvPrev.y());
-
-		m_qvCameraPos.setX(m_qvCameraPos.x() + dx);
-		m_qvCameraPos.setY(m_qvCameraPos.y() + dy);
-
-		m_camera.setToIdentity();
-		m_camera.translate(m_qvCameraPos);
-
-		m_pTiles->move();
+		auto qvPos = m_pCamera->getPosition();
+		qvPos.setX(qvPos.x() + m_vWorld[1].x() - m_vWorld[0].x());
+		qvPos.setY(qvPos.y() + m_vWorld[1].y() - m_vWorld[0].y());
+		m_pCamera->setPosition(qvPos);
 
+		m_bMoved = true;
 		update();
 	}
+	else if (!event->buttons()) {
+		auto uiFeature = pickFeature(event->pos());
+		if (uiFeature && (uiFeature != m_uiHovered))
+			emit featureHovered(*uiFeature);
+
+		m_uiHovered = uiFeature;
+	}
 
 	m_qpLastPos = event->pos();
 }
@@ -89,19 +159,29 @@ void bmView::mouseMoveEvent(QMouseEvent* event)
 void bmView::wheelEvent(QWheelEvent* event)
 {
 	int delta = event->delta();
-	auto fNewZ = m_qvCameraPos.z() + delta * getZoomFactor();
+	auto qvPos = m_pCamera->getPosition();
+	auto fNewZ = qvPos.z() + delta * getZoomFactor();
 
 	if (fNewZ > -1 * gfMinPerspective || fNewZ < -1 * gfMaxPerspective)
 		return;
 
-	m_qvCameraPos.setZ(fNewZ);
-	m_camera.setToIdentity();
-	m_camera.translate(m_qvCameraPos);
+	qvPos.setZ(fNewZ);
+	m_pCamera->setPosition(qvPos);
 
 	updateZoomLevel(delta);
 
+	//A zoom requests a whole new set of textures, so this shows the cost per requested tile
+	auto uiLocal = CAllocCounter::local();
+	auto uiTotal = CAllocCounter::total();
 	m_pTiles->rebuild();
 	m_pTiles->detail(m_uiZoomLevel);
+
+	if (CAllocCounter::enabled()) {
+		static CStatCounter statGui("alloc.zoom.gui");
+		static CStatCounter statAll("alloc.zoom.all");
+		statGui.set(CAllocCounter::local() - uiLocal);
+		statAll.set(CAllocCounter::total() - uiTotal);
+	}
 	update();
 }
 
@@ -110,6 +190,37 @@ void bmView::onRendererUpdate()
 	this->update();
 }
 
+void bmView::onLiveCheck()
+{
+	//An idle view starts drawing when the first reports arrive
+	if (m_pLive && m_pLive->animating())
+		update();
+}
+
+void bmView::reportStats()
+{
+	auto pStats = CStatistics::get();
+	auto sched = CJobScheduler::get()->stats();
+	pStats->set("sched.busy", sched.uiBusy);
+	pStats->set("sched.utilisation.pct", (qint64)(100.0 * sched.dbUtilisation));
+	pStats->set("sched.queued.visible", sched.aQueued[(size_t)EJobPriority::Visible]);
+	pStats->set("sched.queued.prefetch", sched.aQueued[(size_t)EJobPriority::Prefetch]);
+	pStats->set("sched.queued.background", sched.aQueued[(size_t)EJobPriority::Background]);
+	pStats->set("sched.canceled", sched.uiCanceled);
+
+	//Tiers are asked top down: textures, RAM, shared memory, disk. Each rate is over the lookups that reached the tier
+	auto hitRate = [&pStats](const QString& qsTier, const qint64& nHits, const qint64& nMisses) {
+		if (nHits + nMisses)
+			pStats->set(qsTier + ".hitrate.pct", 100 * nHits / (nHits + nMisses));
+	};
+	hitRate("textures", pStats->value("textures.hits"), pStats->value("textures.misses"));
+	hitRate("cache.memory", pStats->value("cache.memory.hits"), pStats->value("cache.memory.misses"));
+	hitRate("cache.shared", pStats->value("cache.shared.hits"), pStats->value("cache.shared.misses"));
+	hitRate("cache.disk", pStats->value("cache.disk.hits") + pStats->value("cache.disk.stale"), pStats->value("cache.disk.misses"));
+
+	qDebug().noquote() << pStats->report();
+}
+
 glm::uint bmView::getZoomLevel()
 {
 	return m_uiZoomLevel;
@@ -117,7 +228,8 @@ glm::uint bmView::getZoomLevel()
 
 QPointF bmView::getCenter()
 {
-	return { m_qvCameraPos.x() / 1000.f, m_qvCameraPos.y() / 1000.f };
+	auto qvPos = m_pCamera->getPosition();
+	return { qvPos.x() / 1000.f, qvPos.y() / 1000.f };
 }
 
 glm::uint bmView::getWidth()
@@ -137,31 +249,42 @@ void bmView::repaint()
 
 QVector3D bmView::screenToWorld(const int& nX, const int& nY)
 {
-	glm::dvec4 glmViewPort(0, 0, width(), height());
-	glm::dmat4x4 glmCam(1.0);
-	glmCam = glm::translate(glmCam, glm::dvec3(m_qvCameraPos.x(), m_qvCameraPos.y(), m_qvCameraPos.z()));
-
-	glm::dmat4x4 glmProj = glm::perspective((double)glm::radians(45.f), (double)width() / height(),
-		(double)gfMinPerspective, (double)gfMaxPerspective);
+	return m_pCamera->screenToWorld(QPointF(nX, nY));
+}
 
-	glm::dvec3 nearP(nX, height() - nY, 0.f);
-	nearP = glm::unProject(nearP, glmCam, glmProj, glmViewPort);
+QMatrix4x4 bmView::getWorldMatrix()
+{
+	return m_pCamera->getWorldMatrix();
+}
 
-	glm::dvec3 farP(nX, height() - nY, 1.f);
-	farP = glm::unProject(farP, glmCam, glmProj, glmViewPort);
+ICameraPtr bmView::getCamera()
+{
+	return m_pCamera;
+}
 
-	double worldZ = -1.f * (double)m_qvCameraPos.z();
-	double t = (worldZ - gfMinPerspective) / ((double)gfMaxPerspective - gfMinPerspective);
+IOverlayLayerPtr bmView::getOverlay()
+{
+	return m_pOverlay;
+}
 
-	auto glmResult = farP * t + nearP * (1.f - t);
+IHeatmapLayerPtr bmView::getHeatmap()
+{
+	return m_pHeatmap;
+}
 
+ILiveLayerPtr bmView::getLiveLayer()
+{
+	return m_pLive;
+}
 
-	return QVector3D(glmResult.x, glmResult.y, m_qvCameraPos.z());
+IDatasetLayerPtr bmView::getDatasetLayer()
+{
+	return m_pDataset;
 }
 
 double bmView::getZoomFactor()
 {
-	double dbZoom = -100 * m_qvCameraPos.z() / ((double)gfMaxPerspective - gfMinPerspective);
+	double dbZoom = -100 * m_pCamera->getPosition().z() / ((double)gfMaxPerspective - gfMinPerspective);
 	double dbResult = 199.9 / 1.9 - 99.0 / (1.9 * dbZoom);
 
 	if (dbResult < 1.0)
@@ -173,6 +296,34 @@ double bmView::getZoomFactor()
 	return dbResult;
 }
 
+std::optional<QPointF> bmView::screenToMercator(const QPoint& qpScreen)
+{
+	auto transform = m_pTiles ? m_pTiles->getMercatorTransform() : TMercatorTransform();
+	if (!transform.bValid || !width() || !height())
+		return std::nullopt;
+
+	//0) Ray through the pixel is intersected with the map plane z = 0
+	auto qvWorld = m_pCamera->screenToPlane(qpScreen);
+	if (!qvWorld)
+		return std::nullopt;
+
+	//1) World to mercator, same transform as the overlay shaders use
+	return QPointF((qvWorld->x() - transform.dbOriginX) / transform.dbScaleX,
+		(qvWorld->y() - transform.dbOriginY) / transform.dbScaleY);
+}
+
+std::optional<uint> bmView::pickFeature(const QPoint& qpScreen)
+{
+	auto qpMerc = screenToMercator(qpScreen);
+	auto qpEdge = screenToMercator(qpScreen + QPoint(giPickRadius, 0));
+	if (!m_pOverlay || !qpMerc || !qpEdge)
+		return std::nullopt;
+
+	//Pick radius is given in pixels, the index works in mercator units
+	auto dbRadius = std::hypot(qpEdge->x() - qpMerc->x(), qpEdge->y() - qpMerc->y());
+	return m_pOverlay->pick(*qpMerc, dbRadius);
+}
+
 void bmView::updateZoomLevel(const int& delta)
 {
 	if (delta < 0) {
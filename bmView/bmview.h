@@ -14,8 +14,14 @@ class bmView : public QOpenGLWidget,
 	Q_OBJECT
 signals:
 	void updateRenderer();
+	void featureHovered(uint uiFeature);
+	void featurePicked(uint uiFeature);
 public:
 	bmView(QWidget *parent = Q_NULLPTR);
+	//Registry of the process with the derived rates, to the debug log
+	static void reportStats();
+	//Before the first paint: where the view opens, lat/lon and zoom level
+	void setStart(const QPointF& qpCenter, const uint& uiZoomLevel);
 protected:
 	void initializeGL() override;
 	void paintGL() override;
@@ -26,6 +32,7 @@ protected:
 	void wheelEvent(QWheelEvent* event) override;
 private slots:
 	void onRendererUpdate();
+	void onLiveCheck();
 protected: //IGlobalRenderer
 	void init() override;
 	uint getZoomLevel() override;
@@ -34,16 +41,37 @@ protected: //IGlobalRenderer
 	uint getHeight() override;
 	void repaint() override;
 	QVector3D screenToWorld(const int& nX, const int& nY) override;
+	QMatrix4x4 getWorldMatrix() override;
+	ICameraPtr getCamera() override;
+	IOverlayLayerPtr getOverlay() override;
+	IHeatmapLayerPtr getHeatmap() override;
+	ILiveLayerPtr getLiveLayer() override;
+	IDatasetLayerPtr getDatasetLayer() override;
 private:
 	Ui::bmViewClass ui;
 private:
-	QMatrix4x4 m_proj;
-	QMatrix4x4 m_camera;
-	QVector3D m_qvCameraPos;
+	ICameraPtr m_pCamera = nullptr;
 	QPoint m_qpLastPos;
+	//Pans are collected between frames, tiles follow once per paint
+	bool m_bMoved = false;
+	//Reused by every mouse event
+	std::vector<QPointF> m_vScreen;
+	std::vector<QVector3D> m_vWorld;
 	ITileMapPtr m_pTiles = nullptr;
+	IOverlayLayerPtr m_pOverlay = nullptr;
+	IHeatmapLayerPtr m_pHeatmap = nullptr;
+	ILiveLayerPtr m_pLive = nullptr;
+	IDatasetLayerPtr m_pDataset = nullptr;
 	uint m_uiZoomLevel = 12;
+	QVector3D m_qvStart = { 55948.87f, 54734.17f, -1000.f };
+	QTimer m_LiveTimer;
+	//From the window to its first frame
+	QElapsedTimer m_StartTimer;
+	bool m_bFirstFrame = true;
+	std::optional<uint> m_uiHovered;
 private:
 	double getZoomFactor();
 	void updateZoomLevel(const int& delta);
+	std::optional<QPointF> screenToMercator(const QPoint& qpScreen);
+	std::optional<uint> pickFeature(const QPoint& qpScreen);
 };
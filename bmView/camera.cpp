@@ -0,0 +1,163 @@
+#include "camera.h"
+#include "consts.h"
+
+CCamera::CCamera(const QVector3D& qvPos, const QSize& qsViewport)
+{
+	setPosition(qvPos);
+	setViewport(qsViewport);
+}
+
+void CCamera::setPosition(const QVector3D& qvPos)
+{
+	if (qvPos == m_qvPos)
+		return;
+
+	m_qvPos = qvPos;
+	m_bDirty = true;
+}
+
+QVector3D CCamera::getPosition()
+{
+	return m_qvPos;
+}
+
+void CCamera::setViewport(const QSize& qsViewport)
+{
+	//Minimised window still needs a valid aspect
+	QSize qsSize(std::max(1, qsViewport.width()), std::max(1, qsViewport.height()));
+	if (qsSize == m_qsViewport)
+		return;
+
+	m_qsViewport = qsSize;
+	m_bDirty = true;
+}
+
+QSize CCamera::getViewport()
+{
+	return m_qsViewport;
+}
+
+void CCamera::setFieldOfView(const float& fFov)
+{
+	if (fFov == m_fFov)
+		return;
+
+	m_fFov = fFov;
+	m_bDirty = true;
+}
+
+const QMatrix4x4& CCamera::getViewMatrix()
+{
+	update();
+	return m_qmView;
+}
+
+const QMatrix4x4& CCamera::getProjectionMatrix()
+{
+	update();
+	return m_qmProj;
+}
+
+const QMatrix4x4& CCamera::getWorldMatrix()
+{
+	update();
+	return m_qmWorld;
+}
+
+QVector3D CCamera::screenToWorld(const QPointF& qpScreen)
+{
+	update();
+	return toWorld(qpScreen);
+}
+
+void CCamera::screenToWorld(const std::vector<QPointF>& vScreen, std::vector<QVector3D>& vWorld)
+{
+	update();
+	vWorld.resize(vScreen.size());
+	for (size_t i = 0; i < vScreen.size(); ++i)
+		vWorld[i] = toWorld(vScreen[i]);
+}
+
+QPointF CCamera::worldToScreen(const QVector3D& qvWorld)
+{
+	update();
+	return toScreen(qvWorld);
+}
+
+void CCamera::worldToScreen(const std::vector<QVector3D>& vWorld, std::vector<QPointF>& vScreen)
+{
+	update();
+	vScreen.resize(vWorld.size());
+	for (size_t i = 0; i < vWorld.size(); ++i)
+		vScreen[i] = toScreen(vWorld[i]);
+}
+
+std::optional<QVector3D> CCamera::screenToPlane(const QPointF& qpScreen)
+{
+	update();
+
+	//Pixel centre, y goes up in GL window coordinates
+	double dbX = qpScreen.x() + 0.5;
+	double dbY = m_qsViewport.height() - (qpScreen.y() + 0.5);
+	auto glmNear = unproject(dbX, dbY, 0.0);
+	auto glmFar = unproject(dbX, dbY, 1.0);
+	if (std::abs(glmFar.z - glmNear.z) <= 0.0)
+		return std::nullopt;
+
+	auto glmHit = glmNear + (glmFar - glmNear) * (glmNear.z / (glmNear.z - glmFar.z));
+	return QVector3D((float)glmHit.x, (float)glmHit.y, 0.f);
+}
+
+void CCamera::update()
+{
+	if (!m_bDirty)
+		return;
+
+	//0) Same matrices the views used to rebuild on every call
+	double dbAspect = (double)m_qsViewport.width() / m_qsViewport.height();
+	m_qmView.setToIdentity();
+	m_qmView.translate(m_qvPos);
+	m_qmProj.setToIdentity();
+	m_qmProj.perspective(m_fFov, (float)dbAspect, gfMinPerspective, gfMaxPerspective);
+	m_qmWorld = m_qmProj * m_qmView;
+
+	//1) One inverse per change instead of two per conversion
+	auto glmView = glm::translate(glm::dmat4(1.0), glm::dvec3(m_qvPos.x(), m_qvPos.y(), m_qvPos.z()));
+	auto glmProj = glm::perspective((double)glm::radians(m_fFov), dbAspect, (double)gfMinPerspective, (double)gfMaxPerspective);
+	m_glmWorld = glmProj * glmView;
+	m_glmInverse = glm::inverse(m_glmWorld);
+
+	double dbWorldZ = -1.0 * m_qvPos.z();
+	m_dbPlaneT = (dbWorldZ - gfMinPerspective) / ((double)gfMaxPerspective - gfMinPerspective);
+
+	m_bDirty = false;
+}
+
+glm::dvec3 CCamera::unproject(const double& dbX, const double& dbY, const double& dbDepth) const
+{
+	//glm::unProject with the inverse already at hand
+	glm::dvec4 glmNdc(2.0 * dbX / m_qsViewport.width() - 1.0, 2.0 * dbY / m_qsViewport.height() - 1.0, 2.0 * dbDepth - 1.0, 1.0);
+	auto glmObj = m_glmInverse * glmNdc;
+	return glm::dvec3(glmObj) / glmObj.w;
+}
+
+QVector3D CCamera::toWorld(const QPointF& qpScreen) const
+{
+	double dbY = m_qsViewport.height() - qpScreen.y();
+	auto glmNear = unproject(qpScreen.x(), dbY, 0.0);
+	auto glmFar = unproject(qpScreen.x(), dbY, 1.0);
+
+	auto glmResult = glmFar * m_dbPlaneT + glmNear * (1.0 - m_dbPlaneT);
+	return QVector3D((float)glmResult.x, (float)glmResult.y, m_qvPos.z());
+}
+
+QPointF CCamera::toScreen(const QVector3D& qvWorld) const
+{
+	auto glmClip = m_glmWorld * glm::dvec4(qvWorld.x(), qvWorld.y(), qvWorld.z(), 1.0);
+	if (glmClip.w == 0.0)
+		return {};
+
+	double dbX = (glmClip.x / glmClip.w * 0.5 + 0.5) * m_qsViewport.width();
+	double dbY = (0.5 - glmClip.y / glmClip.w * 0.5) * m_qsViewport.height();
+	return { dbX, dbY };
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "intfs.h"
+
+class CCamera : public ICamera
+{
+public:
+	CCamera() = default;
+	CCamera(const QVector3D& qvPos, const QSize& qsViewport);
+protected: //ICamera
+	void setPosition(const QVector3D& qvPos) override;
+	QVector3D getPosition() override;
+	void setViewport(const QSize& qsViewport) override;
+	QSize getViewport() override;
+	void setFieldOfView(const float& fFov) override;
+	const QMatrix4x4& getViewMatrix() override;
+	const QMatrix4x4& getProjectionMatrix() override;
+	const QMatrix4x4& getWorldMatrix() override;
+	QVector3D screenToWorld(const QPointF& qpScreen) override;
+	void screenToWorld(const std::vector<QPointF>& vScreen, std::vector<QVector3D>& vWorld) override;
+	QPointF worldToScreen(const QVector3D& qvWorld) override;
+	void worldToScreen(const std::vector<QVector3D>& vWorld, std::vector<QPointF>& vScreen) override;
+	std::optional<QVector3D> screenToPlane(const QPointF& qpScreen) override;
+private:
+	QVector3D m_qvPos;
+	QSize m_qsViewport = { 1, 1 };
+	float m_fFov = 45.f;
+	bool m_bDirty = true;
+
+	//GL gets floats, unprojection runs in doubles like it always did
+	QMatrix4x4 m_qmView;
+	QMatrix4x4 m_qmProj;
+	QMatrix4x4 m_qmWorld;
+	glm::dmat4 m_glmWorld = glm::dmat4(1.0);
+	glm::dmat4 m_glmInverse = glm::dmat4(1.0);
+	//Depth of the camera plane between the near and far planes
+	double m_dbPlaneT = 0.0;
+private:
+	void update();
+	glm::dvec3 unproject(const double& dbX, const double& dbY, const double& dbDepth) const;
+	QVector3D toWorld(const QPointF& qpScreen) const;
+	QPointF toScreen(const QVector3D& qvWorld) const;
+};
@@ -0,0 +1,94 @@
+#pragma once
+#include "intfs.h"
+
+//Bounded lock-free queue, many producers and one consumer. Cells are preallocated, pushing never allocates.
+//Every cell carries a sequence number that tells producers and the consumer whose turn it is (Vyukov's scheme)
+template <typename T> class CCompletionQueue {
+public:
+	//Capacity is rounded up to a power of two
+	explicit CCompletionQueue(const size_t& szCapacity);
+	//False if the queue is full, the value is left untouched then
+	bool push(T&& value);
+	//Consumer side only
+	bool pop(T& value);
+	size_t size() const;
+	size_t capacity() const;
+private:
+	struct TCell {
+		std::atomic<size_t> szSequence{ 0 };
+		T value;
+	};
+	std::unique_ptr<TCell[]> m_pCells;
+	size_t m_szMask = 0;
+	//Producers and the consumer write different ends, keep them on different cache lines
+	alignas(64) std::atomic<size_t> m_szTail{ 0 };
+	alignas(64) std::atomic<size_t> m_szHead{ 0 };
+};
+
+template <typename T> CCompletionQueue<T>::CCompletionQueue(const size_t& szCapacity)
+{
+	size_t szSize = 2;
+	while (szSize < szCapacity)
+		szSize <<= 1;
+
+	m_pCells.reset(new TCell[szSize]);
+	m_szMask = szSize - 1;
+	for (size_t i = 0; i < szSize; ++i)
+		m_pCells[i].szSequence.store(i, std::memory_order_relaxed);
+}
+
+template <typename T> bool CCompletionQueue<T>::push(T&& value)
+{
+	auto szPos = m_szTail.load(std::memory_order_relaxed);
+	TCell* pCell = nullptr;
+
+	//0) Claim a cell: its sequence equals our position when it is free for this lap
+	for (;;) {
+		pCell = &m_pCells[szPos & m_szMask];
+		auto szSequence = pCell->szSequence.load(std::memory_order_acquire);
+		auto nDiff = (std::ptrdiff_t)szSequence - (std::ptrdiff_t)szPos;
+
+		if (0 == nDiff) {
+			if (m_szTail.compare_exchange_weak(szPos, szPos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (nDiff < 0) {
+			return false;
+		}
+		else {
+			szPos = m_szTail.load(std::memory_order_relaxed);
+		}
+	}
+
+	//1) Publish. The consumer sees the value only after the sequence moves on
+	pCell->value = std::move(value);
+	pCell->szSequence.store(szPos + 1, std::memory_order_release);
+	return true;
+}
+
+template <typename T> bool CCompletionQueue<T>::pop(T& value)
+{
+	auto szPos = m_szHead.load(std::memory_order_relaxed);
+	auto& cell = m_pCells[szPos & m_szMask];
+	if (cell.szSequence.load(std::memory_order_acquire) != szPos + 1)
+		return false;
+
+	m_szHead.store(szPos + 1, std::memory_order_relaxed);
+	value = std::move(cell.value);
+	cell.value = T{};
+	//Free for the producers of the next lap
+	cell.szSequence.store(szPos + m_szMask + 1, std::memory_order_release);
+	return true;
+}
+
+template <typename T> size_t CCompletionQueue<T>::size() const
+{
+	auto szTail = m_szTail.load(std::memory_order_relaxed);
+	auto szHead = m_szHead.load(std::memory_order_relaxed);
+	return (szTail > szHead) ? szTail - szHead : 0;
+}
+
+template <typename T> size_t CCompletionQueue<T>::capacity() const
+{
+	return m_szMask + 1;
+}
@@ -9,6 +9,64 @@
 GCONST float    gfMaxPerspective = 1000000.f;
 GCONST float    gfMinPerspective = 100.f;
 
+//Hover and click tolerance around overlay features, pixels
+GCONST int      giPickRadius = 6;
+
+//Layers blended by the tile shader in one pass, one texture unit each
+GCONST size_t   gszMaxLayers = 4;
+
+//Terrain grids go from 1 to 2^N cells per tile side, the height texture has 2^N + 1 samples per side
+GCONST uint     guiTerrainLevels = 5;
+GCONST int      giTerrainGrid = 32;
+//Largest height error a terrain grid may show, pixels
+GCONST float    gfTerrainMaxError = 2.f;
+
+//Decoded images on their way to the GUI thread, bytes. Loaders wait above it, prefetches are not started above half of it
+GCONST qint64   gnHandoffBytes = 32 * 1024 * 1024;
+
+//Cancelled tile bodies up to this size are still read to the end, keeping the connection costs less than a new one
+GCONST qint64   gnReuseBodyBytes = 8 * 1024;
+
+//Encoded tiles kept in RAM by default, all layers together
+GCONST qint64   gnMemoryTileBytes = 64 * 1024 * 1024;
+
+//Shared memory tile tier: a tile takes one page, bigger tiles stay out of it. The LRU evicts within sets of pages
+GCONST int      giSharedPageBytes = 64 * 1024;
+GCONST int      giSharedWays = 8;
+//A tile another process is loading is left to it this long, then fetched here too
+GCONST qint64   gnSharedClaimMs = 3000;
+//Meanwhile the load is put off and looks for the tile again this often
+GCONST qint64   gnSharedRecheckMs = 100;
+
+//Heatmap density is accumulated at 1/N of the screen resolution. Kernel radius in screen pixels
+//and the weight sum where the colour ramp tops out
+GCONST int      giHeatmapDownscale = 4;
+GCONST float    gfHeatmapRadius = 24.f;
+GCONST float    gfHeatmapSaturation = 16.f;
+
+//Live objects: sprite size in pixels. An object moves to its reported position over its last report interval,
+//within these bounds, seconds
+GCONST float    gfLiveSize = 7.f;
+GCONST float    gfLiveMinInterval = 0.02f;
+GCONST float    gfLiveMaxInterval = 2.f;
+//Changed objects this close to each other go to the GPU in one write
+GCONST size_t   gszLiveWriteGap = 16;
+//Updates not yet taken by a frame. A view that doesn't draw drops the older ones, newer reports replace them anyway
+GCONST size_t   gszLivePending = 1 << 20;
+//Instances keep their move times as float seconds from a base, the base is moved up this often, seconds
+GCONST double   gdbLiveRebase = 600.0;
+//Feed updates handed to the layers at once
+GCONST size_t   gszFeedBatch = 1024;
+
+//Point datasets: quadkey level of the offset index, and the most points of the visible cells a view keeps on the GPU
+GCONST uint     guiDatasetIndexLevel = 14;
+GCONST size_t   gszDatasetMaxPoints = 2 * 1024 * 1024;
+//The importer parses its input in pieces of this size in parallel
+GCONST qint64   gnImportChunkBytes = 8 * 1024 * 1024;
+
+//Trace events each thread keeps, the oldest go first. A power of two
+GCONST size_t   gszTraceEvents = 16384;
+
 GCONST std::wstring gsBingAPIKey = L"{your Bing API key here}";
 
 GCONST GLfloat gfRectMatrix[] = {
@@ -18,7 +76,11 @@ GCONST GLfloat gfRectMatrix[] = {
 	1.0f, 0.0f
 };
 
+#ifdef _MSC_VER 
 #define SHADER_CODE __declspec(selectany) extern char* const
+#else
+#define SHADER_CODE static const char* const
+#endif
 
 SHADER_CODE gwTileVS =
 #include "tile.vs"
@@ -26,4 +88,36 @@ SHADER_CODE gwTileVS =
 
 SHADER_CODE gwTileFS =
 #include "tile.fs"
+"";
+
+SHADER_CODE gwOverlayPointVS =
+#include "overlay_pt.vs"
+"";
+
+SHADER_CODE gwOverlayLineVS =
+#include "overlay_ln.vs"
+"";
+
+SHADER_CODE gwOverlayFS =
+#include "overlay.fs"
+"";
+
+SHADER_CODE gwHeatmapVS =
+#include "heatmap.vs"
+"";
+
+SHADER_CODE gwHeatmapFS =
+#include "heatmap.fs"
+"";
+
+SHADER_CODE gwHeatmapRampVS =
+#include "heatmap_ramp.vs"
+"";
+
+SHADER_CODE gwHeatmapRampFS =
+#include "heatmap_ramp.fs"
+"";
+
+SHADER_CODE gwLiveVS =
+#include "live.vs"
 "";
\ No newline at end of file
@@ -0,0 +1,611 @@
+#include "dataset.h"
+#include "consts.h"
+#include "geotex.h"
+#include "overlay.h"
+#include "sched.h"
+#include "trace.h"
+
+struct CPointDataset::THeader {
+	char szMagic[8];
+	quint32 uiVersion;
+	//Quadkey level of the index cells
+	quint32 uiIndexLevel;
+	quint64 uiPoints;
+	quint64 uiCells;
+	//Mercator left, top, right, bottom
+	double dbBounds[4];
+	//From the start of the file, 64 byte aligned. 0 - the column is not in the file
+	quint64 uiCellsOffset;
+	quint64 uiPositionsOffset;
+	quint64 uiWeightsOffset;
+};
+
+struct CPointDataset::TCell {
+	quint64 uiCode;
+	//Index of the first point of the cell
+	quint64 uiFirst;
+};
+
+namespace {
+	const char gszDatasetMagic[8] = { 'B', 'M', 'V', 'P', 'O', 'I', 'N', 'T' };
+	const quint32 guiDatasetVersion = 1;
+	//Points converted and written at a time
+	const size_t gszWriteBlock = 1 << 20;
+	const double gdbKeyCells = 2147483648.0;
+
+	quint64 alignSection(const quint64& uiOffset)
+	{
+		return (uiOffset + 63) & ~quint64(63);
+	}
+
+	//Bits of a 32 bit value to the even bits of a 64 bit one
+	quint64 spread(quint64 uiValue)
+	{
+		uiValue &= 0x00000000FFFFFFFFull;
+		uiValue = (uiValue | (uiValue << 16)) & 0x0000FFFF0000FFFFull;
+		uiValue = (uiValue | (uiValue << 8)) & 0x00FF00FF00FF00FFull;
+		uiValue = (uiValue | (uiValue << 4)) & 0x0F0F0F0F0F0F0F0Full;
+		uiValue = (uiValue | (uiValue << 2)) & 0x3333333333333333ull;
+		uiValue = (uiValue | (uiValue << 1)) & 0x5555555555555555ull;
+		return uiValue;
+	}
+
+	quint64 compact(quint64 uiValue)
+	{
+		uiValue &= 0x5555555555555555ull;
+		uiValue = (uiValue | (uiValue >> 1)) & 0x3333333333333333ull;
+		uiValue = (uiValue | (uiValue >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+		uiValue = (uiValue | (uiValue >> 4)) & 0x00FF00FF00FF00FFull;
+		uiValue = (uiValue | (uiValue >> 8)) & 0x0000FFFF0000FFFFull;
+		uiValue = (uiValue | (uiValue >> 16)) & 0x00000000FFFFFFFFull;
+		return uiValue;
+	}
+
+	//Spaces, quotes and the CR of CRLF files around the field are not part of the number
+	double toNumber(const char* szBegin, const char* szEnd, bool& bOk)
+	{
+		while ((szBegin < szEnd) && ((*szBegin == ' ') || (*szBegin == '"') || (*szBegin == '\t')))
+			++szBegin;
+
+		while ((szEnd > szBegin) && ((szEnd[-1] == ' ') || (szEnd[-1] == '"') || (szEnd[-1] == '\t') || (szEnd[-1] == '\r')))
+			--szEnd;
+
+		//C locale whatever the system one is
+		return QByteArray::fromRawData(szBegin, (int)(szEnd - szBegin)).toDouble(&bOk);
+	}
+
+	bool isNumberChar(const char& c)
+	{
+		return ((c >= '0') && (c <= '9')) || (c == '-') || (c == '+') || (c == '.') || (c == 'e') || (c == 'E');
+	}
+
+	bool lessKey(const std::pair<quint64, float>& a, const std::pair<quint64, float>& b)
+	{
+		return a.first < b.first;
+	}
+}
+
+IPointDatasetPtr CPointDataset::open(const QString& qsPath)
+{
+	std::shared_ptr<CPointDataset> pDataset(new CPointDataset());
+	pDataset->m_File.setFileName(qsPath);
+	if (!pDataset->m_File.open(QIODevice::ReadOnly) || !pDataset->map()) {
+		qWarning() << "Not a point dataset:" << qsPath;
+		return nullptr;
+	}
+
+	return pDataset;
+}
+
+bool CPointDataset::map()
+{
+	auto nSize = m_File.size();
+	if (nSize < (qint64)sizeof(THeader))
+		return false;
+
+	//0) The whole file is one mapping, nothing is read until it is touched
+	auto pData = m_File.map(0, nSize);
+	if (!pData)
+		return false;
+
+	auto pHeader = reinterpret_cast<const THeader*>(pData);
+	if ((memcmp(pHeader->szMagic, gszDatasetMagic, sizeof(gszDatasetMagic)) != 0) || (pHeader->uiVersion != guiDatasetVersion) ||
+		(pHeader->uiIndexLevel > 31))
+		return false;
+
+	//1) Every column has to be inside the file. Counts are bounded by the size first, so the products can't wrap
+	auto fits = [nSize](const quint64& uiOffset, const quint64& uiCount, const quint64& uiItem) {
+		return uiOffset && (uiOffset <= (quint64)nSize) && (uiCount <= ((quint64)nSize - uiOffset) / uiItem);
+	};
+	if (!fits(pHeader->uiCellsOffset, pHeader->uiCells, sizeof(TCell)) ||
+		!fits(pHeader->uiPositionsOffset, pHeader->uiPoints, 4 * sizeof(GLfloat)))
+		return false;
+
+	if (pHeader->uiWeightsOffset && !fits(pHeader->uiWeightsOffset, pHeader->uiPoints, sizeof(float)))
+		return false;
+
+	//2) Ranges are cut by the index: its codes have to be ascending and its points inside the columns and in order.
+	//One pass over the index only, the columns stay untouched
+	auto pCells = reinterpret_cast<const TCell*>(pData + pHeader->uiCellsOffset);
+	for (quint64 i = 0; i < pHeader->uiCells; ++i) {
+		if ((pCells[i].uiFirst > pHeader->uiPoints) ||
+			(i && ((pCells[i].uiCode <= pCells[i - 1].uiCode) || (pCells[i].uiFirst < pCells[i - 1].uiFirst))))
+			return false;
+	}
+
+	m_pHeader = pHeader;
+	m_pCells = pCells;
+	m_pPositions = reinterpret_cast<const GLfloat*>(pData + pHeader->uiPositionsOffset);
+	m_pWeights = pHeader->uiWeightsOffset ? reinterpret_cast<const float*>(pData + pHeader->uiWeightsOffset) : nullptr;
+	return true;
+}
+
+bool CPointDataset::write(const QString& qsPath, const std::vector<std::pair<quint64, float>>& vPoints, const bool& bWeights)
+{
+	//0) Index: the first point of every cell that has any
+	uint uiShift = 2 * (31 - guiDatasetIndexLevel);
+	std::vector<TCell> vCells;
+	for (size_t i = 0; i < vPoints.size(); ++i) {
+		auto uiCode = vPoints[i].first >> uiShift;
+		if (vCells.empty() || (vCells.back().uiCode != uiCode))
+			vCells.push_back({ uiCode, i });
+	}
+
+	THeader header = {};
+	memcpy(header.szMagic, gszDatasetMagic, sizeof(gszDatasetMagic));
+	header.uiVersion = guiDatasetVersion;
+	header.uiIndexLevel = guiDatasetIndexLevel;
+	header.uiPoints = vPoints.size();
+	header.uiCells = vCells.size();
+	header.dbBounds[0] = header.dbBounds[1] = 1.0;
+	for (const auto& it : vPoints) {
+		auto spMerc = merc(it.first);
+		header.dbBounds[0] = std::min(header.dbBounds[0], spMerc.first);
+		header.dbBounds[1] = std::min(header.dbBounds[1], spMerc.second);
+		header.dbBounds[2] = std::max(header.dbBounds[2], spMerc.first);
+		header.dbBounds[3] = std::max(header.dbBounds[3], spMerc.second);
+	}
+
+	header.uiCellsOffset = alignSection(sizeof(THeader));
+	header.uiPositionsOffset = alignSection(header.uiCellsOffset + vCells.size() * sizeof(TCell));
+	header.uiWeightsOffset = bWeights ? alignSection(header.uiPositionsOffset + vPoints.size() * 4 * sizeof(GLfloat)) : 0;
+
+	//1) Sections in file order, each padded up to its offset
+	QSaveFile file(qsPath);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+
+	auto writeAt = [&file](const quint64& uiOffset, const void* pData, const qint64& nBytes) {
+		QByteArray qbPadding((int)(uiOffset - file.pos()), '\0');
+		return (file.write(qbPadding) == qbPadding.size()) && (file.write(reinterpret_cast<const char*>(pData), nBytes) == nBytes);
+	};
+
+	if (!writeAt(0, &header, sizeof(header)) ||
+		!writeAt(header.uiCellsOffset, vCells.data(), vCells.size() * sizeof(TCell)))
+		return false;
+
+	//2) Positions are converted to the hi/lo form of the shaders a block at a time
+	std::vector<GLfloat> vBlock;
+	for (size_t szFirst = 0; szFirst < vPoints.size(); szFirst += gszWriteBlock) {
+		auto szCount = std::min(gszWriteBlock, vPoints.size() - szFirst);
+		vBlock.resize(szCount * 4);
+		CJobScheduler::get()->parallelFor(EJobPriority::Background, szCount, [&](size_t szBegin, size_t szEnd) {
+			for (auto i = szBegin; i < szEnd; ++i) {
+				auto spMerc = merc(vPoints[szFirst + i].first);
+				COverlayLayer::splitDouble(spMerc.first, vBlock[4 * i], vBlock[4 * i + 2]);
+				COverlayLayer::splitDouble(spMerc.second, vBlock[4 * i + 1], vBlock[4 * i + 3]);
+			}
+		});
+
+		auto uiOffset = szFirst ? (quint64)file.pos() : header.uiPositionsOffset;
+		if (!writeAt(uiOffset, vBlock.data(), vBlock.size() * sizeof(GLfloat)))
+			return false;
+	}
+
+	if (bWeights) {
+		std::vector<float> vWeights;
+		for (size_t szFirst = 0; szFirst < vPoints.size(); szFirst += gszWriteBlock) {
+			auto szCount = std::min(gszWriteBlock, vPoints.size() - szFirst);
+			vWeights.resize(szCount);
+			for (size_t i = 0; i < szCount; ++i)
+				vWeights[i] = vPoints[szFirst + i].second;
+
+			auto uiOffset = szFirst ? (quint64)file.pos() : header.uiWeightsOffset;
+			if (!writeAt(uiOffset, vWeights.data(), vWeights.size() * sizeof(float)))
+				return false;
+		}
+	}
+
+	return file.commit();
+}
+
+quint64 CPointDataset::key(const double& dbX, const double& dbY)
+{
+	auto toCell = [](const double& dbValue) {
+		return (quint64)std::min(std::max(dbValue * gdbKeyCells, 0.0), gdbKeyCells - 1.0);
+	};
+	return spread(toCell(dbX)) | (spread(toCell(dbY)) << 1);
+}
+
+std::pair<double, double> CPointDataset::merc(const quint64& uiKey)
+{
+	//Centre of the key cell
+	return { (compact(uiKey) + 0.5) / gdbKeyCells, (compact(uiKey >> 1) + 0.5) / gdbKeyCells };
+}
+
+size_t CPointDataset::size()
+{
+	return (size_t)m_pHeader->uiPoints;
+}
+
+QRectF CPointDataset::bounds()
+{
+	if (!m_pHeader->uiPoints)
+		return QRectF();
+
+	return QRectF(QPointF(m_pHeader->dbBounds[0], m_pHeader->dbBounds[1]), QPointF(m_pHeader->dbBounds[2], m_pHeader->dbBounds[3]));
+}
+
+const GLfloat* CPointDataset::positions()
+{
+	return m_pPositions;
+}
+
+const float* CPointDataset::weights()
+{
+	return m_pWeights;
+}
+
+size_t CPointDataset::first(const quint64& uiCode) const
+{
+	auto pEnd = m_pCells + m_pHeader->uiCells;
+	auto pCell = std::lower_bound(m_pCells, pEnd, uiCode, [](const TCell& cell, const quint64& uiValue) { return cell.uiCode < uiValue; });
+	return (pCell == pEnd) ? (size_t)m_pHeader->uiPoints : (size_t)pCell->uiFirst;
+}
+
+void CPointDataset::ranges(const QRectF& qrMerc, const size_t& szMax, std::vector<std::pair<size_t, size_t>>& vRanges)
+{
+	vRanges.clear();
+	auto qrArea = qrMerc.normalized().intersected(QRectF(0.0, 0.0, 1.0, 1.0));
+	if (qrArea.isEmpty() || !m_pHeader->uiPoints || !szMax)
+		return;
+
+	//0) Cells of about an eighth of the area across: a view is a few dozen contiguous runs of the file
+	uint uiIndexLevel = m_pHeader->uiIndexLevel;
+	double dbSpan = std::max(qrArea.width(), qrArea.height());
+	auto uiLevel = (uint)std::min<double>(std::max(std::floor(std::log2(8.0 / dbSpan)), 0.0), uiIndexLevel);
+	quint64 uiCount = 1ull << uiLevel;
+	auto toCell = [uiCount](const double& dbValue) {
+		return std::min<quint64>((quint64)std::max(dbValue * uiCount, 0.0), uiCount - 1);
+	};
+
+	struct TVisible {
+		quint64 uiCode;
+		double dbDistance;
+	};
+	std::vector<TVisible> vVisible;
+	auto qpCenter = qrArea.center();
+	for (auto y = toCell(qrArea.top()); y <= toCell(qrArea.bottom()); ++y) {
+		for (auto x = toCell(qrArea.left()); x <= toCell(qrArea.right()); ++x) {
+			double dbX = (x + 0.5) / uiCount - qpCenter.x(), dbY = (y + 0.5) / uiCount - qpCenter.y();
+			vVisible.push_back({ spread(x) | (spread(y) << 1), dbX * dbX + dbY * dbY });
+		}
+	}
+
+	//1) Nearest cells first, so a capped view loses its edges. A coarser cell is a contiguous run of the index cells
+	std::sort(vVisible.begin(), vVisible.end(), [](const TVisible& a, const TVisible& b) { return a.dbDistance < b.dbDistance; });
+	uint uiShift = 2 * (uiIndexLevel - uiLevel);
+	size_t szTotal = 0;
+	for (const auto& it : vVisible) {
+		auto szFirst = first(it.uiCode << uiShift);
+		auto szLast = first((it.uiCode + 1) << uiShift);
+		if (szFirst >= szLast)
+			continue;
+
+		szLast = std::min(szLast, szFirst + (szMax - szTotal));
+		vRanges.emplace_back(szFirst, szLast);
+		szTotal += szLast - szFirst;
+		if (szTotal >= szMax)
+			break;
+	}
+
+	//2) In file order, touching runs joined
+	std::sort(vRanges.begin(), vRanges.end());
+	size_t szJoined = 0;
+	for (size_t i = 1; i < vRanges.size(); ++i) {
+		if (vRanges[i].first <= vRanges[szJoined].second)
+			vRanges[szJoined].second = std::max(vRanges[szJoined].second, vRanges[i].second);
+		else
+			vRanges[++szJoined] = vRanges[i];
+	}
+
+	if (!vRanges.empty())
+		vRanges.resize(szJoined + 1);
+}
+
+CDatasetImporter::CDatasetImporter(const QString& qsInput, const QString& qsOutput) : m_qsInput(qsInput), m_qsOutput(qsOutput)
+{
+	m_pMath = std::make_shared<CBingGeoMath>();
+}
+
+int CDatasetImporter::run()
+{
+	CTraceScope scope("import");
+	QElapsedTimer timer;
+	timer.start();
+
+	QFile input(m_qsInput);
+	if (!input.open(QIODevice::ReadOnly)) {
+		qCritical() << "Import input can't be opened:" << m_qsInput;
+		return 1;
+	}
+
+	auto nSize = input.size();
+	auto pData = nSize ? reinterpret_cast<const char*>(input.map(0, nSize)) : nullptr;
+	if (!pData) {
+		qCritical() << "Import input can't be mapped:" << m_qsInput;
+		return 1;
+	}
+
+	//0) Pieces of the input. CSV pieces start at rows, GeoJSON ones anywhere: a feature belongs to the piece its coordinates start in
+	auto qsSuffix = QFileInfo(m_qsInput).suffix().toLower();
+	bool bCsv = (qsSuffix == "csv") || (qsSuffix == "txt");
+	TCsvLayout csv;
+	if (bCsv)
+		csv = layout(pData, nSize);
+
+	std::vector<qint64> vStarts;
+	for (auto n = csv.nFirst; n < nSize; n += gnImportChunkBytes) {
+		auto nStart = n;
+		if (bCsv && (n > csv.nFirst)) {
+			auto szLine = static_cast<const char*>(memchr(pData + n - 1, '\n', nSize - n + 1));
+			nStart = szLine ? (szLine - pData) + 1 : nSize;
+		}
+
+		if (vStarts.empty() || (nStart > vStarts.back()))
+			vStarts.push_back(nStart);
+	}
+
+	if (vStarts.empty() || (vStarts.back() < nSize))
+		vStarts.push_back(nSize);
+
+	//1) Pieces are parsed and sorted on the scheduler
+	auto szChunks = vStarts.size() - 1;
+	std::vector<std::vector<std::pair<quint64, float>>> vChunks(szChunks);
+	CJobScheduler::get()->parallelFor(EJobPriority::Background, szChunks, [&](size_t szFirst, size_t szLast) {
+		for (auto i = szFirst; i < szLast; ++i) {
+			auto szBegin = pData + vStarts[i], szEnd = pData + vStarts[i + 1];
+			if (bCsv)
+				parseCsv(szBegin, szEnd, csv, vChunks[i]);
+			else
+				parseGeoJson(szBegin, szEnd, pData + nSize, vChunks[i]);
+
+			std::sort(vChunks[i].begin(), vChunks[i].end(), lessKey);
+		}
+	});
+	auto nParsed = timer.elapsed();
+
+	//2) One vector of sorted runs, merged into one
+	size_t szTotal = 0;
+	for (const auto& it : vChunks)
+		szTotal += it.size();
+
+	std::vector<std::pair<quint64, float>> vPoints;
+	std::vector<size_t> vBounds = { 0 };
+	vPoints.reserve(szTotal);
+	for (auto& it : vChunks) {
+		vPoints.insert(vPoints.end(), it.begin(), it.end());
+		vBounds.push_back(vPoints.size());
+		std::vector<std::pair<quint64, float>>().swap(it);
+	}
+
+	input.unmap(reinterpret_cast<uchar*>(const_cast<char*>(pData)));
+	input.close();
+	if (vPoints.empty()) {
+		qCritical() << "No points in" << m_qsInput;
+		return 1;
+	}
+
+	merge(vPoints, vBounds);
+	auto nSorted = timer.elapsed();
+
+	//3) Columns
+	if (!CPointDataset::write(m_qsOutput, vPoints, m_bWeights)) {
+		qCritical() << "Dataset can't be written:" << m_qsOutput;
+		return 1;
+	}
+
+	auto nWritten = timer.elapsed();
+	qInfo().noquote() << QString("Imported %1 points from %2 in %3 s: parse %4 s, sort %5 s, write %6 s, %7 points/s")
+		.arg(vPoints.size()).arg(m_qsInput).arg(nWritten / 1000.0, 0, 'f', 2).arg(nParsed / 1000.0, 0, 'f', 2)
+		.arg((nSorted - nParsed) / 1000.0, 0, 'f', 2).arg((nWritten - nSorted) / 1000.0, 0, 'f', 2)
+		.arg((qint64)(vPoints.size() * 1000 / std::max<qint64>(nWritten, 1)));
+	return 0;
+}
+
+CDatasetImporter::TCsvLayout CDatasetImporter::layout(const char* szData, const qint64& nSize)
+{
+	TCsvLayout csv;
+	auto szEnd = szData + nSize;
+	auto szLine = static_cast<const char*>(memchr(szData, '\n', nSize));
+	if (!szLine)
+		szLine = szEnd;
+
+	//0) The delimiter is whichever of the usual ones the first line has most of
+	int nMost = 0;
+	for (char c : { ',', ';', '\t' }) {
+		auto nCount = (int)std::count(szData, szLine, c);
+		if (nCount > nMost) {
+			nMost = nCount;
+			csv.cDelimiter = c;
+		}
+	}
+
+	//1) A first line that isn't all numbers is a header: the columns are looked up by name
+	std::vector<QByteArray> vFields;
+	bool bHeader = false;
+	for (auto szField = szData; szField <= szLine;) {
+		auto szNext = static_cast<const char*>(memchr(szField, csv.cDelimiter, szLine - szField));
+		if (!szNext)
+			szNext = szLine;
+
+		bool bNumber = false;
+		toNumber(szField, szNext, bNumber);
+		bHeader |= !bNumber;
+		vFields.push_back(QByteArray(szField, (int)(szNext - szField)).trimmed().replace("\"", "").toLower());
+		szField = szNext + 1;
+	}
+
+	if (bHeader) {
+		auto find = [&vFields](const std::initializer_list<const char*>& names) {
+			for (size_t i = 0; i < vFields.size(); ++i) {
+				for (auto szName : names) {
+					if (vFields[i] == szName)
+						return (int)i;
+				}
+			}
+			return -1;
+		};
+
+		auto nLat = find({ "lat", "latitude", "y" });
+		auto nLon = find({ "lon", "lng", "long", "longitude", "x" });
+		if ((nLat >= 0) && (nLon >= 0)) {
+			csv.nLat = nLat;
+			csv.nLon = nLon;
+		}
+		else
+			qWarning() << "No lat/lon columns in the header, the first two are taken:" << m_qsInput;
+
+		csv.nWeight = find({ "weight", "value", "w" });
+		csv.nFirst = (szLine < szEnd) ? (szLine - szData) + 1 : nSize;
+	}
+
+	m_bWeights = (csv.nWeight >= 0);
+	return csv;
+}
+
+void CDatasetImporter::parseCsv(const char* szBegin, const char* szEnd, const TCsvLayout& csv, std::vector<std::pair<quint64, float>>& vPoints) const
+{
+	vPoints.reserve((szEnd - szBegin) / 24);
+	for (auto szRow = szBegin; szRow < szEnd;) {
+		auto szLine = static_cast<const char*>(memchr(szRow, '\n', szEnd - szRow));
+		if (!szLine)
+			szLine = szEnd;
+
+		//0) Fields are read in place, the ones of no interest are only skipped
+		double dbLat = 0.0, dbLon = 0.0, dbWeight = 1.0;
+		bool bLat = false, bLon = false, bWeight = true;
+		int nField = 0;
+		for (auto szField = szRow; szField <= szLine; ++nField) {
+			auto szNext = static_cast<const char*>(memchr(szField, csv.cDelimiter, szLine - szField));
+			if (!szNext)
+				szNext = szLine;
+
+			if (nField == csv.nLat)
+				dbLat = toNumber(szField, szNext, bLat);
+			else if (nField == csv.nLon)
+				dbLon = toNumber(szField, szNext, bLon);
+			else if (nField == csv.nWeight)
+				dbWeight = toNumber(szField, szNext, bWeight);
+
+			szField = szNext + 1;
+		}
+
+		if (bLat && bLon && bWeight)
+			add(dbLat, dbLon, (float)dbWeight, vPoints);
+
+		szRow = szLine + 1;
+	}
+}
+
+void CDatasetImporter::parseGeoJson(const char* szBegin, const char* szEnd, const char* szLimit, std::vector<std::pair<quint64, float>>& vPoints) const
+{
+	static const char szKey[] = "\"coordinates\"";
+	const size_t szKeyLength = sizeof(szKey) - 1;
+	const std::boyer_moore_horspool_searcher<const char*> searcher(szKey, szKey + szKeyLength);
+
+	//A key that starts in the piece may end past it
+	auto szSearchEnd = std::min(szEnd + szKeyLength - 1, szLimit);
+	for (auto szText = szBegin; szText < szEnd;) {
+		auto szFound = std::search(szText, szSearchEnd, searcher);
+		if (szFound == szSearchEnd)
+			break;
+
+		//0) Up to the array of the member
+		auto c = szFound + szKeyLength;
+		while ((c < szLimit) && ((*c == ' ') || (*c == ':') || (*c == '\t') || (*c == '\r') || (*c == '\n')))
+			++c;
+
+		//1) Innermost arrays are positions: [lon, lat] or [lon, lat, height], whatever the geometry type nests them in
+		double dbPosition[2] = {};
+		int nNumbers = 0, nDepth = 0;
+		for (; c < szLimit; ++c) {
+			if (*c == '[') {
+				++nDepth;
+				nNumbers = 0;
+			}
+			else if (*c == ']') {
+				if (nNumbers >= 2)
+					add(dbPosition[1], dbPosition[0], 1.f, vPoints);
+
+				nNumbers = 0;
+				if ((--nDepth) <= 0) {
+					++c;
+					break;
+				}
+			}
+			else if (isNumberChar(*c)) {
+				auto szNumber = c;
+				while ((c < szLimit) && isNumberChar(*c))
+					++c;
+
+				bool bOk = false;
+				double dbValue = toNumber(szNumber, c, bOk);
+				if (bOk && (nNumbers < 2))
+					dbPosition[nNumbers] = dbValue;
+
+				nNumbers += bOk ? 1 : 0;
+				--c;
+			}
+			else if ((*c != ',') && (*c != ' ') && (*c != '\t') && (*c != '\r') && (*c != '\n'))
+				break;
+
+			if (!nDepth)
+				break;
+		}
+
+		szText = std::max(c, szFound + szKeyLength);
+	}
+}
+
+void CDatasetImporter::add(const double& dbLat, const double& dbLon, const float& fWeight, std::vector<std::pair<quint64, float>>& vPoints) const
+{
+	if (!(std::abs(dbLat) <= 90.0) || !(std::abs(dbLon) <= 180.0))
+		return;
+
+	auto spMerc = m_pMath->wgs2merc(dbLat, dbLon);
+	vPoints.emplace_back(CPointDataset::key(spMerc.first, spMerc.second), fWeight);
+}
+
+void CDatasetImporter::merge(std::vector<std::pair<quint64, float>>& vPoints, std::vector<size_t> vBounds)
+{
+	//Neighbouring runs are merged pairwise, a round at a time on the scheduler, until one is left
+	while (vBounds.size() > 2) {
+		auto szPairs = (vBounds.size() - 1) / 2;
+		CJobScheduler::get()->parallelFor(EJobPriority::Background, szPairs, [&](size_t szFirst, size_t szLast) {
+			for (auto i = szFirst; i < szLast; ++i) {
+				std::inplace_merge(vPoints.begin() + vBounds[2 * i], vPoints.begin() + vBounds[2 * i + 1],
+					vPoints.begin() + vBounds[2 * i + 2], lessKey);
+			}
+		});
+
+		std::vector<size_t> vNext;
+		for (size_t i = 0; i < vBounds.size(); i += 2)
+			vNext.push_back(vBounds[i]);
+
+		if (vNext.back() != vBounds.back())
+			vNext.push_back(vBounds.back());
+
+		vBounds.swap(vNext);
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "intfs.h"
+
+//Point dataset file: header, offset index of the quadkey cells, then one column per attribute. Opening it only maps it,
+//the pages of a range are read by the OS when the range is first uploaded. Little endian, as written on x86
+class CPointDataset : public IPointDataset {
+public:
+	//Null if the file is not a dataset
+	static IPointDatasetPtr open(const QString& qsPath);
+	//Points as their sort keys, in key order. Weights are written when bWeights is set
+	static bool write(const QString& qsPath, const std::vector<std::pair<quint64, float>>& vPoints, const bool& bWeights);
+	//31 bits of mercator x and y interleaved: sorting by it is sorting by quadkey. About 2 cm at the equator
+	static quint64 key(const double& dbX, const double& dbY);
+	static std::pair<double, double> merc(const quint64& uiKey);
+protected: //IPointDataset
+	size_t size() override;
+	QRectF bounds() override;
+	const GLfloat* positions() override;
+	const float* weights() override;
+	void ranges(const QRectF& qrMerc, const size_t& szMax, std::vector<std::pair<size_t, size_t>>& vRanges) override;
+private:
+	struct THeader;
+	struct TCell;
+	QFile m_File;
+	const THeader* m_pHeader = nullptr;
+	const TCell* m_pCells = nullptr;
+	const GLfloat* m_pPositions = nullptr;
+	const float* m_pWeights = nullptr;
+private:
+	CPointDataset() = default;
+	bool map();
+	//First point of the cells from uiCode on, at the index level
+	size_t first(const quint64& uiCode) const;
+};
+
+//Converts GeoJSON or CSV points into a dataset. The input is mapped and cut into pieces at line or feature boundaries
+//that are parsed on the scheduler in parallel, the sorted pieces are merged the same way
+class CDatasetImporter {
+public:
+	CDatasetImporter(const QString& qsInput, const QString& qsOutput);
+	int run();
+private:
+	struct TCsvLayout {
+		char cDelimiter = ',';
+		int nLat = 0;
+		int nLon = 1;
+		int nWeight = -1;
+		//Data start
+		qint64 nFirst = 0;
+	};
+	QString m_qsInput;
+	QString m_qsOutput;
+	IGeoMathPtr m_pMath;
+	bool m_bWeights = false;
+private:
+	TCsvLayout layout(const char* szData, const qint64& nSize);
+	//Rows that start in [szBegin, szEnd)
+	void parseCsv(const char* szBegin, const char* szEnd, const TCsvLayout& csv, std::vector<std::pair<quint64, float>>& vPoints) const;
+	//"coordinates" members that start in [szBegin, szEnd), their arrays may go on up to szLimit
+	void parseGeoJson(const char* szBegin, const char* szEnd, const char* szLimit, std::vector<std::pair<quint64, float>>& vPoints) const;
+	void add(const double& dbLat, const double& dbLon, const float& fWeight, std::vector<std::pair<quint64, float>>& vPoints) const;
+	//Sorted runs between the bounds become one sorted run
+	static void merge(std::vector<std::pair<quint64, float>>& vPoints, std::vector<size_t> vBounds);
+};
@@ -0,0 +1,159 @@
+#include "datasetlayer.h"
+#include "consts.h"
+#include "stats.h"
+#include "trace.h"
+
+std::shared_ptr<QOpenGLShaderProgram> CDatasetLayer::m_pShaders = nullptr;
+
+namespace {
+	//Triangle strip of a point sprite
+	const GLfloat gfDatasetCorners[] = {
+		-1.0f, -1.0f,	1.0f, -1.0f,	-1.0f, 1.0f,	1.0f, 1.0f
+	};
+}
+
+bool CDatasetLayer::initGL()
+{
+	//Nothing is created before a dataset is drawn
+	m_bInit = true;
+	return true;
+}
+
+bool CDatasetLayer::createGL()
+{
+	//0) Program is shared by every view in the share group
+	if (!m_pShaders)
+		m_pShaders = COverlayLayer::InitShaders(gwOverlayPointVS, gwOverlayFS);
+
+	if (!m_pShaders)
+		return false;
+
+	//1) Corners of the sprite, the buffer of the visible points and its VAO
+	m_pCorners = std::make_shared<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
+	if (!m_pCorners->create())
+		return false;
+
+	m_pCorners->bind();
+	m_pCorners->setUsagePattern(QOpenGLBuffer::StaticDraw);
+	m_pCorners->allocate(gfDatasetCorners, sizeof(gfDatasetCorners));
+
+	m_pPoints = std::make_shared<CGrowableBuffer>(4 * sizeof(GLfloat));
+	m_pVAO = std::make_shared<QOpenGLVertexArrayObject>();
+	if (!m_pVAO->create())
+		return false;
+
+	m_bCreated = true;
+	return true;
+}
+
+void CDatasetLayer::setDataset(IPointDatasetPtr pDataset, const QColor& qcColor, const float& fSize)
+{
+	m_pDataset = pDataset;
+	m_qcColor = qcColor;
+	m_fSize = fSize;
+	m_vUploaded.clear();
+	if (m_pPoints)
+		m_pPoints->clear();
+}
+
+void CDatasetLayer::draw(const QMatrix4x4& qmWorld, const TMercatorTransform& transform, const QSize& qsViewport)
+{
+	if (!m_bInit || !transform.bValid || !m_pDataset || !m_pDataset->size())
+		return;
+
+	if (!m_bCreated && !createGL()) {
+		m_bInit = false;
+		return;
+	}
+
+	CTraceScope scope("dataset");
+	m_pDataset->ranges(visibleArea(qmWorld, transform), gszDatasetMaxPoints, m_vVisible);
+	if (m_vVisible != m_vUploaded)
+		upload();
+
+	if (!m_pPoints->count())
+		return;
+
+	m_pShaders->bind();
+	COverlayLayer::setUniforms(m_pShaders, qmWorld, transform, qsViewport);
+
+	//1) Colour and size are the same for every point: constant attributes instead of arrays
+	auto* pFunc = QOpenGLContext::currentContext()->extraFunctions();
+	m_pVAO->bind();
+	pFunc->glVertexAttrib4f(2, m_qcColor.redF(), m_qcColor.greenF(), m_qcColor.blueF(), m_qcColor.alphaF());
+	pFunc->glVertexAttrib1f(3, m_fSize);
+	pFunc->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)m_pPoints->count());
+	m_pVAO->release();
+}
+
+void CDatasetLayer::upload()
+{
+	//0) Ranges are copied from the mapping as they are, the file already has the layout of the attribute
+	QElapsedTimer timer;
+	timer.start();
+	auto pPositions = m_pDataset->positions();
+	bool bReallocated = false;
+	m_pPoints->clear();
+	for (const auto& it : m_vVisible)
+		bReallocated |= m_pPoints->append(pPositions + 4 * it.first, it.second - it.first);
+
+	//1) Attribute pointers are set again only when the storage moved
+	if (bReallocated)
+		bindAttributes();
+
+	m_vUploaded = m_vVisible;
+
+	auto pStats = CStatistics::get();
+	pStats->add("dataset.uploads", 1);
+	pStats->add("dataset.uploaded.points", (qint64)m_pPoints->count());
+	pStats->set("dataset.upload.us", timer.nsecsElapsed() / 1000);
+}
+
+void CDatasetLayer::bindAttributes()
+{
+	auto* pFunc = QOpenGLContext::currentContext()->extraFunctions();
+	m_pVAO->bind();
+
+	//Corner
+	m_pCorners->bind();
+	pFunc->glEnableVertexAttribArray(0);
+	pFunc->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), nullptr);
+
+	//Per instance: mercator hi/lo
+	m_pPoints->bind();
+	pFunc->glEnableVertexAttribArray(1);
+	pFunc->glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), nullptr);
+	pFunc->glVertexAttribDivisor(1, 1);
+
+	//Colour and size come from the current attribute values
+	pFunc->glDisableVertexAttribArray(2);
+	pFunc->glDisableVertexAttribArray(3);
+
+	m_pVAO->release();
+}
+
+QRectF CDatasetLayer::visibleArea(const QMatrix4x4& qmWorld, const TMercatorTransform& transform)
+{
+	//Corners of the viewport on the map plane, as the screen centre in COverlayLayer::setUniforms
+	auto qmInverse = qmWorld.inverted();
+	double dbLeft = std::numeric_limits<double>::max(), dbTop = dbLeft;
+	double dbRight = std::numeric_limits<double>::lowest(), dbBottom = dbRight;
+	for (auto qpCorner : { QPointF(-1.0, -1.0), QPointF(1.0, -1.0), QPointF(-1.0, 1.0), QPointF(1.0, 1.0) }) {
+		auto qvNear = qmInverse.map(QVector3D((float)qpCorner.x(), (float)qpCorner.y(), -1.f));
+		auto qvFar = qmInverse.map(QVector3D((float)qpCorner.x(), (float)qpCorner.y(), 1.f));
+		float fDepth = qvNear.z() - qvFar.z();
+		float t = (std::abs(fDepth) > 0.f) ? qvNear.z() / fDepth : -1.f;
+		if ((t < 0.f) || (t > 1.f))
+			return QRectF(0.0, 0.0, 1.0, 1.0);
+
+		auto qvGround = qvNear + (qvFar - qvNear) * t;
+		double dbX = (qvGround.x() - transform.dbOriginX) / transform.dbScaleX;
+		double dbY = (qvGround.y() - transform.dbOriginY) / transform.dbScaleY;
+		dbLeft = std::min(dbLeft, dbX);
+		dbTop = std::min(dbTop, dbY);
+		dbRight = std::max(dbRight, dbX);
+		dbBottom = std::max(dbBottom, dbY);
+	}
+
+	return QRectF(QPointF(dbLeft, dbTop), QPointF(dbRight, dbBottom));
+}
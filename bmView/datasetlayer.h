@@ -0,0 +1,35 @@
+#pragma once
+#include "intfs.h"
+#include "overlay.h"
+
+//Points of a mapped dataset. Only the ranges of the cells around the view are copied to the GPU, straight from the mapping,
+//and only when the view moves to other cells. Every point is a sprite of one colour and size
+class CDatasetLayer : public IDatasetLayer {
+public:
+	CDatasetLayer() = default;
+protected: //IDatasetLayer
+	bool initGL() override;
+	void setDataset(IPointDatasetPtr pDataset, const QColor& qcColor, const float& fSize) override;
+	void draw(const QMatrix4x4& qmWorld, const TMercatorTransform& transform, const QSize& qsViewport) override;
+private:
+	IPointDatasetPtr m_pDataset;
+	QColor m_qcColor;
+	float m_fSize = 0.f;
+	bool m_bInit = false;
+	bool m_bCreated = false;
+
+	static std::shared_ptr<QOpenGLShaderProgram> m_pShaders;
+	std::shared_ptr<QOpenGLBuffer> m_pCorners;
+	std::shared_ptr<QOpenGLVertexArrayObject> m_pVAO;
+	std::shared_ptr<CGrowableBuffer> m_pPoints;
+
+	//Ranges of the dataset the buffer holds, one after another
+	std::vector<std::pair<size_t, size_t>> m_vUploaded;
+	std::vector<std::pair<size_t, size_t>> m_vVisible;
+private:
+	bool createGL();
+	void upload();
+	void bindAttributes();
+	//Mercator under the viewport, the whole map when a corner is above the horizon
+	static QRectF visibleArea(const QMatrix4x4& qmWorld, const TMercatorTransform& transform);
+};
@@ -0,0 +1,175 @@
+#include "diskcache.h"
+#include "stats.h"
+
+std::mutex CDiskTileCache::m_Lock;
+std::map<QString, IGeoTileCachePtr> CDiskTileCache::m_mCaches;
+QString CDiskTileCache::m_qsRoot;
+
+IGeoTileCachePtr CDiskTileCache::get(const QString& qsNamespace)
+{
+	//Loader threads ask for the cache too
+	std::lock_guard<std::mutex> lock(m_Lock);
+	auto& pCache = m_mCaches[qsNamespace];
+	if (!pCache) {
+		auto qsRoot = root();
+		if (!qsNamespace.isEmpty())
+			qsRoot += "/" + qsNamespace;
+
+		pCache = IGeoTileCachePtr(new CDiskTileCache(qsRoot));
+	}
+
+	return pCache;
+}
+
+void CDiskTileCache::setRoot(const QString& qsRoot)
+{
+	m_qsRoot = qsRoot;
+}
+
+QString CDiskTileCache::root()
+{
+	if (m_qsRoot.isEmpty())
+		return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/tiles";
+
+	return m_qsRoot;
+}
+
+TTileValidators CDiskTileCache::validators(const web::http::http_headers& headers)
+{
+	auto header = [&headers](const utility::string_t& sName) {
+		auto it = headers.find(sName);
+		return (it == headers.end()) ? QString() : QString::fromStdString(utility::conversions::to_utf8string(it->second));
+	};
+
+	TTileValidators result;
+	result.qsETag = header(web::http::header_names::etag);
+	result.qsLastModified = header(web::http::header_names::last_modified);
+
+	//0) max-age wins over Expires, no-cache means the copy has to be revalidated before every use
+	auto nNow = QDateTime::currentSecsSinceEpoch();
+	auto qsControl = header(web::http::header_names::cache_control).toLower();
+	auto match = QRegularExpression("max-age\\s*=\\s*(\\d+)").match(qsControl);
+	if (qsControl.contains("no-cache") || qsControl.contains("no-store")) {
+		result.nExpires = nNow;
+	}
+	else if (match.hasMatch()) {
+		result.nExpires = nNow + match.captured(1).toLongLong();
+	}
+	else {
+		auto qdtExpires = QDateTime::fromString(header(web::http::header_names::expires), Qt::RFC2822Date);
+		if (qdtExpires.isValid())
+			result.nExpires = qdtExpires.toSecsSinceEpoch();
+	}
+
+	return result;
+}
+
+CDiskTileCache::CDiskTileCache(const QString& qsRoot) : m_qsPath(qsRoot)
+{
+	QDir().mkpath(m_qsPath);
+}
+
+bool CDiskTileCache::contains(const QString& qsQuadKey)
+{
+	return QFileInfo::exists(path(qsQuadKey));
+}
+
+std::optional<TCachedTile> CDiskTileCache::read(const QString& qsQuadKey)
+{
+	QFile file(path(qsQuadKey));
+	if (!file.open(QIODevice::ReadOnly)) {
+		CStatistics::get()->add("cache.disk.misses", 1);
+		return std::nullopt;
+	}
+
+	TCachedTile result;
+	result.qbData = file.readAll();
+
+	//0) Validators live next to the tile. Without them the tile ages from the time it was written
+	QFile meta(metaPath(qsQuadKey));
+	if (meta.open(QIODevice::ReadOnly)) {
+		auto qjMeta = QJsonDocument::fromJson(meta.readAll()).object();
+		result.validators.qsETag = qjMeta["etag"].toString();
+		result.validators.qsLastModified = qjMeta["lastModified"].toString();
+		result.validators.nExpires = (qint64)qjMeta["expires"].toDouble();
+	}
+
+	if (!result.validators.nExpires)
+		result.validators.nExpires = QFileInfo(file).lastModified().toSecsSinceEpoch() + m_nDefaultTtl;
+
+	result.bStale = (result.validators.nExpires <= QDateTime::currentSecsSinceEpoch());
+
+	CStatistics::get()->add(result.bStale ? "cache.disk.stale" : "cache.disk.hits", 1);
+	return result;
+}
+
+bool CDiskTileCache::write(const QString& qsQuadKey, const QByteArray& qbData, const TTileValidators& validators)
+{
+	auto qsPath = path(qsQuadKey);
+	QDir().mkpath(QFileInfo(qsPath).path());
+
+	//Readers and an interrupted seeding never see a half written tile
+	QSaveFile file(qsPath);
+	if (!file.open(QIODevice::WriteOnly) || (file.write(qbData) != qbData.size()) || !file.commit())
+		return false;
+
+	CStatistics::get()->add("cache.disk.writes", 1);
+	return writeMeta(qsQuadKey, validators);
+}
+
+bool CDiskTileCache::refresh(const QString& qsQuadKey, const TTileValidators& validators)
+{
+	if (!contains(qsQuadKey))
+		return false;
+
+	//A 304 may leave out validators that did not change
+	auto merged = validators;
+	if (merged.qsETag.isEmpty() || merged.qsLastModified.isEmpty()) {
+		QFile meta(metaPath(qsQuadKey));
+		if (meta.open(QIODevice::ReadOnly)) {
+			auto qjMeta = QJsonDocument::fromJson(meta.readAll()).object();
+			if (merged.qsETag.isEmpty())
+				merged.qsETag = qjMeta["etag"].toString();
+
+			if (merged.qsLastModified.isEmpty())
+				merged.qsLastModified = qjMeta["lastModified"].toString();
+		}
+	}
+
+	CStatistics::get()->add("cache.disk.refreshed", 1);
+	return writeMeta(qsQuadKey, merged);
+}
+
+void CDiskTileCache::abandon(const QString& qsQuadKey)
+{
+	//Nothing is in flight on disk
+}
+
+QString CDiskTileCache::path(const QString& qsQuadKey)
+{
+	//<root>/<zoom>/0123/0123/.../<quadkey>.tile keeps every directory at up to 256 entries
+	auto qsPath = QString("%1/%2").arg(m_qsPath).arg(qsQuadKey.length());
+	for (int i = 0; i + 4 < qsQuadKey.length(); i += 4)
+		qsPath += "/" + qsQuadKey.mid(i, 4);
+
+	return qsPath + "/" + qsQuadKey + ".tile";
+}
+
+QString CDiskTileCache::metaPath(const QString& qsQuadKey)
+{
+	auto qsPath = path(qsQuadKey);
+	qsPath.chop(4);
+	return qsPath + "meta";
+}
+
+bool CDiskTileCache::writeMeta(const QString& qsQuadKey, const TTileValidators& validators)
+{
+	//No expiry from the server: the default TTL starts now
+	QJsonObject qjMeta;
+	qjMeta["etag"] = validators.qsETag;
+	qjMeta["lastModified"] = validators.qsLastModified;
+	qjMeta["expires"] = (double)(validators.nExpires ? validators.nExpires : QDateTime::currentSecsSinceEpoch() + m_nDefaultTtl);
+
+	QSaveFile file(metaPath(qsQuadKey));
+	return file.open(QIODevice::WriteOnly) && (file.write(QJsonDocument(qjMeta).toJson(QJsonDocument::Compact)) >= 0) && file.commit();
+}
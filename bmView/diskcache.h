@@ -0,0 +1,31 @@
+#pragma once
+#include "intfs.h"
+
+class CDiskTileCache : public IGeoTileCache {
+public:
+	//Each map layer keeps its tiles in its own subdirectory, the base layer uses the root
+	static IGeoTileCachePtr get(const QString& qsNamespace = QString());
+	//Must be called before the first get()
+	static void setRoot(const QString& qsRoot);
+	//Root the caches are under, the default one unless set
+	static QString root();
+	//ETag, Last-Modified and the expiry from Cache-Control or Expires of a tile response
+	static TTileValidators validators(const web::http::http_headers& headers);
+protected: //IGeoTileCache
+	bool contains(const QString& qsQuadKey) override;
+	std::optional<TCachedTile> read(const QString& qsQuadKey) override;
+	bool write(const QString& qsQuadKey, const QByteArray& qbData, const TTileValidators& validators) override;
+	bool refresh(const QString& qsQuadKey, const TTileValidators& validators) override;
+	void abandon(const QString& qsQuadKey) override;
+private:
+	explicit CDiskTileCache(const QString& qsRoot);
+	static std::mutex m_Lock;
+	static std::map<QString, IGeoTileCachePtr> m_mCaches;
+	static QString m_qsRoot;
+	QString m_qsPath;
+	//Servers that send no freshness info, and tiles stored before validators were kept
+	const qint64 m_nDefaultTtl = 7 * 24 * 60 * 60;
+	QString path(const QString& qsQuadKey);
+	QString metaPath(const QString& qsQuadKey);
+	bool writeMeta(const QString& qsQuadKey, const TTileValidators& validators);
+};
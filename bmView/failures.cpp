@@ -0,0 +1,162 @@
+#include "failures.h"
+#include "stats.h"
+
+ITileFailureTrackerPtr CTileFailureTracker::m_pTracker = nullptr;
+
+namespace {
+	uint remaining(const std::chrono::steady_clock::time_point& tpRetry, const std::chrono::steady_clock::time_point& tpNow)
+	{
+		return (uint)std::max<qint64>(1, std::chrono::duration_cast<std::chrono::milliseconds>(tpRetry - tpNow).count());
+	}
+}
+
+ITileFailureTrackerPtr CTileFailureTracker::get()
+{
+	//Texture continuations report from pplx threads
+	static std::once_flag flag;
+	std::call_once(flag, [] {
+		m_pTracker = ITileFailureTrackerPtr(new CTileFailureTracker());
+	});
+
+	return m_pTracker;
+}
+
+std::optional<TTileRetry> CTileFailureTracker::blocked(const QString& qsQuadKey, const QString& qsHost)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	auto tpNow = Clock::now();
+
+	//0) Known bad key: no imagery, or still backing off after a transient error
+	auto itKey = m_mKeys.find(qsQuadKey);
+	if ((itKey != m_mKeys.end()) && (tpNow < itKey->second.tpRetry)) {
+		CStatistics::get()->add("fetch.deferred.key", 1);
+		return TTileRetry{ itKey->second.eFailure, remaining(itKey->second.tpRetry, tpNow) };
+	}
+
+	//1) Host breaker. After the cooldown exactly one request probes the host, the rest keep waiting
+	auto itHost = m_mHosts.find(qsHost);
+	if (itHost == m_mHosts.end() || (EBreaker::Closed == itHost->second.eState))
+		return std::nullopt;
+
+	auto& host = itHost->second;
+	if ((EBreaker::HalfOpen == host.eState) && host.bProbing && (tpNow >= host.tpProbeDeadline)) {
+		CStatistics::get()->add("fetch.breaker.lostprobes", 1);
+		trip(host, tpNow);
+	}
+
+	if ((EBreaker::Open == host.eState) && (tpNow >= host.tpRetry)) {
+		host.eState = EBreaker::HalfOpen;
+		host.bProbing = false;
+	}
+
+	if ((EBreaker::HalfOpen == host.eState) && !host.bProbing) {
+		host.bProbing = true;
+		host.qsProbe = qsQuadKey;
+		host.tpProbeDeadline = tpNow + std::chrono::milliseconds(m_uiProbeTimeout);
+		return std::nullopt;
+	}
+
+	//2) Waiters are spread over a short window after the cooldown instead of all coming back at once
+	CStatistics::get()->add("fetch.deferred.host", 1);
+	auto tpRetry = std::max(host.tpRetry, tpNow + std::chrono::milliseconds(m_uiBaseDelay));
+	std::uniform_int_distribution<uint> spread(0, m_uiCooldown / 2);
+	return TTileRetry{ ETileFailure::Transient, remaining(tpRetry, tpNow) + spread(m_Random) };
+}
+
+void CTileFailureTracker::succeeded(const QString& qsQuadKey, const QString& qsHost)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_mKeys.erase(qsQuadKey);
+
+	auto itHost = m_mHosts.find(qsHost);
+	if (itHost != m_mHosts.end()) {
+		m_mHosts.erase(itHost);
+		updateStats();
+	}
+}
+
+TTileRetry CTileFailureTracker::failed(const QString& qsQuadKey, const QString& qsHost, const ETileFailure& eFailure)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	auto tpNow = Clock::now();
+	prune(tpNow);
+
+	//0) Per key: a fixed TTL for missing imagery, exponential backoff with jitter for everything else
+	auto& key = m_mKeys[qsQuadKey];
+	key.eFailure = eFailure;
+	++key.uiFailures;
+
+	TTileRetry retry;
+	retry.eFailure = eFailure;
+	retry.uiDelay = (ETileFailure::Missing == eFailure) ? m_uiMissingTtl : backoff(m_uiBaseDelay, key.uiFailures, m_uiMaxDelay);
+	key.tpRetry = tpNow + std::chrono::milliseconds(retry.uiDelay);
+
+	//1) Only transient errors count against the host. A 404 or a broken body still means the server answers
+	if (ETileFailure::Transient != eFailure) {
+		if (m_mHosts.erase(qsHost))
+			updateStats();
+
+		return retry;
+	}
+
+	auto& host = m_mHosts[qsHost];
+	++host.uiFailures;
+
+	//2) Failed probe or too many failures in a row: open for a cooldown that grows with every trip
+	bool bTrip = (EBreaker::HalfOpen == host.eState) || ((EBreaker::Closed == host.eState) && (host.uiFailures >= m_uiTripFailures));
+	if (bTrip)
+		trip(host, tpNow);
+
+	if (EBreaker::Closed != host.eState)
+		retry.uiDelay = std::max(retry.uiDelay, remaining(host.tpRetry, tpNow));
+
+	return retry;
+}
+
+void CTileFailureTracker::abandoned(const QString& qsQuadKey, const QString& qsHost)
+{
+	//Only the probe itself frees the slot, other requests of the host were never let through
+	std::lock_guard<std::mutex> lock(m_Lock);
+	auto itHost = m_mHosts.find(qsHost);
+	if ((itHost != m_mHosts.end()) && itHost->second.bProbing && (itHost->second.qsProbe == qsQuadKey)) {
+		itHost->second.bProbing = false;
+		CStatistics::get()->add("fetch.breaker.abandonedprobes", 1);
+	}
+}
+
+void CTileFailureTracker::trip(THostState& host, const Clock::time_point& tpNow)
+{
+	++host.uiTrips;
+	host.eState = EBreaker::Open;
+	host.bProbing = false;
+	host.tpRetry = tpNow + std::chrono::milliseconds(backoff(m_uiCooldown, host.uiTrips, m_uiMaxCooldown));
+	CStatistics::get()->add("fetch.breaker.trips", 1);
+	updateStats();
+}
+
+uint CTileFailureTracker::backoff(const uint& uiBase, const uint& uiAttempt, const uint& uiMax)
+{
+	//Doubling per attempt, then a random point in the upper half so that many viewers don't retry in lockstep
+	double dbDelay = std::min<double>(uiMax, uiBase * std::pow(2.0, std::min(uiAttempt, 20u) - 1.0));
+	std::uniform_real_distribution<double> jitter(0.5, 1.0);
+	return (uint)std::max(1.0, dbDelay * jitter(m_Random));
+}
+
+void CTileFailureTracker::prune(const Clock::time_point& tpNow)
+{
+	if (m_mKeys.size() < m_szPruneKeys)
+		return;
+
+	for (auto it = m_mKeys.begin(); it != m_mKeys.end();) {
+		if (it->second.tpRetry <= tpNow)
+			it = m_mKeys.erase(it);
+		else
+			++it;
+	}
+}
+
+void CTileFailureTracker::updateStats()
+{
+	auto nOpen = std::count_if(m_mHosts.begin(), m_mHosts.end(), [](const auto& it) { return EBreaker::Closed != it.second.eState; });
+	CStatistics::get()->set("fetch.breaker.open", nOpen);
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "intfs.h"
+
+//Thrown inside the tile fetch chain, tells the texture whether and when to retry
+struct TTileFetchError : public std::runtime_error {
+	TTileFetchError(const ETileFailure& eFailure, const bool& bDeferred = false, const uint& uiDelay = 0) :
+		std::runtime_error("Tile fetch failed"), eFailure(eFailure), bDeferred(bDeferred), uiDelay(uiDelay) {}
+	ETileFailure eFailure;
+	//Not requested at all: the key or the host is still blocked
+	bool bDeferred;
+	uint uiDelay;
+};
+
+class CTileFailureTracker : public ITileFailureTracker {
+public:
+	static ITileFailureTrackerPtr get();
+protected: //ITileFailureTracker
+	std::optional<TTileRetry> blocked(const QString& qsQuadKey, const QString& qsHost) override;
+	void succeeded(const QString& qsQuadKey, const QString& qsHost) override;
+	TTileRetry failed(const QString& qsQuadKey, const QString& qsHost, const ETileFailure& eFailure) override;
+	void abandoned(const QString& qsQuadKey, const QString& qsHost) override;
+private:
+	using Clock = std::chrono::steady_clock;
+	struct TKeyState {
+		ETileFailure eFailure = ETileFailure::Transient;
+		uint uiFailures = 0;
+		Clock::time_point tpRetry;
+	};
+	enum class EBreaker { Closed, Open, HalfOpen };
+	struct THostState {
+		EBreaker eState = EBreaker::Closed;
+		uint uiFailures = 0;
+		uint uiTrips = 0;
+		Clock::time_point tpRetry;
+		bool bProbing = false;
+		//Key of the probe and when it counts as lost
+		QString qsProbe;
+		Clock::time_point tpProbeDeadline;
+	};
+
+	CTileFailureTracker() = default;
+	static ITileFailureTrackerPtr m_pTracker;
+
+	std::mutex m_Lock;
+	std::map<QString, TKeyState> m_mKeys;
+	std::map<QString, THostState> m_mHosts;
+	std::mt19937 m_Random{ std::random_device{}() };
+
+	//No imagery rarely changes, one hour before asking again
+	const uint m_uiMissingTtl = 60 * 60 * 1000;
+	const uint m_uiBaseDelay = 500;
+	const uint m_uiMaxDelay = 60 * 1000;
+	//Consecutive transient failures that open the breaker, and its first cooldown
+	const uint m_uiTripFailures = 8;
+	const uint m_uiCooldown = 5 * 1000;
+	const uint m_uiMaxCooldown = 5 * 60 * 1000;
+	//A probe with no answer by then is taken for a failed one
+	const uint m_uiProbeTimeout = 30 * 1000;
+	const size_t m_szPruneKeys = 4096;
+private:
+	uint backoff(const uint& uiBase, const uint& uiAttempt, const uint& uiMax);
+	//Open for a cooldown that grows with every trip
+	void trip(THostState& host, const Clock::time_point& tpNow);
+	void prune(const Clock::time_point& tpNow);
+	void updateStats();
+};
@@ -0,0 +1,336 @@
+#include "feed.h"
+#include "consts.h"
+#include "stats.h"
+#include "trace.h"
+
+CObjectFeed::CObjectFeed(const QString& qsSource, const double& dbSpeed) : m_qsSource(qsSource), m_dbSpeed(dbSpeed)
+{
+}
+
+CObjectFeed::~CObjectFeed()
+{
+	stop();
+}
+
+void CObjectFeed::addLayer(ILiveLayerPtr pLayer)
+{
+	if (pLayer)
+		m_vLayers.push_back(pLayer);
+}
+
+void CObjectFeed::start()
+{
+	if (m_Thread.joinable())
+		return;
+
+	m_bStop = false;
+	m_Thread = std::thread([this] { run(); });
+}
+
+void CObjectFeed::stop()
+{
+	m_bStop = true;
+	if (m_Thread.joinable())
+		m_Thread.join();
+}
+
+bool CObjectFeed::parse(const char* szLine, int nLength, TFeedUpdate& update)
+{
+	while ((nLength > 0) && ((szLine[nLength - 1] == '\n') || (szLine[nLength - 1] == '\r')))
+		--nLength;
+
+	//0) id,lat,lon,time_ms. The fields are ranges of the line, nothing is copied
+	std::pair<const char*, const char*> pFields[4];
+	auto szField = szLine;
+	auto szEnd = szLine + nLength;
+	for (size_t i = 0; i < 4; ++i) {
+		auto szNext = static_cast<const char*>(memchr(szField, ',', szEnd - szField));
+		//Exactly three commas
+		if (!szNext && (i < 3))
+			return false;
+
+		if (szNext && (3 == i))
+			return false;
+
+		if (!szNext)
+			szNext = szEnd;
+
+		//Blanks around a number were allowed before
+		auto szFirst = szField, szLast = szNext;
+		while ((szFirst < szLast) && isblank((unsigned char)*szFirst))
+			++szFirst;
+
+		while ((szLast > szFirst) && isblank((unsigned char)szLast[-1]))
+			--szLast;
+
+		pFields[i] = { szFirst, szLast };
+		szField = szNext + 1;
+	}
+
+	//1) from_chars reads the C format whatever the system locale is. A field must be a number as a whole
+	auto whole = [&](const size_t& i, auto& value) {
+		auto result = std::from_chars(pFields[i].first, pFields[i].second, value);
+		return (std::errc() == result.ec) && (result.ptr == pFields[i].second);
+	};
+
+	double dbLat = 0.0, dbLon = 0.0;
+	if (!whole(0, update.uiObject) || !whole(1, dbLat) || !whole(2, dbLon) || !whole(3, update.nTime))
+		return false;
+
+	update.qpPosition = QPointF(dbLat, dbLon);
+	return (std::abs(dbLat) <= 90.0) && (std::abs(dbLon) <= 180.0);
+}
+
+void CObjectFeed::run()
+{
+	CTracer::setThreadName("feed");
+	m_RateTimer.start();
+
+	if (QFileInfo(m_qsSource).isFile())
+		replay();
+	else
+		listen();
+
+	deliver();
+}
+
+void CObjectFeed::replay()
+{
+	QFile file(m_qsSource);
+	if (!file.open(QIODevice::ReadOnly)) {
+		qWarning() << "Feed log can't be opened:" << m_qsSource;
+		return;
+	}
+
+	QElapsedTimer clock;
+	clock.start();
+	std::optional<qint64> nFirst;
+	char szLine[256];
+	qint64 nLength = 0;
+	while (!m_bStop && ((nLength = file.readLine(szLine, sizeof(szLine))) > 0)) {
+		TFeedUpdate update;
+		if (!parse(szLine, (int)nLength, update)) {
+			CStatistics::get()->add("feed.malformed", 1);
+			continue;
+		}
+
+		//0) Reports that are due go out together, then the thread sleeps until the next one is due
+		if (m_dbSpeed > 0.0) {
+			if (!nFirst)
+				nFirst = update.nTime;
+
+			auto nDue = (qint64)((update.nTime - *nFirst) / m_dbSpeed);
+			if (nDue > clock.elapsed()) {
+				deliver();
+				while (!m_bStop && (nDue > clock.elapsed()))
+					std::this_thread::sleep_for(std::chrono::milliseconds(std::min<qint64>(nDue - clock.elapsed(), 50)));
+			}
+		}
+
+		m_vBatch.push_back(update);
+		if (m_vBatch.size() >= gszFeedBatch)
+			deliver();
+	}
+
+	qInfo() << "Feed log replayed:" << m_qsSource;
+}
+
+void CObjectFeed::listen()
+{
+	QLocalSocket socket;
+	char szLine[256];
+	while (!m_bStop) {
+		//0) The server may start later or restart, it is looked for again every second
+		if (socket.state() != QLocalSocket::ConnectedState) {
+			socket.abort();
+			socket.connectToServer(m_qsSource, QIODevice::ReadOnly);
+			if (!socket.waitForConnected(1000)) {
+				for (int i = 0; (i < 10) && !m_bStop; ++i)
+					std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+				continue;
+			}
+
+			qInfo() << "Feed connected:" << m_qsSource;
+		}
+
+		//1) Whole lines only, a partial one stays in the socket until its end arrives
+		socket.waitForReadyRead(100);
+		while (socket.canReadLine()) {
+			auto nLength = socket.readLine(szLine, sizeof(szLine));
+			TFeedUpdate update;
+			if (!parse(szLine, (int)nLength, update)) {
+				CStatistics::get()->add("feed.malformed", 1);
+				continue;
+			}
+
+			m_vBatch.push_back(update);
+			if (m_vBatch.size() >= gszFeedBatch)
+				deliver();
+		}
+
+		deliver();
+	}
+}
+
+void CObjectFeed::deliver()
+{
+	if (m_vBatch.empty())
+		return;
+
+	for (const auto& it : m_vLayers) {
+		if (auto pLayer = it.lock())
+			pLayer->update(m_vBatch);
+	}
+
+	auto pStats = CStatistics::get();
+	pStats->add("feed.updates", (qint64)m_vBatch.size());
+	m_nRateCount += m_vBatch.size();
+	if (m_RateTimer.elapsed() >= 1000) {
+		pStats->set("feed.rate", m_nRateCount * 1000 / std::max<qint64>(m_RateTimer.restart(), 1));
+		m_nRateCount = 0;
+	}
+
+	m_vBatch.clear();
+}
+
+CFeedGenerator::CFeedGenerator(const std::vector<QPointF>& vArea, const uint& uiObjects, const uint& uiRate) : m_uiRate(uiRate)
+{
+	if (vArea.size() != 2)
+		return;
+
+	m_qpMin = QPointF(std::min(vArea[0].x(), vArea[1].x()), std::min(vArea[0].y(), vArea[1].y()));
+	m_qpMax = QPointF(std::max(vArea[0].x(), vArea[1].x()), std::max(vArea[0].y(), vArea[1].y()));
+
+	//5 to 30 m/s in any direction, a degree of latitude is about 111 km
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<double> dLat(m_qpMin.x(), m_qpMax.x()), dLon(m_qpMin.y(), m_qpMax.y());
+	std::uniform_real_distribution<double> dSpeed(5.0 / 111000.0, 30.0 / 111000.0), dAngle(0.0, 2.0 * M_PI);
+	m_vObjects.resize(uiObjects);
+	for (auto& it : m_vObjects) {
+		double dbSpeed = dSpeed(rng), dbAngle = dAngle(rng);
+		it = { dLat(rng), dLon(rng), dbSpeed * std::sin(dbAngle), dbSpeed * std::cos(dbAngle) };
+	}
+}
+
+QByteArray CFeedGenerator::next(const qint64& nUntil)
+{
+	QByteArray qbLines;
+	if ((nUntil <= m_nTime) || m_vObjects.empty())
+		return qbLines;
+
+	//0) Reports are spread evenly over the span, the fraction of one left over goes to the next call
+	double dbCount = m_uiRate * (nUntil - m_nTime) / 1000.0 + m_dbCarry;
+	auto szCount = (size_t)dbCount;
+	m_dbCarry = dbCount - szCount;
+
+	qbLines.reserve((int)(szCount * 40));
+	for (size_t i = 0; i < szCount; ++i) {
+		qint64 nTime = m_nTime + (qint64)((i + 1) * (nUntil - m_nTime) / szCount);
+		auto szObject = m_szNext;
+		m_szNext = (m_szNext + 1) % m_vObjects.size();
+
+		//1) Position follows from the time, so it doesn't depend on how often the object reported before
+		const auto& object = m_vObjects[szObject];
+		double dbSeconds = nTime / 1000.0;
+		qbLines.append(QByteArray::number((qulonglong)szObject)).append(',')
+			.append(QByteArray::number(bounce(object.dbLat + object.dbSpeedLat * dbSeconds, m_qpMin.x(), m_qpMax.x()), 'f', 7)).append(',')
+			.append(QByteArray::number(bounce(object.dbLon + object.dbSpeedLon * dbSeconds, m_qpMin.y(), m_qpMax.y()), 'f', 7)).append(',')
+			.append(QByteArray::number(nTime)).append('\n');
+	}
+
+	m_nTime = nUntil;
+	return qbLines;
+}
+
+int CFeedGenerator::write(const QString& qsPath, const double& dbSeconds)
+{
+	QFile file(qsPath);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		qCritical() << "Feed log can't be written:" << qsPath;
+		return 1;
+	}
+
+	//A second of reports at a time
+	auto nEnd = (qint64)(dbSeconds * 1000.0);
+	while (m_nTime < nEnd) {
+		auto qbLines = next(std::min<qint64>(m_nTime + 1000, nEnd));
+		if (file.write(qbLines) != qbLines.size()) {
+			qCritical() << "Feed log can't be written:" << qsPath;
+			return 1;
+		}
+	}
+
+	qInfo().noquote() << QString("Feed log: %1 s, %2 objects, %3 reports/s, %4 MB")
+		.arg(dbSeconds).arg(m_vObjects.size()).arg(m_uiRate).arg(file.size() / (1024.0 * 1024.0), 0, 'f', 1);
+	return 0;
+}
+
+bool CFeedGenerator::serve(const QString& qsName)
+{
+	//0) A server that crashed may have left its socket behind
+	QLocalServer::removeServer(qsName);
+	m_pServer = std::make_unique<QLocalServer>();
+	if (!m_pServer->listen(qsName)) {
+		qCritical() << "Feed server can't listen:" << qsName << m_pServer->errorString();
+		return false;
+	}
+
+	QObject::connect(m_pServer.get(), &QLocalServer::newConnection, [this] {
+		while (auto pClient = m_pServer->nextPendingConnection())
+			m_vClients.push_back(pClient);
+	});
+
+	//1) Reports go out every 10 ms with the feed time they were due at
+	QObject::connect(&m_Timer, &QTimer::timeout, [this] { onTick(); });
+	m_Clock.start();
+	m_Timer.start(10);
+
+	qInfo().noquote() << QString("Feed server %1: %2 objects, %3 reports/s").arg(qsName).arg(m_vObjects.size()).arg(m_uiRate);
+	return true;
+}
+
+void CFeedGenerator::onTick()
+{
+	auto nElapsed = m_Clock.elapsed();
+	auto qbLines = next(nElapsed);
+	auto nReports = (qint64)qbLines.count('\n');
+
+	//A client that doesn't keep up misses reports instead of growing its write buffer
+	for (auto it = m_vClients.begin(); it != m_vClients.end();) {
+		auto pClient = *it;
+		if (pClient->state() != QLocalSocket::ConnectedState) {
+			pClient->deleteLater();
+			it = m_vClients.erase(it);
+			continue;
+		}
+
+		if (pClient->bytesToWrite() > 16 * 1024 * 1024)
+			m_nSkipped += nReports;
+		else
+			pClient->write(qbLines);
+
+		++it;
+	}
+
+	m_nSent += nReports;
+	if (nElapsed - m_nReported >= 1000) {
+		qInfo().noquote() << QString("Feed: %1 reports/s, %2 clients, %3 skipped")
+			.arg(m_nSent * 1000 / (nElapsed - m_nReported)).arg(m_vClients.size()).arg(m_nSkipped);
+		m_nReported = nElapsed;
+		m_nSent = 0;
+	}
+}
+
+double CFeedGenerator::bounce(const double& dbValue, const double& dbMin, const double& dbMax)
+{
+	double dbSpan = dbMax - dbMin;
+	if (dbSpan <= 0.0)
+		return dbMin;
+
+	double dbOffset = std::fmod(dbValue - dbMin, 2.0 * dbSpan);
+	if (dbOffset < 0.0)
+		dbOffset += 2.0 * dbSpan;
+
+	return dbMin + ((dbOffset > dbSpan) ? 2.0 * dbSpan - dbOffset : dbOffset);
+}
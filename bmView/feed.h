@@ -0,0 +1,71 @@
+#pragma once
+#include "intfs.h"
+
+//Reads "id,lat,lon,time_ms" lines on its own thread and hands them to the live layers in batches.
+//The source is a log file, replayed at its timestamps, or the name of a local socket server
+class CObjectFeed {
+public:
+	//dbSpeed scales the replay clock, 0 - as fast as the file is read
+	CObjectFeed(const QString& qsSource, const double& dbSpeed = 1.0);
+	~CObjectFeed();
+	//Before start()
+	void addLayer(ILiveLayerPtr pLayer);
+	void start();
+	void stop();
+	static bool parse(const char* szLine, int nLength, TFeedUpdate& update);
+private:
+	QString m_qsSource;
+	double m_dbSpeed;
+	std::vector<ILiveLayerPtr_> m_vLayers;
+	std::thread m_Thread;
+	std::atomic<bool> m_bStop{ false };
+
+	//Feed thread
+	std::vector<TFeedUpdate> m_vBatch;
+	QElapsedTimer m_RateTimer;
+	qint64 m_nRateCount = 0;
+private:
+	void run();
+	void replay();
+	void listen();
+	void deliver();
+};
+
+//Synthetic feed for measurements: objects drive straight through an area and bounce off its edges,
+//reporting round-robin at a fixed total rate
+class CFeedGenerator {
+public:
+	//Opposite corners as QPointF(lat, lon)
+	CFeedGenerator(const std::vector<QPointF>& vArea, const uint& uiObjects, const uint& uiRate);
+	//Lines of the reports up to nUntil ms of feed time
+	QByteArray next(const qint64& nUntil);
+	//Replay log of that many seconds
+	int write(const QString& qsPath, const double& dbSeconds);
+	//Real time to every client of the local socket server
+	bool serve(const QString& qsName);
+private:
+	struct TObject {
+		double dbLat, dbLon;
+		//Degrees per second
+		double dbSpeedLat, dbSpeedLon;
+	};
+	QPointF m_qpMin, m_qpMax;
+	std::vector<TObject> m_vObjects;
+	uint m_uiRate;
+	qint64 m_nTime = 0;
+	double m_dbCarry = 0.0;
+	size_t m_szNext = 0;
+
+	std::unique_ptr<QLocalServer> m_pServer;
+	std::vector<QLocalSocket*> m_vClients;
+	QTimer m_Timer;
+	QElapsedTimer m_Clock;
+	//Since the last report
+	qint64 m_nSent = 0;
+	qint64 m_nReported = 0;
+	qint64 m_nSkipped = 0;
+private:
+	void onTick();
+	//Inside the area, folded back at its edges
+	static double bounce(const double& dbValue, const double& dbMin, const double& dbMax);
+};
@@ -1,24 +1,212 @@
 #include "geotex.h"
 #include "consts.h"
+#include "stats.h"
+#include "tileres.h"
+#include "diskcache.h"
+#include "memcache.h"
+#include "sched.h"
+#include "failures.h"
+#include "tilemap.h"
+#include "trace.h"
 #include <math.h>
 
 IGeoTextureProviderPtr CBingGeoTextureProvider::m_pProvider = nullptr;
+QString CBingGeoTextureProvider::m_qsUriTemplate;
+std::shared_ptr<CGeoFetchQueue> CGeoFetchQueue::m_pQueue = nullptr;
+CHandlePool<CBingGeoTexture*> CBingGeoTexture::m_Registry(4096);
+//Bounded: a stalled GUI thread holds decodes back instead of collecting decoded images
+CCompletionQueue<TTextureCompletion> CBingGeoTexture::m_Completions(256);
+std::atomic<bool> CBingGeoTexture::m_bWakePending{ false };
+std::atomic<qint64> CBingGeoTexture::m_nPendingBytes{ 0 };
+std::mutex CBingGeoTexture::m_ParkLock;
+std::vector<pplx::task_completion_event<void>> CBingGeoTexture::m_vParked;
+std::mutex CBingGeoTexture::m_RevalidateLock;
+std::set<QString> CBingGeoTexture::m_sRevalidating;
 
-CBingGeoTexture::CBingGeoTexture(const QString& qsQuadKey, GeoCallback callback) :
-	m_qsQuadKey(qsQuadKey), m_fCallback(callback)
+namespace {
+	//Failure class of a tile response, nothing if it carries a tile
+	std::optional<ETileFailure> classify(const web::http::http_response& response)
+	{
+		//Bing answers 200 with a placeholder where it has no imagery
+		auto nStatus = response.status_code();
+		auto itInfo = response.headers().find(U("X-VE-Tile-Info"));
+		bool bNoTile = (itInfo != response.headers().end()) && (itInfo->second == U("no-tile"));
+
+		if (bNoTile || (web::http::status_codes::NotFound == nStatus) || (web::http::status_codes::NoContent == nStatus) ||
+			(web::http::status_codes::Gone == nStatus))
+			return ETileFailure::Missing;
+
+		if (web::http::status_codes::OK != nStatus)
+			return ETileFailure::Transient;
+
+		return std::nullopt;
+	}
+
+	//One client per server, so its connections stay open from one tile to the next
+	std::shared_ptr<web::http::client::http_client> clientFor(const QUrl& qUrl)
+	{
+		static std::mutex lock;
+		static std::map<QString, std::shared_ptr<web::http::client::http_client>> mClients;
+
+		auto qsBase = qUrl.adjusted(QUrl::RemovePath | QUrl::RemoveQuery | QUrl::RemoveFragment).toString();
+		std::lock_guard<std::mutex> guard(lock);
+		auto& pClient = mClients[qsBase];
+		if (!pClient)
+			pClient = std::make_shared<web::http::client::http_client>(utility::conversions::to_string_t(qsBase.toStdString()));
+
+		return pClient;
+	}
+
+	//Path and query of a tile uri, relative to its client
+	utility::string_t relativeUri(const QUrl& qUrl)
+	{
+		return utility::conversions::to_string_t(qUrl.toEncoded(QUrl::RemoveScheme | QUrl::RemoveAuthority).toStdString());
+	}
+
+	//What a header only answer like a 304 costs on the wire, roughly
+	qint64 headerBytes(const web::http::http_response& response)
+	{
+		qint64 nBytes = 16;
+		for (const auto& it : response.headers())
+			nBytes += (qint64)(it.first.size() + it.second.size() + 4);
+
+		return nBytes;
+	}
+}
+
+CBingGeoTexture::CBingGeoTexture(const QString& qsQuadKey, CBingGeoTextureProvider* pProvider) :
+	m_qsQuadKey(qsQuadKey), m_pProvider(pProvider)
 {
-	connect(this, &CBingGeoTexture::textureReady, this, &CBingGeoTexture::onTextureReady, Qt::QueuedConnection);
+	m_hTexture = m_Registry.acquire(this);
+	m_vSubscribers.reserve(4);
+	m_nTraceKey = CTracer::enabled() ? CTracer::pack(qsQuadKey) : 0;
 }
 
 CBingGeoTexture::~CBingGeoTexture()
 {
 	m_CTS.cancel();
-	disconnect(this, 0, 0, 0);
+	m_pFetch->transport.cancel();
+	m_Registry.release(m_hTexture);
+	CTileResources::get()->releaseTexture(m_pTexture);
+}
+
+void CBingGeoTexture::complete(const THandle& hTexture, QImage img)
+{
+	//0) Decodes start only while the queue is at most half full, so it overflows only when more of them finish at
+	//once than it has room left for. Those few go as events of their own, a worker never waits for the GUI thread
+	CTracer::begin("deliver", hTexture);
+	qint64 nBytes = img.sizeInBytes();
+	m_nPendingBytes += nBytes;
+	TTextureCompletion completion{ hTexture, std::move(img), nBytes };
+	if (!m_Completions.push(std::move(completion))) {
+		static CStatCounter statOverflows("textures.handoff.overflows");
+		statOverflows.add(1);
+		QMetaObject::invokeMethod(qApp, [completion] {
+			CBingGeoTexture::accept(completion);
+		}, Qt::QueuedConnection);
+	}
+
+	//1) One wake-up per burst instead of one queued event per image
+	if (!m_bWakePending.exchange(true)) {
+		QMetaObject::invokeMethod(qApp, [] {
+			CBingGeoTexture::deliver();
+		}, Qt::QueuedConnection);
+	}
+}
+
+void CBingGeoTexture::deliver()
+{
+	m_bWakePending = false;
+
+	bool bPopped = false;
+	TTextureCompletion completion;
+	while (m_Completions.pop(completion)) {
+		bPopped = true;
+		accept(std::move(completion));
+	}
+
+	if (!bPopped)
+		return;
+
+	static CStatCounter statBytes("textures.handoff.bytes");
+	statBytes.set(m_nPendingBytes);
+
+	//0) Budget freed up: the parked decodes go to the scheduler at their own priority. A backlog that grew back
+	//meanwhile keeps them, its images bring another deliver()
+	std::vector<pplx::task_completion_event<void>> vResumed;
+	{
+		std::lock_guard<std::mutex> lock(m_ParkLock);
+		if (!backlogged())
+			vResumed.swap(m_vParked);
+	}
+
+	for (auto& it : vResumed)
+		it.set();
+
+	//1) Prefetches held back by the budget may start
+	CGeoFetchQueue::get()->pump();
+}
+
+void CBingGeoTexture::accept(TTextureCompletion completion)
+{
+	m_nPendingBytes -= completion.nBytes;
+	CTracer::end("deliver", completion.hTexture);
+
+	//0) Texture is gone: its handle generation moved on
+	auto ppTexture = m_Registry.resolve(completion.hTexture);
+	if (!ppTexture) {
+		static CStatCounter statDropped("textures.dropped");
+		statDropped.add(1);
+		return;
+	}
+
+	//1) Every tile scrolled away while it loaded: nothing is kept for the upload
+	if ((*ppTexture)->m_vSubscribers.empty()) {
+		static CStatCounter statStale("textures.stale");
+		statStale.add(1);
+		(*ppTexture)->drop();
+		return;
+	}
+
+	(*ppTexture)->onTextureReady(std::move(completion.img));
+}
+
+bool CBingGeoTexture::backlogged()
+{
+	return (m_nPendingBytes.load() > gnHandoffBytes / 2) || (m_Completions.size() > m_Completions.capacity() / 2);
+}
+
+pplx::task<void> CBingGeoTexture::room()
+{
+	//Checked under the lock deliver() resumes under, so a decode is never parked just after the last resume
+	std::lock_guard<std::mutex> lock(m_ParkLock);
+	if (!backlogged())
+		return pplx::task_from_result();
+
+	static CStatCounter statParked("textures.handoff.parked");
+	statParked.add(1);
+	pplx::task_completion_event<void> tce;
+	m_vParked.push_back(tce);
+	return pplx::create_task(tce);
 }
 
 void CBingGeoTexture::init()
 {
-	tryLoadTexture();
+	if (m_bStarted || m_bQueued)
+		return;
+
+	//Tile span lasts until the first draw that uses the texture, or until the load fails
+	CTracer::begin("tile", m_hTexture, m_nTraceKey);
+	CTracer::begin("queue", m_hTexture);
+	*m_pWanted = true;
+
+	if (ETexturePriority::Visible == priority()) {
+		CGeoFetchQueue::get()->start(this);
+	}
+	else {
+		m_bQueued = true;
+		CGeoFetchQueue::get()->push(m_hTexture);
+	}
 }
 
 bool CBingGeoTexture::valid()
@@ -26,62 +214,288 @@ bool CBingGeoTexture::valid()
 	return m_bValid;
 }
 
+bool CBingGeoTexture::failed()
+{
+	return *m_pFailed;
+}
+
 bool CBingGeoTexture::bind()
 {
 	if (!m_bValid)
 		return false;
 
+	//Upload happens on first use, in whichever view of the share group draws it first
+	if (!m_pTexture) {
+		CTracer::begin("upload", m_hTexture);
+		m_pTexture = std::make_shared<QOpenGLTexture>(m_Image);
+		m_Image = QImage();
+		CTracer::end("upload", m_hTexture);
+	}
+
 	m_pTexture->bind();
+	if (!m_bDrawn) {
+		m_bDrawn = true;
+		CTracer::end("tile", m_hTexture);
+	}
+
 	return true;
 }
 
+void CBingGeoTexture::setVisible(const bool& bVisible)
+{
+	//A pane that culls the tile must not demote it under another pane that shows it
+	auto ePrevious = priority();
+	if (bVisible)
+		++m_uiVisible;
+	else if (m_uiVisible)
+		--m_uiVisible;
+
+	auto ePriority = priority();
+	if (ePriority == ePrevious)
+		return;
+
+	CJobScheduler::get()->reprioritize(m_pJobPriority, (ETexturePriority::Visible == ePriority) ? EJobPriority::Visible : EJobPriority::Prefetch);
+
+	//Tile came into view while its prefetch was still waiting in the queue
+	if (m_bQueued && (ETexturePriority::Visible == ePriority))
+		CGeoFetchQueue::get()->start(this);
+}
+
+ETexturePriority CBingGeoTexture::priority() const
+{
+	return m_uiVisible ? ETexturePriority::Visible : ETexturePriority::Prefetch;
+}
+
+void CBingGeoTexture::subscribe(const THandle& hTile)
+{
+	m_vSubscribers.push_back(hTile);
+	*m_pWanted = true;
+
+	if (m_bValid) {
+		if (auto pTile = CTileRegistry::get()->resolve(hTile))
+			pTile->onTextureReady();
+	}
+}
+
+void CBingGeoTexture::unsubscribe(const THandle& hTile)
+{
+	auto it = std::find(m_vSubscribers.begin(), m_vSubscribers.end(), hTile);
+	if (it == m_vSubscribers.end())
+		return;
+
+	*it = m_vSubscribers.back();
+	m_vSubscribers.pop_back();
+	if (!m_vSubscribers.empty())
+		return;
+
+	//Superseded, unless a tile takes it again before the event loop comes round: a tile that is refreshed
+	//releases and asks for the same texture in one go
+	*m_pWanted = false;
+	if (m_bQueued || (m_bStarted && !m_bValid)) {
+		QMetaObject::invokeMethod(qApp, [hTexture = m_hTexture] {
+			auto ppTexture = m_Registry.resolve(hTexture);
+			if (ppTexture && (*ppTexture)->m_vSubscribers.empty())
+				(*ppTexture)->cancel();
+		}, Qt::QueuedConnection);
+	}
+}
+
+void CBingGeoTexture::retry()
+{
+	//Tiles that scrolled away have dropped their subscription, they ask again when they need it
+	if (m_bValid || m_bQueued || !*m_pFailed || m_vSubscribers.empty())
+		return;
+
+	*m_pFailed = false;
+	m_bStarted = false;
+	init();
+}
+
 void CBingGeoTexture::onTextureReady(QImage img)
 {
-	try {
-		if (m_Task.get()) {
-			bool bDone = m_Task.is_done();
-			m_pTexture = std::make_shared<QOpenGLTexture>(img);
-			m_bValid = true;
-			m_fCallback();
-		}
+	//Only decoded images are completed, so there is no task result to check here
+	m_Image = std::move(img);
+	m_bValid = true;
+
+	//Refreshed copy replaces the stale one already on the GPU
+	if (m_pTexture) {
+		CTileResources::get()->releaseTexture(m_pTexture);
+		m_pTexture = nullptr;
 	}
-	catch (const std::exception& e) {
-		m_bValid = false;
+
+	//A tile may unsubscribe while it reacts, so no iterators are kept across the calls
+	auto pRegistry = CTileRegistry::get();
+	for (size_t i = 0; i < m_vSubscribers.size(); ++i) {
+		if (auto pTile = pRegistry->resolve(m_vSubscribers[i]))
+			pTile->onTextureReady();
 	}
 }
 
-void CBingGeoTexture::tryLoadTexture()
+void CBingGeoTexture::drop()
 {
-	auto pMeta = CBingGeoTextureProvider::get()->getMetadata();
-	if (!pMeta->valid())
+	//A valid texture keeps the image it has, only a refresh nobody waited for is lost
+	CTracer::mark("stale", m_hTexture);
+	if (m_bValid)
 		return;
 
-	auto qsUri = pMeta->getUriTemplate();
-	qsUri.replace("{quadkey}", m_qsQuadKey);
+	CTracer::end("tile", m_hTexture);
+	m_bStarted = false;
+	if (!m_vSubscribers.empty())
+		init();
+}
+
+void CBingGeoTexture::cancel()
+{
+	auto pStats = CStatistics::get();
+
+	//0) Still waiting for a slot: the fetch queue skips it, no request goes out
+	if (m_bQueued) {
+		m_bQueued = false;
+		pStats->add("fetch.cancelled.queued", 1);
+		CTracer::end("queue", m_hTexture);
+		CTracer::end("tile", m_hTexture);
+		return;
+	}
+
+	if (!m_bStarted || m_bValid)
+		return;
+
+	//1) Jobs not run yet are skipped. The load ends as dropped, not failed
+	m_CTS.cancel();
+	CTracer::mark("cancelled", m_hTexture);
+
+	//2) A small body that is already coming is read to the end and keeps the connection alive. Anything else is
+	//aborted in the transport, which closes the connection
+	qint64 nLength = m_pFetch->nLength;
+	if (m_pFetch->bBody && (nLength >= 0) && (nLength <= gnReuseBodyBytes)) {
+		pStats->add("fetch.cancelled.finished", 1);
+		return;
+	}
+
+	m_pFetch->transport.cancel();
+	pStats->add("fetch.cancelled.aborted", 1);
+	if (m_pFetch->bBody && (nLength > 0))
+		pStats->add("fetch.cancelled.bytes", nLength);
+}
+
+void CBingGeoTexture::tryLoadTexture()
+{
+	//0) Uri is resolved here, metadata is owned by the GUI thread. Each layer has its own source and cache
+	CTracer::end("queue", m_hTexture);
+	QString qsUri;
+	auto pMeta = m_pProvider->getMetadata();
+	auto pCache = m_pProvider->m_pCache;
+	if (pMeta->valid()) {
+		qsUri = pMeta->getUriTemplate();
+		qsUri.replace("{quadkey}", m_qsQuadKey);
+	}
 
+	//Fresh tokens: the previous load may have been cancelled
+	m_CTS = pplx::cancellation_token_source();
+	m_pFetch = std::make_shared<TFetchState>();
 	auto token = m_CTS.get_token();
+	auto pFetch = m_pFetch;
+	auto qsQuadKey = m_qsQuadKey;
+	auto qsHost = QUrl(qsUri).host();
+	auto pScheduler = CJobScheduler::get();
+	auto pTracker = CTileFailureTracker::get();
+	auto pPriority = m_pJobPriority;
+	auto pRetryIn = m_pRetryIn;
+	auto hTexture = m_hTexture;
+	auto pValidators = std::make_shared<TTileValidators>();
+	auto pWanted = m_pWanted;
+	auto pDropped = std::make_shared<std::atomic<bool>>(false);
 
-	web::http::client::http_client client(qsUri.toStdWString());
-	m_Task = client.request(web::http::methods::GET)
-		.then([=](web::http::http_response response) {
-			return response.extract_vector();
-			})
-		.then([=](std::vector<unsigned char> vData) {
-				if (token.is_canceled()) {
-					pplx::cancel_current_task();
-					return false;
-				}
-				else {
-					QByteArray array(reinterpret_cast<const char*>(vData.data()), vData.size());
-					QBuffer buffer(&array);
+	//1) Cache tiers first (RAM, shared memory, disk), they also work offline. Network only on a miss
+	m_Task = scheduleTask(pScheduler, pPriority, token, [pCache, qsQuadKey, hTexture]() {
+			CTracer::begin("cache.read", hTexture);
+			auto cached = pCache->read(qsQuadKey);
+			CTracer::end("cache.read", hTexture);
+			return cached;
+		})
+		.then([=](std::optional<TCachedTile> cached) -> pplx::task<std::pair<QByteArray, bool>> {
+			//Expired copy is shown right away while the server is asked whether it still holds
+			if (cached && cached->bStale && !qsUri.isEmpty())
+				revalidate(hTexture, pCache, qsUri, qsQuadKey, cached->validators);
+
+			if (cached)
+				return pplx::task_from_result(std::make_pair(cached->qbData, false));
+
+			if (qsUri.isEmpty())
+				throw std::runtime_error("No tile source");
+
+			//Known missing tile, a key still backing off or a switched off host: not even asked
+			if (auto retry = pTracker->blocked(qsQuadKey, qsHost))
+				throw TTileFetchError(retry->eFailure, true, retry->uiDelay);
+
+			//Connect and the wait for the first byte are one span, the client reports neither on its own.
+			//The transport token covers the body too, cancel() decides whether it is worth finishing
+			CTracer::begin("http.request", hTexture);
+			QUrl qUrl(qsUri);
+			return clientFor(qUrl)->request(web::http::methods::GET, relativeUri(qUrl), pFetch->transport.get_token())
+				.then([=](web::http::http_response response) {
+					CTracer::end("http.request", hTexture);
+					if (auto eFailure = classify(response))
+						throw TTileFetchError(*eFailure);
+
+					*pValidators = CDiskTileCache::validators(response.headers());
+					if (response.headers().has(web::http::header_names::content_length))
+						pFetch->nLength = (qint64)response.headers().content_length();
+
+					pFetch->bBody = true;
+					CTracer::begin("http.body", hTexture);
+					return response.extract_vector();
+				})
+				.then([hTexture](std::vector<unsigned char> vData) {
+					CTracer::end("http.body", hTexture);
+					CStatistics::get()->add("fetch.bytes.full", (qint64)vData.size());
+					return std::make_pair(QByteArray(reinterpret_cast<const char*>(vData.data()), (int)vData.size()), true);
+				});
+		}, token)
+		.then([=](std::pair<QByteArray, bool> data) {
+			//2) Decode runs on the scheduler with the live priority of the tile, network threads only hand the bytes over.
+			//While the GUI thread is behind with the images it is not posted at all: no worker holds an image it can't hand off
+			return room().then([=]() {
+				return scheduleTask(pScheduler, pPriority, token, [=]() mutable {
+					QBuffer buffer(&data.first);
 					buffer.open(QIODevice::ReadOnly);
+					auto store = [=] {
+						pScheduler->post(EJobPriority::Background, pplx::cancellation_token::none(), [pCache, qsQuadKey, data, pValidators]() {
+							pCache->write(qsQuadKey, data.first, *pValidators);
+						});
+					};
+
+					//Every tile scrolled away meanwhile: no decode. Fetched bytes are still kept if they look like an image
+					if (!*pWanted || token.is_canceled()) {
+						if (data.second && QImageReader(&buffer).canRead())
+							store();
 
+						*pDropped = true;
+						return false;
+					}
+
+					CTracer::begin("decode", hTexture);
 					QImageReader reader(&buffer);
 					QImage img(reader.read());
-					emit this->textureReady(img.mirrored());
+					CTracer::end("decode", hTexture);
+					if (img.isNull() && data.second)
+						throw TTileFetchError(ETileFailure::Corrupt);
+
+					if (img.isNull())
+						return false;
+
+					if (data.second)
+						pTracker->succeeded(qsQuadKey, qsHost);
+
+					//3) Only tiles that decoded fine are kept on disk. Nobody waits for that
+					if (data.second)
+						store();
+
+					complete(hTexture, img.mirrored());
 					return true;
-				}
-			}, token)
+				});
+			}, token);
+		})
 		.then([=](pplx::task<bool> prevTask) -> bool {
 			try {
 				if (token.is_canceled()) {
@@ -90,24 +504,251 @@ void CBingGeoTexture::tryLoadTexture()
 				}else
 					return prevTask.get();
 			}
+			catch (const TTileFetchError& e) {
+				//4) Deferred requests never reached the server, there is nothing new to record. Missing tiles are not retried
+				auto retry = e.bDeferred ? TTileRetry{ e.eFailure, e.uiDelay } : pTracker->failed(qsQuadKey, qsHost, e.eFailure);
+				if (ETileFailure::Missing != retry.eFailure)
+					*pRetryIn = retry.uiDelay;
+
+				return false;
+			}
+			catch (const web::http::http_exception& e) {
+				*pRetryIn = pTracker->failed(qsQuadKey, qsHost, ETileFailure::Transient).uiDelay;
+				return false;
+			}
 			catch (const std::exception& e) {
 				return false;
 			}
 		}, token);
+
+	auto pFailed = m_pFailed;
+	m_Task.then([pFailed, pRetryIn, pDropped, hTexture, token, pCache, pTracker, qsQuadKey, qsHost](pplx::task<bool> prevTask) {
+		bool bLoaded = false;
+		try {
+			bLoaded = prevTask.get();
+		}
+		catch (...) {
+		}
+
+		//Processes that wait for this tile in the shared cache fetch it themselves. A cancelled or dropped probe
+		//recorded neither an answer nor a failure, the host is probed by the next request
+		if (!bLoaded) {
+			pCache->abandon(qsQuadKey);
+			pTracker->abandoned(qsQuadKey, qsHost);
+		}
+
+		//Dropped or cancelled is not failed: the texture loads again when a tile asks for it
+		if (*pDropped || token.is_canceled()) {
+			QMetaObject::invokeMethod(qApp, [hTexture] {
+				if (auto ppTexture = m_Registry.resolve(hTexture))
+					(*ppTexture)->drop();
+			}, Qt::QueuedConnection);
+		}
+		else if (!bLoaded) {
+			*pFailed = true;
+			CTracer::mark("failed", hTexture);
+			CTracer::end("tile", hTexture);
+		}
+
+		//5) Transient failure of a tile that may still be on screen: it asks again once the backoff is over
+		auto uiDelay = pRetryIn->exchange(0);
+		if (!bLoaded && uiDelay) {
+			QMetaObject::invokeMethod(qApp, [hTexture, uiDelay] {
+				QTimer::singleShot((int)uiDelay, qApp, [hTexture] {
+					if (auto ppTexture = m_Registry.resolve(hTexture))
+						(*ppTexture)->retry();
+				});
+			}, Qt::QueuedConnection);
+		}
+
+		CGeoFetchQueue::get()->finished();
+	});
+}
+
+void CBingGeoTexture::revalidate(const THandle& hTexture, IGeoTileCachePtr pCache, const QString& qsUri, const QString& qsQuadKey,
+	const TTileValidators& validators)
+{
+	//0) Panning over an expired area reads the same stale tiles again and again, one request each is enough.
+	//Checked before the breaker, so that a skipped request never takes its probe
+	{
+		std::lock_guard<std::mutex> lock(m_RevalidateLock);
+		if (!m_sRevalidating.insert(qsUri).second) {
+			CStatistics::get()->add("fetch.revalidate.inflight", 1);
+			return;
+		}
+	}
+
+	auto done = [qsUri] {
+		std::lock_guard<std::mutex> lock(m_RevalidateLock);
+		m_sRevalidating.erase(qsUri);
+	};
+
+	auto qsHost = QUrl(qsUri).host();
+	auto pTracker = CTileFailureTracker::get();
+	if (pTracker->blocked(qsQuadKey, qsHost)) {
+		done();
+		return;
+	}
+
+	//1) Conditional GET: a tile that did not change costs a header only 304
+	QUrl qUrl(qsUri);
+	web::http::http_request request(web::http::methods::GET);
+	request.set_request_uri(relativeUri(qUrl));
+	if (!validators.qsETag.isEmpty())
+		request.headers().add(web::http::header_names::if_none_match, utility::conversions::to_string_t(validators.qsETag.toStdString()));
+
+	if (!validators.qsLastModified.isEmpty())
+		request.headers().add(web::http::header_names::if_modified_since, utility::conversions::to_string_t(validators.qsLastModified.toStdString()));
+
+	CStatistics::get()->add("fetch.revalidate.requests", 1);
+	clientFor(qUrl)->request(request)
+		.then([=](web::http::http_response response) -> pplx::task<void> {
+			auto pStats = CStatistics::get();
+
+			//2) Not modified: only the expiry moves forward
+			if (web::http::status_codes::NotModified == response.status_code()) {
+				pTracker->succeeded(qsQuadKey, qsHost);
+				pCache->refresh(qsQuadKey, CDiskTileCache::validators(response.headers()));
+				pStats->add("fetch.revalidate.notmodified", 1);
+				pStats->add("fetch.bytes.revalidate", headerBytes(response));
+				return pplx::task_from_result();
+			}
+
+			if (auto eFailure = classify(response))
+				throw TTileFetchError(*eFailure);
+
+			//3) Changed upstream: stored and shown in place of the stale copy. Checked on the background class
+			auto newValidators = CDiskTileCache::validators(response.headers());
+			return response.extract_vector().then([=](std::vector<unsigned char> vData) {
+				pStats->add("fetch.revalidate.modified", 1);
+				pStats->add("fetch.bytes.refetch", (qint64)vData.size());
+
+				//Decoded under the same hand-off budget as a first load
+				QByteArray qbData(reinterpret_cast<const char*>(vData.data()), (int)vData.size());
+				return room().then([=]() {
+					CJobScheduler::get()->post(EJobPriority::Background, pplx::cancellation_token::none(), [=]() mutable {
+						QBuffer buffer(&qbData);
+						buffer.open(QIODevice::ReadOnly);
+
+						QImage img(QImageReader(&buffer).read());
+						if (img.isNull()) {
+							pTracker->failed(qsQuadKey, qsHost, ETileFailure::Corrupt);
+							return;
+						}
+
+						pTracker->succeeded(qsQuadKey, qsHost);
+						pCache->write(qsQuadKey, qbData, newValidators);
+
+						//Swapped in on the GUI thread, and only if some view still holds the texture
+						complete(hTexture, img.mirrored());
+					});
+				});
+			});
+		})
+		.then([=](pplx::task<void> prevTask) {
+			//4) A failed revalidation keeps the stale copy, the host still gets the blame
+			done();
+			try {
+				prevTask.get();
+			}
+			catch (const TTileFetchError& e) {
+				pTracker->failed(qsQuadKey, qsHost, e.eFailure);
+			}
+			catch (const std::exception& e) {
+				pTracker->failed(qsQuadKey, qsHost, ETileFailure::Transient);
+			}
+		});
+}
+
+std::shared_ptr<CGeoFetchQueue> CGeoFetchQueue::get()
+{
+	if (!m_pQueue)
+		m_pQueue = std::shared_ptr<CGeoFetchQueue>(new CGeoFetchQueue());
+
+	return m_pQueue;
+}
+
+void CGeoFetchQueue::push(const THandle& hTexture)
+{
+	m_qPending.push_back(hTexture);
+	pump();
+}
+
+void CGeoFetchQueue::start(CBingGeoTexture* pTexture)
+{
+	pTexture->m_bQueued = false;
+	pTexture->m_bStarted = true;
+
+	++m_nInFlight;
+	pTexture->tryLoadTexture();
+	updateStats();
+}
+
+void CGeoFetchQueue::finished()
+{
+	--m_nInFlight;
+
+	//Called from a pplx thread, the queue itself is only touched by the GUI thread
+	QMetaObject::invokeMethod(qApp, [] {
+		CGeoFetchQueue::get()->pump();
+	}, Qt::QueuedConnection);
+}
+
+void CGeoFetchQueue::pump()
+{
+	//Visible requests are started immediately, prefetches only fill the remaining slots and wait while the GUI thread
+	//is behind on decoded images
+	while ((m_nInFlight < m_nMaxInFlight) && !m_qPending.empty() && !CBingGeoTexture::backlogged()) {
+		auto ppTexture = CBingGeoTexture::m_Registry.resolve(m_qPending.front());
+		m_qPending.pop_front();
+
+		if (ppTexture && (*ppTexture)->m_bQueued)
+			start(*ppTexture);
+	}
+
+	updateStats();
+}
+
+void CGeoFetchQueue::updateStats()
+{
+	static CStatCounter statInFlight("fetch.inflight");
+	static CStatCounter statQueued("fetch.queued");
+	statInFlight.set(m_nInFlight);
+	statQueued.set((qint64)m_qPending.size());
 }
 
 IGeoTextureProviderPtr CBingGeoTextureProvider::get()
 {
 	if (!m_pProvider)
-		m_pProvider = IGeoTextureProviderPtr(new CBingGeoTextureProvider());
+		m_pProvider = IGeoTextureProviderPtr(new CBingGeoTextureProvider("Aerial", m_qsUriTemplate, QString()));
 
 	return m_pProvider;
 }
 
+IGeoTextureProviderPtr CBingGeoTextureProvider::create(const QString& qsImagery, const QString& qsUriTemplate, const QString& qsNamespace)
+{
+	return IGeoTextureProviderPtr(new CBingGeoTextureProvider(qsImagery, qsUriTemplate, qsNamespace));
+}
+
+CBingGeoTextureProvider::CBingGeoTextureProvider(const QString& qsImagery, const QString& qsUriTemplate, const QString& qsNamespace) :
+	m_qsImagery(qsImagery), m_qsLayerUri(qsUriTemplate), m_qsNamespace(qsNamespace),
+	m_statResident(qsNamespace.isEmpty() ? QString("textures.resident") : "textures.resident." + qsNamespace)
+{
+	m_pCache = CMemoryTileCache::get(m_qsNamespace);
+}
+
+void CBingGeoTextureProvider::setUriTemplate(const QString& qsUriTemplate)
+{
+	m_qsUriTemplate = qsUriTemplate;
+}
+
 IGeoMetadataPtr CBingGeoTextureProvider::getMetadata()
 {
+	if (!m_pMetadata && !m_qsLayerUri.isEmpty())
+		m_pMetadata = std::make_shared<CStaticGeoMetadata>(m_qsLayerUri);
+
 	if (!m_pMetadata)
-		m_pMetadata = std::make_shared<CBingGeoMetadata>();
+		m_pMetadata = std::make_shared<CBingGeoMetadata>(m_qsImagery);
 
 	return m_pMetadata;
 }
@@ -120,12 +761,76 @@ IGeoMathPtr CBingGeoTextureProvider::getMath()
 	return m_pMath;
 }
 
-IGeoTexturePtr CBingGeoTextureProvider::getTexture(const QString& qsQuadKey, GeoCallback callback)
+IGeoTexturePtr CBingGeoTextureProvider::getTexture(const QString& qsQuadKey)
 {
-	return std::make_shared<CBingGeoTexture>(qsQuadKey, callback);
+	//0) One texture per quadkey for all views. Failed loads are not reused
+	auto& cached = m_mTextures[qsQuadKey];
+	auto pTexture = cached.pTexture.lock();
+	if (pTexture && !*pTexture->m_pFailed) {
+		static CStatCounter statHits("textures.hits");
+		statHits.add(1);
+		makeResident(cached, pTexture);
+		return pTexture;
+	}
+
+	//1) Not loaded yet or already evicted
+	static CStatCounter statMisses("textures.misses");
+	statMisses.add(1);
+	if (cached.bResident)
+		m_lResident.erase(cached.itResident);
+
+	cached.bResident = false;
+	pTexture = std::make_shared<CBingGeoTexture>(qsQuadKey, this);
+	cached.pTexture = pTexture;
+	makeResident(cached, pTexture);
+
+	return pTexture;
+}
+
+void CBingGeoTextureProvider::deliver()
+{
+	CBingGeoTexture::deliver();
 }
 
-CBingGeoMetadata::CBingGeoMetadata()
+void CBingGeoTextureProvider::makeResident(TCachedTexture& cached, std::shared_ptr<CBingGeoTexture> pTexture)
+{
+	//0) Most recently used textures stay alive after the last tile has released them. A hit only relinks its node
+	if (cached.bResident) {
+		m_lResident.splice(m_lResident.begin(), m_lResident, cached.itResident);
+	}
+	else {
+		m_lResident.push_front(pTexture);
+		cached.itResident = m_lResident.begin();
+		cached.bResident = true;
+	}
+
+	//1) Evict the least recently used ones. A texture still shown by some view stays alive until released
+	while (m_lResident.size() > m_szMaxResident) {
+		auto it = m_mTextures.find(m_lResident.back()->m_qsQuadKey);
+		m_lResident.pop_back();
+
+		if (it == m_mTextures.end())
+			continue;
+
+		it->second.bResident = false;
+		if (it->second.pTexture.expired())
+			m_mTextures.erase(it);
+	}
+
+	//2) Forget keys whose textures were evicted while still in use and are gone by now
+	if (m_mTextures.size() > 4 * m_szMaxResident) {
+		for (auto it = m_mTextures.begin(); it != m_mTextures.end();) {
+			if (!it->second.bResident && it->second.pTexture.expired())
+				it = m_mTextures.erase(it);
+			else
+				++it;
+		}
+	}
+
+	m_statResident.set((qint64)m_lResident.size());
+}
+
+CBingGeoMetadata::CBingGeoMetadata(const QString& qsImagery) : m_qsImagery(qsImagery)
 {
 	populateData();
 }
@@ -152,20 +857,19 @@ std::pair<uint, uint> CBingGeoMetadata::getZoomLevels()
 
 void CBingGeoMetadata::populateData()
 {
-	std::wstringstream ss;
-	ss << L"http://dev.virtualearth.net/REST/v1/Imagery/Metadata/Aerial?output=json";
-	ss << L"&include=ImageryProviders&uriScheme=http&key=" << gsBingAPIKey;
+	QString qsUri = "http://dev.virtualearth.net/REST/v1/Imagery/Metadata/" + m_qsImagery + "?output=json";
+	qsUri += "&include=ImageryProviders&uriScheme=http&key=" + QString::fromStdWString(gsBingAPIKey);
 	
-	web::http::client::http_client client(ss.str().c_str());
+	web::http::client::http_client client(utility::conversions::to_string_t(qsUri.toStdString()));
 	auto requestTask = client.request(web::http::methods::GET)
 	
 	.then([=](web::http::http_response response) {
 		return response.extract_string(true);
 		})
 
-	.then([=](std::wstring wsBody) {
+	.then([=](utility::string_t sBody) {
 			//2) Parse image metadata json
-			QString qsData = QString::fromStdWString(wsBody);
+			QString qsData = QString::fromStdString(utility::conversions::to_utf8string(sBody));
 			QJsonDocument qjDoc = QJsonDocument::fromJson(qsData.toUtf8());
 			auto qjRoot = qjDoc.object();
 			if (qjRoot.isEmpty())
@@ -205,6 +909,8 @@ void CBingGeoMetadata::populateData()
 
 			auto qsSubDomain = qjSubDomains[0].toString();
 			m_qsUriTemplate.replace("{subdomain}", qsSubDomain);
+			//Road and label sets are rendered on demand in the requested language
+			m_qsUriTemplate.replace("{culture}", "en-US");
 			m_bValid = true;
 	});
 
@@ -218,6 +924,30 @@ void CBingGeoMetadata::populateData()
 
 
 
+CStaticGeoMetadata::CStaticGeoMetadata(const QString& qsUriTemplate) : m_qsUriTemplate(qsUriTemplate)
+{
+}
+
+bool CStaticGeoMetadata::valid()
+{
+	return !m_qsUriTemplate.isEmpty();
+}
+
+QString CStaticGeoMetadata::getUriTemplate()
+{
+	return m_qsUriTemplate;
+}
+
+QSize CStaticGeoMetadata::getImageSize()
+{
+	return { 256, 256 };
+}
+
+std::pair<uint, uint> CStaticGeoMetadata::getZoomLevels()
+{
+	return { 1u, 21u };
+}
+
 uint CBingGeoMath::getMapSize(const uint& uiZoomLevel)
 {
 	return 256 << uiZoomLevel;
@@ -235,6 +965,19 @@ double CBingGeoMath::getScale(const double& dbLattitude, const uint& uiZoomLevel
 }
 
 std::pair<int, int> CBingGeoMath::wgs2pix(const double& dbLattitude, const double& dbLongitude, const uint& uiZoomLevel)
+{
+	double dbX, dbY;
+	std::tie(dbX, dbY) = wgs2merc(dbLattitude, dbLongitude);
+
+	auto uiSize = getMapSize(uiZoomLevel);
+	//Clipped before the cast: at the deepest levels the right edge is past the int range
+	int nX = (int)clip(dbX * uiSize + 0.5, 0.0, uiSize - 1.0);
+	int nY = (int)clip(dbY * uiSize + 0.5, 0.0, uiSize - 1.0);
+
+	return std::make_pair(nX, nY);
+}
+
+std::pair<double, double> CBingGeoMath::wgs2merc(const double& dbLattitude, const double& dbLongitude)
 {
 	auto dbLat = clip(dbLattitude, m_dbMinLattitude, m_dbMaxLattitude);
 	auto dbLng = clip(dbLongitude, m_dbMinLongitude, m_dbMaxLongitude);
@@ -243,18 +986,22 @@ std::pair<int, int> CBingGeoMath::wgs2pix(const double& dbLattitude, const doubl
 	double dbSinLat = std::sin(dbLat * M_PI / 180.0);
 	double dbY = 0.5 - std::log((1.0 + dbSinLat) / (1 - dbSinLat)) / (4 * M_PI);
 
-	auto uiSize = getMapSize(uiZoomLevel);
-	int nX = clip((int)(dbX * uiSize + 0.5), 0, (int)(uiSize - 1));
-	int nY = clip((int)(dbY * uiSize + 0.5), 0, (int)(uiSize - 1));
+	return std::make_pair(dbX, dbY);
+}
 
-	return std::make_pair(nX, nY);
+std::pair<double, double> CBingGeoMath::merc2wgs(const double& dbX, const double& dbY)
+{
+	double dbLat = 90.0 - 360.0 * std::atan(std::exp(-(0.5 - clip(dbY, 0.0, 1.0)) * 2.0 * M_PI)) / M_PI;
+	double dbLong = 360.0 * (clip(dbX, 0.0, 1.0) - 0.5);
+
+	return std::make_pair(dbLat, dbLong);
 }
 
 std::pair<double, double> CBingGeoMath::pix2wgs(const int& nX, const int& nY, const uint& uiZoomLevel)
 {
 	auto uiMapSize = getMapSize(uiZoomLevel);
-	double dbX = clip(nX, 0, (int)(uiMapSize - 1)) / uiMapSize - 0.5;
-	double dbY = 0.5 - clip(nY, 0, (int)(uiMapSize - 1)) / uiMapSize;
+	double dbX = clip(nX, 0, (int)(uiMapSize - 1)) / (double)uiMapSize - 0.5;
+	double dbY = 0.5 - clip(nY, 0, (int)(uiMapSize - 1)) / (double)uiMapSize;
 
 	double dbLat = 90.0 - 360.0 * std::atan(std::exp(-2.0 * dbY * M_PI)) / M_PI;
 	double dbLong = 360.0 * dbX;
@@ -297,16 +1044,18 @@ std::tuple<int, int, uint> CBingGeoMath::quad2tile(const QString& qsKey)
 	int nX = 0, nY = 0;
 	for (auto i = uiZoom; i > 0; --i) {
 		int nMask = 1 << (i - 1);
+		//The first digit is the coarsest level, as in tile2quad
+		auto cDigit = qsKey[uiZoom - i];
 		
-		if ('1' == qsKey[i]) {
+		if ('1' == cDigit) {
 			nX |= nMask;
 		}
 
-		if ('2' == qsKey[i]) {
+		if ('2' == cDigit) {
 			nY |= nMask;
 		}
 
-		if ('3' == qsKey[i]) {
+		if ('3' == cDigit) {
 			nX |= nMask;
 			nY |= nMask;
 		}
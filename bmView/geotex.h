@@ -1,33 +1,123 @@
 #pragma once
 #include "intfs.h"
+#include "handles.h"
+#include "completion.h"
+#include "stats.h"
 
-class CBingGeoTexture : public IGeoTexture {
-	Q_OBJECT
-signals:
-	void textureReady(QImage img);
+//Decoded image on its way from a loader thread to the GUI thread
+struct TTextureCompletion {
+	THandle hTexture = 0;
+	QImage img;
+	qint64 nBytes = 0;
+};
+
+//Transport side of one load. Cancelled apart from the jobs around it, so a nearly complete body can still finish
+struct TFetchState {
+	pplx::cancellation_token_source transport;
+	std::atomic<bool> bBody{ false };
+	//Content-Length of the body under way, -1 - unknown
+	std::atomic<qint64> nLength{ -1 };
+};
+
+class CBingGeoTextureProvider;
+
+class CBingGeoTexture : public IGeoTexture, public std::enable_shared_from_this<CBingGeoTexture> {
 public:
-	explicit CBingGeoTexture(const QString& qsQuadKey, GeoCallback callback);
+	//Layer provider outlives its textures
+	CBingGeoTexture(const QString& qsQuadKey, CBingGeoTextureProvider* pProvider);
 	~CBingGeoTexture();
+	//Any thread, never waits. The decode that made the image has waited for room() instead
+	static void complete(const THandle& hTexture, QImage img);
+	//GUI thread. Completions of textures that are gone by now are dropped
+	static void deliver();
 protected: //IGeoTexture
 	void init() override;
 	bool valid() override;
+	bool failed() override;
 	bool bind() override;
-protected slots:
-	void onTextureReady(QImage img);
+	void setVisible(const bool& bVisible) override;
+	void subscribe(const THandle& hTile) override;
+	void unsubscribe(const THandle& hTile) override;
 private:
+	friend class CGeoFetchQueue;
+	friend class CBingGeoTextureProvider;
 	std::shared_ptr<QOpenGLTexture> m_pTexture = nullptr;
+	QImage m_Image;
+	//Both are replaced by every load, a superseded load is cancelled without touching the next one
 	pplx::cancellation_token_source m_CTS;
+	std::shared_ptr<TFetchState> m_pFetch = std::make_shared<TFetchState>();
 	bool m_bValid = false;
+	std::shared_ptr<std::atomic<bool>> m_pFailed = std::make_shared<std::atomic<bool>>(false);
+	//Backoff of the last transient failure, ms. 0 - no automatic retry
+	std::shared_ptr<std::atomic<uint>> m_pRetryIn = std::make_shared<std::atomic<uint>>(0u);
+	//Cleared when the last tile unsubscribes, loaders skip the decode then
+	std::shared_ptr<std::atomic<bool>> m_pWanted = std::make_shared<std::atomic<bool>>(true);
 	QString m_qsQuadKey;
-	GeoCallback m_fCallback;
+	CBingGeoTextureProvider* m_pProvider = nullptr;
+	THandle m_hTexture = 0;
+	//Tile handles. Rarely more than one view shows the same tile
+	std::vector<THandle> m_vSubscribers;
 	pplx::task<bool> m_Task;
+	//Subscribers that have the tile on screen, the priority is the highest any of them asks for
+	uint m_uiVisible = 0;
+	JobPriorityPtr m_pJobPriority = std::make_shared<std::atomic<EJobPriority>>(EJobPriority::Prefetch);
+	bool m_bQueued = false;
+	bool m_bStarted = false;
+	//Quadkey as the tracer records it, and whether the tile span has ended with the first draw
+	quint64 m_nTraceKey = 0;
+	bool m_bDrawn = false;
 
+	//Async work refers to textures by handle only, never by pointer
+	static CHandlePool<CBingGeoTexture*> m_Registry;
+	static CCompletionQueue<TTextureCompletion> m_Completions;
+	static std::atomic<bool> m_bWakePending;
+	static std::atomic<qint64> m_nPendingBytes;
+	//Decodes held back until the GUI thread takes the images before them
+	static std::mutex m_ParkLock;
+	static std::vector<pplx::task_completion_event<void>> m_vParked;
+	//Uris of the conditional requests on the wire, one per tile of a source however often its stale copy is read
+	static std::mutex m_RevalidateLock;
+	static std::set<QString> m_sRevalidating;
+
+	ETexturePriority priority() const;
 	void tryLoadTexture();
+	void retry();
+	void onTextureReady(QImage img);
+	//Load finished after every tile had gone. Starts over once a tile asks again
+	void drop();
+	//GUI thread. Every tile has gone: a queued request is never sent, a running one is aborted
+	void cancel();
+	//Decoded images waiting for the GUI thread are over half the budget or fill half the queue
+	static bool backlogged();
+	//Done right away, or once deliver() has taken enough of the backlog
+	static pplx::task<void> room();
+	//GUI thread
+	static void accept(TTextureCompletion completion);
+	//Conditional refresh of an expired disk copy, runs alongside the stale tile being shown
+	static void revalidate(const THandle& hTexture, IGeoTileCachePtr pCache, const QString& qsUri, const QString& qsQuadKey,
+		const TTileValidators& validators);
+};
+
+class CGeoFetchQueue {
+public:
+	static std::shared_ptr<CGeoFetchQueue> get();
+	void push(const THandle& hTexture);
+	void start(CBingGeoTexture* pTexture);
+	void finished();
+	void pump();
+private:
+	CGeoFetchQueue() = default;
+	static std::shared_ptr<CGeoFetchQueue> m_pQueue;
+	std::deque<THandle> m_qPending;
+	std::atomic<int> m_nInFlight{ 0 };
+	const int m_nMaxInFlight = 6;
+	void updateStats();
 };
 
 class CBingGeoMetadata : public IGeoMetadata {
 public:
-	explicit CBingGeoMetadata();
+	//Imagery set: Aerial, AerialWithLabelsOnDemand, RoadOnDemand...
+	explicit CBingGeoMetadata(const QString& qsImagery = "Aerial");
 protected: //IGeoMetadata
 	bool valid() override;
 	QString getUriTemplate() override;
@@ -35,12 +125,26 @@ protected: //IGeoMetadata
 	std::pair<uint, uint> getZoomLevels() override;
 private:
 	bool m_bValid = false;
+	QString m_qsImagery;
 	QString m_qsUriTemplate;
 	QSize m_qsSize;
 	std::pair<uint, uint> m_upZoom;
 	void populateData();
 };
 
+//Fixed tile source, e.g. a stand-in server or a local mirror. Used instead of the Bing imagery metadata
+class CStaticGeoMetadata : public IGeoMetadata {
+public:
+	explicit CStaticGeoMetadata(const QString& qsUriTemplate);
+protected: //IGeoMetadata
+	bool valid() override;
+	QString getUriTemplate() override;
+	QSize getImageSize() override;
+	std::pair<uint, uint> getZoomLevels() override;
+private:
+	QString m_qsUriTemplate;
+};
+
 class CBingGeoMath : public IGeoMath {
 protected: //IGeoMath
 	uint getMapSize(const uint& uiZoomLevel) override;
@@ -48,6 +152,8 @@ protected: //IGeoMath
 	double getScale(const double& dbLattitude, const uint& uiZoomLevel, const uint& uiDPI) override;
 	std::pair<int, int> wgs2pix(const double& dbLattitude, const double& dbLongitude, const uint& uiZoomLevel) override;
 	std::pair<double, double> pix2wgs(const int& nX, const int& nY, const uint& uiZoomLevel) override;
+	std::pair<double, double> wgs2merc(const double& dbLattitude, const double& dbLongitude) override;
+	std::pair<double, double> merc2wgs(const double& dbX, const double& dbY) override;
 	std::pair<int, int> pix2tile(const int& nX, const int& nY) override;
 	std::pair<int, int> tile2pix(const int& nX, const int& nY) override;
 	QString tile2quad(const int& nX, const int& nY, const uint& uiZoomLevel) override;
@@ -71,14 +177,37 @@ template <typename T> T CBingGeoMath::clip(const T tVal, const T tMin, const T t
 
 class CBingGeoTextureProvider : public IGeoTextureProvider {
 public:
+	//Base layer: Bing aerial imagery or the uri template below
 	static IGeoTextureProviderPtr get();
+	//Must be called before the first get()
+	static void setUriTemplate(const QString& qsUriTemplate);
+	//Layer with its own imagery set or uri template, its tiles are cached under the namespace
+	static IGeoTextureProviderPtr create(const QString& qsImagery, const QString& qsUriTemplate, const QString& qsNamespace);
 protected: //IGeoTextureProvider
 	IGeoMetadataPtr getMetadata() override;
 	IGeoMathPtr getMath() override;
-	IGeoTexturePtr getTexture(const QString& qsQuadKey, GeoCallback callback) override;
+	IGeoTexturePtr getTexture(const QString& qsQuadKey) override;
+	void deliver() override;
 private:
-	CBingGeoTextureProvider() = default;
+	friend class CBingGeoTexture;
+	CBingGeoTextureProvider(const QString& qsImagery, const QString& qsUriTemplate, const QString& qsNamespace);
 	static IGeoTextureProviderPtr m_pProvider;
+	static QString m_qsUriTemplate;
+	QString m_qsImagery;
+	QString m_qsLayerUri;
+	QString m_qsNamespace;
+	CStatCounter m_statResident;
+	IGeoTileCachePtr m_pCache = nullptr;
 	IGeoMetadataPtr m_pMetadata = nullptr;
 	IGeoMathPtr m_pMath = nullptr;
+private: //Texture cache shared by all views
+	struct TCachedTexture {
+		std::weak_ptr<CBingGeoTexture> pTexture;
+		bool bResident = false;
+		std::list<std::shared_ptr<CBingGeoTexture>>::iterator itResident;
+	};
+	std::map<QString, TCachedTexture> m_mTextures;
+	std::list<std::shared_ptr<CBingGeoTexture>> m_lResident;
+	const size_t m_szMaxResident = 256;
+	void makeResident(TCachedTexture& cached, std::shared_ptr<CBingGeoTexture> pTexture);
 };
@@ -0,0 +1,82 @@
+#pragma once
+#include "intfs.h"
+
+//Preallocated slots addressed by generational handles: slot index in the low half, generation in the high half.
+//Releasing a slot bumps its generation, so a stale handle resolves to nothing instead of to the next occupant.
+//Not thread safe, every pool is owned by the GUI thread
+template <typename T> class CHandlePool {
+public:
+	explicit CHandlePool(const size_t& szReserve);
+	THandle acquire(T value);
+	void release(const THandle& hValue);
+	T* resolve(const THandle& hValue);
+	size_t size() const;
+private:
+	struct TSlot {
+		T value{};
+		quint32 uiGeneration = 1;
+		bool bUsed = false;
+	};
+	std::vector<TSlot> m_vSlots;
+	std::vector<quint32> m_vFree;
+	size_t m_szUsed = 0;
+private:
+	static quint32 index(const THandle& hValue) { return (quint32)(hValue & 0xFFFFFFFFu); }
+	static quint32 generation(const THandle& hValue) { return (quint32)(hValue >> 32); }
+};
+
+template <typename T> CHandlePool<T>::CHandlePool(const size_t& szReserve)
+{
+	m_vSlots.resize(szReserve);
+	m_vFree.reserve(szReserve);
+	for (size_t i = szReserve; i > 0; --i)
+		m_vFree.push_back((quint32)(i - 1));
+}
+
+template <typename T> THandle CHandlePool<T>::acquire(T value)
+{
+	//Grows only past the reserve, steady state reuses released slots
+	if (m_vFree.empty()) {
+		m_vFree.push_back((quint32)m_vSlots.size());
+		m_vSlots.emplace_back();
+	}
+
+	auto uiIndex = m_vFree.back();
+	m_vFree.pop_back();
+
+	auto& slot = m_vSlots[uiIndex];
+	slot.value = std::move(value);
+	slot.bUsed = true;
+	++m_szUsed;
+
+	return ((THandle)slot.uiGeneration << 32) | uiIndex;
+}
+
+template <typename T> void CHandlePool<T>::release(const THandle& hValue)
+{
+	if (!resolve(hValue))
+		return;
+
+	auto& slot = m_vSlots[index(hValue)];
+	slot.value = T{};
+	slot.bUsed = false;
+	//Generation 0 never appears, so a zero handle is always invalid
+	slot.uiGeneration = std::max(1u, slot.uiGeneration + 1);
+	m_vFree.push_back(index(hValue));
+	--m_szUsed;
+}
+
+template <typename T> T* CHandlePool<T>::resolve(const THandle& hValue)
+{
+	auto uiIndex = index(hValue);
+	if (uiIndex >= m_vSlots.size())
+		return nullptr;
+
+	auto& slot = m_vSlots[uiIndex];
+	return (slot.bUsed && (slot.uiGeneration == generation(hValue))) ? &slot.value : nullptr;
+}
+
+template <typename T> size_t CHandlePool<T>::size() const
+{
+	return m_szUsed;
+}
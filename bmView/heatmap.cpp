@@ -0,0 +1,296 @@
+#include "heatmap.h"
+#include "consts.h"
+#include "geotex.h"
+#include "sched.h"
+#include "stats.h"
+#include "trace.h"
+
+std::shared_ptr<QOpenGLShaderProgram> CHeatmapLayer::m_pSplatShaders = nullptr;
+std::shared_ptr<QOpenGLShaderProgram> CHeatmapLayer::m_pRampShaders = nullptr;
+std::shared_ptr<QOpenGLTexture> CHeatmapLayer::m_pRamp = nullptr;
+
+namespace {
+	//Density 0 is transparent, the saturation weight is opaque red
+	std::shared_ptr<QOpenGLTexture> makeRamp()
+	{
+		QLinearGradient gradient(0, 0, 256, 0);
+		gradient.setColorAt(0.0, QColor(0, 0, 255, 0));
+		gradient.setColorAt(0.25, QColor(0, 128, 255, 160));
+		gradient.setColorAt(0.5, QColor(0, 255, 64, 190));
+		gradient.setColorAt(0.75, QColor(255, 255, 0, 215));
+		gradient.setColorAt(1.0, QColor(255, 0, 0, 240));
+
+		QImage img(256, 1, QImage::Format_ARGB32);
+		QPainter painter(&img);
+		painter.setCompositionMode(QPainter::CompositionMode_Source);
+		painter.fillRect(img.rect(), gradient);
+		painter.end();
+
+		auto pRamp = std::make_shared<QOpenGLTexture>(img, QOpenGLTexture::DontGenerateMipMaps);
+		pRamp->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+		pRamp->setWrapMode(QOpenGLTexture::ClampToEdge);
+		return pRamp;
+	}
+}
+
+CHeatmapLayer::CHeatmapLayer() : m_fRadius(gfHeatmapRadius), m_fSaturation(gfHeatmapSaturation)
+{
+}
+
+bool CHeatmapLayer::initGL()
+{
+	//Nothing is created before the first point is drawn
+	m_bInit = true;
+	return true;
+}
+
+bool CHeatmapLayer::createGL()
+{
+	//0) Programs and the ramp are shared by every view in the share group
+	if (!m_pSplatShaders)
+		m_pSplatShaders = COverlayLayer::InitShaders(gwHeatmapVS, gwHeatmapFS);
+
+	if (!m_pRampShaders)
+		m_pRampShaders = COverlayLayer::InitShaders(gwHeatmapRampVS, gwHeatmapRampFS);
+
+	if (!m_pSplatShaders || !m_pRampShaders)
+		return false;
+
+	if (!m_pRamp)
+		m_pRamp = makeRamp();
+
+	//1) Points and their VAO. The full screen quad has no attributes, its VAO only has to be bound
+	m_pPoints = std::make_shared<CGrowableBuffer>(sizeof(THeatVertex));
+	m_pPointVAO = std::make_shared<QOpenGLVertexArrayObject>();
+	m_pQuadVAO = std::make_shared<QOpenGLVertexArrayObject>();
+	if (!m_pPointVAO->create() || !m_pQuadVAO->create())
+		return false;
+
+	m_bCreated = true;
+	return true;
+}
+
+void CHeatmapLayer::addPoints(const std::vector<QPointF>& vPoints, const float& fWeight)
+{
+	auto pMath = CBingGeoTextureProvider::get()->getMath();
+	std::vector<THeatVertex> vBatch(vPoints.size());
+	auto fBuild = [&](size_t szFirst, size_t szLast) {
+		for (auto i = szFirst; i < szLast; ++i) {
+			auto spMerc = pMath->wgs2merc(vPoints[i].x(), vPoints[i].y());
+			auto& vertex = vBatch[i];
+			COverlayLayer::splitDouble(spMerc.first, vertex.fMerc[0], vertex.fMerc[2]);
+			COverlayLayer::splitDouble(spMerc.second, vertex.fMerc[1], vertex.fMerc[3]);
+			vertex.fWeight = fWeight;
+		}
+	};
+
+	if (vPoints.size() >= 16384)
+		CJobScheduler::get()->parallelFor(EJobPriority::Visible, vPoints.size(), fBuild);
+	else
+		fBuild(0, vPoints.size());
+
+	m_szPoints += vPoints.size();
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	if (m_vPending.empty())
+		m_vPending.swap(vBatch);
+	else
+		m_vPending.insert(m_vPending.end(), vBatch.begin(), vBatch.end());
+}
+
+void CHeatmapLayer::setKernel(const float& fRadius, const float& fSaturation)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_fRadius = std::max(fRadius, 1.f);
+	m_fSaturation = std::max(fSaturation, std::numeric_limits<float>::min());
+}
+
+void CHeatmapLayer::clear()
+{
+	m_szPoints = 0;
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_vPending.clear();
+	m_bClear = true;
+}
+
+size_t CHeatmapLayer::size()
+{
+	return m_szPoints;
+}
+
+void CHeatmapLayer::draw(const QMatrix4x4& qmWorld, const TMercatorTransform& transform, const QSize& qsViewport)
+{
+	if (!m_bInit || !transform.bValid || qsViewport.isEmpty())
+		return;
+
+	if (!m_bCreated) {
+		bool bPending = false;
+		{
+			std::lock_guard<std::mutex> lock(m_Lock);
+			bPending = !m_vPending.empty();
+		}
+
+		if (!bPending)
+			return;
+
+		if (!createGL()) {
+			m_bInit = false;
+			return;
+		}
+	}
+
+	CTraceScope scope("heatmap");
+	upload();
+	if (!m_pPoints->count())
+		return;
+
+	float fRadius = 0.f, fSaturation = 0.f;
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		fRadius = m_fRadius;
+		fSaturation = m_fSaturation;
+	}
+
+	//0) A moved camera or another kernel needs every point again, a still one only the points that came since the last frame
+	QSize qsDensity((qsViewport.width() + giHeatmapDownscale - 1) / giHeatmapDownscale,
+		(qsViewport.height() + giHeatmapDownscale - 1) / giHeatmapDownscale);
+	if (!m_pDensity || (m_pDensity->size() != qsDensity) || !sameView(qmWorld, transform, fRadius))
+		m_szSplatted = 0;
+
+	if ((m_szSplatted < m_pPoints->count()) && !splat(qsDensity, qmWorld, transform, fRadius))
+		return;
+
+	//1) Ramp over whatever is drawn already
+	compose(fSaturation);
+}
+
+void CHeatmapLayer::upload()
+{
+	std::vector<THeatVertex> vPoints;
+	bool bClear = false;
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		vPoints.swap(m_vPending);
+		std::swap(bClear, m_bClear);
+	}
+
+	if (bClear) {
+		m_pPoints->clear();
+		m_szSplatted = 0;
+	}
+
+	//The old points stay where they are on reallocation, so the density texture is still valid for them
+	if (m_pPoints->append(vPoints.data(), vPoints.size()))
+		bindAttributes();
+}
+
+void CHeatmapLayer::bindAttributes()
+{
+	auto* pFunc = QOpenGLContext::currentContext()->extraFunctions();
+	m_pPointVAO->bind();
+
+	//Mercator hi/lo, weight
+	m_pPoints->bind();
+	GLsizei nStride = sizeof(THeatVertex);
+	pFunc->glEnableVertexAttribArray(0);
+	pFunc->glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, nStride, reinterpret_cast<void*>(offsetof(THeatVertex, fMerc)));
+	pFunc->glEnableVertexAttribArray(1);
+	pFunc->glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, nStride, reinterpret_cast<void*>(offsetof(THeatVertex, fWeight)));
+
+	m_pPointVAO->release();
+}
+
+bool CHeatmapLayer::sameView(const QMatrix4x4& qmWorld, const TMercatorTransform& transform, const float& fRadius) const
+{
+	return (qmWorld == m_qmSplatted) && (fRadius == m_fSplattedRadius) &&
+		(transform.dbOriginX == m_Splatted.dbOriginX) && (transform.dbOriginY == m_Splatted.dbOriginY) &&
+		(transform.dbScaleX == m_Splatted.dbScaleX) && (transform.dbScaleY == m_Splatted.dbScaleY);
+}
+
+bool CHeatmapLayer::splat(const QSize& qsDensity, const QMatrix4x4& qmWorld, const TMercatorTransform& transform, const float& fRadius)
+{
+	auto* pFunc = QOpenGLContext::currentContext()->extraFunctions();
+
+	//0) Target of the caller is restored afterwards: the widget framebuffer or the offscreen one
+	GLint nFramebuffer = 0;
+	GLint nViewport[4] = {};
+	pFunc->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &nFramebuffer);
+	pFunc->glGetIntegerv(GL_VIEWPORT, nViewport);
+
+	if (!m_pDensity || (m_pDensity->size() != qsDensity)) {
+		//One 32 bit float channel: half floats stop adding small weights to large sums
+		m_pDensity = std::make_unique<QOpenGLFramebufferObject>(qsDensity, QOpenGLFramebufferObject::NoAttachment, GL_TEXTURE_2D, GL_R32F);
+		if (!m_pDensity->isValid()) {
+			m_pDensity.reset();
+			pFunc->glBindFramebuffer(GL_FRAMEBUFFER, nFramebuffer);
+			return false;
+		}
+
+		//Stretched over the screen, so it is filtered
+		pFunc->glBindTexture(GL_TEXTURE_2D, m_pDensity->texture());
+		pFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		pFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		pFunc->glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	m_pDensity->bind();
+	pFunc->glViewport(0, 0, qsDensity.width(), qsDensity.height());
+	if (0 == m_szSplatted) {
+		const GLfloat fZero[4] = {};
+		pFunc->glClearBufferfv(GL_COLOR, 0, fZero);
+	}
+
+	//1) One point sprite per point, the weights are summed. The sprite is as wide as the kernel in density pixels
+	pFunc->glBlendFunc(GL_ONE, GL_ONE);
+	pFunc->glEnable(GL_PROGRAM_POINT_SIZE);
+
+	m_pSplatShaders->bind();
+	COverlayLayer::setUniforms(m_pSplatShaders, qmWorld, transform, qsDensity);
+	m_pSplatShaders->setUniformValue("size", std::max(1.f, 2.f * fRadius / giHeatmapDownscale));
+
+	auto szCount = m_pPoints->count();
+	m_pPointVAO->bind();
+	pFunc->glDrawArrays(GL_POINTS, (GLint)m_szSplatted, (GLsizei)(szCount - m_szSplatted));
+	m_pPointVAO->release();
+
+	//2) State of the caller
+	pFunc->glDisable(GL_PROGRAM_POINT_SIZE);
+	pFunc->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	pFunc->glBindFramebuffer(GL_FRAMEBUFFER, nFramebuffer);
+	pFunc->glViewport(nViewport[0], nViewport[1], nViewport[2], nViewport[3]);
+
+	static CStatCounter statAdded("heatmap.splats.added");
+	static CStatCounter statFull("heatmap.splats.full");
+	static CStatCounter statSplatted("heatmap.splatted");
+	static CStatCounter statPoints("heatmap.points");
+	(m_szSplatted ? statAdded : statFull).add(1);
+	statSplatted.set((qint64)(szCount - m_szSplatted));
+	statPoints.set((qint64)szCount);
+
+	m_szSplatted = szCount;
+	m_qmSplatted = qmWorld;
+	m_Splatted = transform;
+	m_fSplattedRadius = fRadius;
+	return true;
+}
+
+void CHeatmapLayer::compose(const float& fSaturation)
+{
+	auto* pFunc = QOpenGLContext::currentContext()->extraFunctions();
+
+	m_pRampShaders->bind();
+	m_pRampShaders->setUniformValue("density", 0);
+	m_pRampShaders->setUniformValue("ramp", 1);
+	m_pRampShaders->setUniformValue("saturation", fSaturation);
+
+	m_pRamp->bind(1);
+	pFunc->glActiveTexture(GL_TEXTURE0);
+	pFunc->glBindTexture(GL_TEXTURE_2D, m_pDensity->texture());
+
+	m_pQuadVAO->bind();
+	pFunc->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	m_pQuadVAO->release();
+
+	pFunc->glBindTexture(GL_TEXTURE_2D, 0);
+}
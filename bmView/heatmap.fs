@@ -0,0 +1,19 @@
+R"(
+
+#version 330 core
+
+in float vWeight;
+out vec4 color_out;
+
+void main()
+{
+	vec2 offset = gl_PointCoord * 2.f - 1.f;
+	float dist = dot(offset, offset);
+	if (dist > 1.f)
+		discard;
+
+	//Point radius is three sigma of the gaussian
+	color_out = vec4(vWeight * exp(-4.5f * dist), 0.f, 0.f, 0.f);
+}
+
+)"
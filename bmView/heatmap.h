@@ -0,0 +1,50 @@
+#pragma once
+#include "intfs.h"
+#include "overlay.h"
+
+//Gaussian splats of every point are summed in a float texture at a fraction of the viewport resolution, a colour ramp
+//turns the sums into the image. The texture is only rebuilt when the view changes, new points are added on top of it
+class CHeatmapLayer : public IHeatmapLayer {
+public:
+	CHeatmapLayer();
+protected: //IHeatmapLayer
+	bool initGL() override;
+	void addPoints(const std::vector<QPointF>& vPoints, const float& fWeight) override;
+	void setKernel(const float& fRadius, const float& fSaturation) override;
+	void clear() override;
+	size_t size() override;
+	void draw(const QMatrix4x4& qmWorld, const TMercatorTransform& transform, const QSize& qsViewport) override;
+private:
+	struct THeatVertex {
+		GLfloat fMerc[4];
+		GLfloat fWeight;
+	};
+	std::mutex m_Lock;
+	std::vector<THeatVertex> m_vPending;
+	bool m_bClear = false;
+	float m_fRadius = 0.f;
+	float m_fSaturation = 0.f;
+	bool m_bInit = false;
+	bool m_bCreated = false;
+	std::atomic<size_t> m_szPoints{ 0 };
+
+	static std::shared_ptr<QOpenGLShaderProgram> m_pSplatShaders, m_pRampShaders;
+	static std::shared_ptr<QOpenGLTexture> m_pRamp;
+	std::shared_ptr<CGrowableBuffer> m_pPoints;
+	std::shared_ptr<QOpenGLVertexArrayObject> m_pPointVAO, m_pQuadVAO;
+	std::unique_ptr<QOpenGLFramebufferObject> m_pDensity;
+
+	//View the density texture holds the first m_szSplatted points for
+	QMatrix4x4 m_qmSplatted;
+	TMercatorTransform m_Splatted;
+	float m_fSplattedRadius = 0.f;
+	size_t m_szSplatted = 0;
+private:
+	bool createGL();
+	void upload();
+	void bindAttributes();
+	bool sameView(const QMatrix4x4& qmWorld, const TMercatorTransform& transform, const float& fRadius) const;
+	//Points from m_szSplatted on, the density texture is cleared first when it is 0
+	bool splat(const QSize& qsDensity, const QMatrix4x4& qmWorld, const TMercatorTransform& transform, const float& fRadius);
+	void compose(const float& fSaturation);
+};
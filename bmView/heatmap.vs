@@ -0,0 +1,24 @@
+R"(
+
+#version 330 core
+
+layout (location = 0) in vec4 merc;
+layout (location = 1) in float weight;
+
+uniform mat4 world;
+uniform vec4 eye;
+uniform vec2 eyeWorld;
+uniform vec2 scale;
+uniform float size;
+
+out float vWeight;
+
+void main()
+{
+	vec2 rel = (merc.xy - eye.xy) + (merc.zw - eye.zw);
+	gl_Position = world * vec4(eyeWorld + rel * scale, 0.f, 1.0f);
+	gl_PointSize = size;
+	vWeight = weight;
+}
+
+)"
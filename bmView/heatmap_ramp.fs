@@ -0,0 +1,21 @@
+R"(
+
+#version 330 core
+
+uniform sampler2D density;
+uniform sampler2D ramp;
+uniform float saturation;
+
+in vec2 vTexCoord;
+out vec4 color_out;
+
+void main()
+{
+	float value = texture(density, vTexCoord).r;
+	if (value <= 0.f)
+		discard;
+
+	color_out = texture(ramp, vec2(clamp(value / saturation, 0.f, 1.f), 0.5f));
+}
+
+)"
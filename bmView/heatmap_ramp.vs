@@ -0,0 +1,14 @@
+R"(
+
+#version 330 core
+
+out vec2 vTexCoord;
+
+void main()
+{
+	vec2 pos = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1)) * 2.f - 1.f;
+	vTexCoord = pos * 0.5f + 0.5f;
+	gl_Position = vec4(pos, 0.f, 1.f);
+}
+
+)"
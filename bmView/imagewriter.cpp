@@ -0,0 +1,333 @@
+#include "imagewriter.h"
+
+namespace {
+	//TIFF field types
+	const quint16 uiShort = 3;
+	const quint16 uiLong = 4;
+	const quint16 uiLong8 = 16;
+
+	//Largest stored deflate block
+	const int nMaxStored = 65535;
+
+	template <typename T> void appendLE(QByteArray& qbData, const T tValue)
+	{
+		auto tLE = qToLittleEndian(tValue);
+		qbData.append(reinterpret_cast<const char*>(&tLE), sizeof(T));
+	}
+
+	template <typename T> void appendBE(QByteArray& qbData, const T tValue)
+	{
+		auto tBE = qToBigEndian(tValue);
+		qbData.append(reinterpret_cast<const char*>(&tBE), sizeof(T));
+	}
+
+	quint32 crc32(const QByteArray& qbData)
+	{
+		static const auto aTable = [] {
+			std::array<quint32, 256> aTable;
+			for (quint32 i = 0; i < 256; ++i) {
+				quint32 uiCrc = i;
+				for (int k = 0; k < 8; ++k)
+					uiCrc = (uiCrc & 1) ? 0xEDB88320u ^ (uiCrc >> 1) : uiCrc >> 1;
+
+				aTable[i] = uiCrc;
+			}
+			return aTable;
+		}();
+
+		quint32 uiCrc = 0xFFFFFFFFu;
+		for (auto it : qbData)
+			uiCrc = aTable[(uiCrc ^ (uchar)it) & 0xFF] ^ (uiCrc >> 8);
+
+		return uiCrc ^ 0xFFFFFFFFu;
+	}
+
+	quint32 adler32(const quint32& uiAdler, const char* pData, int nSize)
+	{
+		quint32 uiA = uiAdler & 0xFFFF;
+		quint32 uiB = uiAdler >> 16;
+
+		//5552 bytes is the most the sums take before they may overflow
+		while (nSize > 0) {
+			int nStep = std::min(nSize, 5552);
+			nSize -= nStep;
+			while (nStep--) {
+				uiA += (uchar)*pData++;
+				uiB += uiA;
+			}
+
+			uiA %= 65521;
+			uiB %= 65521;
+		}
+
+		return (uiB << 16) | uiA;
+	}
+}
+
+bool CTiffStreamWriter::open(const QString& qsPath, const QSize& qsImage, const QSize& qsChunk)
+{
+	if (qsImage.isEmpty() || (qsChunk.width() % m_nTileSize) || (qsChunk.height() % m_nTileSize))
+		return false;
+
+	m_qsImage = qsImage;
+	m_nTilesX = (qsImage.width() + m_nTileSize - 1) / m_nTileSize;
+	m_nTilesY = (qsImage.height() + m_nTileSize - 1) / m_nTileSize;
+	m_vOffsets.assign((size_t)m_nTilesX * m_nTilesY, 0);
+	m_qbTile.resize(m_nTileSize * m_nTileSize * 3);
+
+	//0) Classic TIFF addresses 4 GB, the directory goes after the tiles
+	quint64 uiEstimate = m_vOffsets.size() * (quint64)(m_qbTile.size() + 16) + 4096;
+	m_bBig = uiEstimate > 0xFFFFFFFFull;
+
+	m_File.setFileName(qsPath);
+	if (!QDir().mkpath(QFileInfo(qsPath).path()) || !m_File.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+
+	//1) Header, the directory offset is patched on close
+	QByteArray qbHeader("II");
+	if (m_bBig) {
+		appendLE<quint16>(qbHeader, 43);
+		appendLE<quint16>(qbHeader, 8);
+		appendLE<quint16>(qbHeader, 0);
+		appendLE<quint64>(qbHeader, 0);
+	}
+	else {
+		appendLE<quint16>(qbHeader, 42);
+		appendLE<quint32>(qbHeader, 0);
+	}
+
+	return m_File.write(qbHeader) == qbHeader.size();
+}
+
+bool CTiffStreamWriter::write(const QImage& img, const QPoint& qpAt)
+{
+	if (!m_File.isOpen() || img.isNull() || (qpAt.x() % m_nTileSize) || (qpAt.y() % m_nTileSize))
+		return false;
+
+	auto imgRGB = img.convertToFormat(QImage::Format_RGB888);
+	int nRight = std::min(qpAt.x() + imgRGB.width(), m_qsImage.width());
+	int nBottom = std::min(qpAt.y() + imgRGB.height(), m_qsImage.height());
+
+	for (int nTileY = qpAt.y() / m_nTileSize; nTileY * m_nTileSize < nBottom; ++nTileY) {
+		for (int nTileX = qpAt.x() / m_nTileSize; nTileX * m_nTileSize < nRight; ++nTileX) {
+			//0) Edge tiles are padded with black up to the full tile size
+			int nX = nTileX * m_nTileSize;
+			int nWidth = std::min(m_nTileSize, nRight - nX);
+			auto pTile = m_qbTile.data();
+			for (int i = 0; i < m_nTileSize; ++i, pTile += m_nTileSize * 3) {
+				int nY = nTileY * m_nTileSize + i;
+				if (nY >= nBottom) {
+					std::memset(pTile, 0, m_nTileSize * 3);
+					continue;
+				}
+
+				std::memcpy(pTile, imgRGB.constScanLine(nY - qpAt.y()) + (nX - qpAt.x()) * 3, nWidth * 3);
+				std::memset(pTile + nWidth * 3, 0, (m_nTileSize - nWidth) * 3);
+			}
+
+			//1) Tile goes to disk right away, only its offset is kept
+			m_vOffsets[(size_t)nTileY * m_nTilesX + nTileX] = m_File.pos();
+			if (m_File.write(m_qbTile) != m_qbTile.size())
+				return false;
+		}
+	}
+
+	return true;
+}
+
+bool CTiffStreamWriter::close()
+{
+	if (!m_File.isOpen())
+		return false;
+
+	//A tile that was never written leaves the file unreadable
+	bool bWritten = std::find(m_vOffsets.begin(), m_vOffsets.end(), 0) == m_vOffsets.end() && writeDirectory();
+	m_File.close();
+
+	return bWritten && (QFileDevice::NoError == m_File.error());
+}
+
+bool CTiffStreamWriter::writeDirectory()
+{
+	auto makeEntry = [](const quint16& uiTag, const quint16& uiType, const std::vector<quint64>& vValues) {
+		TEntry entry;
+		entry.uiTag = uiTag;
+		entry.uiType = uiType;
+		entry.uiCount = vValues.size();
+		for (auto it : vValues) {
+			if (uiShort == uiType)
+				appendLE<quint16>(entry.qbValue, (quint16)it);
+			else if (uiLong == uiType)
+				appendLE<quint32>(entry.qbValue, (quint32)it);
+			else
+				appendLE<quint64>(entry.qbValue, it);
+		}
+		return entry;
+	};
+
+	std::vector<quint64> vCounts(m_vOffsets.size(), (quint64)m_qbTile.size());
+	std::vector<TEntry> vEntries = {
+		makeEntry(256, uiLong, { (quint64)m_qsImage.width() }),
+		makeEntry(257, uiLong, { (quint64)m_qsImage.height() }),
+		makeEntry(258, uiShort, { 8, 8, 8 }),
+		makeEntry(259, uiShort, { 1 }),
+		makeEntry(262, uiShort, { 2 }),
+		makeEntry(277, uiShort, { 3 }),
+		makeEntry(284, uiShort, { 1 }),
+		makeEntry(322, uiShort, { (quint64)m_nTileSize }),
+		makeEntry(323, uiShort, { (quint64)m_nTileSize }),
+		makeEntry(324, m_bBig ? uiLong8 : uiLong, m_vOffsets),
+		makeEntry(325, uiLong, vCounts)
+	};
+
+	//0) Values that don't fit in an entry go first, at word boundaries
+	int nInline = m_bBig ? 8 : 4;
+	std::vector<quint64> vValueOffsets(vEntries.size(), 0);
+	for (size_t i = 0; i < vEntries.size(); ++i) {
+		if (vEntries[i].qbValue.size() <= nInline)
+			continue;
+
+		if ((m_File.pos() & 1) && (m_File.write("\0", 1) != 1))
+			return false;
+
+		vValueOffsets[i] = m_File.pos();
+		if (m_File.write(vEntries[i].qbValue) != vEntries[i].qbValue.size())
+			return false;
+	}
+
+	if ((m_File.pos() & 1) && (m_File.write("\0", 1) != 1))
+		return false;
+
+	//1) Directory, entries sorted by tag
+	quint64 uiDirectory = m_File.pos();
+	QByteArray qbDirectory;
+	m_bBig ? appendLE<quint64>(qbDirectory, vEntries.size()) : appendLE<quint16>(qbDirectory, (quint16)vEntries.size());
+	for (size_t i = 0; i < vEntries.size(); ++i) {
+		const auto& entry = vEntries[i];
+		appendLE<quint16>(qbDirectory, entry.uiTag);
+		appendLE<quint16>(qbDirectory, entry.uiType);
+		m_bBig ? appendLE<quint64>(qbDirectory, entry.uiCount) : appendLE<quint32>(qbDirectory, (quint32)entry.uiCount);
+
+		if (vValueOffsets[i]) {
+			m_bBig ? appendLE<quint64>(qbDirectory, vValueOffsets[i]) : appendLE<quint32>(qbDirectory, (quint32)vValueOffsets[i]);
+		}
+		else {
+			qbDirectory.append(entry.qbValue);
+			qbDirectory.append(nInline - entry.qbValue.size(), '\0');
+		}
+	}
+	m_bBig ? appendLE<quint64>(qbDirectory, 0) : appendLE<quint32>(qbDirectory, 0);
+
+	if (m_File.write(qbDirectory) != qbDirectory.size())
+		return false;
+
+	//2) Header points at the directory
+	QByteArray qbOffset;
+	m_bBig ? appendLE<quint64>(qbOffset, uiDirectory) : appendLE<quint32>(qbOffset, (quint32)uiDirectory);
+
+	return m_File.seek(m_bBig ? 8 : 4) && (m_File.write(qbOffset) == qbOffset.size());
+}
+
+bool CPngStreamWriter::open(const QString& qsPath, const QSize& qsImage, const QSize& qsChunk)
+{
+	if (qsImage.isEmpty() || qsChunk.isEmpty())
+		return false;
+
+	//0) Each row starts with its filter type, 0 - none
+	m_qsImage = qsImage;
+	m_nStride = 1 + qsImage.width() * 3;
+	m_qbBand = QByteArray(m_nStride * qsChunk.height(), '\0');
+	m_qbPending.clear();
+	m_qbPending.reserve(nMaxStored);
+	m_uiAdler = 1;
+
+	m_File.setFileName(qsPath);
+	if (!QDir().mkpath(QFileInfo(qsPath).path()) || !m_File.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+
+	if (m_File.write("\x89PNG\r\n\x1A\n", 8) != 8)
+		return false;
+
+	//1) 8 bit RGB, no interlace
+	QByteArray qbHeader;
+	appendBE<quint32>(qbHeader, (quint32)qsImage.width());
+	appendBE<quint32>(qbHeader, (quint32)qsImage.height());
+	qbHeader.append("\x08\x02\x00\x00\x00", 5);
+
+	//2) Zlib header of the one stream all IDAT chunks share: deflate, 32K window, no dictionary
+	return chunk("IHDR", qbHeader) && chunk("IDAT", QByteArray("\x78\x01", 2));
+}
+
+bool CPngStreamWriter::write(const QImage& img, const QPoint& qpAt)
+{
+	if (!m_File.isOpen() || img.isNull() || (img.height() * m_nStride > m_qbBand.size()))
+		return false;
+
+	auto imgRGB = img.convertToFormat(QImage::Format_RGB888);
+	int nWidth = std::min(imgRGB.width(), m_qsImage.width() - qpAt.x());
+	int nRows = std::min(imgRGB.height(), m_qsImage.height() - qpAt.y());
+	if ((nWidth <= 0) || (nRows <= 0))
+		return false;
+
+	for (int i = 0; i < nRows; ++i)
+		std::memcpy(m_qbBand.data() + i * m_nStride + 1 + qpAt.x() * 3, imgRGB.constScanLine(i), nWidth * 3);
+
+	//Last chunk of the band completes its rows
+	if (qpAt.x() + imgRGB.width() < m_qsImage.width())
+		return true;
+
+	return deflate(m_qbBand.constData(), nRows * m_nStride, false);
+}
+
+bool CPngStreamWriter::close()
+{
+	if (!m_File.isOpen())
+		return false;
+
+	bool bWritten = deflate(nullptr, 0, true) && chunk("IEND", QByteArray());
+	m_File.close();
+
+	return bWritten && (QFileDevice::NoError == m_File.error());
+}
+
+bool CPngStreamWriter::chunk(const char* szType, const QByteArray& qbData)
+{
+	QByteArray qbChunk;
+	appendBE<quint32>(qbChunk, (quint32)qbData.size());
+	qbChunk.append(szType, 4);
+	qbChunk.append(qbData);
+	appendBE<quint32>(qbChunk, crc32(qbChunk.mid(4)));
+
+	return m_File.write(qbChunk) == qbChunk.size();
+}
+
+bool CPngStreamWriter::deflate(const char* pData, const int& nSize, const bool& bFinal)
+{
+	m_uiAdler = adler32(m_uiAdler, pData, nSize);
+	for (int nPos = 0; nPos < nSize;) {
+		int nStep = std::min(nSize - nPos, nMaxStored - m_qbPending.size());
+		m_qbPending.append(pData + nPos, nStep);
+		nPos += nStep;
+
+		if ((m_qbPending.size() == nMaxStored) && !flush(false))
+			return false;
+	}
+
+	return !bFinal || flush(true);
+}
+
+bool CPngStreamWriter::flush(const bool& bFinal)
+{
+	//Stored block: final flag, then the length and its complement. The stream ends with the checksum of the raw data
+	QByteArray qbBlock;
+	qbBlock.append(bFinal ? '\x01' : '\x00');
+	appendLE<quint16>(qbBlock, (quint16)m_qbPending.size());
+	appendLE<quint16>(qbBlock, (quint16)~m_qbPending.size());
+	qbBlock.append(m_qbPending);
+	if (bFinal)
+		appendBE<quint32>(qbBlock, m_uiAdler);
+
+	//Keeps the reserved capacity
+	m_qbPending.resize(0);
+	return chunk("IDAT", qbBlock);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "intfs.h"
+
+//Tiled RGB TIFF, switches to BigTIFF past 4 GB. Tiles go to disk as their chunk arrives, the directory is written last.
+//Chunk origins must be multiples of the tile size
+class CTiffStreamWriter : public IImageWriter {
+public:
+	static const int m_nTileSize = 256;
+protected: //IImageWriter
+	bool open(const QString& qsPath, const QSize& qsImage, const QSize& qsChunk) override;
+	bool write(const QImage& img, const QPoint& qpAt) override;
+	bool close() override;
+private:
+	struct TEntry {
+		quint16 uiTag = 0;
+		quint16 uiType = 0;
+		quint64 uiCount = 0;
+		QByteArray qbValue;
+	};
+	QFile m_File;
+	QSize m_qsImage;
+	bool m_bBig = false;
+	int m_nTilesX = 0;
+	int m_nTilesY = 0;
+	std::vector<quint64> m_vOffsets;
+	QByteArray m_qbTile;
+private:
+	bool writeDirectory();
+};
+
+//RGB PNG with stored (uncompressed) deflate blocks, so rows go out as soon as they are complete.
+//PNG rows span the whole width: one band of chunk height is buffered, memory grows with the width
+class CPngStreamWriter : public IImageWriter {
+protected: //IImageWriter
+	bool open(const QString& qsPath, const QSize& qsImage, const QSize& qsChunk) override;
+	bool write(const QImage& img, const QPoint& qpAt) override;
+	bool close() override;
+private:
+	QFile m_File;
+	QSize m_qsImage;
+	int m_nStride = 0;
+	QByteArray m_qbBand;
+	//Raw bytes waiting for a full stored block
+	QByteArray m_qbPending;
+	quint32 m_uiAdler = 1;
+private:
+	bool chunk(const char* szType, const QByteArray& qbData);
+	bool deflate(const char* pData, const int& nSize, const bool& bFinal);
+	bool flush(const bool& bFinal);
+};
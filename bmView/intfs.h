@@ -1,5 +1,38 @@
 #pragma once
 
+interface IOverlayLayer;
+using IOverlayLayerPtr = std::shared_ptr<IOverlayLayer>;
+interface IHeatmapLayer;
+using IHeatmapLayerPtr = std::shared_ptr<IHeatmapLayer>;
+interface ILiveLayer;
+using ILiveLayerPtr = std::shared_ptr<ILiveLayer>;
+interface IDatasetLayer;
+using IDatasetLayerPtr = std::shared_ptr<IDatasetLayer>;
+
+/* :     ,   . 0 -  */
+using THandle = quint64;
+
+/*:             ,    */
+interface ICamera {
+	virtual void setPosition(const QVector3D&) = 0;
+	virtual QVector3D getPosition() = 0;
+	virtual void setViewport(const QSize&) = 0;
+	virtual QSize getViewport() = 0;
+	virtual void setFieldOfView(const float&) = 0;
+	virtual const QMatrix4x4& getViewMatrix() = 0;
+	virtual const QMatrix4x4& getProjectionMatrix() = 0;
+	/* * */
+	virtual const QMatrix4x4& getWorldMatrix() = 0;
+	virtual QVector3D screenToWorld(const QPointF&) = 0;
+	virtual void screenToWorld(const std::vector<QPointF>&, std::vector<QVector3D>&) = 0;
+	virtual QPointF worldToScreen(const QVector3D&) = 0;
+	virtual void worldToScreen(const std::vector<QVector3D>&, std::vector<QPointF>&) = 0;
+	/*        z = 0*/
+	virtual std::optional<QVector3D> screenToPlane(const QPointF&) = 0;
+	virtual ~ICamera() = default;
+};
+using ICameraPtr = std::shared_ptr<ICamera>;
+
 interface IGlobalRenderer {
 	virtual void init() = 0;
 	virtual uint getZoomLevel() = 0;
@@ -8,11 +41,28 @@ interface IGlobalRenderer {
 	virtual uint getHeight() = 0;
 	virtual void repaint() = 0;
 	virtual QVector3D screenToWorld(const int&, const int&) = 0;
+	virtual QMatrix4x4 getWorldMatrix() = 0;
+	virtual ICameraPtr getCamera() = 0;
+	virtual IOverlayLayerPtr getOverlay() = 0;
+	virtual IHeatmapLayerPtr getHeatmap() = 0;
+	/* */
+	virtual ILiveLayerPtr getLiveLayer() = 0;
+	/* */
+	virtual IDatasetLayerPtr getDatasetLayer() = 0;
 	virtual ~IGlobalRenderer() = default;
 };
 using IGlobalRendererPtr = std::shared_ptr<IGlobalRenderer>;
 using IGlobalRendererPtr_ = std::weak_ptr<IGlobalRenderer>;
 
+/*    (0..1,  Y )    */
+struct TMercatorTransform {
+	double dbOriginX = 0.0;
+	double dbOriginY = 0.0;
+	double dbScaleX = 0.0;
+	double dbScaleY = 0.0;
+	bool bValid = false;
+};
+
 interface ITile {
 	virtual std::pair<uint, uint> getIndex() = 0;
 	virtual void setIndex(const std::pair<uint, uint>&) = 0;
@@ -21,26 +71,62 @@ interface ITile {
 
 	virtual QVector3D getPos() = 0;
 	virtual QVector3D getSize() = 0;
+	virtual bool isVisible() = 0;
+	virtual void setVisible(const bool&) = 0;
+	/*       ,      */
+	virtual void setPixelScale(const float&) = 0;
+	/*  ,       */
+	virtual bool isReady() = 0;
 	
-	virtual void initGL() = 0;
 	virtual void place(const QVector3D&, const QVector3D&) = 0;
 	virtual void draw(const QMatrix4x4&) = 0;
 	virtual void invalidate() = 0;
+	/*   ,      */
+	virtual THandle handle() = 0;
+	virtual void onTextureReady() = 0;
+	virtual void onTerrainReady() = 0;
 	virtual ~ITile() = default;
 };
 using ITilePtr = std::shared_ptr<ITile>;
-using ITilePtr_ = std::weak_ptr<ITile>;
+
+/*    .    GUI*/
+interface ITileRegistry {
+	virtual THandle add(ITile*) = 0;
+	virtual void remove(const THandle&) = 0;
+	/*   nullptr*/
+	virtual ITile* resolve(const THandle&) = 0;
+	virtual ~ITileRegistry() = default;
+};
+using ITileRegistryPtr = std::shared_ptr<ITileRegistry>;
+
+/*  QuadKey:     */
+struct TQuadNode {
+	int nX = 0;
+	int nY = 0;
+	uint uiZoom = 0;
+};
+/*         */
+using QuadMeasure = std::function<bool(const TQuadNode&, float&)>;
+
+/*      .       */
+interface ITileSelector {
+	virtual void reset(const uint& uiMinZoom, const uint& uiMaxZoom) = 0;
+	/*    .   ,    */
+	virtual const std::vector<TQuadNode>& select(const QuadMeasure&) = 0;
+	virtual ~ITileSelector() = default;
+};
+using ITileSelectorPtr = std::shared_ptr<ITileSelector>;
 
 interface ITileCircularBuffer {
-	virtual void addFirst(ITilePtr) = 0;
-	virtual void addLast(ITilePtr) = 0;
+	virtual void addFirst(const THandle&) = 0;
+	virtual void addLast(const THandle&) = 0;
 	virtual ITileCircularBuffer& operator >> (const uint&) = 0;
 	virtual ITileCircularBuffer& operator << (const uint&) = 0;
-	virtual std::vector<ITilePtr_>::const_iterator begin() = 0;
-	virtual std::vector<ITilePtr_>::const_iterator end() = 0;
-	virtual std::vector<ITilePtr_>::reverse_iterator rbegin() = 0;
-	virtual std::vector<ITilePtr_>::reverse_iterator rend() = 0;
-	virtual ITilePtr at(const size_t&) = 0;
+	virtual std::vector<THandle>::const_iterator begin() = 0;
+	virtual std::vector<THandle>::const_iterator end() = 0;
+	virtual std::vector<THandle>::reverse_iterator rbegin() = 0;
+	virtual std::vector<THandle>::reverse_iterator rend() = 0;
+	virtual ITile* at(const size_t&) = 0;
 	virtual bool empty() = 0;
 	virtual size_t size() = 0;
 	virtual void rebuild() = 0;
@@ -52,19 +138,34 @@ interface ITileMap {
 	virtual void init() = 0;
 	virtual void initGL() = 0;
 	virtual void draw(const QMatrix4x4&) = 0;
+	virtual void cull(const QMatrix4x4&) = 0;
 	virtual bool detail(const uint&) = 0;
 	virtual void move() = 0;
 	virtual void rebuild() = 0;
+	/*  ,    */
+	virtual uint pending() = 0;
+	virtual TMercatorTransform getMercatorTransform() = 0;
 	virtual IGlobalRendererPtr renderer() = 0;
 	virtual ~ITileMap() = default;
 };
 using ITileMapPtr = std::shared_ptr<ITileMap>;
 using ITileMapPtr_ = std::weak_ptr<ITileMap>;
 
-interface IGeoTexture : public QObject {
+enum class ETexturePriority {
+	Visible,
+	Prefetch
+};
+
+interface IGeoTexture {
 	virtual void init() = 0;
 	virtual bool valid() = 0;
+	virtual bool failed() = 0;
 	virtual bool bind() = 0;
+	/*  .    ,     */
+	virtual void setVisible(const bool&) = 0;
+	/* -    */
+	virtual void subscribe(const THandle&) = 0;
+	virtual void unsubscribe(const THandle&) = 0;
 	virtual ~IGeoTexture() = default;
 };
 using IGeoTexturePtr = std::shared_ptr<IGeoTexture>;
@@ -89,6 +190,10 @@ interface IGeoMath {
 	virtual std::pair<int, int> wgs2pix(const double&, const double&, const uint&) = 0;
 	/* .    .   X, Y  */
 	virtual std::pair<double, double> pix2wgs(const int&, const int&, const uint&) = 0;
+	/* WGS-84        .     */
+	virtual std::pair<double, double> wgs2merc(const double&, const double&) = 0;
+	/* .    */
+	virtual std::pair<double, double> merc2wgs(const double&, const double&) = 0;
 	/*     */
 	virtual std::pair<int, int> pix2tile(const int&, const int&) = 0;
 	/*       */
@@ -105,14 +210,268 @@ interface IGeoMath {
 };
 using IGeoMathPtr = std::shared_ptr<IGeoMath>;
 
-using GeoCallback = std::function<void()>;
-
 interface IGeoTextureProvider {
 	virtual IGeoMetadataPtr getMetadata() = 0;
 	virtual IGeoMathPtr getMath() = 0;
-	virtual IGeoTexturePtr getTexture(const QString&, GeoCallback) = 0;
+	virtual IGeoTexturePtr getTexture(const QString&) = 0;
+	/*   .   */
+	virtual void deliver() = 0;
 	virtual ~IGeoTextureProvider() = default;
 };
 using IGeoTextureProviderPtr = std::shared_ptr<IGeoTextureProvider>;
 
+/* :    (        )   */
+struct TGeoLayer {
+	QString qsName;
+	IGeoTextureProviderPtr pProvider;
+	float fOpacity = 1.f;
+};
+
+/*  .  - ,      */
+interface IGeoLayers {
+	virtual size_t count() = 0;
+	virtual const TGeoLayer& layer(const size_t&) = 0;
+	/*false,    ,      */
+	virtual bool add(const TGeoLayer&) = 0;
+	virtual void setOpacity(const size_t&, const float&) = 0;
+	virtual ~IGeoLayers() = default;
+};
+using IGeoLayersPtr = std::shared_ptr<IGeoLayers>;
+
+/* HTTP  :       */
+struct TTileValidators {
+	QString qsETag;
+	QString qsLastModified;
+	qint64 nExpires = 0;	//UTC, . 0 -   
+};
+
+struct TCachedTile {
+	QByteArray qbData;
+	TTileValidators validators;
+	bool bStale = false;
+};
+
+/*   , .   ,    */
+struct TTerrainMesh {
+	std::vector<float> vHeights;
+	/*        , */
+	std::vector<float> vErrors;
+};
+using TTerrainMeshPtr = std::shared_ptr<const TTerrainMesh>;
+
+/*   .        QuadKey.  GUI*/
+interface ITerrain {
+	virtual bool enabled() = 0;
+	/*   .     ,    onTerrainReady*/
+	virtual TTerrainMeshPtr mesh(const QString&, const THandle&) = 0;
+	/*      */
+	virtual bool bind(const QString&) = 0;
+	virtual ~ITerrain() = default;
+};
+using ITerrainPtr = std::shared_ptr<ITerrain>;
+
+/*   (   )  QuadKey*/
+interface IGeoTileCache {
+	virtual bool contains(const QString&) = 0;
+	virtual std::optional<TCachedTile> read(const QString&) = 0;
+	virtual bool write(const QString&, const QByteArray&, const TTileValidators& = {}) = 0;
+	/* 304:   ,     */
+	virtual bool refresh(const QString&, const TTileValidators&) = 0;
+	/*   :      */
+	virtual void abandon(const QString&) = 0;
+	virtual ~IGeoTileCache() = default;
+};
+using IGeoTileCachePtr = std::shared_ptr<IGeoTileCache>;
+
+/*   */
+enum class ETileFailure {
+	Missing,	//       (404, no-tile)
+	Transient,	//   ,   
+	Corrupt		// ,   
+};
+
+struct TTileRetry {
+	ETileFailure eFailure = ETileFailure::Transient;
+	uint uiDelay = 0;	//   
+};
+
+/*   :  ,      */
+interface ITileFailureTracker {
+	/* -  ,     */
+	virtual std::optional<TTileRetry> blocked(const QString& qsQuadKey, const QString& qsHost) = 0;
+	virtual void succeeded(const QString& qsQuadKey, const QString& qsHost) = 0;
+	virtual TTileRetry failed(const QString& qsQuadKey, const QString& qsHost, const ETileFailure& eFailure) = 0;
+	/*     .     ,    */
+	virtual void abandoned(const QString& qsQuadKey, const QString& qsHost) = 0;
+	virtual ~ITileFailureTracker() = default;
+};
+using ITileFailureTrackerPtr = std::shared_ptr<ITileFailureTracker>;
+
+interface IStatistics {
+	virtual void set(const QString&, const qint64&) = 0;
+	virtual void add(const QString&, const qint64&) = 0;
+	virtual qint64 value(const QString&) = 0;
+	virtual QString report() = 0;
+	/*  ,   .   ,    */
+	virtual std::atomic<qint64>& counter(const QString&) = 0;
+	virtual ~IStatistics() = default;
+};
+using IStatisticsPtr = std::shared_ptr<IStatistics>;
+
+/*  .    */
+enum class EJobPriority {
+	Visible = 0,
+	Prefetch,
+	Background,
+	Count
+};
+using JobPriorityPtr = std::shared_ptr<std::atomic<EJobPriority>>;
+
+struct TSchedulerStats {
+	uint uiWorkers = 0;
+	uint uiBusy = 0;
+	/* ,    ,   */
+	double dbUtilisation = 0.0;
+	std::array<size_t, (size_t)EJobPriority::Count> aQueued = {};
+	quint64 uiCanceled = 0;
+};
+
+interface IJobScheduler {
+	/*     ,         .
+	    ,    fnCancel*/
+	virtual void post(const JobPriorityPtr&, const pplx::cancellation_token&, std::function<void()>, std::function<void()> fnCancel = nullptr) = 0;
+	virtual void post(const EJobPriority&, const pplx::cancellation_token&, std::function<void()>, std::function<void()> fnCancel = nullptr) = 0;
+	/*  .  ,     ,    ,   */
+	virtual void reprioritize(const JobPriorityPtr&, const EJobPriority&) = 0;
+	/*    ,      */
+	virtual void parallelFor(const EJobPriority&, const size_t&, const std::function<void(size_t, size_t)>&) = 0;
+	virtual TSchedulerStats stats() = 0;
+	virtual ~IJobScheduler() = default;
+};
+using IJobSchedulerPtr = std::shared_ptr<IJobScheduler>;
+
+interface ITileResources {
+	virtual bool initGL() = 0;
+	virtual void bindVertexBuffers() = 0;
+	virtual void bindShaders(const QMatrix4x4&) = 0;
+	virtual void setGeometry(const QVector3D&, const QVector3D&) = 0;
+	/*    . 0 -         */
+	virtual void setLayers(const QVector4D&) = 0;
+	/*        . 0 -  */
+	virtual void setTerrain(const float&, const float&) = 0;
+	/*  ,       */
+	virtual void setTerrainLimit(const float&) = 0;
+	virtual void drawQuad() = 0;
+	/*   N: 2^N   ,    */
+	virtual void drawGrid(const uint&) = 0;
+	virtual void releaseTexture(std::shared_ptr<QOpenGLTexture>) = 0;
+	virtual void collect() = 0;
+	virtual ~ITileResources() = default;
+};
+using ITileResourcesPtr = std::shared_ptr<ITileResources>;
+
+/*  .     (X0 == X1, Y0 == Y1)*/
+struct TSpatialItem {
+	uint uiFeature = 0;
+	double dbX0 = 0.0;
+	double dbY0 = 0.0;
+	double dbX1 = 0.0;
+	double dbY1 = 0.0;
+};
+
+/*     (0..1)*/
+interface ISpatialIndex {
+	virtual void build(const std::vector<TSpatialItem>&) = 0;
+	virtual void insert(const std::vector<TSpatialItem>&) = 0;
+	virtual void remove(const uint&) = 0;
+	virtual void query(const QRectF&, std::vector<uint>&) = 0;
+	/*      */
+	virtual std::optional<uint> nearest(const QPointF&, const double&) = 0;
+	virtual size_t size() = 0;
+	virtual size_t memory() = 0;
+	virtual ~ISpatialIndex() = default;
+};
+using ISpatialIndexPtr = std::shared_ptr<ISpatialIndex>;
+
+/*     QPointF(, ).    (  -  )*/
+interface IOverlayLayer {
+	virtual bool initGL() = 0;
+	virtual uint addPoints(const std::vector<QPointF>&, const QColor&, const float&) = 0;
+	virtual uint addPolyline(const std::vector<QPointF>&, const QColor&, const float&) = 0;
+	/*          */
+	virtual std::optional<uint> pick(const QPointF&, const double&) = 0;
+	virtual void query(const QRectF&, std::vector<uint>&) = 0;
+	virtual void clear() = 0;
+	virtual void draw(const QMatrix4x4&, const TMercatorTransform&, const QSize&) = 0;
+	virtual ~IOverlayLayer() = default;
+};
+
+/*    QPointF(, )  .      ,
+     */
+interface IHeatmapLayer {
+	virtual bool initGL() = 0;
+	virtual void addPoints(const std::vector<QPointF>&, const float&) = 0;
+	/*       ,    */
+	virtual void setKernel(const float&, const float&) = 0;
+	virtual void clear() = 0;
+	virtual size_t size() = 0;
+	virtual void draw(const QMatrix4x4&, const TMercatorTransform&, const QSize&) = 0;
+	virtual ~IHeatmapLayer() = default;
+};
+
+/*  : QPointF(, )     , */
+struct TFeedUpdate {
+	quint64 uiObject = 0;
+	QPointF qpPosition;
+	qint64 nTime = 0;
+};
+
+/* .         ,    */
+interface ILiveLayer {
+	virtual bool initGL() = 0;
+	virtual void update(const std::vector<TFeedUpdate>&) = 0;
+	virtual size_t size() = 0;
+	/*       ,    */
+	virtual bool animating() = 0;
+	virtual void draw(const QMatrix4x4&, const TMercatorTransform&, const QSize&) = 0;
+	virtual ~ILiveLayer() = default;
+};
+using ILiveLayerPtr_ = std::weak_ptr<ILiveLayer>;
+
+/*    ,   .    ,    */
+interface IPointDataset {
+	virtual size_t size() = 0;
+	/* ,     */
+	virtual QRectF bounds() = 0;
+	/*    :  x, y   x, y,    */
+	virtual const GLfloat* positions() = 0;
+	/*   .  -     */
+	virtual const float* weights() = 0;
+	/*  [,   )      ,  .
+	      ,      */
+	virtual void ranges(const QRectF&, const size_t&, std::vector<std::pair<size_t, size_t>>&) = 0;
+	virtual ~IPointDataset() = default;
+};
+using IPointDatasetPtr = std::shared_ptr<IPointDataset>;
+
+/*  ,      */
+interface IDatasetLayer {
+	virtual bool initGL() = 0;
+	virtual void setDataset(IPointDatasetPtr, const QColor&, const float&) = 0;
+	virtual void draw(const QMatrix4x4&, const TMercatorTransform&, const QSize&) = 0;
+	virtual ~IDatasetLayer() = default;
+};
+
+/*  ,     .    :  ,  .
+     */
+interface IImageWriter {
+	/*     */
+	virtual bool open(const QString&, const QSize&, const QSize&) = 0;
+	/*       */
+	virtual bool write(const QImage&, const QPoint&) = 0;
+	virtual bool close() = 0;
+	virtual ~IImageWriter() = default;
+};
+using IImageWriterPtr = std::shared_ptr<IImageWriter>;
+
 
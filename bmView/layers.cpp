@@ -0,0 +1,45 @@
+#include "layers.h"
+#include "consts.h"
+#include "geotex.h"
+
+IGeoLayersPtr CGeoLayers::m_pLayers = nullptr;
+
+IGeoLayersPtr CGeoLayers::get()
+{
+	if (!m_pLayers)
+		m_pLayers = IGeoLayersPtr(new CGeoLayers());
+
+	return m_pLayers;
+}
+
+CGeoLayers::CGeoLayers()
+{
+	m_vLayers.reserve(gszMaxLayers);
+	m_vLayers.push_back({ "base", CBingGeoTextureProvider::get(), 1.f });
+}
+
+size_t CGeoLayers::count()
+{
+	return m_vLayers.size();
+}
+
+const TGeoLayer& CGeoLayers::layer(const size_t& szIdx)
+{
+	return m_vLayers[szIdx];
+}
+
+bool CGeoLayers::add(const TGeoLayer& layer)
+{
+	//Every layer takes a texture unit of the tile shader
+	if (!layer.pProvider || (m_vLayers.size() >= gszMaxLayers))
+		return false;
+
+	m_vLayers.push_back(layer);
+	return true;
+}
+
+void CGeoLayers::setOpacity(const size_t& szIdx, const float& fOpacity)
+{
+	if (szIdx < m_vLayers.size())
+		m_vLayers[szIdx].fOpacity = std::min(std::max(fOpacity, 0.f), 1.f);
+}
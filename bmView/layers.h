@@ -0,0 +1,17 @@
+#pragma once
+#include "intfs.h"
+
+//GUI thread only. Layers are added at startup, before the first map is built
+class CGeoLayers : public IGeoLayers {
+public:
+	static IGeoLayersPtr get();
+protected: //IGeoLayers
+	size_t count() override;
+	const TGeoLayer& layer(const size_t& szIdx) override;
+	bool add(const TGeoLayer& layer) override;
+	void setOpacity(const size_t& szIdx, const float& fOpacity) override;
+private:
+	CGeoLayers();
+	static IGeoLayersPtr m_pLayers;
+	std::vector<TGeoLayer> m_vLayers;
+};
@@ -0,0 +1,34 @@
+R"(
+
+#version 330 core
+
+layout (location = 0) in vec2 corner;
+layout (location = 1) in vec4 from;
+layout (location = 2) in vec4 to;
+layout (location = 3) in vec2 time;
+
+uniform mat4 world;
+uniform vec4 eye;
+uniform vec2 eyeWorld;
+uniform vec2 scale;
+uniform vec2 viewport;
+uniform float now;
+uniform vec4 color;
+uniform float size;
+
+out vec4 vColor;
+out vec2 vCorner;
+
+void main()
+{
+	float progress = (time.y > time.x) ? clamp((now - time.x) / (time.y - time.x), 0.f, 1.f) : 1.f;
+	vec2 relFrom = (from.xy - eye.xy) + (from.zw - eye.zw);
+	vec2 relTo = (to.xy - eye.xy) + (to.zw - eye.zw);
+	vec4 center = world * vec4(eyeWorld + mix(relFrom, relTo, progress) * scale, 0.f, 1.0f);
+
+	gl_Position = center + vec4(corner * size / viewport * center.w, 0.f, 0.f);
+	vColor = color;
+	vCorner = corner;
+}
+
+)"
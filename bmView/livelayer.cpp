@@ -0,0 +1,283 @@
+#include "livelayer.h"
+#include "consts.h"
+#include "geotex.h"
+#include "stats.h"
+#include "trace.h"
+
+std::shared_ptr<QOpenGLShaderProgram> CLiveLayer::m_pShaders = nullptr;
+
+namespace {
+	//Triangle strip of a point sprite
+	const GLfloat gfLiveCorners[] = {
+		-1.0f, -1.0f,	1.0f, -1.0f,	-1.0f, 1.0f,	1.0f, 1.0f
+	};
+}
+
+CLiveLayer::CLiveLayer()
+{
+	m_Clock.start();
+}
+
+bool CLiveLayer::initGL()
+{
+	//Nothing is created before the first report is drawn
+	m_bInit = true;
+	return true;
+}
+
+bool CLiveLayer::createGL()
+{
+	//0) Program is shared by every view in the share group
+	if (!m_pShaders)
+		m_pShaders = COverlayLayer::InitShaders(gwLiveVS, gwOverlayFS);
+
+	if (!m_pShaders)
+		return false;
+
+	//1) Corners of the sprite, the instance buffer and its VAO
+	m_pCorners = std::make_shared<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
+	if (!m_pCorners->create())
+		return false;
+
+	m_pCorners->bind();
+	m_pCorners->setUsagePattern(QOpenGLBuffer::StaticDraw);
+	m_pCorners->allocate(gfLiveCorners, sizeof(gfLiveCorners));
+
+	m_pObjects = std::make_shared<CGrowableBuffer>(sizeof(TLiveVertex));
+	m_pVAO = std::make_shared<QOpenGLVertexArrayObject>();
+	if (!m_pVAO->create())
+		return false;
+
+	m_bCreated = true;
+	return true;
+}
+
+void CLiveLayer::update(const std::vector<TFeedUpdate>& vUpdates)
+{
+	if (vUpdates.empty())
+		return;
+
+	//0) Mercator on the calling thread, the frame only copies
+	auto pMath = CBingGeoTextureProvider::get()->getMath();
+	std::vector<TPending> vBatch(vUpdates.size());
+	for (size_t i = 0; i < vUpdates.size(); ++i) {
+		auto spMerc = pMath->wgs2merc(vUpdates[i].qpPosition.x(), vUpdates[i].qpPosition.y());
+		vBatch[i] = { vUpdates[i].uiObject, spMerc.first, spMerc.second, vUpdates[i].nTime };
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		if (m_vPending.size() > gszLivePending) {
+			CStatistics::get()->add("live.dropped", (qint64)m_vPending.size());
+			m_vPending.clear();
+		}
+
+		m_vPending.insert(m_vPending.end(), vBatch.begin(), vBatch.end());
+		m_bPending = true;
+	}
+}
+
+size_t CLiveLayer::size()
+{
+	return m_szObjects;
+}
+
+bool CLiveLayer::animating()
+{
+	//Nothing to take and every object has arrived: the frames would all look the same
+	return m_bPending || (m_Clock.nsecsElapsed() / 1e9 < m_dbMovingUntil);
+}
+
+void CLiveLayer::draw(const QMatrix4x4& qmWorld, const TMercatorTransform& transform, const QSize& qsViewport)
+{
+	//Nothing is drawn before the first report
+	if (!m_bInit || !transform.bValid || (!m_bCreated && !m_bPending))
+		return;
+
+	if (!m_bCreated && !createGL()) {
+		m_bInit = false;
+		return;
+	}
+
+	CTraceScope scope("live");
+	double dbNow = m_Clock.nsecsElapsed() / 1e9;
+	if (dbNow - m_dbBase > gdbLiveRebase)
+		rebase(dbNow);
+
+	float fNow = (float)(dbNow - m_dbBase);
+	apply(fNow);
+	upload();
+	if (!m_pObjects->count())
+		return;
+
+	m_pShaders->bind();
+	COverlayLayer::setUniforms(m_pShaders, qmWorld, transform, qsViewport);
+	m_pShaders->setUniformValue("now", fNow);
+	m_pShaders->setUniformValue("color", QColor(Qt::yellow));
+	m_pShaders->setUniformValue("size", gfLiveSize);
+
+	auto* pFunc = QOpenGLContext::currentContext()->extraFunctions();
+	m_pVAO->bind();
+	pFunc->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)m_pObjects->count());
+	m_pVAO->release();
+}
+
+void CLiveLayer::apply(const float& fNow)
+{
+	//0) A frame never waits for the feed: if it holds the lock, the updates are taken by the next frame
+	{
+		std::unique_lock<std::mutex> lock(m_Lock, std::try_to_lock);
+		if (!lock.owns_lock()) {
+			static CStatCounter statDeferred("live.deferred");
+			statDeferred.add(1);
+			return;
+		}
+
+		m_vApplying.swap(m_vPending);
+		m_bPending = false;
+	}
+
+	if (m_vApplying.empty())
+		return;
+
+	auto szUploaded = m_pObjects->count();
+	for (const auto& it : m_vApplying) {
+		auto itSlot = m_mSlots.find(it.uiObject);
+		if (itSlot == m_mSlots.end()) {
+			//1) A new object shows up where it is reported, it goes to the GPU with the other new ones
+			TLiveVertex vertex;
+			COverlayLayer::splitDouble(it.dbX, vertex.fTo[0], vertex.fTo[2]);
+			COverlayLayer::splitDouble(it.dbY, vertex.fTo[1], vertex.fTo[3]);
+			std::copy(std::begin(vertex.fTo), std::end(vertex.fTo), vertex.fFrom);
+			vertex.fTime[0] = vertex.fTime[1] = fNow;
+
+			m_mSlots.emplace(it.uiObject, (uint)m_vVertices.size());
+			m_vVertices.push_back(vertex);
+			m_vReported.push_back(it.nTime);
+			m_vbDirty.push_back(false);
+			continue;
+		}
+
+		auto uiSlot = itSlot->second;
+		if (it.nTime < m_vReported[uiSlot])
+			continue;
+
+		//2) The move starts where the object is drawn now and lasts as long as the report interval
+		auto& vertex = m_vVertices[uiSlot];
+		float fProgress = (vertex.fTime[1] > vertex.fTime[0]) ?
+			std::min(std::max((fNow - vertex.fTime[0]) / (vertex.fTime[1] - vertex.fTime[0]), 0.f), 1.f) : 1.f;
+		for (int i = 0; i < 2; ++i) {
+			double dbFrom = (double)vertex.fFrom[i] + vertex.fFrom[i + 2];
+			double dbTo = (double)vertex.fTo[i] + vertex.fTo[i + 2];
+			COverlayLayer::splitDouble(dbFrom + (dbTo - dbFrom) * fProgress, vertex.fFrom[i], vertex.fFrom[i + 2]);
+		}
+
+		COverlayLayer::splitDouble(it.dbX, vertex.fTo[0], vertex.fTo[2]);
+		COverlayLayer::splitDouble(it.dbY, vertex.fTo[1], vertex.fTo[3]);
+		float fInterval = (float)(it.nTime - m_vReported[uiSlot]) / 1000.f;
+		vertex.fTime[0] = fNow;
+		vertex.fTime[1] = fNow + std::min(std::max(fInterval, gfLiveMinInterval), gfLiveMaxInterval);
+		m_dbMovingUntil = std::max(m_dbMovingUntil, m_dbBase + vertex.fTime[1]);
+		m_vReported[uiSlot] = it.nTime;
+
+		if ((uiSlot < szUploaded) && !m_vbDirty[uiSlot]) {
+			m_vbDirty[uiSlot] = true;
+			m_vDirty.push_back(uiSlot);
+		}
+	}
+
+	static CStatCounter statApplied("live.applied");
+	statApplied.add((qint64)m_vApplying.size());
+	m_vApplying.clear();
+	m_szObjects = m_vVertices.size();
+}
+
+void CLiveLayer::rebase(const double& dbNow)
+{
+	//Finished moves are only ever drawn at their end, the ones still going are a few seconds long at most
+	auto fShift = (float)(dbNow - m_dbBase);
+	for (auto& it : m_vVertices) {
+		if (it.fTime[1] <= fShift)
+			it.fTime[0] = it.fTime[1] = 0.f;
+		else {
+			it.fTime[0] -= fShift;
+			it.fTime[1] -= fShift;
+		}
+	}
+
+	m_dbBase += fShift;
+
+	//Every instance on the GPU changed, upload() joins them into one write
+	for (size_t i = 0; i < m_pObjects->count(); ++i) {
+		if (!m_vbDirty[i]) {
+			m_vbDirty[i] = true;
+			m_vDirty.push_back((uint)i);
+		}
+	}
+}
+
+void CLiveLayer::upload()
+{
+	//0) Changed objects in runs: a few unchanged instances in between cost less than another write
+	std::sort(m_vDirty.begin(), m_vDirty.end());
+	qint64 nBytes = 0, nWrites = 0;
+	for (size_t i = 0; i < m_vDirty.size();) {
+		auto uiFirst = m_vDirty[i];
+		auto uiLast = uiFirst;
+		while ((++i < m_vDirty.size()) && (m_vDirty[i] - uiLast <= gszLiveWriteGap))
+			uiLast = m_vDirty[i];
+
+		m_pObjects->write(uiFirst, &m_vVertices[uiFirst], uiLast - uiFirst + 1);
+		nBytes += (uiLast - uiFirst + 1) * sizeof(TLiveVertex);
+		++nWrites;
+	}
+
+	for (auto it : m_vDirty)
+		m_vbDirty[it] = false;
+
+	m_vDirty.clear();
+
+	//1) New objects go at the end. Attribute pointers are set again only when the storage moved
+	auto szUploaded = m_pObjects->count();
+	if (m_vVertices.size() > szUploaded) {
+		nBytes += (m_vVertices.size() - szUploaded) * sizeof(TLiveVertex);
+		++nWrites;
+		if (m_pObjects->append(&m_vVertices[szUploaded], m_vVertices.size() - szUploaded))
+			bindAttributes();
+	}
+
+	if (nWrites) {
+		static CStatCounter statBytes("live.written.bytes");
+		static CStatCounter statWrites("live.writes");
+		static CStatCounter statObjects("live.objects");
+		statBytes.add(nBytes);
+		statWrites.add(nWrites);
+		statObjects.set((qint64)m_vVertices.size());
+	}
+}
+
+void CLiveLayer::bindAttributes()
+{
+	auto* pFunc = QOpenGLContext::currentContext()->extraFunctions();
+	m_pVAO->bind();
+
+	//Corner
+	m_pCorners->bind();
+	pFunc->glEnableVertexAttribArray(0);
+	pFunc->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), nullptr);
+
+	//Per instance: mercator hi/lo of both ends of the move, its start and end
+	m_pObjects->bind();
+	GLsizei nStride = sizeof(TLiveVertex);
+	pFunc->glEnableVertexAttribArray(1);
+	pFunc->glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, nStride, reinterpret_cast<void*>(offsetof(TLiveVertex, fFrom)));
+	pFunc->glEnableVertexAttribArray(2);
+	pFunc->glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, nStride, reinterpret_cast<void*>(offsetof(TLiveVertex, fTo)));
+	pFunc->glEnableVertexAttribArray(3);
+	pFunc->glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, nStride, reinterpret_cast<void*>(offsetof(TLiveVertex, fTime)));
+
+	for (GLuint i = 1; i <= 3; ++i)
+		pFunc->glVertexAttribDivisor(i, 1);
+
+	m_pVAO->release();
+}
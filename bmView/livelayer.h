@@ -0,0 +1,61 @@
+#pragma once
+#include "intfs.h"
+#include "overlay.h"
+
+//Moving objects, one sprite instance each. A frame rewrites only the instances of the objects reported since the last one,
+//the vertex shader moves every object from where it was drawn to its reported position over its report interval
+class CLiveLayer : public ILiveLayer {
+public:
+	CLiveLayer();
+protected: //ILiveLayer
+	bool initGL() override;
+	void update(const std::vector<TFeedUpdate>& vUpdates) override;
+	size_t size() override;
+	bool animating() override;
+	void draw(const QMatrix4x4& qmWorld, const TMercatorTransform& transform, const QSize& qsViewport) override;
+private:
+	struct TLiveVertex {
+		GLfloat fFrom[4];
+		GLfloat fTo[4];
+		//Render clock, seconds from m_dbBase: the move from fFrom to fTo starts and ends
+		GLfloat fTime[2];
+	};
+	struct TPending {
+		quint64 uiObject;
+		double dbX, dbY;
+		qint64 nTime;
+	};
+	//The feed appends to one vector, a frame swaps it for the other one and applies it
+	std::mutex m_Lock;
+	std::vector<TPending> m_vPending;
+	std::vector<TPending> m_vApplying;
+	//Set under m_Lock by the feed, cleared by the frame that takes the updates
+	std::atomic<bool> m_bPending{ false };
+	std::atomic<size_t> m_szObjects{ 0 };
+	bool m_bInit = false;
+	bool m_bCreated = false;
+	QElapsedTimer m_Clock;
+
+	//GUI thread: slot of every object, CPU copy of the instances and the source time of the last report
+	std::map<quint64, uint> m_mSlots;
+	std::vector<TLiveVertex> m_vVertices;
+	std::vector<qint64> m_vReported;
+	//Render clock, seconds: the instance times start at, the last of the moves ends
+	double m_dbBase = 0.0;
+	double m_dbMovingUntil = 0.0;
+	//Slots already on the GPU that changed
+	std::vector<uint> m_vDirty;
+	std::vector<bool> m_vbDirty;
+
+	static std::shared_ptr<QOpenGLShaderProgram> m_pShaders;
+	std::shared_ptr<QOpenGLBuffer> m_pCorners;
+	std::shared_ptr<QOpenGLVertexArrayObject> m_pVAO;
+	std::shared_ptr<CGrowableBuffer> m_pObjects;
+private:
+	bool createGL();
+	void apply(const float& fNow);
+	//Instance times relative to the render clock at dbNow, so float keeps them exact however long the layer lives
+	void rebase(const double& dbNow);
+	void upload();
+	void bindAttributes();
+};
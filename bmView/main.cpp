@@ -2,16 +2,335 @@
 #include "bmview.h"
 #include <QtWidgets/QApplication>
 #include "intfs.h"
+#include "bench.h"
+#include "seed.h"
+#include "diskcache.h"
+#include "sharedcache.h"
+#include "memcache.h"
+#include "tileserver.h"
+#include "staticmap.h"
+#include "mapexport.h"
+#include "geotex.h"
+#include "layers.h"
+#include "terrain.h"
+#include "quadmap.h"
+#include "trace.h"
+#include "feed.h"
+#include "dataset.h"
+
+namespace {
+	//"lat,lon;lat,lon;..." or "lat0,lon0,lat1,lon1"
+	std::vector<QPointF> parseArea(const QString& qsArea)
+	{
+		std::vector<double> vValues;
+		for (const auto& it : qsArea.split(QRegularExpression("[,; ]"), QString::SkipEmptyParts))
+			vValues.push_back(it.toDouble());
+
+		std::vector<QPointF> vPoints;
+		for (size_t i = 0; i + 1 < vValues.size(); i += 2)
+			vPoints.emplace_back(vValues[i], vValues[i + 1]);
+
+		return vPoints;
+	}
+
+	//"lat,lon,zoom"
+	bool parsePane(const QString& qsPane, QPointF& qpCenter, uint& uiZoomLevel)
+	{
+		auto qslValues = qsPane.split(',');
+		if (qslValues.size() != 3)
+			return false;
+
+		bool bLat = false, bLon = false, bZoom = false;
+		qpCenter = QPointF(qslValues[0].toDouble(&bLat), qslValues[1].toDouble(&bLon));
+		uiZoomLevel = qslValues[2].toUInt(&bZoom);
+		return bLat && bLon && bZoom && (std::abs(qpCenter.x()) <= 90.0) && (std::abs(qpCenter.y()) <= 180.0);
+	}
+
+	//"name=source[,opacity]", the source is a Bing imagery set or a uri template with {quadkey}
+	bool addLayer(const QString& qsLayer)
+	{
+		auto nEq = qsLayer.indexOf('=');
+		if (nEq <= 0)
+			return false;
+
+		TGeoLayer layer;
+		layer.qsName = qsLayer.left(nEq);
+		auto qsSource = qsLayer.mid(nEq + 1);
+
+		bool bOpacity = false;
+		auto nComma = qsSource.lastIndexOf(',');
+		auto fOpacity = (nComma < 0) ? 0.f : qsSource.mid(nComma + 1).toFloat(&bOpacity);
+		if (bOpacity) {
+			layer.fOpacity = std::min(std::max(fOpacity, 0.f), 1.f);
+			qsSource.truncate(nComma);
+		}
+
+		bool bUri = qsSource.contains("{quadkey}");
+		layer.pProvider = CBingGeoTextureProvider::create(bUri ? QString() : qsSource, bUri ? qsSource : QString(), layer.qsName);
+
+		return CGeoLayers::get()->add(layer);
+	}
+
+	//Random points around a few hot spots in the lat0,lon0,lat1,lon1 area, as real point data usually clusters
+	std::vector<QPointF> makeHeatmap(const std::vector<QPointF>& vArea, const size_t& szCount)
+	{
+		std::vector<QPointF> vPoints;
+		if ((vArea.size() != 2) || !szCount)
+			return vPoints;
+
+		std::mt19937 rng(42);
+		std::uniform_real_distribution<double> dLat(vArea[0].x(), vArea[1].x()), dLon(vArea[0].y(), vArea[1].y());
+		std::vector<QPointF> vSpots(8);
+		for (auto& it : vSpots)
+			it = QPointF(dLat(rng), dLon(rng));
+
+		std::uniform_int_distribution<size_t> dSpot(0, vSpots.size() - 1);
+		std::normal_distribution<double> dLatOffset(0.0, std::abs(vArea[1].x() - vArea[0].x()) / 12.0);
+		std::normal_distribution<double> dLonOffset(0.0, std::abs(vArea[1].y() - vArea[0].y()) / 12.0);
+		vPoints.reserve(szCount);
+		for (size_t i = 0; i < szCount; ++i) {
+			const auto& qpSpot = vSpots[dSpot(rng)];
+			vPoints.emplace_back(qpSpot.x() + dLatOffset(rng), qpSpot.y() + dLonOffset(rng));
+		}
+
+		return vPoints;
+	}
+}
 
 int main(int argc, char *argv[])
 {
+	//All map views share one context group: tile textures and shaders are created once
+	QApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
 	QApplication a(argc, argv);
 
-	concurrency::SchedulerPolicy sp(1, concurrency::MaxConcurrency, 10);
-	concurrency::CurrentScheduler::Create(sp);
+	QCommandLineParser parser;
+	parser.addHelpOption();
+	parser.addOption({ "panes", "Number of map panes in the window.", "count", "1" });
+	parser.addOption({ "pane", "Start of the next pane: lat,lon,zoom. Repeat for every pane, adds panes beyond --panes.", "view" });
+	parser.addOption({ "stats", "Log the statistics every second." });
+	parser.addOption({ "trace", "Trace tile loading and frames, written as a trace event JSON file (Perfetto) on exit.", "path" });
+	parser.addOption({ "bench", "Run benchmarks whose name starts with the filter and exit.", "filter" });
+	parser.addOption({ "bench-json", "Write the benchmark results as JSON to the file, - for stdout.", "path" });
+	parser.addOption({ "bench-baseline", "Compare the benchmark timings with the JSON results of an earlier run.", "path" });
+	parser.addOption({ "cache-dir", "Disk tile cache directory.", "path" });
+	parser.addOption({ "ram-cache", "Encoded tiles kept in RAM in front of the disk cache, 0 - none.", "MB", "64" });
+	parser.addOption({ "shared-cache", "Share fetched tiles with the other bmView processes on this machine in shared memory of this size.", "MB" });
+	parser.addOption({ "seed", "Fill the disk cache for an area and exit." });
+	parser.addOption({ "bbox", "Seeding, export, heatmap or synthetic feed area: lat0,lon0,lat1,lon1.", "bbox" });
+	parser.addOption({ "polygon", "Seeding area: lat,lon;lat,lon;...", "points" });
+	parser.addOption({ "zoom", "Seeding zoom levels: A-B. Export uses the last one.", "range", "1-12" });
+	parser.addOption({ "jobs", "Parallel seeding requests.", "count", "8" });
+	parser.addOption({ "retries", "Retries per tile.", "count", "2" });
+	parser.addOption({ "tile-url", "Tile uri template with {quadkey}, overrides the imagery metadata.", "uri" });
+	parser.addOption({ "layer", "Layer over the imagery: name=imagery set or uri template[,opacity]. Up to 3.", "layer" });
+	parser.addOption({ "mixed-zoom", "Pick tiles of mixed zoom levels by screen-space error instead of the fixed grid." });
+	parser.addOption({ "terrain", "Local elevation tiles (terrain-RGB or 16 bit greyscale): path with {z}/{x}/{y} or {quadkey}.", "path" });
+	parser.addOption({ "render", "Render the static map jobs from the list (one JSON object per line) and exit.", "jobs" });
+	parser.addOption({ "export", "Render the --bbox area at the --zoom level into a .tif or .png of any size and exit.", "path" });
+	parser.addOption({ "heatmap", "Show that many random points in the --bbox area as a heatmap.", "count" });
+	parser.addOption({ "feed", "Show moving objects from a replay log or a local socket server.", "source" });
+	parser.addOption({ "feed-speed", "Replay speed of the --feed log, 0 - as fast as it is read.", "factor", "1" });
+	parser.addOption({ "feed-serve", "Run a synthetic moving object feed on the local socket.", "name" });
+	parser.addOption({ "feed-write", "Write a synthetic moving object replay log and exit.", "path" });
+	parser.addOption({ "feed-objects", "Synthetic feed: moving objects.", "count", "10000" });
+	parser.addOption({ "feed-rate", "Synthetic feed: reports per second, all objects together.", "count", "100000" });
+	parser.addOption({ "feed-seconds", "Synthetic feed: length of the replay log.", "seconds", "60" });
+	parser.addOption({ "dataset", "Show the points of a dataset file, or with --import the file to write.", "path" });
+	parser.addOption({ "import", "Convert a CSV or GeoJSON file of points into the --dataset file and exit.", "path" });
+	parser.addOption({ "contexts", "Offscreen contexts used for rendering.", "count", "4" });
+	parser.addOption({ "serve-tiles", "Run a stand-in tile server at the address.", "address" });
+	parser.addOption({ "fail-rate", "Stand-in server: share of failed requests.", "rate", "0" });
+	parser.addOption({ "latency", "Stand-in server: response delay.", "ms", "0" });
+	parser.process(a);
+
+	//First, so that every thread that records finds tracing on
+	if (parser.isSet("trace")) {
+		CTracer::setEnabled(true);
+		CTracer::setThreadName("gui");
+		QObject::connect(&a, &QCoreApplication::aboutToQuit, [qsPath = parser.value("trace")] {
+			if (!CTracer::write(qsPath))
+				qWarning() << "Trace can't be written:" << qsPath;
+		});
+	}
+
+	if (parser.isSet("cache-dir"))
+		CDiskTileCache::setRoot(parser.value("cache-dir"));
+
+	CMemoryTileCache::setBudget(parser.value("ram-cache").toLongLong() * 1024 * 1024);
+	if (parser.isSet("shared-cache"))
+		CSharedTileCache::setBudget(parser.value("shared-cache").toLongLong() * 1024 * 1024);
+
+	if (parser.isSet("tile-url"))
+		CBingGeoTextureProvider::setUriTemplate(parser.value("tile-url"));
+
+	CQuadTileMap::setEnabled(parser.isSet("mixed-zoom"));
+
+	if (parser.isSet("terrain"))
+		CTerrain::setSource(parser.value("terrain"));
+
+	for (const auto& it : parser.values("layer")) {
+		if (!addLayer(it))
+			qWarning() << "Layer is ignored:" << it;
+	}
+
+	if (parser.isSet("bench")) {
+		//The tile map benchmark must not wait for the imagery metadata, its tile requests go to a closed port
+		if (!parser.isSet("tile-url"))
+			CBingGeoTextureProvider::setUriTemplate("http://127.0.0.1:9/{quadkey}");
+
+		return CBenchmark(parser.value("bench"), parser.value("bench-json"), parser.value("bench-baseline")).run();
+	}
+
+	if (parser.isSet("serve-tiles")) {
+		CTileStandInServer server(parser.value("serve-tiles"), parser.value("fail-rate").toDouble(), parser.value("latency").toUInt());
+		if (!server.start())
+			return 1;
+
+		return a.exec();
+	}
+
+	if (parser.isSet("feed-write") || parser.isSet("feed-serve")) {
+		auto vArea = parseArea(parser.isSet("bbox") ? parser.value("bbox") : QString("55.60,37.40,55.90,37.80"));
+		CFeedGenerator generator(vArea, parser.value("feed-objects").toUInt(), parser.value("feed-rate").toUInt());
+		if (parser.isSet("feed-write"))
+			return generator.write(parser.value("feed-write"), parser.value("feed-seconds").toDouble());
+
+		if (!generator.serve(parser.value("feed-serve")))
+			return 1;
+
+		return a.exec();
+	}
+
+	if (parser.isSet("import")) {
+		if (!parser.isSet("dataset")) {
+			qCritical() << "Import needs --dataset output";
+			return 1;
+		}
+
+		return CDatasetImporter(parser.value("import"), parser.value("dataset")).run();
+	}
+
+	if (parser.isSet("seed")) {
+		TSeedOptions options;
+		options.vArea = parseArea(parser.isSet("polygon") ? parser.value("polygon") : parser.value("bbox"));
+		auto qslZoom = parser.value("zoom").split('-');
+		options.uiMinZoom = qslZoom.first().toUInt();
+		options.uiMaxZoom = qslZoom.last().toUInt();
+		options.uiJobs = parser.value("jobs").toUInt();
+		options.uiRetries = parser.value("retries").toUInt();
+		options.qsUriTemplate = parser.value("tile-url");
+
+		return CTileSeeder(options).run();
+	}
+
+	if (parser.isSet("render"))
+		return CStaticMapBatch(parser.value("render"), parser.value("contexts").toUInt()).run();
+
+	if (parser.isSet("export")) {
+		auto vArea = parseArea(parser.value("bbox"));
+		if (vArea.size() != 2) {
+			qCritical() << "Export needs --bbox lat0,lon0,lat1,lon1";
+			return 1;
+		}
+
+		TExportJob job;
+		job.qpMin = vArea[0];
+		job.qpMax = vArea[1];
+		job.uiZoomLevel = parser.value("zoom").split('-').last().toUInt();
+		job.qsOutput = parser.value("export");
+
+		return CMapExport(job).run();
+	}
+
+	std::vector<QPointF> vHeatmap;
+	if (parser.isSet("heatmap"))
+		vHeatmap = makeHeatmap(parseArea(parser.value("bbox")), parser.value("heatmap").toULongLong());
+
+	//One mapping for every view
+	IPointDatasetPtr pDataset;
+	if (parser.isSet("dataset")) {
+		pDataset = CPointDataset::open(parser.value("dataset"));
+		if (!pDataset)
+			return 1;
+	}
+
+	//Stopped before the views go, its thread hands updates to their layers
+	std::unique_ptr<CObjectFeed> pFeed;
+	if (parser.isSet("feed")) {
+		pFeed = std::make_unique<CObjectFeed>(parser.value("feed"), parser.value("feed-speed").toDouble());
+		QObject::connect(&a, &QCoreApplication::aboutToQuit, [&pFeed] { pFeed->stop(); });
+	}
+
+	//One report for the process however many panes it has
+	QTimer statsTimer;
+	if (parser.isSet("stats")) {
+		QObject::connect(&statsTimer, &QTimer::timeout, [] { bmView::reportStats(); });
+		statsTimer.start(1000);
+	}
+
+	//Pane i opens where the i-th --pane says, the others at the default place
+	auto qslPanes = parser.values("pane");
+	auto start = [&qslPanes](bmView* pView, const int& nPane) {
+		if (nPane >= qslPanes.size())
+			return;
+
+		QPointF qpCenter;
+		uint uiZoomLevel = 0;
+		if (parsePane(qslPanes[nPane], qpCenter, uiZoomLevel))
+			pView->setStart(qpCenter, uiZoomLevel);
+		else
+			qWarning() << "Pane start is ignored:" << qslPanes[nPane];
+	};
+
+	int nPanes = std::max({ 1, parser.value("panes").toInt(), qslPanes.size() });
+	if (1 == nPanes) {
+		auto pView = std::make_shared<bmView>();
+		start(pView.get(), 0);
+
+		IGlobalRendererPtr pRender = pView;
+		pRender->init();
+		if (!vHeatmap.empty())
+			pRender->getHeatmap()->addPoints(vHeatmap, 1.f);
+
+		if (pDataset)
+			pRender->getDatasetLayer()->setDataset(pDataset, Qt::cyan, 4.f);
+
+		if (pFeed) {
+			pFeed->addLayer(pRender->getLiveLayer());
+			pFeed->start();
+		}
+
+		return a.exec();
+	}
+
+	//Window must outlive the panes it parents
+	QWidget wndPanes;
+	auto pLayout = new QGridLayout(&wndPanes);
+	pLayout->setSpacing(2);
+	pLayout->setContentsMargins(0, 0, 0, 0);
+
+	int nColumns = (int)std::ceil(std::sqrt((double)nPanes));
+	std::vector<IGlobalRendererPtr> vPanes;
+	for (int i = 0; i < nPanes; ++i) {
+		auto pView = std::make_shared<bmView>(&wndPanes);
+		start(pView.get(), i);
+		pLayout->addWidget(pView.get(), i / nColumns, i % nColumns);
+
+		vPanes.push_back(pView);
+		vPanes.back()->init();
+		if (!vHeatmap.empty())
+			vPanes.back()->getHeatmap()->addPoints(vHeatmap, 1.f);
+
+		if (pDataset)
+			vPanes.back()->getDatasetLayer()->setDataset(pDataset, Qt::cyan, 4.f);
+
+		if (pFeed)
+			pFeed->addLayer(vPanes.back()->getLiveLayer());
+	}
 
-	IGlobalRendererPtr pRender = std::make_shared<bmView>();
-	pRender->init();
+	if (pFeed)
+		pFeed->start();
 
+	wndPanes.showMaximized();
 	return a.exec();
 }
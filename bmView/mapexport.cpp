@@ -0,0 +1,216 @@
+#include "mapexport.h"
+#include "imagewriter.h"
+#include "geotex.h"
+#include "sched.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+CMapExport::CMapExport(const TExportJob& job) : m_Job(job)
+{
+}
+
+int CMapExport::run()
+{
+	//0) Area in pixels of the zoom level, from the north-west corner
+	auto pMath = CBingGeoTextureProvider::get()->getMath();
+	auto pxNW = pMath->wgs2pix(std::max(m_Job.qpMin.x(), m_Job.qpMax.x()), std::min(m_Job.qpMin.y(), m_Job.qpMax.y()), m_Job.uiZoomLevel);
+	auto pxSE = pMath->wgs2pix(std::min(m_Job.qpMin.x(), m_Job.qpMax.x()), std::max(m_Job.qpMin.y(), m_Job.qpMax.y()), m_Job.uiZoomLevel);
+	m_qrArea = QRect(QPoint(pxNW.first, pxNW.second), QPoint(pxSE.first, pxSE.second));
+	if (m_qrArea.isEmpty()) {
+		qCritical() << "The export area is empty";
+		return 1;
+	}
+
+	//1) PNG keeps a band of whole rows in memory, so its chunks are short. TIFF tiles need chunks in whole tiles
+	bool bPng = !QFileInfo(m_Job.qsOutput).suffix().compare("png", Qt::CaseInsensitive);
+	m_qsChunk = bPng ? QSize(2048, 256) : QSize(2048, 1024);
+	m_nColumns = (m_qrArea.width() + m_qsChunk.width() - 1) / m_qsChunk.width();
+	m_nRows = (m_qrArea.height() + m_qsChunk.height() - 1) / m_qsChunk.height();
+
+	m_pWriter = bPng ? IImageWriterPtr(std::make_shared<CPngStreamWriter>()) : IImageWriterPtr(std::make_shared<CTiffStreamWriter>());
+	if (!m_pWriter->open(m_Job.qsOutput, m_qrArea.size(), m_qsChunk)) {
+		qCritical() << "Cannot write" << m_Job.qsOutput;
+		return 1;
+	}
+
+	double dbMegapixels = (double)m_qrArea.width() * m_qrArea.height() / 1e6;
+	qInfo().noquote() << QString("Exporting %1 x %2 px (%3 Mpx) at zoom %4 in %5 chunks")
+		.arg(m_qrArea.width()).arg(m_qrArea.height()).arg(dbMegapixels, 0, 'f', 1).arg(m_Job.uiZoomLevel).arg(chunks());
+
+	QElapsedTimer timer;
+	timer.start();
+
+	m_pRenderer = std::make_shared<COffscreenRenderer>();
+	renderNext();
+
+	auto megapixelsPerSecond = [&] {
+		double dbDone = (double)m_szWritten * m_qsChunk.width() * m_qsChunk.height() / 1e6;
+		return std::min(dbDone, dbMegapixels) * 1000.0 / std::max<qint64>(1, timer.elapsed());
+	};
+
+	QTimer progress;
+	QObject::connect(&progress, &QTimer::timeout, [&] {
+		qInfo().noquote() << QString("%1/%2 chunks, %3 Mpx/s, %4 MB of images held")
+			.arg(m_szWritten).arg(chunks()).arg(megapixelsPerSecond(), 0, 'f', 2).arg(m_nHeldBytes / (1024.0 * 1024.0), 0, 'f', 1);
+	});
+	progress.start(1000);
+
+	if (!finished())
+		m_Loop.exec();
+
+	progress.stop();
+	m_pRenderer.reset();
+
+	bool bClosed = m_pWriter->close();
+	if (m_bFailed || !bClosed) {
+		qCritical() << "Export failed after" << m_szWritten << "chunks:" << m_Job.qsOutput;
+		QFile::remove(m_Job.qsOutput);
+		return 2;
+	}
+
+	double dbSeconds = timer.elapsed() / 1000.0;
+	double dbFileMB = QFileInfo(m_Job.qsOutput).size() / (1024.0 * 1024.0);
+	qInfo().noquote() << QString("Done: %1 Mpx in %2 s, %3 Mpx/s, %4 MB/s written, %5 chunks with missing tiles")
+		.arg(dbMegapixels, 0, 'f', 1).arg(dbSeconds, 0, 'f', 2).arg(megapixelsPerSecond(), 0, 'f', 2)
+		.arg((dbSeconds > 0.0) ? dbFileMB / dbSeconds : 0.0, 0, 'f', 1).arg(m_szIncomplete);
+	qInfo().noquote() << QString("Peak memory: %1 MB of chunk images, %2 MB resident")
+		.arg(m_nPeakHeldBytes / (1024.0 * 1024.0), 0, 'f', 1).arg(peakMemory() / (1024.0 * 1024.0), 0, 'f', 1);
+
+	return 0;
+}
+
+size_t CMapExport::chunks() const
+{
+	return (size_t)m_nColumns * m_nRows;
+}
+
+QPoint CMapExport::origin(const size_t& szChunk) const
+{
+	return QPoint((int)(szChunk % m_nColumns) * m_qsChunk.width(), (int)(szChunk / m_nColumns) * m_qsChunk.height());
+}
+
+void CMapExport::renderNext()
+{
+	//A rendered chunk waiting for the encoder is enough, another one would only take memory
+	if (m_bFailed || (m_szNext >= chunks()) || m_Waiting || m_pRenderer->busy())
+		return;
+
+	//0) Chunk at full size, centred on its middle pixel: the renderer puts the centre exactly in the middle of the image
+	size_t szChunk = m_szNext++;
+	auto qpCenter = m_qrArea.topLeft() + origin(szChunk) + QPoint(m_qsChunk.width() / 2, m_qsChunk.height() / 2);
+	auto wgsCenter = CBingGeoTextureProvider::get()->getMath()->pix2wgs(qpCenter.x(), qpCenter.y(), m_Job.uiZoomLevel);
+
+	TStaticMapJob job;
+	job.qpCenter = QPointF(wgsCenter.first, wgsCenter.second);
+	job.uiZoomLevel = m_Job.uiZoomLevel;
+	job.qsSize = m_qsChunk;
+	job.nTimeout = m_Job.nTimeout;
+
+	bool bStarted = m_pRenderer->render(job, [this, szChunk](const QImage& img, bool bComplete) {
+		onRendered(szChunk, img, bComplete);
+	});
+
+	if (!bStarted) {
+		qWarning() << "Cannot render chunk" << szChunk;
+		m_bFailed = true;
+		if (finished())
+			m_Loop.quit();
+	}
+}
+
+void CMapExport::onRendered(const size_t& szChunk, const QImage& img, const bool& bComplete)
+{
+	if (!bComplete)
+		++m_szIncomplete;
+
+	if (img.isNull()) {
+		qWarning() << "Chunk" << szChunk << "was not rendered";
+		m_bFailed = true;
+	}
+
+	if (m_bFailed) {
+		if (finished())
+			m_Loop.quit();
+
+		return;
+	}
+
+	m_nHeldBytes += img.sizeInBytes();
+	m_nPeakHeldBytes = std::max(m_nPeakHeldBytes, m_nHeldBytes);
+
+	//0) Chunks go to the writer in the order they were rendered
+	TChunk chunk;
+	chunk.qpAt = origin(szChunk);
+	chunk.img = img;
+	if (m_bEncoding)
+		m_Waiting = chunk;
+	else
+		encode(chunk);
+
+	renderNext();
+}
+
+void CMapExport::encode(const TChunk& chunk)
+{
+	m_bEncoding = true;
+	auto pWriter = m_pWriter;
+	qint64 nBytes = chunk.img.sizeInBytes();
+	CJobScheduler::get()->post(EJobPriority::Background, pplx::cancellation_token::none(), [this, pWriter, chunk, nBytes]() {
+		bool bWritten = pWriter->write(chunk.img, chunk.qpAt);
+		QMetaObject::invokeMethod(qApp, [this, bWritten, nBytes] { onEncoded(bWritten, nBytes); }, Qt::QueuedConnection);
+	});
+}
+
+void CMapExport::onEncoded(const bool& bWritten, const qint64& nBytes)
+{
+	m_bEncoding = false;
+	m_nHeldBytes -= nBytes;
+	if (bWritten)
+		++m_szWritten;
+	else
+		m_bFailed = true;
+
+	if (m_Waiting) {
+		auto chunk = std::move(*m_Waiting);
+		m_Waiting.reset();
+		if (m_bFailed)
+			m_nHeldBytes -= chunk.img.sizeInBytes();
+		else
+			encode(chunk);
+	}
+
+	renderNext();
+	if (finished())
+		m_Loop.quit();
+}
+
+bool CMapExport::finished() const
+{
+	return !m_bEncoding && !m_pRenderer->busy() && (m_bFailed || (m_szWritten >= chunks()));
+}
+
+qint64 CMapExport::peakMemory()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+
+	return (qint64)counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+
+	//Kilobytes on Linux
+	return (qint64)usage.ru_maxrss * 1024;
+#endif
+}
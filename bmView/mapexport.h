@@ -0,0 +1,55 @@
+#pragma once
+#include "offscreen.h"
+
+struct TExportJob {
+	//Opposite corners as QPointF(lat, lon)
+	QPointF qpMin, qpMax;
+	uint uiZoomLevel = 18;
+	//.tif (BigTIFF when it needs to) or .png
+	QString qsOutput;
+	//Per chunk
+	int nTimeout = 30000;
+};
+
+//Renders an area too big for one framebuffer in chunks and streams them to disk, so the whole image is never in memory.
+//One chunk is encoded on the scheduler while the renderer already loads the tiles of the next one
+class CMapExport {
+public:
+	explicit CMapExport(const TExportJob& job);
+	int run();
+private:
+	struct TChunk {
+		QPoint qpAt;
+		QImage img;
+	};
+	TExportJob m_Job;
+	IImageWriterPtr m_pWriter = nullptr;
+	std::shared_ptr<COffscreenRenderer> m_pRenderer = nullptr;
+	//Pixels at the export zoom level
+	QRect m_qrArea;
+	QSize m_qsChunk;
+	int m_nColumns = 0;
+	int m_nRows = 0;
+
+	//GUI thread only. At most one chunk is encoded and one waits for it, the renderer holds back meanwhile
+	size_t m_szNext = 0;
+	size_t m_szWritten = 0;
+	size_t m_szIncomplete = 0;
+	bool m_bEncoding = false;
+	bool m_bFailed = false;
+	std::optional<TChunk> m_Waiting;
+	qint64 m_nHeldBytes = 0;
+	qint64 m_nPeakHeldBytes = 0;
+	QEventLoop m_Loop;
+private:
+	size_t chunks() const;
+	//Top left corner in the image, chunks go row by row
+	QPoint origin(const size_t& szChunk) const;
+	void renderNext();
+	void onRendered(const size_t& szChunk, const QImage& img, const bool& bComplete);
+	void encode(const TChunk& chunk);
+	void onEncoded(const bool& bWritten, const qint64& nBytes);
+	bool finished() const;
+	//Peak resident set of the process, bytes
+	static qint64 peakMemory();
+};
@@ -0,0 +1,152 @@
+#include "memcache.h"
+#include "sharedcache.h"
+#include "stats.h"
+#include "consts.h"
+
+std::mutex CMemoryTileCache::m_Lock;
+std::map<QString, IGeoTileCachePtr> CMemoryTileCache::m_mCaches;
+qint64 CMemoryTileCache::m_nBudget = gnMemoryTileBytes;
+qint64 CMemoryTileCache::m_nBytes = 0;
+std::list<CMemoryTileCache::TEntry> CMemoryTileCache::m_lEntries;
+std::map<QString, std::list<CMemoryTileCache::TEntry>::iterator> CMemoryTileCache::m_mEntries;
+
+IGeoTileCachePtr CMemoryTileCache::get(const QString& qsNamespace)
+{
+	auto pNext = CSharedTileCache::get(qsNamespace);
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	if (m_nBudget <= 0)
+		return pNext;
+
+	auto& pCache = m_mCaches[qsNamespace];
+	if (!pCache)
+		pCache = IGeoTileCachePtr(new CMemoryTileCache(pNext, qsNamespace));
+
+	return pCache;
+}
+
+void CMemoryTileCache::setBudget(const qint64& nBytes)
+{
+	m_nBudget = nBytes;
+}
+
+CMemoryTileCache::CMemoryTileCache(IGeoTileCachePtr pNext, const QString& qsNamespace) :
+	m_pNext(pNext), m_qsPrefix(qsNamespace + "/")
+{
+}
+
+bool CMemoryTileCache::contains(const QString& qsQuadKey)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		if (m_mEntries.count(m_qsPrefix + qsQuadKey))
+			return true;
+	}
+
+	return m_pNext->contains(qsQuadKey);
+}
+
+std::optional<TCachedTile> CMemoryTileCache::read(const QString& qsQuadKey)
+{
+	auto qsKey = m_qsPrefix + qsQuadKey;
+	std::optional<TCachedTile> cached;
+	{
+		//0) A hit only relinks its node, the bytes are shared with the copy handed out
+		std::lock_guard<std::mutex> lock(m_Lock);
+		auto it = m_mEntries.find(qsKey);
+		if (it != m_mEntries.end()) {
+			m_lEntries.splice(m_lEntries.begin(), m_lEntries, it->second);
+			cached = it->second->tile;
+		}
+	}
+
+	if (cached) {
+		static CStatCounter statHits("cache.memory.hits");
+		statHits.add(1);
+		cached->bStale = (cached->validators.nExpires <= QDateTime::currentSecsSinceEpoch());
+		return cached;
+	}
+
+	//1) Whatever the tiers below have is kept, stale copies too: they are revalidated like the ones on disk
+	static CStatCounter statMisses("cache.memory.misses");
+	statMisses.add(1);
+	cached = m_pNext->read(qsQuadKey);
+	if (cached) {
+		std::lock_guard<std::mutex> lock(m_Lock);
+		insert(qsKey, *cached);
+	}
+
+	return cached;
+}
+
+bool CMemoryTileCache::write(const QString& qsQuadKey, const QByteArray& qbData, const TTileValidators& validators)
+{
+	TCachedTile tile;
+	tile.qbData = qbData;
+	tile.validators = validators;
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		insert(m_qsPrefix + qsQuadKey, tile);
+	}
+
+	return m_pNext->write(qsQuadKey, qbData, validators);
+}
+
+bool CMemoryTileCache::refresh(const QString& qsQuadKey, const TTileValidators& validators)
+{
+	//The copy here goes, the next read takes the merged validators from below
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		remove(m_qsPrefix + qsQuadKey);
+	}
+
+	return m_pNext->refresh(qsQuadKey, validators);
+}
+
+void CMemoryTileCache::abandon(const QString& qsQuadKey)
+{
+	m_pNext->abandon(qsQuadKey);
+}
+
+void CMemoryTileCache::insert(const QString& qsKey, const TCachedTile& tile)
+{
+	//0) One tile may not push out a large part of the others
+	qint64 nBytes = tile.qbData.size() + qsKey.size() * (qint64)sizeof(QChar);
+	if (nBytes > m_nBudget / 16)
+		return;
+
+	remove(qsKey);
+	TEntry entry;
+	entry.qsKey = qsKey;
+	entry.tile = tile;
+	entry.tile.bStale = false;
+	entry.nBytes = nBytes;
+	m_lEntries.push_front(entry);
+	m_mEntries[qsKey] = m_lEntries.begin();
+	m_nBytes += nBytes;
+
+	//1) Least recently used go first
+	while (m_nBytes > m_nBudget) {
+		m_nBytes -= m_lEntries.back().nBytes;
+		m_mEntries.erase(m_lEntries.back().qsKey);
+		m_lEntries.pop_back();
+		static CStatCounter statEvictions("cache.memory.evictions");
+		statEvictions.add(1);
+	}
+
+	static CStatCounter statBytes("cache.memory.bytes");
+	static CStatCounter statTiles("cache.memory.tiles");
+	statBytes.set(m_nBytes);
+	statTiles.set((qint64)m_lEntries.size());
+}
+
+void CMemoryTileCache::remove(const QString& qsKey)
+{
+	auto it = m_mEntries.find(qsKey);
+	if (it == m_mEntries.end())
+		return;
+
+	m_nBytes -= it->second->nBytes;
+	m_lEntries.erase(it->second);
+	m_mEntries.erase(it);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "intfs.h"
+
+//Encoded tiles in RAM in front of the shared and disk tiers, so an evicted texture comes back with a decode and no I/O.
+//One LRU with a byte budget holds the tiles of every layer
+class CMemoryTileCache : public IGeoTileCache {
+public:
+	//Tiles of the namespace, the tiers below on a miss
+	static IGeoTileCachePtr get(const QString& qsNamespace = QString());
+	//Before the first get(). 0 - off
+	static void setBudget(const qint64& nBytes);
+protected: //IGeoTileCache
+	bool contains(const QString& qsQuadKey) override;
+	std::optional<TCachedTile> read(const QString& qsQuadKey) override;
+	bool write(const QString& qsQuadKey, const QByteArray& qbData, const TTileValidators& validators) override;
+	bool refresh(const QString& qsQuadKey, const TTileValidators& validators) override;
+	void abandon(const QString& qsQuadKey) override;
+private:
+	struct TEntry {
+		QString qsKey;
+		TCachedTile tile;
+		qint64 nBytes = 0;
+	};
+	CMemoryTileCache(IGeoTileCachePtr pNext, const QString& qsNamespace);
+	static std::mutex m_Lock;
+	static std::map<QString, IGeoTileCachePtr> m_mCaches;
+	static qint64 m_nBudget;
+	static qint64 m_nBytes;
+	//Most recently used first
+	static std::list<TEntry> m_lEntries;
+	static std::map<QString, std::list<TEntry>::iterator> m_mEntries;
+	IGeoTileCachePtr m_pNext;
+	QString m_qsPrefix;
+	//Under the lock
+	static void insert(const QString& qsKey, const TCachedTile& tile);
+	static void remove(const QString& qsKey);
+};
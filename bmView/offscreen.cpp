@@ -0,0 +1,300 @@
+#include "offscreen.h"
+#include "consts.h"
+#include "geotex.h"
+#include "overlay.h"
+#include "heatmap.h"
+#include "tilemap.h"
+#include "stats.h"
+#include "camera.h"
+
+COffscreenRenderer::~COffscreenRenderer()
+{
+	m_PollTimer.stop();
+
+	//GL objects of this renderer have to go while its context is current
+	if (m_pContext && m_pSurface && m_pContext->makeCurrent(m_pSurface.get())) {
+		m_pFBO.reset();
+		m_pOverlay = nullptr;
+		m_pHeatmap = nullptr;
+		m_pTiles = nullptr;
+		m_pContext->doneCurrent();
+	}
+}
+
+bool COffscreenRenderer::render(const TStaticMapJob& job, StaticMapCallback callback)
+{
+	if (m_bBusy || job.qsSize.isEmpty() || (job.qsSize.width() > maxSize().width()) || (job.qsSize.height() > maxSize().height()))
+		return false;
+
+	if (!m_pTiles)
+		init();
+
+	if (!initGL() || !resize(job.qsSize))
+		return false;
+
+	m_bBusy = true;
+	m_Job = job;
+	m_Callback = callback;
+
+	//0) Overlay of the previous job is dropped
+	m_pOverlay->clear();
+	for (const auto& it : job.vPolylines)
+		m_pOverlay->addPolyline(it, job.qcOverlay, 3.f);
+
+	if (!job.vPoints.empty())
+		m_pOverlay->addPoints(job.vPoints, job.qcOverlay, 8.f);
+
+	m_pHeatmap->clear();
+	if (!job.vHeatmap.empty())
+		m_pHeatmap->addPoints(job.vHeatmap, 1.f);
+
+	//1) Camera and tiles. Texture callbacks and the poll timer tell when the visible ones are there
+	m_pContext->makeCurrent(m_pSurface.get());
+	place(job);
+	m_pContext->doneCurrent();
+
+	m_JobTimer.start();
+	m_PollTimer.start(30);
+	poll();
+
+	return true;
+}
+
+bool COffscreenRenderer::busy() const
+{
+	return m_bBusy;
+}
+
+QImage COffscreenRenderer::renderStaticMap(const TStaticMapJob& job)
+{
+	auto pRenderer = std::make_shared<COffscreenRenderer>();
+	pRenderer->init();
+
+	QImage result;
+	QEventLoop loop;
+	bool bStarted = pRenderer->render(job, [&](const QImage& img, bool) {
+		result = img;
+		loop.quit();
+	});
+
+	if (bStarted)
+		loop.exec();
+
+	return result;
+}
+
+QSize COffscreenRenderer::maxSize()
+{
+	//10 x 6 tiles, one of them is spent on panning to the exact centre
+	return { 9 * 256, 5 * 256 };
+}
+
+void COffscreenRenderer::init()
+{
+	auto pRender = std::dynamic_pointer_cast<IGlobalRenderer>(shared_from_this());
+	m_pTiles = std::make_shared<CTileMap>(pRender);
+	m_pOverlay = std::make_shared<COverlayLayer>();
+	m_pHeatmap = std::make_shared<CHeatmapLayer>();
+	m_pCamera = std::make_shared<CCamera>();
+
+	m_PollTimer.setSingleShot(false);
+	QObject::connect(&m_PollTimer, &QTimer::timeout, [this] { poll(); });
+}
+
+glm::uint COffscreenRenderer::getZoomLevel()
+{
+	return m_uiZoomLevel;
+}
+
+QPointF COffscreenRenderer::getCenter()
+{
+	return m_qpCenter;
+}
+
+glm::uint COffscreenRenderer::getWidth()
+{
+	return m_qsSize.width();
+}
+
+glm::uint COffscreenRenderer::getHeight()
+{
+	return m_qsSize.height();
+}
+
+void COffscreenRenderer::repaint()
+{
+	//A texture arrived. Checked right away instead of waiting for the next poll
+	if (m_bBusy)
+		QTimer::singleShot(0, [pRenderer = weak_from_this()] {
+			if (auto p = pRenderer.lock())
+				p->poll();
+		});
+}
+
+QVector3D COffscreenRenderer::screenToWorld(const int& nX, const int& nY)
+{
+	return m_pCamera->screenToWorld(QPointF(nX, nY));
+}
+
+QMatrix4x4 COffscreenRenderer::getWorldMatrix()
+{
+	return m_pCamera->getWorldMatrix();
+}
+
+ICameraPtr COffscreenRenderer::getCamera()
+{
+	return m_pCamera;
+}
+
+IOverlayLayerPtr COffscreenRenderer::getOverlay()
+{
+	return m_pOverlay;
+}
+
+IHeatmapLayerPtr COffscreenRenderer::getHeatmap()
+{
+	return m_pHeatmap;
+}
+
+ILiveLayerPtr COffscreenRenderer::getLiveLayer()
+{
+	//A still image has no use for moving objects
+	return nullptr;
+}
+
+IDatasetLayerPtr COffscreenRenderer::getDatasetLayer()
+{
+	//Jobs bring their own points
+	return nullptr;
+}
+
+bool COffscreenRenderer::initGL()
+{
+	if (m_bInitGL)
+		return true;
+
+	//0) Context joins the global share group: tile textures, shaders and the fetch queue are shared with every view
+	m_pContext = std::make_unique<QOpenGLContext>();
+	m_pContext->setShareContext(QOpenGLContext::globalShareContext());
+	m_pContext->setFormat(QSurfaceFormat::defaultFormat());
+	if (!m_pContext->create())
+		return false;
+
+	m_pSurface = std::make_unique<QOffscreenSurface>();
+	m_pSurface->setFormat(m_pContext->format());
+	m_pSurface->create();
+	if (!m_pSurface->isValid() || !m_pContext->makeCurrent(m_pSurface.get()))
+		return false;
+
+	initializeOpenGLFunctions();
+
+	m_pTiles->init();
+	m_pTiles->initGL();
+	m_pOverlay->initGL();
+	m_pHeatmap->initGL();
+
+	m_pContext->doneCurrent();
+	m_bInitGL = true;
+	return true;
+}
+
+bool COffscreenRenderer::resize(const QSize& qsSize)
+{
+	if (m_pFBO && (m_qsSize == qsSize))
+		return true;
+
+	if (!m_pContext->makeCurrent(m_pSurface.get()))
+		return false;
+
+	m_qsSize = qsSize;
+	m_pFBO = std::make_unique<QOpenGLFramebufferObject>(m_qsSize, QOpenGLFramebufferObject::CombinedDepthStencil);
+
+	m_pCamera->setViewport(m_qsSize);
+
+	m_pContext->doneCurrent();
+	return m_pFBO->isValid();
+}
+
+void COffscreenRenderer::place(const TStaticMapJob& job)
+{
+	auto pMath = CBingGeoTextureProvider::get()->getMath();
+	m_qpCenter = job.qpCenter;
+	m_uiZoomLevel = job.uiZoomLevel;
+
+	//0) Bbox: the deepest zoom it fits in, centred on its mercator middle
+	if (job.bFitBounds) {
+		auto spMin = pMath->wgs2merc(job.qpBoundsMin.x(), job.qpBoundsMin.y());
+		auto spMax = pMath->wgs2merc(job.qpBoundsMax.x(), job.qpBoundsMax.y());
+		double dbSpanX = std::max(std::abs(spMax.first - spMin.first), 1e-9);
+		double dbSpanY = std::max(std::abs(spMax.second - spMin.second), 1e-9);
+		double dbFit = std::min(m_qsSize.width() / (256.0 * dbSpanX), m_qsSize.height() / (256.0 * dbSpanY));
+
+		m_uiZoomLevel = (uint)std::min(std::max(std::floor(std::log2(dbFit)), 1.0), 21.0);
+		auto spCenter = pMath->merc2wgs((spMin.first + spMax.first) / 2.0, (spMin.second + spMax.second) / 2.0);
+		m_qpCenter = QPointF(spCenter.first, spCenter.second);
+	}
+
+	//1) Same start as an interactive view, then the grid is laid out around the centre tile
+	m_pCamera->setPosition({ 0.f, 0.f, -1000.f });
+	m_pTiles->rebuild();
+	m_pTiles->detail(m_uiZoomLevel);
+
+	//2) The grid is aligned to tiles, so pan until the requested point is exactly in the middle
+	auto transform = m_pTiles->getMercatorTransform();
+	if (transform.bValid) {
+		auto spMerc = pMath->wgs2merc(m_qpCenter.x(), m_qpCenter.y());
+		double dbWorldX = transform.dbOriginX + spMerc.first * transform.dbScaleX;
+		double dbWorldY = transform.dbOriginY + spMerc.second * transform.dbScaleY;
+
+		m_pCamera->setPosition({ (float)-dbWorldX, (float)-dbWorldY, m_pCamera->getPosition().z() });
+		m_pTiles->move();
+	}
+}
+
+void COffscreenRenderer::poll()
+{
+	if (!m_bBusy)
+		return;
+
+	bool bComplete = (0 == m_pTiles->pending());
+	if (bComplete || (m_JobTimer.elapsed() > m_Job.nTimeout))
+		finish(bComplete);
+}
+
+void COffscreenRenderer::finish(const bool& bComplete)
+{
+	m_PollTimer.stop();
+
+	//0) Draw into the FBO and read it back
+	QImage img;
+	if (m_pContext->makeCurrent(m_pSurface.get())) {
+		m_pFBO->bind();
+		glViewport(0, 0, m_qsSize.width(), m_qsSize.height());
+		glClearColor(0x00, 0x00, 0x00, 0xFF);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		const auto& qmWorld = m_pCamera->getWorldMatrix();
+		m_pTiles->draw(qmWorld);
+		auto transform = m_pTiles->getMercatorTransform();
+		m_pHeatmap->draw(qmWorld, transform, m_qsSize);
+		m_pOverlay->draw(qmWorld, transform, m_qsSize);
+
+		img = m_pFBO->toImage();
+		m_pFBO->release();
+		m_pContext->doneCurrent();
+	}
+
+	auto pStats = CStatistics::get();
+	pStats->add("static.rendered", 1);
+	if (!bComplete)
+		pStats->add("static.incomplete", 1);
+
+	//1) Callback may start the next job right away
+	m_bBusy = false;
+	auto callback = m_Callback;
+	m_Callback = nullptr;
+	if (callback)
+		callback(img, bComplete);
+}
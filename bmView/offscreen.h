@@ -0,0 +1,80 @@
+#pragma once
+#include "intfs.h"
+
+struct TStaticMapJob {
+	//Centre as QPointF(lat, lon) and zoom, or a bbox to fit in the image
+	QPointF qpCenter;
+	uint uiZoomLevel = 12;
+	bool bFitBounds = false;
+	QPointF qpBoundsMin, qpBoundsMax;
+
+	QSize qsSize = { 512, 512 };
+	QString qsOutput;
+	int nQuality = -1;
+	int nTimeout = 15000;
+
+	//Optional overlay
+	std::vector<QPointF> vPoints;
+	std::vector<std::vector<QPointF>> vPolylines;
+	QColor qcOverlay = Qt::red;
+	//Optional heatmap, every point weighs 1
+	std::vector<QPointF> vHeatmap;
+};
+
+//Image and whether every visible tile made it into it before the timeout
+using StaticMapCallback = std::function<void(const QImage&, bool)>;
+
+class COffscreenRenderer : protected QOpenGLFunctions,
+	public IGlobalRenderer,
+	public std::enable_shared_from_this<COffscreenRenderer>
+{
+public:
+	COffscreenRenderer() = default;
+	~COffscreenRenderer();
+	//Asynchronous, driven by the GUI thread event loop. False if the renderer is busy or the job is invalid
+	bool render(const TStaticMapJob& job, StaticMapCallback callback);
+	bool busy() const;
+	//Blocking library call, spins a local event loop
+	static QImage renderStaticMap(const TStaticMapJob& job);
+	//The tile grid of a map covers this much, bigger images need the chunked export
+	static QSize maxSize();
+protected: //IGlobalRenderer
+	void init() override;
+	uint getZoomLevel() override;
+	QPointF getCenter() override;
+	uint getWidth() override;
+	uint getHeight() override;
+	void repaint() override;
+	QVector3D screenToWorld(const int& nX, const int& nY) override;
+	QMatrix4x4 getWorldMatrix() override;
+	ICameraPtr getCamera() override;
+	IOverlayLayerPtr getOverlay() override;
+	IHeatmapLayerPtr getHeatmap() override;
+	ILiveLayerPtr getLiveLayer() override;
+	IDatasetLayerPtr getDatasetLayer() override;
+private:
+	std::unique_ptr<QOpenGLContext> m_pContext;
+	std::unique_ptr<QOffscreenSurface> m_pSurface;
+	std::unique_ptr<QOpenGLFramebufferObject> m_pFBO;
+	ITileMapPtr m_pTiles = nullptr;
+	IOverlayLayerPtr m_pOverlay = nullptr;
+	IHeatmapLayerPtr m_pHeatmap = nullptr;
+	bool m_bInitGL = false;
+
+	ICameraPtr m_pCamera = nullptr;
+	QSize m_qsSize;
+	QPointF m_qpCenter;
+	uint m_uiZoomLevel = 12;
+
+	bool m_bBusy = false;
+	QTimer m_PollTimer;
+	QElapsedTimer m_JobTimer;
+	TStaticMapJob m_Job;
+	StaticMapCallback m_Callback;
+private:
+	bool initGL();
+	bool resize(const QSize& qsSize);
+	void place(const TStaticMapJob& job);
+	void poll();
+	void finish(const bool& bComplete);
+};
@@ -0,0 +1,402 @@
+#include "overlay.h"
+#include "consts.h"
+#include "geotex.h"
+#include "spatial.h"
+#include "sched.h"
+
+std::shared_ptr<QOpenGLShaderProgram> COverlayLayer::m_pPointShaders = nullptr;
+std::shared_ptr<QOpenGLShaderProgram> COverlayLayer::m_pLineShaders = nullptr;
+
+namespace {
+	//Triangle strips for a point sprite (-1..1) and a line segment (start/end, left/right side)
+	const GLfloat gfOverlayCorners[] = {
+		-1.0f, -1.0f,	1.0f, -1.0f,	-1.0f, 1.0f,	1.0f, 1.0f,
+		0.0f, -1.0f,	0.0f, 1.0f,		1.0f, -1.0f,	1.0f, 1.0f
+	};
+}
+
+bool CGrowableBuffer::append(const void* pData, const size_t& szCount)
+{
+	if (!szCount)
+		return false;
+
+	bool bReallocated = reserve(m_szCount + szCount);
+
+	//Only the new batch goes over the bus, old data stays where it is
+	m_pBuffer->bind();
+	m_pBuffer->write((int)(m_szCount * m_szStride), pData, (int)(szCount * m_szStride));
+	m_szCount += szCount;
+
+	return bReallocated;
+}
+
+void CGrowableBuffer::write(const size_t& szFirst, const void* pData, const size_t& szCount)
+{
+	if (!szCount || (szFirst + szCount > m_szCount))
+		return;
+
+	m_pBuffer->bind();
+	m_pBuffer->write((int)(szFirst * m_szStride), pData, (int)(szCount * m_szStride));
+}
+
+void CGrowableBuffer::clear()
+{
+	m_szCount = 0;
+}
+
+void CGrowableBuffer::bind()
+{
+	if (m_pBuffer)
+		m_pBuffer->bind();
+}
+
+size_t CGrowableBuffer::count() const
+{
+	return m_szCount;
+}
+
+bool CGrowableBuffer::reserve(const size_t& szCount)
+{
+	if (m_pBuffer && (szCount <= m_szCapacity))
+		return false;
+
+	//0) Grow geometrically so that appends stay amortized O(batch)
+	size_t szCapacity = std::max<size_t>(4096, m_szCapacity);
+	while (szCapacity < szCount)
+		szCapacity *= 2;
+
+	auto pBuffer = std::make_shared<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
+	if (!pBuffer->create())
+		return false;
+
+	pBuffer->bind();
+	pBuffer->setUsagePattern(QOpenGLBuffer::DynamicDraw);
+	pBuffer->allocate((int)(szCapacity * m_szStride));
+
+	//1) Old contents are copied on the GPU side, nothing is rebuilt on the CPU
+	if (m_pBuffer && m_szCount) {
+		auto* pFunc = QOpenGLContext::currentContext()->extraFunctions();
+		pFunc->glBindBuffer(GL_COPY_READ_BUFFER, m_pBuffer->bufferId());
+		pFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, pBuffer->bufferId());
+		pFunc->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, m_szCount * m_szStride);
+	}
+
+	m_pBuffer = pBuffer;
+	m_szCapacity = szCapacity;
+	return true;
+}
+
+COverlayLayer::COverlayLayer() : m_pIndex(std::make_shared<CQuadIndex>())
+{
+}
+
+bool COverlayLayer::initGL()
+{
+	//Most views never show a feature: nothing is created before the first one is drawn
+	m_bInit = true;
+	return true;
+}
+
+bool COverlayLayer::createGL()
+{
+	//0) Programs are shared by every view in the share group
+	if (!m_pPointShaders)
+		m_pPointShaders = InitShaders(gwOverlayPointVS, gwOverlayFS);
+
+	if (!m_pLineShaders)
+		m_pLineShaders = InitShaders(gwOverlayLineVS, gwOverlayFS);
+
+	if (!m_pPointShaders || !m_pLineShaders)
+		return false;
+
+	//1) Shared corner buffer
+	m_pCorners = std::make_shared<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
+	if (!m_pCorners->create())
+		return false;
+
+	m_pCorners->bind();
+	m_pCorners->setUsagePattern(QOpenGLBuffer::StaticDraw);
+	m_pCorners->allocate(gfOverlayCorners, sizeof(gfOverlayCorners));
+
+	//2) Instance buffers and their VAOs
+	m_pPoints = std::make_shared<CGrowableBuffer>(sizeof(TOverlayVertex));
+	m_pLines = std::make_shared<CGrowableBuffer>(sizeof(TOverlayVertex));
+
+	m_pPointVAO = std::make_shared<QOpenGLVertexArrayObject>();
+	m_pLineVAO = std::make_shared<QOpenGLVertexArrayObject>();
+	if (!m_pPointVAO->create() || !m_pLineVAO->create())
+		return false;
+
+	m_bCreated = true;
+	return true;
+}
+
+uint COverlayLayer::addPoints(const std::vector<QPointF>& vPoints, const QColor& qcColor, const float& fSize)
+{
+	auto uiFirst = m_uiNextFeature.fetch_add((uint)vPoints.size());
+
+	auto pMath = CBingGeoTextureProvider::get()->getMath();
+	std::vector<TOverlayVertex> vBatch(vPoints.size());
+	std::vector<TSpatialItem> vItems(vPoints.size());
+	auto fBuild = [&](size_t szFirst, size_t szLast) {
+		for (auto i = szFirst; i < szLast; ++i) {
+			auto spMerc = pMath->wgs2merc(vPoints[i].x(), vPoints[i].y());
+			vBatch[i] = makeVertex(spMerc, qcColor, fSize);
+			vItems[i] = { uiFirst + (uint)i, spMerc.first, spMerc.second, spMerc.first, spMerc.second };
+		}
+	};
+
+	//Big imports are converted on the scheduler, a handful of points is not worth the hand-off
+	if (vPoints.size() >= 16384)
+		CJobScheduler::get()->parallelFor(EJobPriority::Visible, vPoints.size(), fBuild);
+	else
+		fBuild(0, vPoints.size());
+
+	m_pIndex->insert(vItems);
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_vPendingPoints.insert(m_vPendingPoints.end(), vBatch.begin(), vBatch.end());
+	return uiFirst;
+}
+
+uint COverlayLayer::addPolyline(const std::vector<QPointF>& vPoints, const QColor& qcColor, const float& fWidth)
+{
+	auto uiFeature = m_uiNextFeature.fetch_add(1);
+	if (vPoints.size() < 2)
+		return uiFeature;
+
+	auto pMath = CBingGeoTextureProvider::get()->getMath();
+	std::vector<TOverlayVertex> vBatch;
+	std::vector<TSpatialItem> vItems;
+	vBatch.reserve(vPoints.size());
+	vItems.reserve(vPoints.size() - 1);
+	std::pair<double, double> spPrev;
+	for (const auto& it : vPoints) {
+		auto spMerc = pMath->wgs2merc(it.x(), it.y());
+		vBatch.push_back(makeVertex(spMerc, qcColor, fWidth));
+
+		//Every segment is indexed separately under the polyline id
+		if (vBatch.size() > 1)
+			vItems.push_back({ uiFeature, spPrev.first, spPrev.second, spMerc.first, spMerc.second });
+
+		spPrev = spMerc;
+	}
+
+	//Negative width on the last vertex breaks the strip between two polylines
+	vBatch.back().fSize = -fWidth;
+	m_pIndex->insert(vItems);
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_vPendingLines.insert(m_vPendingLines.end(), vBatch.begin(), vBatch.end());
+	return uiFeature;
+}
+
+std::optional<uint> COverlayLayer::pick(const QPointF& qpMerc, const double& dbRadius)
+{
+	return m_pIndex->nearest(qpMerc, dbRadius);
+}
+
+void COverlayLayer::query(const QRectF& qrMerc, std::vector<uint>& vResult)
+{
+	m_pIndex->query(qrMerc, vResult);
+}
+
+void COverlayLayer::clear()
+{
+	m_pIndex->build({});
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_vPendingPoints.clear();
+	m_vPendingLines.clear();
+	m_bClear = true;
+}
+
+void COverlayLayer::draw(const QMatrix4x4& qmWorld, const TMercatorTransform& transform, const QSize& qsViewport)
+{
+	if (!m_bInit || !transform.bValid)
+		return;
+
+	if (!m_bCreated) {
+		bool bPending = false;
+		{
+			std::lock_guard<std::mutex> lock(m_Lock);
+			bPending = !m_vPendingPoints.empty() || !m_vPendingLines.empty();
+		}
+
+		if (!bPending)
+			return;
+
+		//A failed attempt is not repeated every frame
+		if (!createGL()) {
+			m_bInit = false;
+			return;
+		}
+	}
+
+	upload();
+
+	auto* pFunc = QOpenGLContext::currentContext()->extraFunctions();
+
+	//0) Lines first, points are drawn over them
+	if (m_pLines->count() > 1) {
+		m_pLineShaders->bind();
+		setUniforms(m_pLineShaders, qmWorld, transform, qsViewport);
+
+		m_pLineVAO->bind();
+		pFunc->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)(m_pLines->count() - 1));
+		m_pLineVAO->release();
+	}
+
+	if (m_pPoints->count()) {
+		m_pPointShaders->bind();
+		setUniforms(m_pPointShaders, qmWorld, transform, qsViewport);
+
+		m_pPointVAO->bind();
+		pFunc->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)m_pPoints->count());
+		m_pPointVAO->release();
+	}
+}
+
+void COverlayLayer::upload()
+{
+	std::vector<TOverlayVertex> vPoints, vLines;
+	bool bClear = false;
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		vPoints.swap(m_vPendingPoints);
+		vLines.swap(m_vPendingLines);
+		std::swap(bClear, m_bClear);
+	}
+
+	if (bClear) {
+		m_pPoints->clear();
+		m_pLines->clear();
+	}
+
+	//Attribute pointers have to be set again only when the storage moved to a bigger buffer
+	if (m_pPoints->append(vPoints.data(), vPoints.size()))
+		bindPointAttributes();
+
+	if (m_pLines->append(vLines.data(), vLines.size()))
+		bindLineAttributes();
+}
+
+void COverlayLayer::bindPointAttributes()
+{
+	auto* pFunc = QOpenGLContext::currentContext()->extraFunctions();
+	m_pPointVAO->bind();
+
+	//Corner
+	m_pCorners->bind();
+	pFunc->glEnableVertexAttribArray(0);
+	pFunc->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), nullptr);
+
+	//Per instance: mercator hi/lo, color, size
+	m_pPoints->bind();
+	GLsizei nStride = sizeof(TOverlayVertex);
+	pFunc->glEnableVertexAttribArray(1);
+	pFunc->glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, nStride, reinterpret_cast<void*>(offsetof(TOverlayVertex, fMerc)));
+	pFunc->glEnableVertexAttribArray(2);
+	pFunc->glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, nStride, reinterpret_cast<void*>(offsetof(TOverlayVertex, ucColor)));
+	pFunc->glEnableVertexAttribArray(3);
+	pFunc->glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, nStride, reinterpret_cast<void*>(offsetof(TOverlayVertex, fSize)));
+
+	for (GLuint i = 1; i <= 3; ++i)
+		pFunc->glVertexAttribDivisor(i, 1);
+
+	m_pPointVAO->release();
+}
+
+void COverlayLayer::bindLineAttributes()
+{
+	auto* pFunc = QOpenGLContext::currentContext()->extraFunctions();
+	m_pLineVAO->bind();
+
+	//Corner, the second half of the corner buffer
+	m_pCorners->bind();
+	pFunc->glEnableVertexAttribArray(0);
+	pFunc->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), reinterpret_cast<void*>(8 * sizeof(GLfloat)));
+
+	//Per instance: segment i is made of polyline vertices i and i + 1
+	m_pLines->bind();
+	GLsizei nStride = sizeof(TOverlayVertex);
+	pFunc->glEnableVertexAttribArray(1);
+	pFunc->glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, nStride, reinterpret_cast<void*>(offsetof(TOverlayVertex, fMerc)));
+	pFunc->glEnableVertexAttribArray(2);
+	pFunc->glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, nStride, reinterpret_cast<void*>(offsetof(TOverlayVertex, ucColor)));
+	pFunc->glEnableVertexAttribArray(3);
+	pFunc->glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, nStride, reinterpret_cast<void*>(offsetof(TOverlayVertex, fSize)));
+	pFunc->glEnableVertexAttribArray(4);
+	pFunc->glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, nStride, reinterpret_cast<void*>(nStride + offsetof(TOverlayVertex, fMerc)));
+
+	for (GLuint i = 1; i <= 4; ++i)
+		pFunc->glVertexAttribDivisor(i, 1);
+
+	m_pLineVAO->release();
+}
+
+void COverlayLayer::setUniforms(std::shared_ptr<QOpenGLShaderProgram> pShaders, const QMatrix4x4& qmWorld,
+	const TMercatorTransform& transform, const QSize& qsViewport)
+{
+	//0) Map point under the screen centre is the reference for relative coordinates
+	auto qmInverse = qmWorld.inverted();
+	auto qvNear = qmInverse.map(QVector3D(0.f, 0.f, -1.f));
+	auto qvFar = qmInverse.map(QVector3D(0.f, 0.f, 1.f));
+	float t = (std::abs(qvFar.z() - qvNear.z()) > 0.f) ? qvNear.z() / (qvNear.z() - qvFar.z()) : 0.f;
+	auto qvCenter = qvNear + (qvFar - qvNear) * t;
+
+	double dbEyeX = (qvCenter.x() - transform.dbOriginX) / transform.dbScaleX;
+	double dbEyeY = (qvCenter.y() - transform.dbOriginY) / transform.dbScaleY;
+
+	//1) Eye in mercator is split as hi + lo, so the subtraction in the shader keeps full precision
+	GLfloat fEye[4];
+	splitDouble(dbEyeX, fEye[0], fEye[2]);
+	splitDouble(dbEyeY, fEye[1], fEye[3]);
+
+	pShaders->setUniformValue("world", qmWorld);
+	pShaders->setUniformValue("eye", QVector4D(fEye[0], fEye[1], fEye[2], fEye[3]));
+	pShaders->setUniformValue("eyeWorld", QVector2D(transform.dbOriginX + dbEyeX * transform.dbScaleX,
+		transform.dbOriginY + dbEyeY * transform.dbScaleY));
+	pShaders->setUniformValue("scale", QVector2D(transform.dbScaleX, transform.dbScaleY));
+	pShaders->setUniformValue("viewport", QVector2D(qsViewport.width(), qsViewport.height()));
+}
+
+void COverlayLayer::splitDouble(const double& dbValue, GLfloat& fHi, GLfloat& fLo)
+{
+	fHi = (GLfloat)dbValue;
+	fLo = (GLfloat)(dbValue - fHi);
+}
+
+COverlayLayer::TOverlayVertex COverlayLayer::makeVertex(const std::pair<double, double>& spMerc, const QColor& qcColor, const float& fSize)
+{
+	TOverlayVertex vertex;
+	splitDouble(spMerc.first, vertex.fMerc[0], vertex.fMerc[2]);
+	splitDouble(spMerc.second, vertex.fMerc[1], vertex.fMerc[3]);
+	vertex.ucColor[0] = (GLubyte)qcColor.red();
+	vertex.ucColor[1] = (GLubyte)qcColor.green();
+	vertex.ucColor[2] = (GLubyte)qcColor.blue();
+	vertex.ucColor[3] = (GLubyte)qcColor.alpha();
+	vertex.fSize = fSize;
+
+	return vertex;
+}
+
+std::shared_ptr<QOpenGLShaderProgram> COverlayLayer::InitShaders(const char* szVertexShader, const char* szFragmentShader)
+{
+	//Linked binaries are kept in the Qt shader disk cache, a warm start skips compiling and linking
+	auto pShaders = std::make_shared<QOpenGLShaderProgram>();
+	if (!pShaders->addCacheableShaderFromSourceCode(QOpenGLShader::Vertex, szVertexShader)) {
+		auto sError = pShaders->log();
+		return nullptr;
+	}
+
+	if (!pShaders->addCacheableShaderFromSourceCode(QOpenGLShader::Fragment, szFragmentShader)) {
+		auto sError = pShaders->log();
+		return nullptr;
+	}
+
+	if (!pShaders->link())
+		return nullptr;
+
+	return pShaders;
+}
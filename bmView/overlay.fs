@@ -0,0 +1,18 @@
+R"(
+
+#version 330 core
+
+in vec4 vColor;
+in vec2 vCorner;
+out vec4 color_out;
+
+void main()
+{
+	float dist = dot(vCorner, vCorner);
+	if (dist > 1.f)
+		discard;
+
+	color_out = vec4(vColor.rgb, vColor.a * (1.f - smoothstep(0.8f, 1.f, dist)));
+}
+
+)"
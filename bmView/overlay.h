@@ -0,0 +1,65 @@
+#pragma once
+#include "intfs.h"
+
+class CGrowableBuffer {
+public:
+	explicit CGrowableBuffer(const size_t& szStride) : m_szStride(szStride) {};
+	bool append(const void* pData, const size_t& szCount);
+	//In place, within what was appended
+	void write(const size_t& szFirst, const void* pData, const size_t& szCount);
+	void clear();
+	void bind();
+	size_t count() const;
+private:
+	std::shared_ptr<QOpenGLBuffer> m_pBuffer = nullptr;
+	size_t m_szStride;
+	size_t m_szCount = 0;
+	size_t m_szCapacity = 0;
+	bool reserve(const size_t& szCount);
+};
+
+class COverlayLayer : public IOverlayLayer {
+public:
+	COverlayLayer();
+	//world, eye, eyeWorld, scale and viewport of the programs that place mercator hi/lo positions relative to the eye
+	static void setUniforms(std::shared_ptr<QOpenGLShaderProgram> pShaders, const QMatrix4x4& qmWorld,
+		const TMercatorTransform& transform, const QSize& qsViewport);
+	//Mercator coordinate as the hi/lo pair those programs take
+	static void splitDouble(const double& dbValue, GLfloat& fHi, GLfloat& fLo);
+	//Null if a shader doesn't compile or the program doesn't link
+	static std::shared_ptr<QOpenGLShaderProgram> InitShaders(const char* szVertexShader, const char* szFragmentShader);
+protected: //IOverlayLayer
+	bool initGL() override;
+	uint addPoints(const std::vector<QPointF>& vPoints, const QColor& qcColor, const float& fSize) override;
+	uint addPolyline(const std::vector<QPointF>& vPoints, const QColor& qcColor, const float& fWidth) override;
+	std::optional<uint> pick(const QPointF& qpMerc, const double& dbRadius) override;
+	void query(const QRectF& qrMerc, std::vector<uint>& vResult) override;
+	void clear() override;
+	void draw(const QMatrix4x4& qmWorld, const TMercatorTransform& transform, const QSize& qsViewport) override;
+private:
+	struct TOverlayVertex {
+		GLfloat fMerc[4];
+		GLubyte ucColor[4];
+		GLfloat fSize;
+	};
+	std::mutex m_Lock;
+	std::vector<TOverlayVertex> m_vPendingPoints;
+	std::vector<TOverlayVertex> m_vPendingLines;
+	bool m_bClear = false;
+	bool m_bInit = false;
+	bool m_bCreated = false;
+
+	ISpatialIndexPtr m_pIndex;
+	std::atomic<uint> m_uiNextFeature{ 0 };
+
+	std::shared_ptr<QOpenGLBuffer> m_pCorners;
+	std::shared_ptr<QOpenGLVertexArrayObject> m_pPointVAO, m_pLineVAO;
+	static std::shared_ptr<QOpenGLShaderProgram> m_pPointShaders, m_pLineShaders;
+	std::shared_ptr<CGrowableBuffer> m_pPoints, m_pLines;
+private:
+	bool createGL();
+	void upload();
+	void bindPointAttributes();
+	void bindLineAttributes();
+	static TOverlayVertex makeVertex(const std::pair<double, double>& spMerc, const QColor& qcColor, const float& fSize);
+};
@@ -0,0 +1,49 @@
+R"(
+#version 330 core
+
+layout (location = 0) in vec2 corner;
+layout (location = 1) in vec4 merc0;
+layout (location = 2) in vec4 color0;
+layout (location = 3) in float width0;
+layout (location = 4) in vec4 merc1;
+
+uniform mat4 world;
+uniform vec4 eye;
+uniform vec2 eyeWorld;
+uniform vec2 scale;
+uniform vec2 viewport;
+
+out vec4 vColor;
+out vec2 vCorner;
+
+vec4 project(vec4 pt)
+{
+	vec2 rel = (pt.xy - eye.xy) + (pt.zw - eye.zw);
+	return world * vec4(eyeWorld + rel * scale, 0.f, 1.0f);
+}
+
+void main()
+{
+	//Negative width marks the last vertex of a polyline, the segment after it joins two polylines
+	if (width0 < 0.f) {
+		gl_Position = vec4(2.f, 2.f, 2.f, 1.f);
+		return;
+	}
+
+	vec4 p0 = project(merc0);
+	vec4 p1 = project(merc1);
+
+	vec2 s0 = p0.xy / p0.w * viewport;
+	vec2 s1 = p1.xy / p1.w * viewport;
+	vec2 dir = s1 - s0;
+	dir = (dot(dir, dir) > 0.f) ? normalize(dir) : vec2(1.f, 0.f);
+
+	vec4 pos = mix(p0, p1, corner.x);
+	pos.xy += vec2(-dir.y, dir.x) * corner.y * width0 / viewport * pos.w;
+
+	gl_Position = pos;
+	vColor = color0;
+	vCorner = vec2(0.f, corner.y);
+}
+
+)"
@@ -0,0 +1,28 @@
+R"(
+#version 330 core
+
+layout (location = 0) in vec2 corner;
+layout (location = 1) in vec4 merc;
+layout (location = 2) in vec4 color;
+layout (location = 3) in float size;
+
+uniform mat4 world;
+uniform vec4 eye;
+uniform vec2 eyeWorld;
+uniform vec2 scale;
+uniform vec2 viewport;
+
+out vec4 vColor;
+out vec2 vCorner;
+
+void main()
+{
+	vec2 rel = (merc.xy - eye.xy) + (merc.zw - eye.zw);
+	vec4 center = world * vec4(eyeWorld + rel * scale, 0.f, 1.0f);
+
+	gl_Position = center + vec4(corner * size / viewport * center.w, 0.f, 0.f);
+	vColor = color;
+	vCorner = corner;
+}
+
+)"
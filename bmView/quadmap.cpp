@@ -0,0 +1,393 @@
+#include "quadmap.h"
+#include "geotex.h"
+#include "stats.h"
+#include "terrain.h"
+#include "tilemap.h"
+#include "tileres.h"
+
+bool CQuadTileMap::m_bEnabled = false;
+
+namespace {
+	quint64 nodeKey(const TQuadNode& node)
+	{
+		return ((quint64)node.uiZoom << 58) | ((quint64)node.nX << 29) | (quint64)node.nY;
+	}
+
+	TQuadNode parentNode(const TQuadNode& node)
+	{
+		return { node.nX >> 1, node.nY >> 1, node.uiZoom - 1 };
+	}
+}
+
+CQuadTreeSelector::CQuadTreeSelector(const size_t& szMaxTiles, const QString& qsStats) :
+	m_szMaxTiles(std::max<size_t>(szMaxTiles, 4)), m_statLeaves(qsStats + ".selector.leaves")
+{
+	m_vLeaves.reserve(m_szMaxTiles);
+	m_vNext.reserve(m_szMaxTiles);
+	m_vOrder.reserve(m_szMaxTiles);
+	m_vVisible.reserve(m_szMaxTiles);
+	reset(m_uiMinZoom, m_uiMaxZoom);
+}
+
+void CQuadTreeSelector::reset(const uint& uiMinZoom, const uint& uiMaxZoom)
+{
+	//The cut starts with the whole top level, it must fit into the budget on its own
+	m_uiMinZoom = std::max(1u, uiMinZoom);
+	while ((m_uiMinZoom > 1u) && ((size_t)1 << (2 * m_uiMinZoom)) > m_szMaxTiles)
+		--m_uiMinZoom;
+
+	m_uiMaxZoom = std::max(m_uiMinZoom, uiMaxZoom);
+
+	m_vLeaves.clear();
+	int nSide = 1 << m_uiMinZoom;
+	for (int y = 0; y < nSide; ++y) {
+		for (int x = 0; x < nSide; ++x) {
+			TLeaf leaf;
+			leaf.node = { x, y, m_uiMinZoom };
+			m_vLeaves.push_back(leaf);
+		}
+	}
+}
+
+const std::vector<TQuadNode>& CQuadTreeSelector::select(const QuadMeasure& fnMeasure)
+{
+	//0) The camera has moved since the last step, every leaf is measured again
+	for (auto& it : m_vLeaves) {
+		it.bVisible = fnMeasure(it.node, it.fPixels);
+		it.bSplit = false;
+	}
+
+	//1) Merges go first, they free the budget the splits need
+	auto szChanges = merge(fnMeasure);
+	split(fnMeasure, szChanges);
+
+	m_vVisible.clear();
+	for (const auto& it : m_vLeaves) {
+		if (it.bVisible)
+			m_vVisible.push_back(it.node);
+	}
+
+	m_statLeaves.set((qint64)m_vLeaves.size());
+	return m_vVisible;
+}
+
+size_t CQuadTreeSelector::merge(const QuadMeasure& fnMeasure)
+{
+	//0) Deepest leaves first, siblings next to each other
+	std::sort(m_vLeaves.begin(), m_vLeaves.end(), [](const TLeaf& a, const TLeaf& b) {
+		if (a.node.uiZoom != b.node.uiZoom)
+			return a.node.uiZoom > b.node.uiZoom;
+
+		auto uiParentA = nodeKey(parentNode(a.node));
+		auto uiParentB = nodeKey(parentNode(b.node));
+		return (uiParentA != uiParentB) ? (uiParentA < uiParentB) : (nodeKey(a.node) < nodeKey(b.node));
+	});
+
+	//1) Four sibling leaves give way to their parent once it is off screen or fine enough by itself
+	size_t szChanges = 0;
+	m_vNext.clear();
+	for (size_t i = 0; i < m_vLeaves.size();) {
+		const auto& first = m_vLeaves[i].node;
+		bool bFamily = (first.uiZoom > m_uiMinZoom) && (i + 3 < m_vLeaves.size()) && (szChanges < m_szMaxChanges);
+		for (size_t j = 1; bFamily && (j < 4); ++j) {
+			const auto& sibling = m_vLeaves[i + j].node;
+			bFamily = (sibling.uiZoom == first.uiZoom) && (nodeKey(parentNode(sibling)) == nodeKey(parentNode(first)));
+		}
+
+		if (bFamily) {
+			TLeaf up;
+			up.node = parentNode(first);
+			up.bVisible = fnMeasure(up.node, up.fPixels);
+			if (!up.bVisible || (up.fPixels < m_fMergePixels)) {
+				m_vNext.push_back(up);
+				i += 4;
+				++szChanges;
+				continue;
+			}
+		}
+
+		m_vNext.push_back(m_vLeaves[i]);
+		++i;
+	}
+
+	std::swap(m_vLeaves, m_vNext);
+	return szChanges;
+}
+
+void CQuadTreeSelector::split(const QuadMeasure& fnMeasure, size_t szChanges)
+{
+	//0) The leaves that are the coarsest for the screen split first, as long as the budget lasts
+	m_vOrder.clear();
+	for (size_t i = 0; i < m_vLeaves.size(); ++i) {
+		const auto& it = m_vLeaves[i];
+		if (it.bVisible && (it.fPixels > m_fSplitPixels) && (it.node.uiZoom < m_uiMaxZoom))
+			m_vOrder.push_back(i);
+	}
+
+	std::sort(m_vOrder.begin(), m_vOrder.end(), [this](size_t a, size_t b) {
+		return m_vLeaves[a].fPixels > m_vLeaves[b].fPixels;
+	});
+
+	size_t szCount = m_vLeaves.size();
+	for (auto i : m_vOrder) {
+		if ((szChanges >= m_szMaxChanges) || (szCount + 3 > m_szMaxTiles))
+			break;
+
+		m_vLeaves[i].bSplit = true;
+		szCount += 3;
+		++szChanges;
+	}
+
+	if (szCount == m_vLeaves.size())
+		return;
+
+	//1) Children are measured right away, the ones off screen are not shown
+	m_vNext.clear();
+	for (const auto& it : m_vLeaves) {
+		if (!it.bSplit) {
+			m_vNext.push_back(it);
+			continue;
+		}
+
+		for (int c = 0; c < 4; ++c) {
+			TLeaf child;
+			child.node = { 2 * it.node.nX + (c & 1), 2 * it.node.nY + (c >> 1), it.node.uiZoom + 1 };
+			child.bVisible = fnMeasure(child.node, child.fPixels);
+			m_vNext.push_back(child);
+		}
+	}
+
+	std::swap(m_vLeaves, m_vNext);
+}
+
+CQuadTileMap::CQuadTileMap(IGlobalRendererPtr pRenderer, const size_t& szMaxTiles) :
+	m_pGlobal(pRenderer), m_szMaxTiles(szMaxTiles)
+{
+	auto pMeta = CBingGeoTextureProvider::get()->getMetadata();
+	if (pMeta->valid())
+		m_upZoomLevels = pMeta->getZoomLevels();
+
+	m_pSelector = std::make_shared<CQuadTreeSelector>(m_szMaxTiles, m_qsStats);
+	m_pSelector->reset(m_upZoomLevels.first, m_upZoomLevels.second);
+}
+
+void CQuadTileMap::setEnabled(const bool& bEnabled)
+{
+	m_bEnabled = bEnabled;
+}
+
+bool CQuadTileMap::enabled()
+{
+	return m_bEnabled;
+}
+
+void CQuadTileMap::init()
+{
+	//The selector never emits more leaves than the pool holds
+	m_vPool.reserve(m_szMaxTiles);
+	m_vFree.reserve(m_szMaxTiles);
+	m_vUsed.reserve(m_szMaxTiles);
+	m_vNext.reserve(m_szMaxTiles);
+	for (size_t i = 0; i < m_szMaxTiles; ++i) {
+		m_vPool.push_back(std::make_shared<CTile>(this));
+		m_vFree.push_back(m_vPool.back().get());
+	}
+}
+
+void CQuadTileMap::initGL()
+{
+	auto pRes = CTileResources::get();
+	if (!pRes->initGL())
+		return;
+
+	//VAO is not shared between contexts
+	m_pVAO = std::make_shared<QOpenGLVertexArrayObject>();
+	if (!m_pVAO->create())
+		return;
+
+	m_pVAO->bind();
+	pRes->bindVertexBuffers();
+	m_pVAO->release();
+}
+
+void CQuadTileMap::draw(const QMatrix4x4& qmWorld)
+{
+	auto pRes = CTileResources::get();
+	pRes->collect();
+
+	CBingGeoTextureProvider::get()->deliver();
+	cull(qmWorld);
+
+	if (m_pVAO) {
+		m_pVAO->bind();
+		pRes->bindShaders(qmWorld);
+
+		//Same terrain setup as the grid
+		auto* pFunc = QOpenGLContext::currentContext()->functions();
+		bool bTerrain = CTerrain::get()->enabled();
+		auto pRender = m_pGlobal.lock();
+		if (bTerrain && pRender) {
+			pFunc->glEnable(GL_DEPTH_TEST);
+			pFunc->glDepthFunc(GL_LEQUAL);
+			pRes->setTerrainLimit(0.5f * std::abs(pRender->getCamera()->getPosition().z()));
+		}
+
+		//Leaves of a cut never overlap, the order does not matter
+		for (const auto& it : m_vUsed)
+			it.pTile->draw(qmWorld);
+
+		if (bTerrain)
+			pFunc->glDisable(GL_DEPTH_TEST);
+
+		m_pVAO->release();
+	}
+
+	m_statVisible.set((qint64)m_vUsed.size());
+}
+
+void CQuadTileMap::cull(const QMatrix4x4& qmWorld)
+{
+	auto pRender = m_pGlobal.lock();
+	if (!pRender || !m_Transform.bValid)
+		return;
+
+	m_qmWorld = qmWorld;
+	m_qsViewport = QSizeF(pRender->getWidth(), pRender->getHeight());
+	assign(m_pSelector->select([this](const TQuadNode& node, float& fPixels) { return measure(node, fPixels); }));
+}
+
+bool CQuadTileMap::detail(const uint& uiZoomLevel)
+{
+	if ((uiZoomLevel < m_upZoomLevels.first) || (uiZoomLevel > m_upZoomLevels.second))
+		return false;
+
+	auto pRender = m_pGlobal.lock();
+	if (!pRender)
+		return false;
+
+	//0) A tile of the current zoom level is 256 world units, the map centre is in the middle of the screen
+	m_uiZoomLevel = uiZoomLevel;
+	auto pMath = CBingGeoTextureProvider::get()->getMath();
+	auto qpCenter = pRender->getCenter();
+	auto spMerc = pMath->wgs2merc(qpCenter.x(), qpCenter.y());
+	auto qvCamera = pRender->getCamera()->getPosition();
+	double dbScale = 256.0 * std::ldexp(1.0, (int)m_uiZoomLevel);
+
+	m_Transform.dbScaleX = dbScale;
+	m_Transform.dbScaleY = -dbScale;
+	m_Transform.dbOriginX = -qvCamera.x() - spMerc.first * dbScale;
+	m_Transform.dbOriginY = -qvCamera.y() + spMerc.second * dbScale;
+	m_Transform.bValid = true;
+
+	//1) Selected nodes keep their tiles and textures, only their place in the world changes.
+	//A few steps right away bring the cut close to the new view, the rest follows frame by frame
+	m_qmWorld = pRender->getWorldMatrix();
+	m_qsViewport = QSizeF(pRender->getWidth(), pRender->getHeight());
+	for (uint i = m_upZoomLevels.first; i < m_upZoomLevels.second; ++i)
+		m_pSelector->select([this](const TQuadNode& node, float& fPixels) { return measure(node, fPixels); });
+
+	cull(m_qmWorld);
+	return true;
+}
+
+void CQuadTileMap::move()
+{
+	auto pRender = m_pGlobal.lock();
+	if (pRender)
+		cull(pRender->getCamera()->getWorldMatrix());
+}
+
+void CQuadTileMap::rebuild()
+{
+	//No grid to lay out: tiles are placed from the tree in cull
+}
+
+uint CQuadTileMap::pending()
+{
+	return (uint)std::count_if(m_vUsed.begin(), m_vUsed.end(), [](const TUsedTile& used) { return !used.pTile->isReady(); });
+}
+
+TMercatorTransform CQuadTileMap::getMercatorTransform()
+{
+	return m_Transform;
+}
+
+IGlobalRendererPtr CQuadTileMap::renderer()
+{
+	return m_pGlobal.lock();
+}
+
+bool CQuadTileMap::measure(const TQuadNode& node, float& fPixels)
+{
+	QVector3D qvPos, qvSize;
+	geometry(node, qvPos, qvSize);
+
+	QRectF qrFootprint;
+	QSizeF qsProjected;
+	if (!CTileMap::getFootprint(m_qmWorld, qvPos, qvSize, m_qsViewport, qrFootprint, &qsProjected))
+		return false;
+
+	fPixels = (float)std::min(std::max(qsProjected.width(), qsProjected.height()), (double)std::numeric_limits<float>::max());
+	return true;
+}
+
+void CQuadTileMap::geometry(const TQuadNode& node, QVector3D& qvPos, QVector3D& qvSize)
+{
+	//Bottom left corner: texture row 0 is the bottom of the image
+	double dbTiles = std::ldexp(1.0, (int)node.uiZoom);
+	qvPos = QVector3D((float)(m_Transform.dbOriginX + node.nX / dbTiles * m_Transform.dbScaleX),
+		(float)(m_Transform.dbOriginY + (node.nY + 1) / dbTiles * m_Transform.dbScaleY), 0.f);
+	qvSize = QVector3D((float)(m_Transform.dbScaleX / dbTiles), (float)(-m_Transform.dbScaleY / dbTiles), 0.f);
+}
+
+void CQuadTileMap::assign(const std::vector<TQuadNode>& vNodes)
+{
+	//0) New set sorted by key, so it can be walked together with the current one
+	m_vNext.clear();
+	for (const auto& it : vNodes)
+		m_vNext.push_back({ nodeKey(it), it, nullptr });
+
+	std::sort(m_vNext.begin(), m_vNext.end(), [](const TUsedTile& a, const TUsedTile& b) { return a.uiKey < b.uiKey; });
+
+	//1) Nodes that stay keep their tiles, tiles of the nodes that went are released
+	auto itNext = m_vNext.begin();
+	for (const auto& it : m_vUsed) {
+		while ((itNext != m_vNext.end()) && (itNext->uiKey < it.uiKey))
+			++itNext;
+
+		if ((itNext != m_vNext.end()) && (itNext->uiKey == it.uiKey)) {
+			itNext->pTile = it.pTile;
+			continue;
+		}
+
+		it.pTile->invalidate();
+		it.pTile->setVisible(false);
+		m_vFree.push_back(it.pTile);
+	}
+
+	//2) New nodes take free tiles and ask for their textures
+	for (auto& it : m_vNext) {
+		if (!it.pTile && !m_vFree.empty()) {
+			it.pTile = m_vFree.back();
+			m_vFree.pop_back();
+
+			it.pTile->invalidate();
+			it.pTile->setVisible(true);
+			it.pTile->setTileIndex({ it.node.nX, it.node.nY }, it.node.uiZoom);
+		}
+
+		if (!it.pTile)
+			continue;
+
+		QVector3D qvPos, qvSize;
+		geometry(it.node, qvPos, qvSize);
+		it.pTile->place(qvPos, qvSize);
+
+		float fPixels = 0.f;
+		if (measure(it.node, fPixels))
+			it.pTile->setPixelScale(fPixels / std::max(qvSize.y(), 1e-3f));
+	}
+
+	m_vNext.erase(std::remove_if(m_vNext.begin(), m_vNext.end(), [](const TUsedTile& used) { return !used.pTile; }), m_vNext.end());
+	std::swap(m_vUsed, m_vNext);
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "intfs.h"
+#include "stats.h"
+
+//Keeps a cut of the quadkey tree: every point of the map is covered by exactly one leaf
+class CQuadTreeSelector : public ITileSelector {
+public:
+	//qsStats: statistics prefix of the view
+	CQuadTreeSelector(const size_t& szMaxTiles, const QString& qsStats);
+protected: //ITileSelector
+	void reset(const uint& uiMinZoom, const uint& uiMaxZoom) override;
+	const std::vector<TQuadNode>& select(const QuadMeasure& fnMeasure) override;
+private:
+	struct TLeaf {
+		TQuadNode node;
+		bool bVisible = false;
+		float fPixels = 0.f;
+		bool bSplit = false;
+	};
+	const size_t m_szMaxTiles;
+	//Splits and merges per step: the cut follows the camera over a few frames instead of being rebuilt
+	const size_t m_szMaxChanges = 32;
+	//A leaf splits once its texels get bigger than pixels, four siblings merge once the parent would not.
+	//The gap keeps a tile on the edge from flipping every frame
+	const float m_fSplitPixels = 256.f;
+	const float m_fMergePixels = 0.9f * 256.f;
+	uint m_uiMinZoom = 1u;
+	uint m_uiMaxZoom = 19u;
+	std::vector<TLeaf> m_vLeaves, m_vNext;
+	std::vector<size_t> m_vOrder;
+	std::vector<TQuadNode> m_vVisible;
+	CStatCounter m_statLeaves;
+private:
+	size_t merge(const QuadMeasure& fnMeasure);
+	void split(const QuadMeasure& fnMeasure, size_t szChanges);
+};
+
+//Mixed zoom alternative to the fixed tile grid, fed by the quadtree selector
+class CQuadTileMap : public ITileMap, public std::enable_shared_from_this<CQuadTileMap> {
+public:
+	explicit CQuadTileMap(IGlobalRendererPtr pRenderer, const size_t& szMaxTiles = 160);
+	//Views created after this use mixed zoom levels
+	static void setEnabled(const bool& bEnabled);
+	static bool enabled();
+protected: //ITileMap
+	void init() override;
+	void initGL() override;
+	void draw(const QMatrix4x4& qmWorld) override;
+	void cull(const QMatrix4x4& qmWorld) override;
+	bool detail(const uint& uiZoomLevel) override;
+	void move() override;
+	void rebuild() override;
+	uint pending() override;
+	TMercatorTransform getMercatorTransform() override;
+	IGlobalRendererPtr renderer() override;
+private:
+	static bool m_bEnabled;
+	IGlobalRendererPtr_ m_pGlobal;
+	ITileSelectorPtr m_pSelector;
+	const size_t m_szMaxTiles;
+	std::shared_ptr<QOpenGLVertexArrayObject> m_pVAO;
+	std::pair<uint, uint> m_upZoomLevels = { 1u, 19u };
+	uint m_uiZoomLevel = 1u;
+	//World units of a map tile are those of the current zoom level, like in the grid
+	TMercatorTransform m_Transform;
+	QMatrix4x4 m_qmWorld;
+	QSizeF m_qsViewport;
+
+	//Tiles sorted by node key. Kept across frames, so a node that stays selected keeps its textures
+	struct TUsedTile {
+		quint64 uiKey = 0;
+		TQuadNode node;
+		ITile* pTile = nullptr;
+	};
+	std::vector<ITilePtr> m_vPool;
+	std::vector<ITile*> m_vFree;
+	std::vector<TUsedTile> m_vUsed, m_vNext;
+	//Views draw one after another, each one keeps its own counts
+	QString m_qsStats = CStatistics::instance("tiles");
+	CStatCounter m_statVisible{ m_qsStats + ".visible" };
+private:
+	bool measure(const TQuadNode& node, float& fPixels);
+	void geometry(const TQuadNode& node, QVector3D& qvPos, QVector3D& qvSize);
+	void assign(const std::vector<TQuadNode>& vNodes);
+};
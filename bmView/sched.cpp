@@ -0,0 +1,302 @@
+#include "sched.h"
+#include "trace.h"
+
+IJobSchedulerPtr CJobScheduler::m_pScheduler = nullptr;
+
+namespace {
+	//Worker index of the current thread, so that jobs posted from a job stay on the local deque
+	thread_local const CJobScheduler* tl_pScheduler = nullptr;
+	thread_local size_t tl_szWorker = 0;
+}
+
+IJobSchedulerPtr CJobScheduler::get()
+{
+	static std::once_flag flag;
+	std::call_once(flag, [] {
+		auto uiWorkers = std::max(2u, std::thread::hardware_concurrency());
+		m_pScheduler = IJobSchedulerPtr(new CJobScheduler(uiWorkers));
+	});
+
+	return m_pScheduler;
+}
+
+CJobScheduler::CJobScheduler(const uint& uiWorkers)
+{
+	for (auto& it : m_aQueued)
+		it = 0;
+
+	for (uint i = 0; i < uiWorkers; ++i)
+		m_vLocal.push_back(std::make_unique<TJobQueue>());
+
+	for (uint i = 0; i < uiWorkers; ++i)
+		m_vWorkers.emplace_back([this, i] { worker(i); });
+}
+
+CJobScheduler::~CJobScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_WaitLock);
+		m_bStop = true;
+	}
+
+	m_cvWork.notify_all();
+	for (auto& it : m_vWorkers)
+		it.join();
+}
+
+void CJobScheduler::post(const JobPriorityPtr& pPriority, const pplx::cancellation_token& token, std::function<void()> fnRun, std::function<void()> fnCancel)
+{
+	TJob job;
+	job.pPriority = pPriority;
+	job.token = token;
+	job.fnRun = std::move(fnRun);
+	job.fnCancel = std::move(fnCancel);
+
+	enqueue(std::move(job), (size_t)pPriority->load());
+}
+
+void CJobScheduler::post(const EJobPriority& ePriority, const pplx::cancellation_token& token, std::function<void()> fnRun, std::function<void()> fnCancel)
+{
+	post(std::make_shared<std::atomic<EJobPriority>>(ePriority), token, std::move(fnRun), std::move(fnCancel));
+}
+
+void CJobScheduler::reprioritize(const JobPriorityPtr& pPriority, const EJobPriority& ePriority)
+{
+	//Demotion is found when the job is taken, a promoted job has to be looked for in the lower classes
+	if (pPriority->exchange(ePriority) > ePriority) {
+		++m_uiPromoted;
+		m_cvWork.notify_one();
+	}
+}
+
+void CJobScheduler::parallelFor(const EJobPriority& ePriority, const size_t& szCount, const std::function<void(size_t, size_t)>& fBody)
+{
+	if (!szCount)
+		return;
+
+	//0) A few chunks per worker, so that stealing can even out uneven chunks
+	size_t szChunk = std::max<size_t>(1, szCount / (4 * m_vWorkers.size()));
+	size_t szChunks = (szCount + szChunk - 1) / szChunk;
+	if (szChunks < 2) {
+		fBody(0, szCount);
+		return;
+	}
+
+	struct TState {
+		std::atomic<size_t> szNext{ 0 };
+		std::atomic<size_t> szDone{ 0 };
+		const std::function<void(size_t, size_t)>* pBody = nullptr;
+	};
+	auto pState = std::make_shared<TState>();
+	pState->pBody = &fBody;
+
+	//1) Chunks are claimed, not assigned. The body is only touched for a claimed chunk, and we wait for those
+	auto fnDrain = [pState, szChunk, szChunks, szCount]() {
+		for (size_t i = pState->szNext++; i < szChunks; i = pState->szNext++) {
+			(*pState->pBody)(i * szChunk, std::min(szCount, (i + 1) * szChunk));
+			++pState->szDone;
+		}
+	};
+
+	auto szHelpers = std::min(szChunks, m_vWorkers.size()) - 1;
+	for (size_t i = 0; i < szHelpers; ++i)
+		post(ePriority, pplx::cancellation_token::none(), fnDrain, nullptr);
+
+	//2) The caller works too, so this never waits for a job that nobody has started
+	fnDrain();
+	while (pState->szDone < szChunks)
+		std::this_thread::yield();
+}
+
+TSchedulerStats CJobScheduler::stats()
+{
+	TSchedulerStats result;
+	result.uiWorkers = (uint)m_vWorkers.size();
+	result.uiBusy = m_uiBusy;
+	result.uiCanceled = m_uiCanceled;
+	for (size_t i = 0; i < m_szClasses; ++i)
+		result.aQueued[i] = m_aQueued[i];
+
+	std::lock_guard<std::mutex> lock(m_StatsLock);
+	auto tpNow = std::chrono::steady_clock::now();
+	auto uiWallNs = std::chrono::duration_cast<std::chrono::nanoseconds>(tpNow - m_tpLastStats).count();
+	quint64 uiBusyNs = m_uiBusyNs;
+	if (uiWallNs > 0)
+		result.dbUtilisation = (double)(uiBusyNs - m_uiLastBusyNs) / ((double)uiWallNs * m_vWorkers.size());
+
+	m_tpLastStats = tpNow;
+	m_uiLastBusyNs = uiBusyNs;
+
+	return result;
+}
+
+void CJobScheduler::worker(const size_t& szWorker)
+{
+	tl_pScheduler = this;
+	tl_szWorker = szWorker;
+	CTracer::setThreadName(QString("scheduler %1").arg(szWorker));
+
+	while (!m_bStop) {
+		TJob job;
+		if (take(szWorker, job)) {
+			execute(job);
+			continue;
+		}
+
+		//Timeout covers a notify that raced with the emptiness check
+		std::unique_lock<std::mutex> lock(m_WaitLock);
+		m_cvWork.wait_for(lock, std::chrono::milliseconds(50), [this] {
+			if (m_bStop)
+				return true;
+
+			for (const auto& it : m_aQueued) {
+				if (it > 0)
+					return true;
+			}
+
+			return false;
+		});
+	}
+}
+
+bool CJobScheduler::take(const size_t& szWorker, TJob& job)
+{
+	//One worker sweeps for all promotions made since the previous sweep
+	if (m_uiPromoted && m_uiPromoted.exchange(0))
+		sweep();
+
+	for (size_t szClass = 0; szClass < m_szClasses;) {
+		if (!m_aQueued[szClass]) {
+			++szClass;
+			continue;
+		}
+
+		//0) Own newest job, then the shared queue, then the oldest job of a neighbour
+		bool bFound = popBack(*m_vLocal[szWorker], szClass, job) || popFront(m_Global, szClass, job);
+		for (size_t i = 1; !bFound && (i < m_vLocal.size()); ++i)
+			bFound = popFront(*m_vLocal[(szWorker + i) % m_vLocal.size()], szClass, job);
+
+		if (!bFound) {
+			++szClass;
+			continue;
+		}
+
+		--m_aQueued[szClass];
+
+		//1) Job was demoted while waiting, e.g. its tile scrolled away. It goes behind the jobs of its new class,
+		//the current class is looked at again
+		auto szActual = (size_t)job.pPriority->load();
+		if (szActual > szClass) {
+			enqueueGlobal(std::move(job), szActual, false);
+			continue;
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+bool CJobScheduler::popBack(TJobQueue& queue, const size_t& szClass, TJob& job)
+{
+	std::lock_guard<std::mutex> lock(queue.lock);
+	auto& dqJobs = queue.aJobs[szClass];
+	if (dqJobs.empty())
+		return false;
+
+	job = std::move(dqJobs.back());
+	dqJobs.pop_back();
+	return true;
+}
+
+bool CJobScheduler::popFront(TJobQueue& queue, const size_t& szClass, TJob& job)
+{
+	std::lock_guard<std::mutex> lock(queue.lock);
+	auto& dqJobs = queue.aJobs[szClass];
+	if (dqJobs.empty())
+		return false;
+
+	job = std::move(dqJobs.front());
+	dqJobs.pop_front();
+	return true;
+}
+
+void CJobScheduler::enqueue(TJob job, const size_t& szClass)
+{
+	auto& queue = (this == tl_pScheduler) ? *m_vLocal[tl_szWorker] : m_Global;
+	{
+		std::lock_guard<std::mutex> lock(queue.lock);
+		queue.aJobs[szClass].push_back(std::move(job));
+	}
+
+	++m_aQueued[szClass];
+	m_cvWork.notify_one();
+}
+
+void CJobScheduler::enqueueGlobal(TJob job, const size_t& szClass, const bool& bFront)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Global.lock);
+		if (bFront)
+			m_Global.aJobs[szClass].push_front(std::move(job));
+		else
+			m_Global.aJobs[szClass].push_back(std::move(job));
+	}
+
+	++m_aQueued[szClass];
+	m_cvWork.notify_one();
+}
+
+void CJobScheduler::sweep()
+{
+	//0) Promoted jobs are taken out of every queue, one lock at a time
+	std::vector<std::pair<size_t, TJob>> vPromoted;
+	auto collect = [this, &vPromoted](TJobQueue& queue) {
+		std::lock_guard<std::mutex> lock(queue.lock);
+		for (size_t szClass = 1; szClass < m_szClasses; ++szClass) {
+			auto& dqJobs = queue.aJobs[szClass];
+			for (auto it = dqJobs.begin(); it != dqJobs.end();) {
+				auto szActual = (size_t)it->pPriority->load();
+				if (szActual >= szClass) {
+					++it;
+					continue;
+				}
+
+				vPromoted.emplace_back(szActual, std::move(*it));
+				it = dqJobs.erase(it);
+				--m_aQueued[szClass];
+			}
+		}
+	};
+
+	collect(m_Global);
+	for (auto& it : m_vLocal)
+		collect(*it);
+
+	//1) They waited longer than the jobs of their new class, so they go first. The order among them is kept
+	for (auto it = vPromoted.rbegin(); it != vPromoted.rend(); ++it)
+		enqueueGlobal(std::move(it->second), it->first, true);
+}
+
+void CJobScheduler::execute(TJob& job)
+{
+	if (job.token.is_canceled()) {
+		++m_uiCanceled;
+		if (job.fnCancel)
+			job.fnCancel();
+
+		return;
+	}
+
+	++m_uiBusy;
+	auto tpStart = std::chrono::steady_clock::now();
+
+	try {
+		job.fnRun();
+	}
+	catch (...) {
+	}
+
+	m_uiBusyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tpStart).count();
+	--m_uiBusy;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include "intfs.h"
+
+class CJobScheduler : public IJobScheduler {
+public:
+	static IJobSchedulerPtr get();
+	~CJobScheduler();
+protected: //IJobScheduler
+	void post(const JobPriorityPtr& pPriority, const pplx::cancellation_token& token, std::function<void()> fnRun, std::function<void()> fnCancel) override;
+	void post(const EJobPriority& ePriority, const pplx::cancellation_token& token, std::function<void()> fnRun, std::function<void()> fnCancel) override;
+	void reprioritize(const JobPriorityPtr& pPriority, const EJobPriority& ePriority) override;
+	void parallelFor(const EJobPriority& ePriority, const size_t& szCount, const std::function<void(size_t, size_t)>& fBody) override;
+	TSchedulerStats stats() override;
+private:
+	static const size_t m_szClasses = (size_t)EJobPriority::Count;
+	struct TJob {
+		JobPriorityPtr pPriority;
+		pplx::cancellation_token token = pplx::cancellation_token::none();
+		std::function<void()> fnRun;
+		std::function<void()> fnCancel;
+	};
+	struct TJobQueue {
+		std::mutex lock;
+		std::array<std::deque<TJob>, m_szClasses> aJobs;
+	};
+	explicit CJobScheduler(const uint& uiWorkers);
+	static IJobSchedulerPtr m_pScheduler;
+
+	std::vector<std::thread> m_vWorkers;
+	//One deque per worker: the owner pops the newest job, thieves take the oldest
+	std::vector<std::unique_ptr<TJobQueue>> m_vLocal;
+	//Jobs posted from outside the pool
+	TJobQueue m_Global;
+
+	std::mutex m_WaitLock;
+	std::condition_variable m_cvWork;
+	std::array<std::atomic<size_t>, m_szClasses> m_aQueued;
+	std::atomic<bool> m_bStop{ false };
+	//Promotions since the last sweep of the queues
+	std::atomic<uint> m_uiPromoted{ 0 };
+
+	std::atomic<uint> m_uiBusy{ 0 };
+	std::atomic<quint64> m_uiBusyNs{ 0 };
+	std::atomic<quint64> m_uiCanceled{ 0 };
+	std::mutex m_StatsLock;
+	std::chrono::steady_clock::time_point m_tpLastStats = std::chrono::steady_clock::now();
+	quint64 m_uiLastBusyNs = 0;
+private:
+	void worker(const size_t& szWorker);
+	bool take(const size_t& szWorker, TJob& job);
+	bool popBack(TJobQueue& queue, const size_t& szClass, TJob& job);
+	bool popFront(TJobQueue& queue, const size_t& szClass, TJob& job);
+	void enqueue(TJob job, const size_t& szClass);
+	//Into the shared queue: at the back it runs after every job of the class, at the front before them
+	void enqueueGlobal(TJob job, const size_t& szClass, const bool& bFront);
+	//Moves the promoted jobs of every queue to the front of their new classes
+	void sweep();
+	void execute(TJob& job);
+};
+
+//Runs fn on the scheduler and returns its result as a pplx task, so it can be chained with the network continuations
+template <typename F> auto scheduleTask(const IJobSchedulerPtr& pScheduler, const JobPriorityPtr& pPriority,
+	const pplx::cancellation_token& token, F fn) -> pplx::task<decltype(fn())>
+{
+	using R = decltype(fn());
+	pplx::task_completion_event<R> tce;
+	pScheduler->post(pPriority, token,
+		[tce, fn]() {
+			try {
+				tce.set(fn());
+			}
+			catch (...) {
+				tce.set_exception(std::current_exception());
+			}
+		},
+		[tce]() {
+			tce.set_exception(pplx::task_canceled());
+		});
+
+	return pplx::create_task(tce);
+}
+
+template <typename F> auto scheduleTask(const IJobSchedulerPtr& pScheduler, const EJobPriority& ePriority,
+	const pplx::cancellation_token& token, F fn) -> pplx::task<decltype(fn())>
+{
+	return scheduleTask(pScheduler, std::make_shared<std::atomic<EJobPriority>>(ePriority), token, fn);
+}
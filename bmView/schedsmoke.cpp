@@ -0,0 +1,139 @@
+#include "sched.h"
+
+//Smoke run of the job scheduler for the Linux build: every class runs, a promoted job overtakes a queue,
+//a cancelled job is not run and parallelFor covers its range exactly once. Exit code 0 - all fine
+namespace {
+	//Waits for a number of jobs, gives up after a while instead of hanging the test
+	class CLatch {
+	public:
+		explicit CLatch(const size_t& szCount) : m_szCount(szCount) {}
+		void done()
+		{
+			std::lock_guard<std::mutex> lock(m_Lock);
+			if (m_szCount && !--m_szCount)
+				m_cvDone.notify_all();
+		}
+		bool wait()
+		{
+			std::unique_lock<std::mutex> lock(m_Lock);
+			return m_cvDone.wait_for(lock, std::chrono::seconds(10), [this] { return !m_szCount; });
+		}
+	private:
+		std::mutex m_Lock;
+		std::condition_variable m_cvDone;
+		size_t m_szCount;
+	};
+
+	bool check(const bool& bPassed, const char* szName)
+	{
+		printf("%s: %s\n", szName, bPassed ? "ok" : "FAILED");
+		return bPassed;
+	}
+}
+
+int main()
+{
+	auto pScheduler = CJobScheduler::get();
+	bool bPassed = true;
+
+	//0) Jobs of every class run
+	{
+		const size_t szJobs = 1000;
+		CLatch latch(szJobs * (size_t)EJobPriority::Count);
+		std::atomic<size_t> szRun{ 0 };
+		for (size_t i = 0; i < szJobs; ++i) {
+			for (size_t c = 0; c < (size_t)EJobPriority::Count; ++c) {
+				pScheduler->post((EJobPriority)c, pplx::cancellation_token::none(), [&] {
+					++szRun;
+					latch.done();
+				});
+			}
+		}
+
+		bPassed &= check(latch.wait() && (szRun == szJobs * (size_t)EJobPriority::Count), "classes");
+	}
+
+	//1) Workers are kept busy, a background job promoted to visible runs before the background queue behind it
+	{
+		const size_t szWorkers = pScheduler->stats().uiWorkers;
+		const size_t szQueued = 64;
+		CLatch started(szWorkers), latch(szWorkers + szQueued + 1);
+		std::atomic<bool> bRelease{ false };
+		for (size_t i = 0; i < szWorkers; ++i) {
+			pScheduler->post(EJobPriority::Visible, pplx::cancellation_token::none(), [&] {
+				started.done();
+				while (!bRelease)
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+				latch.done();
+			});
+		}
+
+		started.wait();
+		std::atomic<size_t> szOrder{ 0 }, szPromotedAt{ 0 };
+		for (size_t i = 0; i < szQueued; ++i) {
+			pScheduler->post(EJobPriority::Background, pplx::cancellation_token::none(), [&] {
+				++szOrder;
+				latch.done();
+			});
+		}
+
+		auto pPriority = std::make_shared<std::atomic<EJobPriority>>(EJobPriority::Background);
+		pScheduler->post(pPriority, pplx::cancellation_token::none(), [&] {
+			szPromotedAt = szOrder++;
+			latch.done();
+		});
+
+		pScheduler->reprioritize(pPriority, EJobPriority::Visible);
+		bRelease = true;
+		bPassed &= check(latch.wait() && (szPromotedAt < szQueued / 2), "promotion");
+	}
+
+	//2) Token cancelled before the job starts: fnCancel instead of the job
+	{
+		CLatch latch(1);
+		pplx::cancellation_token_source cts;
+		cts.cancel();
+		std::atomic<bool> bRun{ false }, bCancelled{ false };
+		pScheduler->post(EJobPriority::Visible, cts.get_token(),
+			[&] {
+				bRun = true;
+				latch.done();
+			},
+			[&] {
+				bCancelled = true;
+				latch.done();
+			});
+
+		bPassed &= check(latch.wait() && bCancelled && !bRun, "cancel");
+	}
+
+	//3) Every index once, also when called from inside a job
+	{
+		const size_t szCount = 1000000;
+		auto runFor = [&] {
+			std::vector<std::atomic<unsigned char>> vHits(szCount);
+			pScheduler->parallelFor(EJobPriority::Visible, szCount, [&](size_t szFirst, size_t szLast) {
+				for (auto i = szFirst; i < szLast; ++i)
+					++vHits[i];
+			});
+
+			return std::all_of(vHits.begin(), vHits.end(), [](const std::atomic<unsigned char>& it) { return 1 == it; });
+		};
+
+		bPassed &= check(runFor(), "parallelFor");
+
+		CLatch latch(1);
+		std::atomic<bool> bNested{ false };
+		pScheduler->post(EJobPriority::Prefetch, pplx::cancellation_token::none(), [&] {
+			bNested = runFor();
+			latch.done();
+		});
+
+		bPassed &= check(latch.wait() && bNested, "parallelFor.nested");
+	}
+
+	//Workers are joined by the static scheduler on exit
+	fflush(stdout);
+	return bPassed ? 0 : 1;
+}
@@ -0,0 +1,269 @@
+#include "seed.h"
+#include "geotex.h"
+#include "diskcache.h"
+#include "sched.h"
+
+namespace {
+	//Liang-Barsky: does the segment touch the rectangle
+	bool segmentHitsRect(double dbX0, double dbY0, double dbX1, double dbY1, const QRectF& qrRect)
+	{
+		double t0 = 0.0, t1 = 1.0;
+		double dbDX = dbX1 - dbX0, dbDY = dbY1 - dbY0;
+		const double p[] = { -dbDX, dbDX, -dbDY, dbDY };
+		const double q[] = { dbX0 - qrRect.left(), qrRect.right() - dbX0, dbY0 - qrRect.top(), qrRect.bottom() - dbY0 };
+
+		for (int i = 0; i < 4; ++i) {
+			if (0.0 == p[i]) {
+				if (q[i] < 0.0)
+					return false;
+				continue;
+			}
+
+			double t = q[i] / p[i];
+			if (p[i] < 0.0)
+				t0 = std::max(t0, t);
+			else
+				t1 = std::min(t1, t);
+
+			if (t0 > t1)
+				return false;
+		}
+
+		return true;
+	}
+
+	bool pointInPolygon(const double& dbX, const double& dbY, const std::vector<std::pair<double, double>>& vPolygon)
+	{
+		bool bInside = false;
+		for (size_t i = 0, j = vPolygon.size() - 1; i < vPolygon.size(); j = i++) {
+			const auto& a = vPolygon[i];
+			const auto& b = vPolygon[j];
+			if (((a.second > dbY) != (b.second > dbY)) &&
+				(dbX < (b.first - a.first) * (dbY - a.second) / (b.second - a.second) + a.first))
+				bInside = !bInside;
+		}
+
+		return bInside;
+	}
+}
+
+CTileSeeder::CTileSeeder(const TSeedOptions& options) : m_Options(options)
+{
+	m_pMath = CBingGeoTextureProvider::get()->getMath();
+	m_pCache = CDiskTileCache::get();
+}
+
+int CTileSeeder::run()
+{
+	if ((m_Options.vArea.size() < 2) || (m_Options.uiMinZoom > m_Options.uiMaxZoom)) {
+		qCritical() << "Seeding area or zoom range is empty";
+		return 1;
+	}
+
+	//0) Tile source
+	if (m_Options.qsUriTemplate.isEmpty()) {
+		auto pMeta = CBingGeoTextureProvider::get()->getMetadata();
+		if (!pMeta->valid()) {
+			qCritical() << "Imagery metadata is not available, use --tile-url";
+			return 1;
+		}
+
+		m_Options.qsUriTemplate = pMeta->getUriTemplate();
+	}
+
+	//1) Tile ranges and the total count
+	prepare();
+	qInfo().noquote() << QString("Seeding %1 tiles, zoom %2..%3, %4 jobs")
+		.arg(m_uiTotal).arg(m_Options.uiMinZoom).arg(m_Options.uiMaxZoom).arg(m_Options.uiJobs);
+
+	//2) Workers pull quadkeys from the shared cursor, the main thread only reports
+	QElapsedTimer timer;
+	timer.start();
+
+	std::vector<std::thread> vWorkers;
+	m_uiActive = std::max(1u, m_Options.uiJobs);
+	for (uint i = 0; i < m_uiActive; ++i)
+		vWorkers.emplace_back([this] { worker(); });
+
+	for (qint64 nNextReport = 1000; m_uiActive > 0;) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		if (timer.elapsed() >= nNextReport) {
+			report(timer.elapsed() / 1000.0, false);
+			nNextReport += 1000;
+		}
+	}
+
+	for (auto& it : vWorkers)
+		it.join();
+
+	report(timer.elapsed() / 1000.0, true);
+	return m_uiFailed ? 2 : 0;
+}
+
+void CTileSeeder::prepare()
+{
+	//0) Area in mercator, bbox of all points
+	double dbX0 = 1.0, dbY0 = 1.0, dbX1 = 0.0, dbY1 = 0.0;
+	for (const auto& it : m_Options.vArea) {
+		auto spMerc = m_pMath->wgs2merc(it.x(), it.y());
+		dbX0 = std::min(dbX0, spMerc.first);
+		dbX1 = std::max(dbX1, spMerc.first);
+		dbY0 = std::min(dbY0, spMerc.second);
+		dbY1 = std::max(dbY1, spMerc.second);
+
+		if (m_Options.vArea.size() > 2)
+			m_vPolygon.push_back(spMerc);
+	}
+
+	//1) Tile range per zoom. Polygon ranges are counted exactly, bbox ones by their size
+	for (auto uiZoom = m_Options.uiMinZoom; uiZoom <= m_Options.uiMaxZoom; ++uiZoom) {
+		int nCount = 1 << uiZoom;
+		auto tile = [nCount](const double& dbValue) {
+			return std::min(std::max((int)std::floor(dbValue * nCount), 0), nCount - 1);
+		};
+
+		TTileRange range = { uiZoom, tile(dbX0), tile(dbY0), tile(dbX1), tile(dbY1) };
+		m_vRanges.push_back(range);
+
+		if (m_vPolygon.empty()) {
+			m_uiTotal += (quint64)(range.nX1 - range.nX0 + 1) * (range.nY1 - range.nY0 + 1);
+			continue;
+		}
+
+		for (int nY = range.nY0; nY <= range.nY1; ++nY)
+			for (int nX = range.nX0; nX <= range.nX1; ++nX)
+				m_uiTotal += inArea(uiZoom, nX, nY) ? 1 : 0;
+	}
+
+	if (!m_vRanges.empty()) {
+		m_nX = m_vRanges[0].nX0;
+		m_nY = m_vRanges[0].nY0;
+	}
+}
+
+bool CTileSeeder::next(QString& qsQuadKey)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	while (m_szRange < m_vRanges.size()) {
+		const auto& range = m_vRanges[m_szRange];
+		int nX = m_nX, nY = m_nY;
+
+		//Advance the cursor: row by row, then the next zoom
+		if (++m_nX > range.nX1) {
+			m_nX = range.nX0;
+			if (++m_nY > range.nY1) {
+				if (++m_szRange < m_vRanges.size()) {
+					m_nX = m_vRanges[m_szRange].nX0;
+					m_nY = m_vRanges[m_szRange].nY0;
+				}
+			}
+		}
+
+		if (inArea(range.uiZoom, nX, nY)) {
+			qsQuadKey = m_pMath->tile2quad(nX, nY, range.uiZoom);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool CTileSeeder::inArea(const uint& uiZoom, const int& nX, const int& nY)
+{
+	if (m_vPolygon.empty())
+		return true;
+
+	double dbSize = 1.0 / (double)(1 << uiZoom);
+	QRectF qrTile(nX * dbSize, nY * dbSize, dbSize, dbSize);
+
+	//0) Polygon edge crosses or lies in the tile
+	for (size_t i = 0, j = m_vPolygon.size() - 1; i < m_vPolygon.size(); j = i++) {
+		if (segmentHitsRect(m_vPolygon[j].first, m_vPolygon[j].second, m_vPolygon[i].first, m_vPolygon[i].second, qrTile))
+			return true;
+	}
+
+	//1) No edge touches the tile: it is either fully inside or fully outside
+	return pointInPolygon(qrTile.center().x(), qrTile.center().y(), m_vPolygon);
+}
+
+void CTileSeeder::worker()
+{
+	//One client per worker keeps its connection alive between tiles
+	web::uri uri(utility::conversions::to_string_t(m_Options.qsUriTemplate.toStdString()));
+	web::http::client::http_client client(uri.authority());
+	QString qsQuadKey;
+
+	while (next(qsQuadKey)) {
+		//Tiles are written atomically, so whatever is on disk is complete: resume just skips it
+		if (m_pCache->contains(qsQuadKey)) {
+			++m_uiSkipped;
+			continue;
+		}
+
+		bool bFetched = false;
+		for (uint uiAttempt = 0; !bFetched && (uiAttempt <= m_Options.uiRetries); ++uiAttempt) {
+			if (uiAttempt)
+				std::this_thread::sleep_for(std::chrono::milliseconds(200 << uiAttempt));
+
+			bFetched = fetch(client, qsQuadKey);
+		}
+
+		if (bFetched)
+			++m_uiFetched;
+		else
+			++m_uiFailed;
+	}
+
+	--m_uiActive;
+}
+
+bool CTileSeeder::fetch(web::http::client::http_client& client, const QString& qsQuadKey)
+{
+	auto qsUri = m_Options.qsUriTemplate;
+	qsUri.replace("{quadkey}", qsQuadKey);
+
+	try {
+		web::uri uri(utility::conversions::to_string_t(qsUri.toStdString()));
+		auto response = client.request(web::http::methods::GET, uri.resource().to_string()).get();
+		if (web::http::status_codes::OK != response.status_code())
+			return false;
+
+		auto vData = response.extract_vector().get();
+		if (vData.empty())
+			return false;
+
+		//Checking and storing the tile is background work, so seeding never slows down an open map view
+		QByteArray qbData(reinterpret_cast<const char*>(vData.data()), (int)vData.size());
+		auto validators = CDiskTileCache::validators(response.headers());
+		auto pCache = m_pCache;
+		bool bStored = scheduleTask(CJobScheduler::get(), EJobPriority::Background, pplx::cancellation_token::none(), [=]() mutable {
+			QBuffer buffer(&qbData);
+			buffer.open(QIODevice::ReadOnly);
+			return QImageReader(&buffer).canRead() && pCache->write(qsQuadKey, qbData, validators);
+		}).get();
+
+		if (!bStored)
+			return false;
+
+		m_uiBytes += vData.size();
+		return true;
+	}
+	catch (const std::exception& e) {
+		return false;
+	}
+}
+
+void CTileSeeder::report(const double& dbSeconds, const bool& bFinal)
+{
+	quint64 uiDone = m_uiFetched + m_uiSkipped + m_uiFailed;
+	double dbRate = (dbSeconds > 0.0) ? m_uiFetched / dbSeconds : 0.0;
+	double dbMBytes = m_uiBytes / (1024.0 * 1024.0);
+
+	qInfo().noquote() << QString("%1%2/%3 (%4%) fetched %5, skipped %6, failed %7, %8 tiles/s, %9 MB/s")
+		.arg(bFinal ? "Done: " : "")
+		.arg(uiDone).arg(m_uiTotal)
+		.arg(m_uiTotal ? 100.0 * uiDone / m_uiTotal : 100.0, 0, 'f', 1)
+		.arg((quint64)m_uiFetched).arg((quint64)m_uiSkipped).arg((quint64)m_uiFailed)
+		.arg(dbRate, 0, 'f', 1)
+		.arg((dbSeconds > 0.0) ? dbMBytes / dbSeconds : 0.0, 0, 'f', 2);
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "intfs.h"
+
+struct TSeedOptions {
+	//Two points are a bbox corner pair, three or more a polygon. Points are QPointF(lat, lon)
+	std::vector<QPointF> vArea;
+	uint uiMinZoom = 1;
+	uint uiMaxZoom = 1;
+	uint uiJobs = 8;
+	uint uiRetries = 2;
+	//Overrides the Bing metadata, e.g. a stand-in server
+	QString qsUriTemplate;
+};
+
+class CTileSeeder {
+public:
+	explicit CTileSeeder(const TSeedOptions& options);
+	int run();
+private:
+	struct TTileRange {
+		uint uiZoom;
+		int nX0, nY0, nX1, nY1;
+	};
+	TSeedOptions m_Options;
+	IGeoMathPtr m_pMath;
+	IGeoTileCachePtr m_pCache;
+	std::vector<std::pair<double, double>> m_vPolygon;
+	std::vector<TTileRange> m_vRanges;
+
+	//Enumeration cursor, shared by the workers
+	std::mutex m_Lock;
+	size_t m_szRange = 0;
+	int m_nX = 0, m_nY = 0;
+
+	quint64 m_uiTotal = 0;
+	std::atomic<quint64> m_uiFetched{ 0 };
+	std::atomic<quint64> m_uiSkipped{ 0 };
+	std::atomic<quint64> m_uiFailed{ 0 };
+	std::atomic<quint64> m_uiBytes{ 0 };
+	std::atomic<uint> m_uiActive{ 0 };
+private:
+	void prepare();
+	bool next(QString& qsQuadKey);
+	bool inArea(const uint& uiZoom, const int& nX, const int& nY);
+	void worker();
+	bool fetch(web::http::client::http_client& client, const QString& qsQuadKey);
+	void report(const double& dbSeconds, const bool& bFinal);
+};
@@ -0,0 +1,499 @@
+#include "sharedcache.h"
+#include "diskcache.h"
+#include "stats.h"
+#include "consts.h"
+#include "failures.h"
+
+std::mutex CSharedTileCache::m_Lock;
+std::map<QString, IGeoTileCachePtr> CSharedTileCache::m_mCaches;
+std::shared_ptr<CSharedTileSegment> CSharedTileCache::m_pSegment;
+qint64 CSharedTileCache::m_nBudget = 0;
+
+namespace {
+	const quint32 uiMagic = 0x31544D42;
+
+	enum ESlotState : quint32 {
+		SlotEmpty = 0,
+		SlotLoading,
+		SlotReady
+	};
+
+	//Stable across processes, unlike qHash
+	quint32 fnv1a(const QByteArray& qbData)
+	{
+		quint32 uiHash = 2166136261u;
+		for (auto it : qbData)
+			uiHash = (uiHash ^ (uchar)it) * 16777619u;
+
+		return uiHash;
+	}
+
+	quint64 mix(quint64 uiValue)
+	{
+		uiValue = (uiValue ^ (uiValue >> 30)) * 0xBF58476D1CE4E5B9ull;
+		uiValue = (uiValue ^ (uiValue >> 27)) * 0x94D049BB133111EBull;
+		return uiValue ^ (uiValue >> 31);
+	}
+
+	qint64 align(const qint64& nBytes)
+	{
+		return (nBytes + 63) & ~(qint64)63;
+	}
+
+	//Page: validators, then the tile
+	QByteArray pack(const QByteArray& qbData, const TTileValidators& validators)
+	{
+		auto qbETag = validators.qsETag.toUtf8().left(0xFFFF);
+		auto qbModified = validators.qsLastModified.toUtf8().left(0xFFFF);
+
+		QByteArray qbPage;
+		qbPage.reserve(4 + qbETag.size() + qbModified.size() + qbData.size());
+		for (const auto& it : { qbETag, qbModified }) {
+			auto uiLength = (quint16)it.size();
+			qbPage.append(reinterpret_cast<const char*>(&uiLength), sizeof(uiLength));
+			qbPage.append(it);
+		}
+
+		return qbPage.append(qbData);
+	}
+
+	bool unpack(const QByteArray& qbPage, TCachedTile& tile)
+	{
+		int nPos = 0;
+		QByteArray aFields[2];
+		for (auto& it : aFields) {
+			quint16 uiLength = 0;
+			if (nPos + (int)sizeof(uiLength) > qbPage.size())
+				return false;
+
+			std::memcpy(&uiLength, qbPage.constData() + nPos, sizeof(uiLength));
+			nPos += sizeof(uiLength);
+			if (nPos + uiLength > qbPage.size())
+				return false;
+
+			it = qbPage.mid(nPos, uiLength);
+			nPos += uiLength;
+		}
+
+		tile.validators.qsETag = QString::fromUtf8(aFields[0]);
+		tile.validators.qsLastModified = QString::fromUtf8(aFields[1]);
+		tile.qbData = qbPage.mid(nPos);
+		return true;
+	}
+}
+
+//Plain fields are written before the magic and never change after it
+struct CSharedTileSegment::THeader {
+	std::atomic<quint32> uiMagic;
+	quint32 uiSets;
+	quint32 uiWays;
+	quint32 uiPageBytes;
+	std::atomic<quint64> uiClock;
+	std::atomic<qint64> nBytes;
+};
+
+//Odd sequence - the slot is being written. Every field is atomic, a reader may look at it any time
+struct alignas(64) CSharedTileSegment::TSlot {
+	std::atomic<quint32> uiSequence;
+	std::atomic<quint32> uiState;
+	std::atomic<quint64> uiTile;
+	std::atomic<quint32> uiNamespace;
+	std::atomic<quint32> uiSize;
+	std::atomic<qint64> nExpires;
+	//Loading: the process that loads the tile and until when the others wait for it
+	std::atomic<qint64> nOwner;
+	std::atomic<qint64> nClaimedUntil;
+	//Clock of the last hit, for the LRU
+	std::atomic<quint64> uiUsed;
+};
+
+static_assert(std::atomic<quint64>::is_always_lock_free, "Slots are shared between processes, their atomics can't take locks");
+
+std::shared_ptr<CSharedTileSegment> CSharedTileSegment::attach(const QString& qsKey, const qint64& nBudget)
+{
+	auto pSegment = std::shared_ptr<CSharedTileSegment>(new CSharedTileSegment());
+	pSegment->m_Memory.setKey(qsKey);
+	pSegment->m_nPid = QCoreApplication::applicationPid();
+	if (!pSegment->map(nBudget)) {
+		qWarning() << "Shared tile cache is off:" << pSegment->m_Memory.errorString();
+		return nullptr;
+	}
+
+	return pSegment;
+}
+
+std::optional<TCachedTile> CSharedTileSegment::lookup(const TSharedTileKey& key)
+{
+	auto pSet = set(key);
+	for (quint32 i = 0; i < m_pHeader->uiWays; ++i) {
+		auto pSlot = pSet + i;
+		for (int nTry = 0; nTry < 100; ++nTry) {
+			//0) A writer holds the slot for one page copy at most
+			auto uiSequence = pSlot->uiSequence.load(std::memory_order_acquire);
+			if (uiSequence & 1) {
+				std::this_thread::yield();
+				continue;
+			}
+
+			if ((SlotReady != pSlot->uiState.load(std::memory_order_relaxed)) || (key.uiTile != pSlot->uiTile.load(std::memory_order_relaxed)) ||
+				(key.uiNamespace != pSlot->uiNamespace.load(std::memory_order_relaxed)))
+				break;
+
+			//1) Copy first, the sequence tells afterwards whether the copy is whole
+			auto uiSize = std::min(pSlot->uiSize.load(std::memory_order_relaxed), m_pHeader->uiPageBytes);
+			QByteArray qbPage(page(pSlot), (int)uiSize);
+			auto nExpires = pSlot->nExpires.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (pSlot->uiSequence.load(std::memory_order_relaxed) != uiSequence)
+				continue;
+
+			TCachedTile tile;
+			if (!unpack(qbPage, tile))
+				break;
+
+			pSlot->uiUsed.store(m_pHeader->uiClock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+			tile.validators.nExpires = nExpires;
+			tile.bStale = (nExpires <= QDateTime::currentSecsSinceEpoch());
+			return tile;
+		}
+	}
+
+	return std::nullopt;
+}
+
+bool CSharedTileSegment::contains(const TSharedTileKey& key)
+{
+	auto pSlot = find(key);
+	return pSlot && (SlotReady == pSlot->uiState.load(std::memory_order_relaxed));
+}
+
+bool CSharedTileSegment::publish(const TSharedTileKey& key, const QByteArray& qbData, const TTileValidators& validators)
+{
+	auto qbPage = pack(qbData, validators);
+	if (qbPage.size() > (int)m_pHeader->uiPageBytes) {
+		CStatistics::get()->add("cache.shared.toolarge", 1);
+		return false;
+	}
+
+	if (!m_Memory.lock())
+		return false;
+
+	auto pSlot = allocate(key);
+	if (pSlot) {
+		//0) Readers that start meanwhile see an odd sequence, the ones already copying see it changed
+		auto uiSequence = pSlot->uiSequence.load(std::memory_order_relaxed);
+		pSlot->uiSequence.store(uiSequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		if (SlotReady == pSlot->uiState.load(std::memory_order_relaxed))
+			m_pHeader->nBytes.fetch_sub(pSlot->uiSize.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+		std::memcpy(page(pSlot), qbPage.constData(), qbPage.size());
+		pSlot->uiTile.store(key.uiTile, std::memory_order_relaxed);
+		pSlot->uiNamespace.store(key.uiNamespace, std::memory_order_relaxed);
+		pSlot->uiSize.store((quint32)qbPage.size(), std::memory_order_relaxed);
+		pSlot->nExpires.store(validators.nExpires, std::memory_order_relaxed);
+		pSlot->nOwner.store(0, std::memory_order_relaxed);
+		pSlot->uiUsed.store(m_pHeader->uiClock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+		pSlot->uiState.store(SlotReady, std::memory_order_relaxed);
+		m_pHeader->nBytes.fetch_add(qbPage.size(), std::memory_order_relaxed);
+
+		//1) Even again: the page is whole
+		pSlot->uiSequence.store(uiSequence + 2, std::memory_order_release);
+	}
+
+	m_Memory.unlock();
+
+	CStatistics::get()->add(pSlot ? "cache.shared.writes" : "cache.shared.full", 1);
+	updateStats();
+	return pSlot != nullptr;
+}
+
+bool CSharedTileSegment::refresh(const TSharedTileKey& key, const qint64& nExpires)
+{
+	if (!m_Memory.lock())
+		return false;
+
+	auto pSlot = find(key);
+	bool bReady = pSlot && (SlotReady == pSlot->uiState.load(std::memory_order_relaxed));
+	if (bReady)
+		pSlot->nExpires.store(nExpires, std::memory_order_relaxed);
+
+	m_Memory.unlock();
+	return bReady;
+}
+
+bool CSharedTileSegment::claim(const TSharedTileKey& key, qint64& nClaimedUntil)
+{
+	if (!m_Memory.lock())
+		return true;
+
+	//0) Loaded meanwhile or being loaded by another process: this one waits
+	auto nNow = QDateTime::currentMSecsSinceEpoch();
+	auto pSlot = find(key);
+	if (pSlot) {
+		auto uiState = pSlot->uiState.load(std::memory_order_relaxed);
+		auto nUntil = pSlot->nClaimedUntil.load(std::memory_order_relaxed);
+		bool bForeign = (SlotLoading == uiState) && (pSlot->nOwner.load(std::memory_order_relaxed) != m_nPid) && (nUntil > nNow);
+		if ((SlotReady == uiState) || bForeign) {
+			nClaimedUntil = (SlotReady == uiState) ? nNow : nUntil;
+			m_Memory.unlock();
+			return false;
+		}
+	}
+
+	//1) A set full of live claims has no room for another one, the tile is loaded without
+	pSlot = allocate(key);
+	if (pSlot) {
+		auto uiSequence = pSlot->uiSequence.load(std::memory_order_relaxed);
+		pSlot->uiSequence.store(uiSequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		if (SlotReady == pSlot->uiState.load(std::memory_order_relaxed))
+			m_pHeader->nBytes.fetch_sub(pSlot->uiSize.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+		pSlot->uiTile.store(key.uiTile, std::memory_order_relaxed);
+		pSlot->uiNamespace.store(key.uiNamespace, std::memory_order_relaxed);
+		pSlot->uiSize.store(0, std::memory_order_relaxed);
+		pSlot->nOwner.store(m_nPid, std::memory_order_relaxed);
+		pSlot->nClaimedUntil.store(nNow + gnSharedClaimMs, std::memory_order_relaxed);
+		pSlot->uiState.store(SlotLoading, std::memory_order_relaxed);
+		pSlot->uiSequence.store(uiSequence + 2, std::memory_order_release);
+	}
+
+	m_Memory.unlock();
+	return true;
+}
+
+void CSharedTileSegment::abandon(const TSharedTileKey& key)
+{
+	if (!m_Memory.lock())
+		return;
+
+	//Only an own claim, a tile that arrived meanwhile stays
+	auto pSlot = find(key);
+	if (pSlot && (SlotLoading == pSlot->uiState.load(std::memory_order_relaxed)) && (m_nPid == pSlot->nOwner.load(std::memory_order_relaxed)))
+		release(pSlot);
+
+	m_Memory.unlock();
+}
+
+bool CSharedTileSegment::map(const qint64& nBudget)
+{
+	//0) Geometry of a new segment. Attaching processes take the one in the header. QSharedMemory sizes are int
+	auto nPages = std::min<qint64>(nBudget, 1024 * 1024 * 1024) / giSharedPageBytes;
+	quint32 uiSets = (quint32)std::max<qint64>(1, nPages / giSharedWays);
+	auto layoutSize = [](const quint32& uiSets, const quint32& uiWays, const quint32& uiPageBytes) {
+		return align(sizeof(THeader)) + align((qint64)uiSets * uiWays * sizeof(TSlot)) + (qint64)uiSets * uiWays * uiPageBytes;
+	};
+
+	bool bCreated = m_Memory.create((int)layoutSize(uiSets, giSharedWays, giSharedPageBytes));
+	if (!bCreated && ((QSharedMemory::AlreadyExists != m_Memory.error()) || !m_Memory.attach()))
+		return false;
+
+	//1) A new segment is zeroed: every slot is empty
+	m_pHeader = static_cast<THeader*>(m_Memory.data());
+	if (bCreated) {
+		m_Memory.lock();
+		m_pHeader->uiSets = uiSets;
+		m_pHeader->uiWays = giSharedWays;
+		m_pHeader->uiPageBytes = giSharedPageBytes;
+		m_pHeader->uiMagic.store(uiMagic, std::memory_order_release);
+		m_Memory.unlock();
+	}
+	else {
+		//The creator may not have filled the header yet
+		for (int i = 0; (i < 100) && (uiMagic != m_pHeader->uiMagic.load(std::memory_order_acquire)); ++i)
+			QThread::msleep(10);
+
+		if ((uiMagic != m_pHeader->uiMagic.load(std::memory_order_acquire)) ||
+			(m_Memory.size() < layoutSize(m_pHeader->uiSets, m_pHeader->uiWays, m_pHeader->uiPageBytes)))
+			return false;
+	}
+
+	auto pBase = static_cast<char*>(m_Memory.data());
+	m_pSlots = reinterpret_cast<TSlot*>(pBase + align(sizeof(THeader)));
+	m_pPages = pBase + align(sizeof(THeader)) + align((qint64)m_pHeader->uiSets * m_pHeader->uiWays * sizeof(TSlot));
+
+	qInfo().noquote() << QString("Shared tile cache: %1 MB, %2")
+		.arg((qint64)m_pHeader->uiSets * m_pHeader->uiWays * m_pHeader->uiPageBytes / (1024 * 1024)).arg(bCreated ? "created" : "attached");
+	return true;
+}
+
+CSharedTileSegment::TSlot* CSharedTileSegment::set(const TSharedTileKey& key)
+{
+	auto uiSet = mix(key.uiTile ^ ((quint64)key.uiNamespace << 32)) % m_pHeader->uiSets;
+	return m_pSlots + uiSet * m_pHeader->uiWays;
+}
+
+CSharedTileSegment::TSlot* CSharedTileSegment::find(const TSharedTileKey& key)
+{
+	auto pSet = set(key);
+	for (quint32 i = 0; i < m_pHeader->uiWays; ++i) {
+		auto pSlot = pSet + i;
+		if ((SlotEmpty != pSlot->uiState.load(std::memory_order_relaxed)) && (key.uiTile == pSlot->uiTile.load(std::memory_order_relaxed)) &&
+			(key.uiNamespace == pSlot->uiNamespace.load(std::memory_order_relaxed)))
+			return pSlot;
+	}
+
+	return nullptr;
+}
+
+CSharedTileSegment::TSlot* CSharedTileSegment::allocate(const TSharedTileKey& key)
+{
+	if (auto pSlot = find(key))
+		return pSlot;
+
+	//0) Free slot, or one whose loading process gave up without saying so
+	auto nNow = QDateTime::currentMSecsSinceEpoch();
+	auto pSet = set(key);
+	TSlot* pOldest = nullptr;
+	for (quint32 i = 0; i < m_pHeader->uiWays; ++i) {
+		auto pSlot = pSet + i;
+		auto uiState = pSlot->uiState.load(std::memory_order_relaxed);
+		if ((SlotEmpty == uiState) || ((SlotLoading == uiState) && (pSlot->nClaimedUntil.load(std::memory_order_relaxed) <= nNow)))
+			return pSlot;
+
+		if ((SlotReady == uiState) && (!pOldest || (pSlot->uiUsed.load(std::memory_order_relaxed) < pOldest->uiUsed.load(std::memory_order_relaxed))))
+			pOldest = pSlot;
+	}
+
+	//1) Least recently used tile of the set. Live claims are never evicted
+	if (pOldest)
+		CStatistics::get()->add("cache.shared.evictions", 1);
+
+	return pOldest;
+}
+
+char* CSharedTileSegment::page(const TSlot* pSlot)
+{
+	return m_pPages + (qint64)(pSlot - m_pSlots) * m_pHeader->uiPageBytes;
+}
+
+void CSharedTileSegment::release(TSlot* pSlot)
+{
+	auto uiSequence = pSlot->uiSequence.load(std::memory_order_relaxed);
+	pSlot->uiSequence.store(uiSequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	pSlot->uiState.store(SlotEmpty, std::memory_order_relaxed);
+	pSlot->nOwner.store(0, std::memory_order_relaxed);
+	pSlot->uiSequence.store(uiSequence + 2, std::memory_order_release);
+}
+
+void CSharedTileSegment::updateStats()
+{
+	CStatistics::get()->set("cache.shared.bytes", m_pHeader->nBytes.load(std::memory_order_relaxed));
+}
+
+IGeoTileCachePtr CSharedTileCache::get(const QString& qsNamespace)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	if (m_nBudget <= 0)
+		return CDiskTileCache::get(qsNamespace);
+
+	//0) Processes share tiles only if they share the disk cache: same root, same sources
+	if (!m_pSegment) {
+		m_pSegment = CSharedTileSegment::attach(QString("bmView.tiles.%1").arg(fnv1a(CDiskTileCache::root().toUtf8()), 8, 16, QChar('0')), m_nBudget);
+		if (!m_pSegment) {
+			m_nBudget = 0;
+			return CDiskTileCache::get(qsNamespace);
+		}
+	}
+
+	auto& pCache = m_mCaches[qsNamespace];
+	if (!pCache)
+		pCache = IGeoTileCachePtr(new CSharedTileCache(CDiskTileCache::get(qsNamespace), m_pSegment, qsNamespace));
+
+	return pCache;
+}
+
+void CSharedTileCache::setBudget(const qint64& nBytes)
+{
+	m_nBudget = nBytes;
+}
+
+CSharedTileCache::CSharedTileCache(IGeoTileCachePtr pDisk, std::shared_ptr<CSharedTileSegment> pSegment, const QString& qsNamespace) :
+	m_pDisk(pDisk), m_pShared(pSegment), m_uiNamespace(fnv1a(qsNamespace.toUtf8()))
+{
+}
+
+bool CSharedTileCache::contains(const QString& qsQuadKey)
+{
+	return m_pShared->contains(key(qsQuadKey)) || m_pDisk->contains(qsQuadKey);
+}
+
+std::optional<TCachedTile> CSharedTileCache::read(const QString& qsQuadKey)
+{
+	auto pStats = CStatistics::get();
+	auto tileKey = key(qsQuadKey);
+
+	//0) Another process may have it already
+	if (auto shared = m_pShared->lookup(tileKey)) {
+		pStats->add("cache.shared.hits", 1);
+		return shared;
+	}
+
+	pStats->add("cache.shared.misses", 1);
+
+	//1) A disk copy is shared on the way
+	if (auto cached = m_pDisk->read(qsQuadKey)) {
+		m_pShared->publish(tileKey, cached->qbData, cached->validators);
+		return cached;
+	}
+
+	//2) Nobody has it: this process loads it, unless another one already does. Then the load is put off instead of
+	//holding a scheduler worker: the retry timer of the texture reads again, by then the tile is shared or the claim
+	//has run out and this process takes it over
+	qint64 nClaimedUntil = 0;
+	if (m_pShared->claim(tileKey, nClaimedUntil)) {
+		pStats->add("cache.shared.claims", 1);
+		return std::nullopt;
+	}
+
+	//Published between the lookup and the claim
+	if (auto shared = m_pShared->lookup(tileKey)) {
+		pStats->add("cache.shared.hits.late", 1);
+		return shared;
+	}
+
+	pStats->add("cache.shared.deferred", 1);
+	auto nRemaining = nClaimedUntil - QDateTime::currentMSecsSinceEpoch();
+	throw TTileFetchError(ETileFailure::Transient, true, (uint)std::min(std::max<qint64>(nRemaining, 1), gnSharedRecheckMs));
+}
+
+bool CSharedTileCache::write(const QString& qsQuadKey, const QByteArray& qbData, const TTileValidators& validators)
+{
+	//Shared first, the processes waiting for the tile should not wait for the disk too
+	m_pShared->publish(key(qsQuadKey), qbData, validators);
+	return m_pDisk->write(qsQuadKey, qbData, validators);
+}
+
+bool CSharedTileCache::refresh(const QString& qsQuadKey, const TTileValidators& validators)
+{
+	if (!m_pDisk->refresh(qsQuadKey, validators))
+		return false;
+
+	//The disk merged the validators a 304 left out and knows the expiry it fell back to
+	if (auto cached = m_pDisk->read(qsQuadKey))
+		m_pShared->refresh(key(qsQuadKey), cached->validators.nExpires);
+
+	return true;
+}
+
+void CSharedTileCache::abandon(const QString& qsQuadKey)
+{
+	m_pShared->abandon(key(qsQuadKey));
+	m_pDisk->abandon(qsQuadKey);
+}
+
+TSharedTileKey CSharedTileCache::key(const QString& qsQuadKey) const
+{
+	//Two bits per digit under the length
+	TSharedTileKey result;
+	for (auto it : qsQuadKey)
+		result.uiTile = (result.uiTile << 2) | (quint64)((it.unicode() - '0') & 3);
+
+	result.uiTile |= (quint64)qsQuadKey.length() << 58;
+	result.uiNamespace = m_uiNamespace;
+	return result;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "intfs.h"
+
+//Packed quadkey and a hash of the layer namespace, both the same in every process
+struct TSharedTileKey {
+	quint64 uiTile = 0;
+	quint32 uiNamespace = 0;
+};
+
+//Encoded tiles in one shared memory segment mapped by every bmView process on the machine that uses the same disk cache.
+//Lookups take no lock: every page is guarded by a sequence counter and a copy that saw it change is retried.
+//Writers take the segment lock. A miss claims the tile, so the other processes wait for it instead of fetching it too
+class CSharedTileSegment {
+public:
+	//Null if the segment can't be created or attached. The first process sets the size, the others map what it made
+	static std::shared_ptr<CSharedTileSegment> attach(const QString& qsKey, const qint64& nBudget);
+	std::optional<TCachedTile> lookup(const TSharedTileKey& key);
+	bool contains(const TSharedTileKey& key);
+	bool publish(const TSharedTileKey& key, const QByteArray& qbData, const TTileValidators& validators);
+	bool refresh(const TSharedTileKey& key, const qint64& nExpires);
+	//True if this process should load the tile. Otherwise nClaimedUntil is when the claim of the loading process runs out
+	bool claim(const TSharedTileKey& key, qint64& nClaimedUntil);
+	void abandon(const TSharedTileKey& key);
+private:
+	struct THeader;
+	struct TSlot;
+	QSharedMemory m_Memory;
+	THeader* m_pHeader = nullptr;
+	TSlot* m_pSlots = nullptr;
+	char* m_pPages = nullptr;
+	qint64 m_nPid = 0;
+private:
+	CSharedTileSegment() = default;
+	bool map(const qint64& nBudget);
+	//First slot of the set the key maps to
+	TSlot* set(const TSharedTileKey& key);
+	TSlot* find(const TSharedTileKey& key);
+	//Slot for the key in its set: its own, a free one or the least recently used. Under the segment lock
+	TSlot* allocate(const TSharedTileKey& key);
+	char* page(const TSlot* pSlot);
+	void release(TSlot* pSlot);
+	void updateStats();
+};
+
+//Disk cache of a namespace behind the shared tier
+class CSharedTileCache : public IGeoTileCache {
+public:
+	//The plain disk cache while the shared tier is off
+	static IGeoTileCachePtr get(const QString& qsNamespace = QString());
+	//Before the first get(). 0 - off
+	static void setBudget(const qint64& nBytes);
+protected: //IGeoTileCache
+	bool contains(const QString& qsQuadKey) override;
+	std::optional<TCachedTile> read(const QString& qsQuadKey) override;
+	bool write(const QString& qsQuadKey, const QByteArray& qbData, const TTileValidators& validators) override;
+	bool refresh(const QString& qsQuadKey, const TTileValidators& validators) override;
+	void abandon(const QString& qsQuadKey) override;
+private:
+	CSharedTileCache(IGeoTileCachePtr pDisk, std::shared_ptr<CSharedTileSegment> pSegment, const QString& qsNamespace);
+	static std::mutex m_Lock;
+	static std::map<QString, IGeoTileCachePtr> m_mCaches;
+	static std::shared_ptr<CSharedTileSegment> m_pSegment;
+	static qint64 m_nBudget;
+	IGeoTileCachePtr m_pDisk;
+	std::shared_ptr<CSharedTileSegment> m_pShared;
+	quint32 m_uiNamespace = 0;
+	TSharedTileKey key(const QString& qsQuadKey) const;
+};
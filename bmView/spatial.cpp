@@ -0,0 +1,324 @@
+#include "spatial.h"
+#include "sched.h"
+
+namespace {
+	template <typename T, typename L> void parallelSort(std::vector<T>& vData, L fLess)
+	{
+		//0) Sort runs independently
+		auto pScheduler = CJobScheduler::get();
+		size_t szRuns = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), vData.size() / 16384));
+		size_t szRun = (vData.size() + szRuns - 1) / szRuns;
+		std::vector<size_t> vBounds;
+		for (size_t i = 0; i <= szRuns; ++i)
+			vBounds.push_back(std::min(vData.size(), i * szRun));
+
+		pScheduler->parallelFor(EJobPriority::Visible, szRuns, [&](size_t szFirst, size_t szLast) {
+			for (auto i = szFirst; i < szLast; ++i)
+				std::sort(vData.begin() + vBounds[i], vData.begin() + vBounds[i + 1], fLess);
+		});
+
+		//1) Merge neighbouring runs pairwise until one is left. Odd run is carried to the next pass as is
+		while (vBounds.size() > 2) {
+			size_t szPairs = (vBounds.size() - 1) / 2;
+			pScheduler->parallelFor(EJobPriority::Visible, szPairs, [&](size_t szFirst, size_t szLast) {
+				for (auto i = szFirst; i < szLast; ++i) {
+					std::inplace_merge(vData.begin() + vBounds[2 * i], vData.begin() + vBounds[2 * i + 1],
+						vData.begin() + vBounds[2 * i + 2], fLess);
+				}
+			});
+
+			std::vector<size_t> vMerged;
+			for (size_t i = 0; i < vBounds.size(); i += 2)
+				vMerged.push_back(vBounds[i]);
+
+			if (vMerged.back() != vBounds.back())
+				vMerged.push_back(vBounds.back());
+
+			vBounds.swap(vMerged);
+		}
+	}
+
+	bool entryLess(const quint64& uiLeft, const quint64& uiRight)
+	{
+		return uiLeft < uiRight;
+	}
+}
+
+void CQuadIndex::build(const std::vector<TSpatialItem>& vItems)
+{
+	std::lock_guard<std::mutex> write(m_WriteLock);
+	std::vector<TEntry> vEntries(vItems.size());
+	CJobScheduler::get()->parallelFor(EJobPriority::Visible, vItems.size(), [&](size_t szFirst, size_t szLast) {
+		for (size_t i = szFirst; i < szLast; ++i)
+			vEntries[i] = makeEntry(vItems[i]);
+	});
+
+	parallelSort(vEntries, [](const TEntry& left, const TEntry& right) { return entryLess(left.uiCode, right.uiCode); });
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	for (auto& it : vEntries)
+		it.uiGeneration = m_uiGeneration;
+
+	auto pRun = std::make_shared<const std::vector<TEntry>>(std::move(vEntries));
+	m_vRuns.assign(1, pRun);
+	m_vDelta.clear();
+	m_mRemoved.clear();
+}
+
+void CQuadIndex::insert(const std::vector<TSpatialItem>& vItems)
+{
+	std::lock_guard<std::mutex> write(m_WriteLock);
+	std::vector<TEntry> vEntries(vItems.size());
+	CJobScheduler::get()->parallelFor(EJobPriority::Visible, vItems.size(), [&](size_t szFirst, size_t szLast) {
+		for (size_t i = szFirst; i < szLast; ++i)
+			vEntries[i] = makeEntry(vItems[i]);
+	});
+
+	{
+		//A removed feature comes back with a newer generation, its old entries stay hidden until they are compacted out
+		std::lock_guard<std::mutex> lock(m_Lock);
+		auto uiGeneration = ++m_uiGeneration;
+		for (auto& it : vEntries)
+			it.uiGeneration = uiGeneration;
+
+		m_vDelta.insert(m_vDelta.end(), vEntries.begin(), vEntries.end());
+		if (m_vDelta.size() < m_szMaxDelta)
+			return;
+	}
+
+	//Tail is full: it becomes a run
+	merge();
+}
+
+void CQuadIndex::remove(const uint& uiFeature)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_mRemoved[uiFeature] = ++m_uiGeneration;
+}
+
+void CQuadIndex::query(const QRectF& qrBox, std::vector<uint>& vResult)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	visit(qrBox, [&](const TEntry& entry) {
+		vResult.push_back(entry.uiFeature);
+	});
+}
+
+std::optional<uint> CQuadIndex::nearest(const QPointF& qpPoint, const double& dbRadius)
+{
+	std::optional<uint> result;
+	double dbBest = dbRadius;
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	QRectF qrBox(qpPoint.x() - dbRadius, qpPoint.y() - dbRadius, 2.0 * dbRadius, 2.0 * dbRadius);
+	visit(qrBox, [&](const TEntry& entry) {
+		auto dbDistance = distance(entry, qpPoint);
+		if (dbDistance <= dbBest) {
+			dbBest = dbDistance;
+			result = entry.uiFeature;
+		}
+	});
+
+	return result;
+}
+
+size_t CQuadIndex::size()
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	size_t szEntries = m_vDelta.size();
+	for (const auto& it : m_vRuns)
+		szEntries += it->size();
+
+	return szEntries - std::min(m_mRemoved.size(), szEntries);
+}
+
+size_t CQuadIndex::memory()
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	size_t szEntries = m_vDelta.capacity();
+	for (const auto& it : m_vRuns)
+		szEntries += it->capacity();
+
+	return szEntries * sizeof(TEntry) + m_mRemoved.size() * (2 * sizeof(uint) + 32);
+}
+
+CQuadIndex::TEntry CQuadIndex::makeEntry(const TSpatialItem& item)
+{
+	TEntry entry;
+	entry.uiFeature = item.uiFeature;
+	entry.dbX0 = std::min(item.dbX0, item.dbX1);
+	entry.dbX1 = std::max(item.dbX0, item.dbX1);
+	entry.dbY0 = std::min(item.dbY0, item.dbY1);
+	entry.dbY1 = std::max(item.dbY0, item.dbY1);
+
+	//0) Cells of the bbox corners on the deepest level
+	auto cell = [](const double& dbValue) -> quint64 {
+		double dbCells = (double)(1u << m_uiMaxLevel);
+		return (quint64)std::min(std::max(dbValue * dbCells, 0.0), dbCells - 1.0);
+	};
+
+	quint64 uiX0 = cell(entry.dbX0), uiX1 = cell(entry.dbX1);
+	quint64 uiY0 = cell(entry.dbY0), uiY1 = cell(entry.dbY1);
+
+	//1) Deepest quad that holds the whole bbox: drop the bits where the corners differ
+	uint uiShift = 0;
+	for (auto uiDiff = (uiX0 ^ uiX1) | (uiY0 ^ uiY1); uiDiff; uiDiff >>= 1)
+		++uiShift;
+
+	//2) Quadkey of that quad, padded to the deepest level. Level goes to the low bits so parents sort first
+	quint64 uiMorton = spread(uiX0 >> uiShift) | (spread(uiY0 >> uiShift) << 1);
+	entry.uiCode = ((uiMorton << (2 * uiShift)) << 6) | (m_uiMaxLevel - uiShift);
+
+	return entry;
+}
+
+quint64 CQuadIndex::spread(quint64 uiValue)
+{
+	uiValue &= 0xFFFFFFFFull;
+	uiValue = (uiValue | (uiValue << 16)) & 0x0000FFFF0000FFFFull;
+	uiValue = (uiValue | (uiValue << 8)) & 0x00FF00FF00FF00FFull;
+	uiValue = (uiValue | (uiValue << 4)) & 0x0F0F0F0F0F0F0F0Full;
+	uiValue = (uiValue | (uiValue << 2)) & 0x3333333333333333ull;
+	uiValue = (uiValue | (uiValue << 1)) & 0x5555555555555555ull;
+	return uiValue;
+}
+
+uint CQuadIndex::levelOf(const TEntry& entry)
+{
+	return (uint)(entry.uiCode & 0x3F);
+}
+
+bool CQuadIndex::intersects(const TEntry& entry, const QRectF& qrBox)
+{
+	return (entry.dbX1 >= qrBox.left()) && (entry.dbX0 <= qrBox.right()) &&
+		(entry.dbY1 >= qrBox.top()) && (entry.dbY0 <= qrBox.bottom());
+}
+
+double CQuadIndex::distance(const TEntry& entry, const QPointF& qpPoint)
+{
+	//Points are degenerate segments. Segments are stored by their bbox, the diagonal is the segment itself
+	double dbDX = entry.dbX1 - entry.dbX0, dbDY = entry.dbY1 - entry.dbY0;
+	double dbLen = dbDX * dbDX + dbDY * dbDY;
+	double t = (dbLen > 0.0) ? ((qpPoint.x() - entry.dbX0) * dbDX + (qpPoint.y() - entry.dbY0) * dbDY) / dbLen : 0.0;
+	t = std::min(std::max(t, 0.0), 1.0);
+
+	return std::hypot(entry.dbX0 + t * dbDX - qpPoint.x(), entry.dbY0 + t * dbDY - qpPoint.y());
+}
+
+void CQuadIndex::merge()
+{
+	//0) Snapshot of the tail and the runs. Readers keep using both until the result is published
+	std::vector<TEntry> vTail;
+	std::vector<TRun> vRuns;
+	std::map<uint, uint> mRemoved;
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		vTail = m_vDelta;
+		vRuns = m_vRuns;
+		mRemoved = m_mRemoved;
+	}
+
+	auto fLess = [](const TEntry& left, const TEntry& right) { return entryLess(left.uiCode, right.uiCode); };
+	parallelSort(vTail, fLess);
+
+	//1) The new run swallows the smaller runs at the end until it is less than half the one before it, so a run
+	//is copied O(log n) times over its life. All runs merged: removed features are compacted out
+	auto vMerged = std::move(vTail);
+	while (!vRuns.empty() && (vRuns.back()->size() < 2 * vMerged.size())) {
+		const auto& vRun = *vRuns.back();
+		std::vector<TEntry> vEntries;
+		vEntries.reserve(vRun.size() + vMerged.size());
+		std::merge(vRun.begin(), vRun.end(), vMerged.begin(), vMerged.end(), std::back_inserter(vEntries), fLess);
+		vMerged.swap(vEntries);
+		vRuns.pop_back();
+	}
+
+	bool bCompacted = vRuns.empty() && !mRemoved.empty();
+	if (bCompacted) {
+		vMerged.erase(std::remove_if(vMerged.begin(), vMerged.end(), [&](const TEntry& entry) {
+			auto it = mRemoved.find(entry.uiFeature);
+			return (it != mRemoved.end()) && (entry.uiGeneration < it->second);
+		}), vMerged.end());
+	}
+
+	vRuns.push_back(std::make_shared<const std::vector<TEntry>>(std::move(vMerged)));
+
+	//2) Publish. Only removals can have come in meanwhile, inserts wait for m_WriteLock. A feature removed again
+	//since the snapshot keeps its newer tombstone
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_vRuns.swap(vRuns);
+	m_vDelta.clear();
+	if (bCompacted) {
+		for (const auto& it : mRemoved) {
+			auto itRemoved = m_mRemoved.find(it.first);
+			if ((itRemoved != m_mRemoved.end()) && (itRemoved->second == it.second))
+				m_mRemoved.erase(itRemoved);
+		}
+	}
+}
+
+template <typename F> void CQuadIndex::visit(const QRectF& qrBox, F fVisitor)
+{
+	auto fFiltered = [&](const TEntry& entry) {
+		if (!m_mRemoved.empty()) {
+			auto it = m_mRemoved.find(entry.uiFeature);
+			if ((it != m_mRemoved.end()) && (entry.uiGeneration < it->second))
+				return;
+		}
+
+		fVisitor(entry);
+	};
+
+	for (const auto& it : m_vRuns)
+		visitNode(*it, 0, 0, 0, 0, it->size(), qrBox, fFiltered);
+
+	for (const auto& it : m_vDelta) {
+		if (intersects(it, qrBox))
+			fFiltered(it);
+	}
+}
+
+template <typename F> void CQuadIndex::visitNode(const std::vector<TEntry>& vEntries, const uint& uiLevel, const quint64& uiX, const quint64& uiY,
+	size_t szFirst, const size_t& szLast, const QRectF& qrBox, F& fVisitor)
+{
+	if (szFirst >= szLast)
+		return;
+
+	//0) Quad bounds. Everything stored under this quad lies inside it
+	double dbSize = 1.0 / (double)(1ull << uiLevel);
+	QRectF qrCell(uiX * dbSize, uiY * dbSize, dbSize, dbSize);
+	if ((qrCell.right() < qrBox.left()) || (qrCell.left() > qrBox.right()) ||
+		(qrCell.bottom() < qrBox.top()) || (qrCell.top() > qrBox.bottom()))
+		return;
+
+	//1) Quad is inside the query: take the whole range without testing
+	if (qrBox.contains(qrCell)) {
+		for (auto i = szFirst; i < szLast; ++i)
+			fVisitor(vEntries[i]);
+		return;
+	}
+
+	//2) Items that do not fit any child are sorted first
+	while ((szFirst < szLast) && (levelOf(vEntries[szFirst]) == uiLevel)) {
+		if (intersects(vEntries[szFirst], qrBox))
+			fVisitor(vEntries[szFirst]);
+		++szFirst;
+	}
+
+	if (uiLevel >= m_uiMaxLevel)
+		return;
+
+	//3) Children occupy consecutive ranges of the quadkey order
+	uint uiChildShift = 2 * (m_uiMaxLevel - uiLevel - 1) + 6;
+	for (quint64 uiDigit = 0; uiDigit < 4; ++uiDigit) {
+		quint64 uiChildX = 2 * uiX + (uiDigit & 1), uiChildY = 2 * uiY + (uiDigit >> 1);
+		quint64 uiNextCode = ((spread(uiChildX) | (spread(uiChildY) << 1)) + 1) << uiChildShift;
+
+		auto itLast = std::lower_bound(vEntries.begin() + szFirst, vEntries.begin() + szLast, uiNextCode,
+			[](const TEntry& entry, const quint64& uiCode) { return entry.uiCode < uiCode; });
+		size_t szChildLast = itLast - vEntries.begin();
+
+		visitNode(vEntries, uiLevel + 1, uiChildX, uiChildY, szFirst, szChildLast, qrBox, fVisitor);
+		szFirst = szChildLast;
+	}
+}
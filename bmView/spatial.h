@@ -0,0 +1,48 @@
+#pragma once
+#include "intfs.h"
+
+//Sorted runs of quadkey ordered entries of halving sizes and a small unsorted tail. Runs are merged the way
+//an LSM tree does it, off the lock, so a pick never waits for a merge and never scans more than the tail linearly
+class CQuadIndex : public ISpatialIndex {
+public:
+	CQuadIndex() = default;
+protected: //ISpatialIndex
+	void build(const std::vector<TSpatialItem>& vItems) override;
+	void insert(const std::vector<TSpatialItem>& vItems) override;
+	void remove(const uint& uiFeature) override;
+	void query(const QRectF& qrBox, std::vector<uint>& vResult) override;
+	std::optional<uint> nearest(const QPointF& qpPoint, const double& dbRadius) override;
+	size_t size() override;
+	size_t memory() override;
+private:
+	struct TEntry {
+		quint64 uiCode;
+		uint uiFeature;
+		//Insert it came with. Fits in the padding before the doubles
+		uint uiGeneration;
+		double dbX0, dbY0, dbX1, dbY1;
+	};
+	using TRun = std::shared_ptr<const std::vector<TEntry>>;
+	//Largest first, each at least twice the size of the next one
+	std::vector<TRun> m_vRuns;
+	std::vector<TEntry> m_vDelta;
+	//Feature to the generation it was removed in: its entries of earlier generations are gone, a later insert is not
+	std::map<uint, uint> m_mRemoved;
+	uint m_uiGeneration = 0;
+	std::mutex m_Lock;
+	//Writers build runs one at a time, readers only take m_Lock
+	std::mutex m_WriteLock;
+private:
+	static const uint m_uiMaxLevel = 20;
+	static const size_t m_szMaxDelta = 1024;
+	static TEntry makeEntry(const TSpatialItem& item);
+	static quint64 spread(quint64 uiValue);
+	static uint levelOf(const TEntry& entry);
+	static bool intersects(const TEntry& entry, const QRectF& qrBox);
+	static double distance(const TEntry& entry, const QPointF& qpPoint);
+	//Called with m_WriteLock held, takes m_Lock only to read the tail and to publish the new runs
+	void merge();
+	template <typename F> void visit(const QRectF& qrBox, F fVisitor);
+	template <typename F> void visitNode(const std::vector<TEntry>& vEntries, const uint& uiLevel, const quint64& uiX, const quint64& uiY,
+		size_t szFirst, const size_t& szLast, const QRectF& qrBox, F& fVisitor);
+};
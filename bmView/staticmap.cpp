@@ -0,0 +1,177 @@
+#include "staticmap.h"
+#include "sched.h"
+
+namespace {
+	QPointF toPoint(const QJsonValue& qjValue)
+	{
+		auto qjPoint = qjValue.toArray();
+		return QPointF(qjPoint.at(0).toDouble(), qjPoint.at(1).toDouble());
+	}
+
+	std::vector<QPointF> toPoints(const QJsonValue& qjValue)
+	{
+		std::vector<QPointF> vPoints;
+		for (const auto& it : qjValue.toArray())
+			vPoints.push_back(toPoint(it));
+
+		return vPoints;
+	}
+}
+
+CStaticMapBatch::CStaticMapBatch(const QString& qsJobList, const uint& uiContexts) :
+	m_qsJobList(qsJobList), m_uiContexts(std::max(1u, uiContexts))
+{
+}
+
+int CStaticMapBatch::run()
+{
+	if (!load())
+		return 1;
+
+	qInfo().noquote() << QString("Rendering %1 images with %2 contexts").arg(m_vJobs.size()).arg(m_uiContexts);
+
+	QElapsedTimer timer;
+	timer.start();
+
+	//0) Every renderer pulls the next job as soon as its previous image is read back
+	for (uint i = 0; (i < m_uiContexts) && (i < m_vJobs.size()); ++i) {
+		auto pRenderer = std::make_shared<COffscreenRenderer>();
+		m_vRenderers.push_back(pRenderer);
+		startNext(pRenderer);
+	}
+
+	QTimer progress;
+	QObject::connect(&progress, &QTimer::timeout, [&] {
+		qInfo().noquote() << QString("%1/%2 images, %3 images/s")
+			.arg(m_szDone).arg(m_vJobs.size()).arg(m_szDone * 1000.0 / std::max<qint64>(1, timer.elapsed()), 0, 'f', 2);
+	});
+	progress.start(1000);
+
+	if (!finished())
+		m_Loop.exec();
+
+	progress.stop();
+	m_vRenderers.clear();
+
+	double dbSeconds = timer.elapsed() / 1000.0;
+	qInfo().noquote() << QString("Done: %1 images in %2 s, %3 images/s, %4 failed, %5 with missing tiles")
+		.arg(m_szDone).arg(dbSeconds, 0, 'f', 2).arg((dbSeconds > 0.0) ? m_szDone / dbSeconds : 0.0, 0, 'f', 2)
+		.arg(m_szFailed).arg(m_szIncomplete);
+
+	return m_szFailed ? 2 : 0;
+}
+
+bool CStaticMapBatch::parseJob(const QJsonObject& qjJob, const QDir& qdBase, TStaticMapJob& job)
+{
+	if (qjJob.contains("bbox")) {
+		auto qjBox = qjJob["bbox"].toArray();
+		if (qjBox.size() != 4)
+			return false;
+
+		job.bFitBounds = true;
+		job.qpBoundsMin = QPointF(qjBox[0].toDouble(), qjBox[1].toDouble());
+		job.qpBoundsMax = QPointF(qjBox[2].toDouble(), qjBox[3].toDouble());
+	}
+	else if (qjJob.contains("center")) {
+		job.qpCenter = toPoint(qjJob["center"]);
+		job.uiZoomLevel = qjJob["zoom"].toInt(job.uiZoomLevel);
+	}
+	else {
+		return false;
+	}
+
+	job.qsSize = QSize(qjJob["width"].toInt(job.qsSize.width()), qjJob["height"].toInt(job.qsSize.height()));
+	job.qsOutput = qdBase.absoluteFilePath(qjJob["output"].toString());
+	job.nQuality = qjJob["quality"].toInt(job.nQuality);
+	job.nTimeout = qjJob["timeout"].toInt(job.nTimeout);
+
+	job.vPoints = toPoints(qjJob["points"]);
+	for (const auto& it : qjJob["polylines"].toArray())
+		job.vPolylines.push_back(toPoints(it));
+
+	job.vHeatmap = toPoints(qjJob["heatmap"]);
+
+	if (qjJob.contains("color"))
+		job.qcOverlay = QColor(qjJob["color"].toString());
+
+	return !qjJob["output"].toString().isEmpty();
+}
+
+bool CStaticMapBatch::load()
+{
+	QFile file(m_qsJobList);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		qCritical() << "Cannot open the job list" << m_qsJobList;
+		return false;
+	}
+
+	//Outputs are relative to the job list
+	QDir qdBase = QFileInfo(m_qsJobList).absoluteDir();
+	for (int nLine = 1; !file.atEnd(); ++nLine) {
+		auto qbLine = file.readLine().trimmed();
+		if (qbLine.isEmpty() || qbLine.startsWith('#'))
+			continue;
+
+		TStaticMapJob job;
+		auto qjDoc = QJsonDocument::fromJson(qbLine);
+		if (!qjDoc.isObject() || !parseJob(qjDoc.object(), qdBase, job)) {
+			qWarning() << "Skipping invalid job at line" << nLine;
+			continue;
+		}
+
+		m_vJobs.push_back(job);
+	}
+
+	return !m_vJobs.empty();
+}
+
+void CStaticMapBatch::startNext(std::shared_ptr<COffscreenRenderer> pRenderer)
+{
+	while (m_szNext < m_vJobs.size()) {
+		const auto& job = m_vJobs[m_szNext++];
+		bool bStarted = pRenderer->render(job, [this, pRenderer, job](const QImage& img, bool bComplete) {
+			onRendered(pRenderer, job, img, bComplete);
+		});
+
+		if (bStarted)
+			return;
+
+		qWarning() << "Cannot render" << job.qsOutput;
+		++m_szFailed;
+	}
+
+	if (finished())
+		m_Loop.quit();
+}
+
+void CStaticMapBatch::onRendered(std::shared_ptr<COffscreenRenderer> pRenderer, const TStaticMapJob& job, const QImage& img, const bool& bComplete)
+{
+	if (!bComplete)
+		++m_szIncomplete;
+
+	//0) Compression is CPU work, it goes to the scheduler while this context already loads the next map
+	++m_szWriting;
+	auto qsOutput = job.qsOutput;
+	auto nQuality = job.nQuality;
+	CJobScheduler::get()->post(EJobPriority::Background, pplx::cancellation_token::none(), [this, img, qsOutput, nQuality]() {
+		bool bSaved = !img.isNull() && QDir().mkpath(QFileInfo(qsOutput).path()) && img.save(qsOutput, nullptr, nQuality);
+		QMetaObject::invokeMethod(qApp, [this, bSaved] { onWritten(bSaved); }, Qt::QueuedConnection);
+	});
+
+	startNext(pRenderer);
+}
+
+void CStaticMapBatch::onWritten(const bool& bSaved)
+{
+	--m_szWriting;
+	bSaved ? ++m_szDone : ++m_szFailed;
+
+	if (finished())
+		m_Loop.quit();
+}
+
+bool CStaticMapBatch::finished() const
+{
+	return (m_szNext >= m_vJobs.size()) && !m_szWriting && std::none_of(m_vRenderers.begin(), m_vRenderers.end(),
+		[](const std::shared_ptr<COffscreenRenderer>& pRenderer) { return pRenderer->busy(); });
+}
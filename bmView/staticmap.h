@@ -0,0 +1,29 @@
+#pragma once
+#include "offscreen.h"
+
+//Renders a job list (one JSON object per line) with several offscreen contexts at once
+class CStaticMapBatch {
+public:
+	CStaticMapBatch(const QString& qsJobList, const uint& uiContexts);
+	int run();
+	static bool parseJob(const QJsonObject& qjJob, const QDir& qdBase, TStaticMapJob& job);
+private:
+	QString m_qsJobList;
+	uint m_uiContexts;
+	std::vector<TStaticMapJob> m_vJobs;
+	size_t m_szNext = 0;
+	std::vector<std::shared_ptr<COffscreenRenderer>> m_vRenderers;
+
+	//Encoding runs on the scheduler, the counters are only touched by the GUI thread
+	size_t m_szWriting = 0;
+	size_t m_szDone = 0;
+	size_t m_szFailed = 0;
+	size_t m_szIncomplete = 0;
+	QEventLoop m_Loop;
+private:
+	bool load();
+	void startNext(std::shared_ptr<COffscreenRenderer> pRenderer);
+	void onRendered(std::shared_ptr<COffscreenRenderer> pRenderer, const TStaticMapJob& job, const QImage& img, const bool& bComplete);
+	void onWritten(const bool& bSaved);
+	bool finished() const;
+};
@@ -0,0 +1,54 @@
+#include "stats.h"
+
+IStatisticsPtr CStatistics::m_pStatistics = nullptr;
+
+IStatisticsPtr CStatistics::get()
+{
+	static std::once_flag flag;
+	std::call_once(flag, [] { m_pStatistics = IStatisticsPtr(new CStatistics()); });
+
+	return m_pStatistics;
+}
+
+QString CStatistics::instance(const QString& qsPrefix)
+{
+	auto pStatistics = std::static_pointer_cast<CStatistics>(get());
+	std::lock_guard<std::mutex> lock(pStatistics->m_Lock);
+	return QString("%1.%2").arg(qsPrefix).arg(pStatistics->m_mInstances[qsPrefix]++);
+}
+
+void CStatistics::set(const QString& qsName, const qint64& nValue)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_mValues[qsName] = nValue;
+}
+
+void CStatistics::add(const QString& qsName, const qint64& nDelta)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_mValues[qsName] += nDelta;
+}
+
+qint64 CStatistics::value(const QString& qsName)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	auto it = m_mValues.find(qsName);
+	return (it == m_mValues.end()) ? 0 : it->second.load();
+}
+
+QString CStatistics::report()
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	QStringList qslItems;
+	for (const auto& it : m_mValues)
+		qslItems << QString("%1=%2").arg(it.first).arg(it.second.load());
+
+	return qslItems.join(' ');
+}
+
+std::atomic<qint64>& CStatistics::counter(const QString& qsName)
+{
+	//Map nodes never move, the reference stays valid for the life of the process
+	std::lock_guard<std::mutex> lock(m_Lock);
+	return m_mValues[qsName];
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "intfs.h"
+
+class CStatistics : public IStatistics {
+public:
+	static IStatisticsPtr get();
+	//Prefix of the next instance: "tiles.0", "tiles.1"... for statistics every view keeps apart
+	static QString instance(const QString& qsPrefix);
+protected: //IStatistics
+	void set(const QString& qsName, const qint64& nValue) override;
+	void add(const QString& qsName, const qint64& nDelta) override;
+	qint64 value(const QString& qsName) override;
+	QString report() override;
+	std::atomic<qint64>& counter(const QString& qsName) override;
+private:
+	CStatistics() = default;
+	static IStatisticsPtr m_pStatistics;
+	//The lock guards the map, the values are atomic: counters are written without it
+	std::mutex m_Lock;
+	std::map<QString, std::atomic<qint64>> m_mValues;
+	std::map<QString, uint> m_mInstances;
+};
+
+//Statistic of a hot path, usually a function local static: the name is looked up once, then it is a relaxed atomic
+class CStatCounter {
+public:
+	explicit CStatCounter(const QString& qsName) : m_nValue(CStatistics::get()->counter(qsName)) {}
+	void set(const qint64& nValue) { m_nValue.store(nValue, std::memory_order_relaxed); }
+	void add(const qint64& nDelta) { m_nValue.fetch_add(nDelta, std::memory_order_relaxed); }
+private:
+	std::atomic<qint64>& m_nValue;
+};
@@ -3,16 +3,28 @@
 //Stdlib
 #include <string>
 #include <vector>
+#include <array>
+#include <deque>
+#include <atomic>
+#include <algorithm>
+#include <limits>
 #include <map>
+#include <list>
+#include <set>
+#include <random>
+#include <functional>
 #include <optional>
 #include <memory>
 #include <queue>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <future>
 #include <math.h>
 #include <sstream>
 #include <cmath>
+#include <charconv>
 
 //QT stuff
 #include <QtWidgets>
@@ -28,10 +40,13 @@
 #include <QMatrix4x4>
 #include <QOpenGLShaderProgram>
 #include <QOpenGL.h>
+#include <QLocalServer>
+#include <QLocalSocket>
 
 //CppRest
 #include <cpprest/http_client.h>
 #include <cpprest/filestream.h>
+#include <cpprest/http_listener.h>
 
 //GLM stuff
 #include <glm/glm.hpp>
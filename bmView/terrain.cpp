@@ -0,0 +1,226 @@
+#include "terrain.h"
+#include "consts.h"
+#include "geotex.h"
+#include "sched.h"
+#include "stats.h"
+#include "tilemap.h"
+#include "tileres.h"
+
+ITerrainPtr CTerrain::m_pTerrain = nullptr;
+QString CTerrain::m_qsSource;
+
+ITerrainPtr CTerrain::get()
+{
+	if (!m_pTerrain)
+		m_pTerrain = ITerrainPtr(new CTerrain());
+
+	return m_pTerrain;
+}
+
+void CTerrain::setSource(const QString& qsTemplate)
+{
+	m_qsSource = qsTemplate;
+}
+
+TTerrainMeshPtr CTerrain::build(const QString& qsTemplate, const QString& qsQuadKey)
+{
+	//0) Elevation packs usually stop a few levels short of the imagery, so the parents are tried too.
+	//The tile then covers a part of the parent: origin and span in its normalised coordinates
+	int nX = 0, nY = 0;
+	uint uiZoom = 0;
+	for (auto it : qsQuadKey) {
+		int nDigit = it.digitValue();
+		nX = (nX << 1) | (nDigit & 1);
+		nY = (nY << 1) | ((nDigit >> 1) & 1);
+		++uiZoom;
+	}
+
+	QImage img;
+	double dbX0 = 0.0, dbY0 = 0.0, dbSpan = 1.0;
+	while (true) {
+		img = QImage(path(qsTemplate, nX, nY, uiZoom));
+		if (!img.isNull() || (0 == uiZoom))
+			break;
+
+		dbX0 = ((nX & 1) + dbX0) / 2.0;
+		dbY0 = ((nY & 1) + dbY0) / 2.0;
+		dbSpan /= 2.0;
+		nX >>= 1;
+		nY >>= 1;
+		--uiZoom;
+	}
+
+	auto pMesh = std::make_shared<TTerrainMesh>();
+	int nSide = giTerrainGrid + 1;
+	pMesh->vHeights.assign(nSide * nSide, 0.f);
+	pMesh->vErrors.assign(guiTerrainLevels + 1, 0.f);
+	if (img.isNull()) {
+		CStatistics::get()->add("terrain.missing", 1);
+		return pMesh;
+	}
+
+	//1) Samples on the finest grid. Image rows go top down, the grid goes bottom up like the mirrored tile textures
+	if ((QImage::Format_Grayscale16 != img.format()) && (QImage::Format_RGB32 != img.format()))
+		img = img.convertToFormat(QImage::Format_RGB32);
+
+	for (int r = 0; r < nSide; ++r) {
+		for (int c = 0; c < nSide; ++c) {
+			double dbX = dbX0 + dbSpan * c / giTerrainGrid;
+			double dbY = dbY0 + dbSpan * (giTerrainGrid - r) / giTerrainGrid;
+			pMesh->vHeights[r * nSide + c] = height(img, dbX, dbY);
+		}
+	}
+
+	//2) Error of a coarser grid is how far the bilinear surface between its vertices misses the fine samples
+	const auto& vHeights = pMesh->vHeights;
+	for (uint uiLevel = 0; uiLevel < guiTerrainLevels; ++uiLevel) {
+		int nStep = giTerrainGrid >> uiLevel;
+		float fError = 0.f;
+		for (int r = 0; r < nSide; ++r) {
+			for (int c = 0; c < nSide; ++c) {
+				int r0 = std::min(r / nStep * nStep, giTerrainGrid - nStep);
+				int c0 = std::min(c / nStep * nStep, giTerrainGrid - nStep);
+				float fX = (float)(c - c0) / nStep;
+				float fY = (float)(r - r0) / nStep;
+
+				float fBottom = vHeights[r0 * nSide + c0] * (1.f - fX) + vHeights[r0 * nSide + c0 + nStep] * fX;
+				float fTop = vHeights[(r0 + nStep) * nSide + c0] * (1.f - fX) + vHeights[(r0 + nStep) * nSide + c0 + nStep] * fX;
+				fError = std::max(fError, std::abs(vHeights[r * nSide + c] - (fBottom * (1.f - fY) + fTop * fY)));
+			}
+		}
+
+		pMesh->vErrors[uiLevel] = fError;
+	}
+
+	return pMesh;
+}
+
+bool CTerrain::enabled()
+{
+	return !m_qsSource.isEmpty();
+}
+
+TTerrainMeshPtr CTerrain::mesh(const QString& qsQuadKey, const THandle& hTile)
+{
+	if (!enabled() || qsQuadKey.isEmpty())
+		return nullptr;
+
+	//0) Built already: used last
+	auto it = m_mMeshes.find(qsQuadKey);
+	if (it != m_mMeshes.end()) {
+		m_lUsed.splice(m_lUsed.begin(), m_lUsed, it->second.itUsed);
+		return it->second.pMesh;
+	}
+
+	//1) Being built: the tile is told when it is there
+	auto itPending = m_mPending.find(qsQuadKey);
+	if (itPending != m_mPending.end()) {
+		if (std::find(itPending->second.begin(), itPending->second.end(), hTile) == itPending->second.end())
+			itPending->second.push_back(hTile);
+
+		return nullptr;
+	}
+
+	//2) Decoding and resampling go to a worker, the result comes back to the GUI thread
+	m_mPending[qsQuadKey].push_back(hTile);
+	CStatistics::get()->add("terrain.requests", 1);
+
+	auto qsSource = m_qsSource;
+	CJobScheduler::get()->post(EJobPriority::Prefetch, pplx::cancellation_token::none(), [qsSource, qsQuadKey]() {
+		auto pMesh = build(qsSource, qsQuadKey);
+		QMetaObject::invokeMethod(qApp, [qsQuadKey, pMesh] {
+			std::static_pointer_cast<CTerrain>(get())->onBuilt(qsQuadKey, pMesh);
+		}, Qt::QueuedConnection);
+	});
+
+	return nullptr;
+}
+
+bool CTerrain::bind(const QString& qsQuadKey)
+{
+	auto it = m_mMeshes.find(qsQuadKey);
+	if (it == m_mMeshes.end())
+		return false;
+
+	//Float heights go up on first use, like the imagery
+	auto& cached = it->second;
+	if (!cached.pTexture) {
+		cached.pTexture = std::make_shared<QOpenGLTexture>(QOpenGLTexture::Target2D);
+		cached.pTexture->setSize(giTerrainGrid + 1, giTerrainGrid + 1);
+		cached.pTexture->setFormat(QOpenGLTexture::R32F);
+		cached.pTexture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+		cached.pTexture->setWrapMode(QOpenGLTexture::ClampToEdge);
+		cached.pTexture->allocateStorage(QOpenGLTexture::Red, QOpenGLTexture::Float32);
+		cached.pTexture->setData(QOpenGLTexture::Red, QOpenGLTexture::Float32, cached.pMesh->vHeights.data());
+	}
+
+	cached.pTexture->bind();
+	return true;
+}
+
+void CTerrain::onBuilt(const QString& qsQuadKey, TTerrainMeshPtr pMesh)
+{
+	//0) Least recently used meshes go, their textures are freed with the next frame
+	m_lUsed.push_front(qsQuadKey);
+	m_mMeshes[qsQuadKey] = { pMesh, nullptr, m_lUsed.begin() };
+	while (m_lUsed.size() > m_szMaxMeshes) {
+		auto itOld = m_mMeshes.find(m_lUsed.back());
+		CTileResources::get()->releaseTexture(itOld->second.pTexture);
+		m_mMeshes.erase(itOld);
+		m_lUsed.pop_back();
+	}
+
+	CStatistics::get()->set("terrain.cached", m_mMeshes.size());
+
+	//1) Tiles that asked for it and are still around
+	auto itPending = m_mPending.find(qsQuadKey);
+	if (itPending == m_mPending.end())
+		return;
+
+	auto vTiles = std::move(itPending->second);
+	m_mPending.erase(itPending);
+
+	auto pRegistry = CTileRegistry::get();
+	for (const auto& it : vTiles) {
+		if (auto pTile = pRegistry->resolve(it))
+			pTile->onTerrainReady();
+	}
+}
+
+QString CTerrain::path(const QString& qsTemplate, const int& nX, const int& nY, const uint& uiZoom)
+{
+	QString qsQuadKey;
+	for (auto i = uiZoom; i > 0; --i) {
+		int nMask = 1 << (i - 1);
+		qsQuadKey += QChar('0' + ((nX & nMask) ? 1 : 0) + ((nY & nMask) ? 2 : 0));
+	}
+
+	return QString(qsTemplate)
+		.replace("{z}", QString::number(uiZoom))
+		.replace("{x}", QString::number(nX))
+		.replace("{y}", QString::number(nY))
+		.replace("{quadkey}", qsQuadKey);
+}
+
+float CTerrain::height(const QImage& img, const double& dbX, const double& dbY)
+{
+	//0) Bilinear between the pixel centres around the point
+	double dbPX = std::min(std::max(dbX * img.width() - 0.5, 0.0), img.width() - 1.0);
+	double dbPY = std::min(std::max(dbY * img.height() - 0.5, 0.0), img.height() - 1.0);
+	int nX0 = (int)dbPX, nY0 = (int)dbPY;
+	int nX1 = std::min(nX0 + 1, img.width() - 1), nY1 = std::min(nY0 + 1, img.height() - 1);
+	float fX = (float)(dbPX - nX0), fY = (float)(dbPY - nY0);
+
+	//1) 16 bit greyscale holds metres (SRTM derived packs), colour ones are terrain-RGB
+	auto sample = [&img](int nX, int nY) -> float {
+		if (QImage::Format_Grayscale16 == img.format())
+			return (float)reinterpret_cast<const quint16*>(img.constScanLine(nY))[nX];
+
+		QRgb rgb = reinterpret_cast<const QRgb*>(img.constScanLine(nY))[nX];
+		return -10000.f + 0.1f * (float)((qRed(rgb) << 16) + (qGreen(rgb) << 8) + qBlue(rgb));
+	};
+
+	float fRow0 = sample(nX0, nY0) * (1.f - fX) + sample(nX1, nY0) * fX;
+	float fRow1 = sample(nX0, nY1) * (1.f - fX) + sample(nX1, nY1) * fX;
+	return fRow0 * (1.f - fY) + fRow1 * fY;
+}
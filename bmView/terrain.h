@@ -0,0 +1,33 @@
+#pragma once
+#include "intfs.h"
+
+class CTerrain : public ITerrain {
+public:
+	static ITerrainPtr get();
+	//Local elevation tiles, a path template with {z}, {x}, {y} or {quadkey}. Must be called before the first get()
+	static void setSource(const QString& qsTemplate);
+	//Worker thread. Tiles missing in the pack are cut out of the nearest parent, no data at all gives a flat mesh
+	static TTerrainMeshPtr build(const QString& qsTemplate, const QString& qsQuadKey);
+protected: //ITerrain
+	bool enabled() override;
+	TTerrainMeshPtr mesh(const QString& qsQuadKey, const THandle& hTile) override;
+	bool bind(const QString& qsQuadKey) override;
+private:
+	CTerrain() = default;
+	static ITerrainPtr m_pTerrain;
+	static QString m_qsSource;
+	struct TCachedMesh {
+		TTerrainMeshPtr pMesh;
+		std::shared_ptr<QOpenGLTexture> pTexture;
+		std::list<QString>::iterator itUsed;
+	};
+	std::map<QString, TCachedMesh> m_mMeshes;
+	std::list<QString> m_lUsed;
+	//Tiles waiting for a mesh that is being built
+	std::map<QString, std::vector<THandle>> m_mPending;
+	const size_t m_szMaxMeshes = 512;
+private:
+	void onBuilt(const QString& qsQuadKey, TTerrainMeshPtr pMesh);
+	static QString path(const QString& qsTemplate, const int& nX, const int& nY, const uint& uiZoom);
+	static float height(const QImage& img, const double& dbX, const double& dbY);
+};
@@ -4,11 +4,40 @@ R"(
 
 in vec2 txCoord;
 out vec4 color_out;
-uniform sampler2D map_data;
+
+//Layers bottom to top, one texture unit each. Opacity 0 - the layer is missing or not loaded yet
+uniform sampler2D layer0;
+uniform sampler2D layer1;
+uniform sampler2D layer2;
+uniform sampler2D layer3;
+uniform vec4 opacity;
+
+vec4 over(vec4 dst, vec4 src, float fOpacity)
+{
+	float fSrc = src.a * fOpacity;
+	float fOut = fSrc + dst.a * (1.0 - fSrc);
+	if (fOut <= 0.0)
+		return vec4(0.0);
+
+	return vec4((src.rgb * fSrc + dst.rgb * dst.a * (1.0 - fSrc)) / fOut, fOut);
+}
 
 void main()
 {
-	color_out = texture2D(map_data, txCoord);
+	vec4 color = vec4(0.0);
+	if (opacity.x > 0.0)
+		color = over(color, texture(layer0, txCoord), opacity.x);
+
+	if (opacity.y > 0.0)
+		color = over(color, texture(layer1, txCoord), opacity.y);
+
+	if (opacity.z > 0.0)
+		color = over(color, texture(layer2, txCoord), opacity.z);
+
+	if (opacity.w > 0.0)
+		color = over(color, texture(layer3, txCoord), opacity.w);
+
+	color_out = color;
 }
 
 )"
\ No newline at end of file
@@ -3,16 +3,31 @@ R"(
 
 layout (location = 0) in vec2 position;
 layout (location = 1) in vec2 texCoord;
+//1 for the skirt vertices hanging under the grid edges
+layout (location = 2) in float skirt;
 
 uniform mat4 world;
 uniform vec3 pos;
 uniform vec3 size;
 
+//Terrain: heights in metres, world units per metre (0 - flat tile), skirt depth and the height limit
+uniform sampler2D heights;
+uniform float grid;
+uniform float height_scale;
+uniform float skirt_depth;
+uniform float max_height;
+
 out vec2 txCoord;
 
 void main()
 {
-	gl_Position = world * vec4(position.x * size.x + pos.x, position.y * size.y + pos.y, 0.f, 1.0f);
+	float z = 0.f;
+	if (height_scale > 0.f) {
+		float h = texelFetch(heights, ivec2(round(position * grid)), 0).r;
+		z = clamp(h * height_scale, -max_height, max_height) - skirt * skirt_depth;
+	}
+
+	gl_Position = world * vec4(position.x * size.x + pos.x, position.y * size.y + pos.y, z, 1.0f);
 	txCoord = texCoord;
 }
 
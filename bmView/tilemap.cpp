@@ -1,16 +1,22 @@
 #include "tilemap.h"
 #include "consts.h"
 #include "geotex.h"
+#include "stats.h"
+#include "tileres.h"
+#include "layers.h"
+#include "terrain.h"
 
-CTile::CTile(ITileMapPtr pMap) : m_pMap(pMap)
+ITileRegistryPtr CTileRegistry::m_pRegistry = nullptr;
+
+CTile::CTile(ITileMap* pMap) : m_pMap(pMap)
 {
-	
+	m_hTile = CTileRegistry::get()->add(this);
 }
 
-void CTile::initGL()
+CTile::~CTile()
 {
-	InitGLBuffers();
-	InitShaders();
+	releaseTexture();
+	CTileRegistry::get()->remove(m_hTile);
 }
 
 std::pair<uint, uint> CTile::getIndex()
@@ -46,177 +52,177 @@ QVector3D CTile::getSize()
 	return m_qvSize;
 }
 
-void CTile::place(const QVector3D& qvPos, const QVector3D& qvSize)
+bool CTile::isVisible()
 {
-	m_qvPos = qvPos;
-	m_qvSize = qvSize;
+	return m_bVisible;
 }
 
-void CTile::draw(const QMatrix4x4& qmWorld)
+void CTile::setVisible(const bool& bVisible)
 {
-	bool bHaveTexture = false;
-	
-	if (m_pTexture && m_pTexture->valid()) {
-		m_pTexture->bind();
-		bHaveTexture = true;
-	}
-	else if (m_pPrevTexture && m_pPrevTexture->valid()) {
-		m_pPrevTexture->bind();
-		bHaveTexture = true;
-	}
-
-	if (!bHaveTexture)
+	if (m_bVisible == bVisible)
 		return;
-	
-	m_pVAO->bind();
-	m_pShaders->bind();
 
-	m_pShaders->setUniformValue(m_nWorldMatrixLoc, qmWorld);
-	m_pShaders->setUniformValue(m_nPosLoc, m_qvPos);
-	m_pShaders->setUniformValue(m_nSizeLoc, m_qvSize);
-
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	m_bVisible = bVisible;
+	for (auto& it : m_vTextures) {
+		if (it)
+			it->setVisible(m_bVisible);
+	}
 }
 
-void CTile::invalidate()
+void CTile::setPixelScale(const float& fScale)
 {
-	m_bInvalidate = true;
-	//if (m_pTexture && m_pTexture->valid())
-		//m_pPrevTexture = m_pTexture;
-	m_pTexture = nullptr;
+	m_fPixelScale = fScale;
 }
 
-bool CTile::InitGLBuffers()
+bool CTile::isReady()
 {
-	//0) Create and bind VAO
-	m_pVAO = std::make_shared<QOpenGLVertexArrayObject>();
-	if (!m_pVAO->create())
-		return false;
-	m_pVAO->bind();
+	//    (  )   .   ,  
+	if (!m_bVisible)
+		return true;
 
-	//1) Create & allocate index buffer
-	{
-		auto pDrawIndex = InitIndexBuffer();
-		m_pEBO = std::make_shared<QOpenGLBuffer>(QOpenGLBuffer::IndexBuffer);
-		if (!m_pEBO->create())
+	for (auto& it : m_vTextures) {
+		if (it && !it->valid() && !it->failed())
 			return false;
-
-		m_pEBO->bind();
-		m_pEBO->setUsagePattern(QOpenGLBuffer::StaticDraw);
-		m_pEBO->allocate(pDrawIndex.get(), 6 * sizeof(GLuint));
 	}
 
-	//2) Create and allocate vertex buffer
-	{
-		auto pVertexData = InitVertexBuffer();
-		m_pVBO = std::make_shared<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
-		if (!m_pVBO->create())
-			return false;
-
-		m_pVBO->bind();
-		m_pVBO->setUsagePattern(QOpenGLBuffer::StaticDraw);
-		m_pVBO->allocate(pVertexData.get(), 4 * 4 * sizeof(GLfloat));
-	}
+	//  ,   .    
+	auto pTerrain = CTerrain::get();
+	return !pTerrain->enabled() || m_qsQuadKey.isEmpty() || pTerrain->mesh(m_qsQuadKey, m_hTile);
+}
 
-	//4) Setup vertex coord and well positions buffer indexes
-	auto* pFunc = QOpenGLContext::currentContext()->functions();
+void CTile::place(const QVector3D& qvPos, const QVector3D& qvSize)
+{
+	m_qvPos = qvPos;
+	m_qvSize = qvSize;
+}
 
-	//Coordinates
-	pFunc->glEnableVertexAttribArray(0);
-	//Texture coordinates
-	pFunc->glEnableVertexAttribArray(1);
+void CTile::draw(const QMatrix4x4& qmWorld)
+{
+	if (!m_bVisible)
+		return;
 
-	m_pVBO->bind();
-	pFunc->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), nullptr);
-	pFunc->glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), reinterpret_cast<void*>(2 * sizeof(GLfloat)));
+	//0)        .     
+	//      ,      
+	auto* pFunc = QOpenGLContext::currentContext()->functions();
+	auto pLayers = CGeoLayers::get();
+	QVector4D qvOpacity;
+	bool bHaveTexture = false;
 
-	return true;
-}
+	for (size_t i = 0; i < m_vTextures.size(); ++i) {
+		auto& pTexture = m_vTextures[i];
+		if (!pTexture || !pTexture->valid())
+			continue;
 
-bool CTile::InitShaders()
-{
-	m_pShaders = std::make_shared<QOpenGLShaderProgram>();
-	if (!m_pShaders->addShaderFromSourceCode(QOpenGLShader::Vertex, gwTileVS)) {
-		auto sError = m_pShaders->log();
-		return false;
+		pFunc->glActiveTexture(GL_TEXTURE0 + (GLenum)i);
+		pTexture->bind();
+		qvOpacity[(int)i] = pLayers->layer(i).fOpacity;
+		bHaveTexture = true;
 	}
 
-	if (!m_pShaders->addShaderFromSourceCode(QOpenGLShader::Fragment, gwTileFS)) {
-		auto sError = m_pShaders->log();
-		return false;
+	if (!bHaveTexture) {
+		pFunc->glActiveTexture(GL_TEXTURE0);
+		return;
 	}
 
-	m_pShaders->bindAttributeLocation("position", 0);
-	m_pShaders->bindAttributeLocation("texCoord", 1);
+	//1)     ,         
+	auto pRes = CTileResources::get();
+	pRes->setLayers(qvOpacity);
+	pRes->setGeometry(m_qvPos, m_qvSize);
+
+	//2) :    ,       gfTerrainMaxError .
+	//  ,   
+	auto pTerrain = CTerrain::get();
+	auto pMesh = pTerrain->mesh(m_qsQuadKey, m_hTile);
+	if (pMesh) {
+		pFunc->glActiveTexture(GL_TEXTURE0 + (GLenum)gszMaxLayers);
+		pTerrain->bind(m_qsQuadKey);
+	}
 
-	if (!m_pShaders->link()) {
-		return false;
+	pFunc->glActiveTexture(GL_TEXTURE0);
+	if (!pMesh) {
+		pRes->setTerrain(0.f, 0.f);
+		pRes->drawQuad();
+		return;
 	}
 
-	m_pShaders->bind();
+	float fHeightScale = m_qvSize.y() / (256.f * m_fResolution);
+	uint uiLevel = 0;
+	while ((uiLevel < guiTerrainLevels) && (pMesh->vErrors[uiLevel] * fHeightScale * m_fPixelScale > gfTerrainMaxError))
+		++uiLevel;
 
-	m_nWorldMatrixLoc = m_pShaders->uniformLocation("world");
-	m_nPosLoc = m_pShaders->uniformLocation("pos");
-	m_nSizeLoc = m_pShaders->uniformLocation("size");
+	//          
+	pRes->setTerrain(fHeightScale, std::max(pMesh->vErrors[0] * fHeightScale, 1.f));
+	pRes->drawGrid(uiLevel);
+}
 
-	m_pShaders->setUniformValue("map_data", 0);
+void CTile::invalidate()
+{
+	m_bInvalidate = true;
+	m_qsQuadKey.clear();
+	releaseTexture();
+}
 
-	return true;
+THandle CTile::handle()
+{
+	return m_hTile;
 }
 
 void CTile::onTextureReady()
 {
-	m_pPrevTexture = nullptr;
-	auto pMap = m_pMap.lock();
-	pMap->renderer()->repaint();
+	m_pMap->renderer()->repaint();
 	m_bInvalidate = false;
 }
 
-std::shared_ptr<GLuint[]> CTile::InitIndexBuffer()
+void CTile::onTerrainReady()
 {
-	auto pDrawIndex = new GLuint[6];
-	//0 - 1 - 2 - 0 - 2 - 3
-	pDrawIndex[0] = 0;
-	pDrawIndex[1] = pDrawIndex[0] + 1;
-	pDrawIndex[2] = pDrawIndex[0] + 2;
-	pDrawIndex[3] = pDrawIndex[0];
-	pDrawIndex[4] = pDrawIndex[0] + 2;
-	pDrawIndex[5] = pDrawIndex[0] + 3;
-
-	return std::shared_ptr<GLuint[]>(pDrawIndex);
+	m_pMap->renderer()->repaint();
 }
 
-std::shared_ptr<GLfloat[]> CTile::InitVertexBuffer()
+void CTile::invalidateTexture()
 {
-	auto pVertexBuffer = new GLfloat[4 * 4];
-	auto pPtr = pVertexBuffer;
+	if (!m_bInvalidate)
+		return;
 
-	for (size_t i = 0; i < 4; ++i) {
-		auto szVertIdx = 2 * i;
+	releaseTexture();
+	auto pLayers = CGeoLayers::get();
+	auto pMath = CBingGeoTextureProvider::get()->getMath();
+	auto qsQuad = pMath->tile2quad(m_qpTileIndex.rx(), m_qpTileIndex.ry(), m_uiZoomLevel);
+	m_qsQuadKey = qsQuad;
+
+	//      ,       
+	double dbMercY = (m_qpTileIndex.y() + 0.5) / std::ldexp(1.0, (int)m_uiZoomLevel);
+	m_fResolution = (float)pMath->getResolution(pMath->merc2wgs(0.5, dbMercY).first, m_uiZoomLevel);
+
+	// ,        .       
+	m_vTextures.resize(pLayers->count());
+	for (size_t i = 0; i < m_vTextures.size(); ++i) {
+		auto pProvider = pLayers->layer(i).pProvider;
+		auto pMeta = pProvider->getMetadata();
+		if (pMeta->valid() && ((m_uiZoomLevel < pMeta->getZoomLevels().first) || (m_uiZoomLevel > pMeta->getZoomLevels().second)))
+			continue;
 
-		pPtr[0] = gfRectMatrix[szVertIdx];
-		pPtr[1] = gfRectMatrix[szVertIdx + 1];
-		pPtr[2] = gfRectMatrix[szVertIdx];
-		pPtr[3] = gfRectMatrix[szVertIdx + 1];
+		auto& pTexture = m_vTextures[i];
+		pTexture = pProvider->getTexture(qsQuad);
+		if (m_bVisible)
+			pTexture->setVisible(true);
 
-		pPtr += 4;
+		pTexture->init();
+		pTexture->subscribe(m_hTile);
 	}
-
-	return std::shared_ptr<GLfloat[]>(pVertexBuffer);
 }
 
-void CTile::invalidateTexture()
+void CTile::releaseTexture()
 {
-	if (!m_bInvalidate)
-		return;
+	//      ,     
+	for (auto& it : m_vTextures) {
+		if (it && m_bVisible)
+			it->setVisible(false);
 
-	m_pTexture = nullptr;
-	auto pProvider = CBingGeoTextureProvider::get();
-	auto pMath = pProvider->getMath();
+		if (it)
+			it->unsubscribe(m_hTile);
 
-	auto qsQuad = pMath->tile2quad(m_qpTileIndex.rx(), m_qpTileIndex.ry(), m_uiZoomLevel);
-	m_pTexture = pProvider->getTexture(qsQuad, std::bind(&CTile::onTextureReady, this));
-	m_pTexture->init();
+		it = nullptr;
+	}
 }
 
 ITileCircularBuffer& CTileCircularBuffer::operator>>(const uint& uiCount)
@@ -224,13 +230,15 @@ ITileCircularBuffer& CTileCircularBuffer::operator>>(const uint& uiCount)
 	if (m_vTiles.size() < 2)
 		return *this;
 
+	auto pRegistry = CTileRegistry::get();
 	for (uint i = 0; i < uiCount; ++i) {
-		auto pItem = m_vTiles.back();
+		auto hItem = m_vTiles.back();
 		
-		pItem.lock()->invalidate();
+		if (auto pTile = pRegistry->resolve(hItem))
+			pTile->invalidate();
 		
 		m_vTiles.erase(m_vTiles.end() - 1);
-		m_vTiles.emplace(m_vTiles.begin(), pItem);
+		m_vTiles.emplace(m_vTiles.begin(), hItem);
 	}
 
 	rebuild();
@@ -239,55 +247,57 @@ ITileCircularBuffer& CTileCircularBuffer::operator>>(const uint& uiCount)
 
 ITileCircularBuffer& CTileCircularBuffer::operator<<(const uint& uiCount)
 {
+	auto pRegistry = CTileRegistry::get();
 	for (uint i = 0; i < uiCount; ++i) {
-		auto pItem = m_vTiles.front();
+		auto hItem = m_vTiles.front();
 
-		pItem.lock()->invalidate();
+		if (auto pTile = pRegistry->resolve(hItem))
+			pTile->invalidate();
 
 		m_vTiles.erase(m_vTiles.begin());
-		m_vTiles.push_back(pItem);
+		m_vTiles.push_back(hItem);
 	}
 
 	rebuild();
 	return *this;
 }
 
-void CTileCircularBuffer::addFirst(ITilePtr pTile)
+void CTileCircularBuffer::addFirst(const THandle& hTile)
 {
-	m_vTiles.emplace(m_vTiles.begin(), pTile);
+	m_vTiles.emplace(m_vTiles.begin(), hTile);
 }
 
-void CTileCircularBuffer::addLast(ITilePtr pTile)
+void CTileCircularBuffer::addLast(const THandle& hTile)
 {
-	m_vTiles.push_back(pTile);
+	m_vTiles.push_back(hTile);
 }
 
-std::vector<ITilePtr_>::const_iterator CTileCircularBuffer::begin()
+std::vector<THandle>::const_iterator CTileCircularBuffer::begin()
 {
 	return m_vTiles.cbegin();
 }
 
-std::vector<ITilePtr_>::const_iterator CTileCircularBuffer::end()
+std::vector<THandle>::const_iterator CTileCircularBuffer::end()
 {
 	return m_vTiles.cend();
 }
 
-std::vector<ITilePtr_>::reverse_iterator CTileCircularBuffer::rbegin()
+std::vector<THandle>::reverse_iterator CTileCircularBuffer::rbegin()
 {
 	return m_vTiles.rbegin();
 }
 
-std::vector<ITilePtr_>::reverse_iterator CTileCircularBuffer::rend()
+std::vector<THandle>::reverse_iterator CTileCircularBuffer::rend()
 {
 	return m_vTiles.rend();
 }
 
-ITilePtr CTileCircularBuffer::at(const size_t& szIdx)
+ITile* CTileCircularBuffer::at(const size_t& szIdx)
 {
-	if ((szIdx < 0) || szIdx > m_vTiles.size())
+	if (szIdx >= m_vTiles.size())
 		return nullptr;
 
-	return m_vTiles[szIdx].lock();
+	return CTileRegistry::get()->resolve(m_vTiles[szIdx]);
 }
 
 bool CTileCircularBuffer::empty()
@@ -302,8 +312,9 @@ size_t CTileCircularBuffer::size()
 
 void CTileCircularBuffer::rebuild()
 {
+	auto pRegistry = CTileRegistry::get();
 	for (size_t i = 0; i < m_vTiles.size(); ++i) {
-		auto pTile = m_vTiles[i].lock();
+		auto pTile = pRegistry->resolve(m_vTiles[i]);
 		if (pTile) {
 			auto spIndex = pTile->getIndex();
 			m_bVertical ? spIndex.second = i : spIndex.first = i;
@@ -324,7 +335,6 @@ CTileMap::CTileMap(IGlobalRendererPtr pRenderer) : m_pGlobal(pRenderer)
 
 void CTileMap::init()
 {
-	auto pMap = std::dynamic_pointer_cast<ITileMap>(shared_from_this());
 	//0)        
 	for (size_t i = 0; i < 6; ++i)
 		m_vRows.push_back(std::make_shared<CTileCircularBuffer>(false));
@@ -334,7 +344,7 @@ void CTileMap::init()
 
 	//1)         
 	for (size_t i = 0; i < m_vRows.size() * m_vCols.size(); ++i) {
-		ITilePtr pTile = std::make_shared<CTile>(pMap);
+		ITilePtr pTile = std::make_shared<CTile>(this);
 		m_vTiles.push_back(pTile);
 
 		size_t nRow = i / m_vCols.size();
@@ -342,8 +352,8 @@ void CTileMap::init()
 		size_t nCol = i % m_vCols.size();
 		bool bLast = ((m_vCols.size() * m_vRows.size() - 1) == i);
 
-		m_vRows[nRow]->addLast(pTile);
-		m_vCols[nCol]->addLast(pTile);
+		m_vRows[nRow]->addLast(pTile->handle());
+		m_vCols[nCol]->addLast(pTile->handle());
 	}
 	
 	//2)  
@@ -357,14 +367,77 @@ void CTileMap::init()
 
 void CTileMap::initGL()
 {
-	for (auto pTile : m_vTiles)
-		pTile->initGL();
+	//0)        ,   
+	auto pRes = CTileResources::get();
+	if (!pRes->initGL())
+		return;
+
+	//1) VAO    ,      
+	m_pVAO = std::make_shared<QOpenGLVertexArrayObject>();
+	if (!m_pVAO->create())
+		return;
+
+	m_pVAO->bind();
+	pRes->bindVertexBuffers();
+	m_pVAO->release();
 }
 
 void CTileMap::draw(const QMatrix4x4& qmWorld)
 {
-	for (auto it : m_vTiles)
-		it->draw(qmWorld);
+	auto pRes = CTileResources::get();
+	pRes->collect();
+
+	//,    ,   
+	CBingGeoTextureProvider::get()->deliver();
+	cull(qmWorld);
+
+	if (m_pVAO) {
+		m_pVAO->bind();
+		pRes->bindShaders(qmWorld);
+
+		//     ,      .
+		//     ,       
+		auto* pFunc = QOpenGLContext::currentContext()->functions();
+		bool bTerrain = CTerrain::get()->enabled();
+		auto pRender = m_pGlobal.lock();
+		if (bTerrain && pRender) {
+			pFunc->glEnable(GL_DEPTH_TEST);
+			pFunc->glDepthFunc(GL_LEQUAL);
+			pRes->setTerrainLimit(0.5f * std::abs(pRender->getCamera()->getPosition().z()));
+		}
+
+		for (auto it : m_vTiles)
+			it->draw(qmWorld);
+
+		if (bTerrain)
+			pFunc->glDisable(GL_DEPTH_TEST);
+
+		m_pVAO->release();
+	}
+
+	m_statVisible.set(m_uiVisible);
+	m_statCulled.set(m_uiCulled);
+}
+
+void CTileMap::cull(const QMatrix4x4& qmWorld)
+{
+	auto pRender = m_pGlobal.lock();
+	if (!pRender)
+		return;
+
+	QSizeF qsViewport(pRender->getWidth(), pRender->getHeight());
+	m_uiVisible = m_uiCulled = 0u;
+
+	//0)       ,        
+	for (auto pTile : m_vTiles) {
+		QRectF qrFootprint;
+		bool bVisible = getFootprint(qmWorld, pTile->getPos(), pTile->getSize(), qsViewport, qrFootprint);
+		pTile->setVisible(bVisible);
+		if (bVisible)
+			pTile->setPixelScale((float)(qrFootprint.height() / std::max(pTile->getSize().y(), 1e-3f)));
+
+		bVisible ? ++m_uiVisible : ++m_uiCulled;
+	}
 }
 
 bool CTileMap::detail(const uint& uiZoomLevel)
@@ -389,14 +462,14 @@ bool CTileMap::detail(const uint& uiZoomLevel)
 	auto nTileCount = pMath->getTileIndexRange(m_uiZoomLevel);
 
 	//3)     
-	std::pair<int, int> spIdx0 = std::make_pair(ptIdx.first - ((int)m_vCols.size() / 2 - 1),
+	m_spTileIdx0 = std::make_pair(ptIdx.first - ((int)m_vCols.size() / 2 - 1),
 		ptIdx.second + ((int)m_vRows.size() / 2 ));
 
 	//4)     
 	for (auto pTile : m_vTiles) {
 		auto spIdx = pTile->getIndex();
-		int nX = spIdx.first + spIdx0.first;
-		int nY = spIdx0.second - spIdx.second;
+		int nX = spIdx.first + m_spTileIdx0.first;
+		int nY = m_spTileIdx0.second - spIdx.second;
 
 		if ((nX < 0) || (nX > nTileCount) || (nY < 0) || (nY > nTileCount))
 			continue;
@@ -404,6 +477,8 @@ bool CTileMap::detail(const uint& uiZoomLevel)
 		pTile->setTileIndex({ nX, nY }, m_uiZoomLevel);
 	}
 
+	//5)        
+	cull(pRender->getWorldMatrix());
 	return true;
 }
 
@@ -414,14 +489,20 @@ void CTileMap::move()
 	
 	//0)    
 	auto pRender = m_pGlobal.lock();
-	auto qvLB = pRender->screenToWorld(0, pRender->getHeight());
-	auto qvRT = pRender->screenToWorld(pRender->getWidth(), 0);
+	auto pCamera = pRender->getCamera();
+	m_vScreen.assign({ QPointF(0, pRender->getHeight()), QPointF(pRender->getWidth(), 0) });
+	pCamera->screenToWorld(m_vScreen, m_vWorld);
+	const auto qvLB = m_vWorld[0];
+	const auto qvRT = m_vWorld[1];
 
 	//1)     
 	checkLeftBorder(qvRT.x());
 	checkRightBorder(qvLB.x());
 	checkBottomBorder(qvRT.y());
 	checkTopBorder(qvLB.y());
+
+	//2)   ,    
+	cull(pCamera->getWorldMatrix());
 }
 
 void CTileMap::rebuild()
@@ -429,11 +510,93 @@ void CTileMap::rebuild()
 	rebuildTileGeometry();
 }
 
+uint CTileMap::pending()
+{
+	return (uint)std::count_if(m_vTiles.begin(), m_vTiles.end(), [](const ITilePtr& pTile) { return !pTile->isReady(); });
+}
+
+TMercatorTransform CTileMap::getMercatorTransform()
+{
+	TMercatorTransform transform;
+	if (m_vTiles.empty())
+		return transform;
+
+	//0)   :           
+	auto pTile = m_vTiles.front();
+	auto spIdx = pTile->getIndex();
+	auto qvPos = pTile->getPos();
+	auto qvSize = pTile->getSize();
+	if ((qvSize.x() <= 0.f) || (qvSize.y() <= 0.f))
+		return transform;
+
+	double dbTileX = m_spTileIdx0.first + (int)spIdx.first;
+	double dbTileY = m_spTileIdx0.second - (int)spIdx.second;
+	double dbTiles = std::pow(2.0, m_uiZoomLevel);
+
+	//1)    (t = 0)    
+	transform.dbScaleX = dbTiles * qvSize.x();
+	transform.dbScaleY = -dbTiles * qvSize.y();
+	transform.dbOriginX = qvPos.x() - dbTileX * qvSize.x();
+	transform.dbOriginY = qvPos.y() + (dbTileY + 1.0) * qvSize.y();
+	transform.bValid = true;
+
+	return transform;
+}
+
 IGlobalRendererPtr CTileMap::renderer()
 {
 	return m_pGlobal.lock();
 }
 
+bool CTileMap::getFootprint(const QMatrix4x4& qmWorld, const QVector3D& qvPos, const QVector3D& qvSize,
+	const QSizeF& qsViewport, QRectF& qrFootprint, QSizeF* pqsProjected)
+{
+	//0)      
+	std::array<QVector4D, 4> vCorners;
+	for (size_t i = 0; i < vCorners.size(); ++i) {
+		vCorners[i] = qmWorld * QVector4D(qvPos.x() + gfRectMatrix[2 * i] * qvSize.x(),
+			qvPos.y() + gfRectMatrix[2 * i + 1] * qvSize.y(), 0.f, 1.f);
+	}
+
+	//1)  ,             
+	auto allOutside = [&](auto fTest) { return std::all_of(vCorners.begin(), vCorners.end(), fTest); };
+	if (allOutside([](const QVector4D& v) { return v.x() < -v.w(); }) ||
+		allOutside([](const QVector4D& v) { return v.x() > v.w(); }) ||
+		allOutside([](const QVector4D& v) { return v.y() < -v.w(); }) ||
+		allOutside([](const QVector4D& v) { return v.y() > v.w(); }) ||
+		allOutside([](const QVector4D& v) { return v.z() < -v.w(); }) ||
+		allOutside([](const QVector4D& v) { return v.z() > v.w(); }))
+		return false;
+
+	//2)       ( ),      
+	QRectF qrViewport(QPointF(0.0, 0.0), qsViewport);
+	if (std::any_of(vCorners.begin(), vCorners.end(), [](const QVector4D& v) { return v.w() <= 0.f; })) {
+		qrFootprint = qrViewport;
+		if (pqsProjected)
+			*pqsProjected = QSizeF(std::numeric_limits<double>::max(), std::numeric_limits<double>::max());
+
+		return true;
+	}
+
+	//3)  -      
+	double dbMinX = std::numeric_limits<double>::max(), dbMinY = dbMinX;
+	double dbMaxX = std::numeric_limits<double>::lowest(), dbMaxY = dbMaxX;
+	for (const auto& v : vCorners) {
+		double dbX = (v.x() / v.w() * 0.5 + 0.5) * qsViewport.width();
+		double dbY = (0.5 - v.y() / v.w() * 0.5) * qsViewport.height();
+		dbMinX = std::min(dbMinX, dbX);
+		dbMaxX = std::max(dbMaxX, dbX);
+		dbMinY = std::min(dbMinY, dbY);
+		dbMaxY = std::max(dbMaxY, dbY);
+	}
+
+	if (pqsProjected)
+		*pqsProjected = QSizeF(dbMaxX - dbMinX, dbMaxY - dbMinY);
+
+	qrFootprint = QRectF(QPointF(dbMinX, dbMinY), QPointF(dbMaxX, dbMaxY)).intersected(qrViewport);
+	return true;
+}
+
 void CTileMap::rebuildTileGeometry()
 {
 	//0)   -     
@@ -444,16 +607,20 @@ void CTileMap::rebuildTileGeometry()
 	auto qsSize = pMeta->getImageSize();
 	
 	//1)              
+	//        :    
 	auto pRenderer = m_pGlobal.lock();
-	auto qvP0 = pRenderer->screenToWorld(0, qsSize.height());
-	auto qvP1 = pRenderer->screenToWorld(qsSize.width(), 0);
+	m_vScreen.assign({ QPointF(0, qsSize.height()), QPointF(qsSize.width(), 0),
+		QPointF(0, pRenderer->getHeight()), QPointF(pRenderer->getWidth(), 0) });
+	pRenderer->getCamera()->screenToWorld(m_vScreen, m_vWorld);
+	const auto qvP0 = m_vWorld[0];
+	const auto qvP1 = m_vWorld[1];
 	m_dbTileWidth = qvP1.x() - qvP0.x();
 	m_dbTileHeight = qvP1.y() - qvP0.y();
 	QVector3D qvSize = { m_dbTileWidth, m_dbTileHeight, 0.f };
 		
 	//2)          
-	auto qvLB = pRenderer->screenToWorld(0, pRenderer->getHeight());
-	auto qvRT = pRenderer->screenToWorld(pRenderer->getWidth(), 0);
+	const auto qvLB = m_vWorld[2];
+	const auto qvRT = m_vWorld[3];
 	QPointF qpScreenCenter = { qvLB.x() + (qvRT.x() - qvLB.x()) / 2.0, qvLB.y() + (qvRT.y() - qvLB.y()) / 2.0 };
 
 	//3)       .    
@@ -470,8 +637,9 @@ void CTileMap::rebuildTileGeometry()
 
 void CTileMap::checkLeftBorder(const float& dbScreenX)
 {
+	auto pRegistry = CTileRegistry::get();
 	auto pRow = m_vRows[0];
-	auto pTile = pRow->rbegin()->lock();
+	auto pTile = pRegistry->resolve(*pRow->rbegin());
 
 	if (dbScreenX <= pTile->getPos().x())
 		return;
@@ -489,13 +657,13 @@ void CTileMap::checkLeftBorder(const float& dbScreenX)
 		*it << nDelta;
 
 		//2)      
-		auto pTileLast = (it->rbegin() + nDelta)->lock();
+		auto pTileLast = pRegistry->resolve(*(it->rbegin() + nDelta));
 		auto qvSize = pTileLast->getSize();
 		auto qvPos = pTileLast->getPos();
 		auto qpTileIdx = pTileLast->getTileIndex();
 
 		for (int i = 0; i < nDelta; ++i) {
-			auto pTile = (it->rbegin() + i)->lock();
+			auto pTile = pRegistry->resolve(*(it->rbegin() + i));
 			QVector3D qvNewPos = { qvPos.x() + (nDelta - i) * qvSize.x(), qvPos.y(), 0.f };
 			pTile->place(qvNewPos, qvSize);
 
@@ -507,12 +675,15 @@ void CTileMap::checkLeftBorder(const float& dbScreenX)
 			pTile->setTileIndex(qpGeo, m_uiZoomLevel);
 		}
 	}
+
+	m_spTileIdx0.first += nDelta;
 }
 
 void CTileMap::checkRightBorder(const float& dbScreenX)
 {
+	auto pRegistry = CTileRegistry::get();
 	auto pRow = m_vRows[0];
-	auto pTile = pRow->begin()->lock();
+	auto pTile = pRegistry->resolve(*pRow->begin());
 
 	if (dbScreenX >= pTile->getPos().x())
 		return;
@@ -530,13 +701,13 @@ void CTileMap::checkRightBorder(const float& dbScreenX)
 		*it >> nDelta;
 
 		//2)      
-		auto pTileLast = (it->begin() + nDelta)->lock();
+		auto pTileLast = pRegistry->resolve(*(it->begin() + nDelta));
 		auto qvSize = pTileLast->getSize();
 		auto qvPos = pTileLast->getPos();
 		auto qpTileIdx = pTileLast->getTileIndex();
 
 		for (int i = 0; i < nDelta; ++i) {
-			auto pTile = (it->begin() + i)->lock();
+			auto pTile = pRegistry->resolve(*(it->begin() + i));
 			QVector3D qvNewPos = { qvPos.x() - (nDelta - i) * qvSize.x(), qvPos.y(), 0.f };
 			pTile->place(qvNewPos, qvSize);
 
@@ -548,12 +719,15 @@ void CTileMap::checkRightBorder(const float& dbScreenX)
 			pTile->setTileIndex(qpGeo, m_uiZoomLevel);
 		}
 	}
+
+	m_spTileIdx0.first -= nDelta;
 }
 
 void CTileMap::checkBottomBorder(const float& dbScreenY)
 {
+	auto pRegistry = CTileRegistry::get();
 	auto pCol = m_vCols[0];
-	auto pTile = pCol->rbegin()->lock();
+	auto pTile = pRegistry->resolve(*pCol->rbegin());
 
 	if (dbScreenY <= pTile->getPos().y())
 		return;
@@ -570,13 +744,13 @@ void CTileMap::checkBottomBorder(const float& dbScreenY)
 		*it << nDelta;
 
 		//2)      
-		auto pTileLast = (it->rbegin() + nDelta)->lock();
+		auto pTileLast = pRegistry->resolve(*(it->rbegin() + nDelta));
 		auto qvSize = pTileLast->getSize();
 		auto qvPos = pTileLast->getPos();
 		auto qpTileIdx = pTileLast->getTileIndex();
 
 		for (int i = 0; i < nDelta; ++i) {
-			auto pTile = (it->rbegin() + i)->lock();
+			auto pTile = pRegistry->resolve(*(it->rbegin() + i));
 			QVector3D qvNewPos = { qvPos.x(), qvPos.y() + (nDelta - i) * qvSize.y(), 0.f };
 			pTile->place(qvNewPos, qvSize);
 
@@ -588,12 +762,15 @@ void CTileMap::checkBottomBorder(const float& dbScreenY)
 			pTile->setTileIndex(qpGeo, m_uiZoomLevel);
 		}
 	}
+
+	m_spTileIdx0.second -= nDelta;
 }
 
 void CTileMap::checkTopBorder(const float& dbScreenY)
 {
+	auto pRegistry = CTileRegistry::get();
 	auto pCol = m_vCols[0];
-	auto pTile = pCol->begin()->lock();
+	auto pTile = pRegistry->resolve(*pCol->begin());
 
 	if (dbScreenY >= pTile->getPos().y())
 		return;
@@ -610,13 +787,13 @@ void CTileMap::checkTopBorder(const float& dbScreenY)
 		*it >> nDelta;
 
 		//2)      
-		auto pTileLast = (it->begin() + nDelta)->lock();
+		auto pTileLast = pRegistry->resolve(*(it->begin() + nDelta));
 		auto qvSize = pTileLast->getSize();
 		auto qvPos = pTileLast->getPos();
 		auto qpTileIdx = pTileLast->getTileIndex();
 
 		for (int i = 0; i < nDelta; ++i) {
-			auto pTile = (it->begin() + i)->lock();
+			auto pTile = pRegistry->resolve(*(it->begin() + i));
 			QVector3D qvNewPos = { qvPos.x(), qvPos.y() - (nDelta - i) * qvSize.y(), 0.f };
 			pTile->place(qvNewPos, qvSize);
 
@@ -628,5 +805,30 @@ void CTileMap::checkTopBorder(const float& dbScreenY)
 			pTile->setTileIndex(qpGeo, m_uiZoomLevel);
 		}
 	}
+
+	m_spTileIdx0.second += nDelta;
+}
+
+ITileRegistryPtr CTileRegistry::get()
+{
+	if (!m_pRegistry)
+		m_pRegistry = ITileRegistryPtr(new CTileRegistry());
+
+	return m_pRegistry;
 }
 
+THandle CTileRegistry::add(ITile* pTile)
+{
+	return m_Tiles.acquire(pTile);
+}
+
+void CTileRegistry::remove(const THandle& hTile)
+{
+	m_Tiles.release(hTile);
+}
+
+ITile* CTileRegistry::resolve(const THandle& hTile)
+{
+	auto ppTile = m_Tiles.resolve(hTile);
+	return ppTile ? *ppTile : nullptr;
+}
@@ -1,9 +1,13 @@
 #pragma once
 #include "intfs.h"
+#include "handles.h"
+#include "stats.h"
 
 class CTile : public ITile {
 public:
-	explicit CTile(ITileMapPtr pMap);
+	//The map owns its tiles and outlives them
+	explicit CTile(ITileMap* pMap);
+	~CTile();
 protected: //ITile
 	std::pair<uint, uint> getIndex() override;
 	void setIndex(const std::pair<uint, uint>& spIndex) override;
@@ -12,76 +16,109 @@ protected: //ITile
 
 	QVector3D getPos() override;
 	QVector3D getSize() override;
+	bool isVisible() override;
+	void setVisible(const bool& bVisible) override;
+	void setPixelScale(const float& fScale) override;
+	bool isReady() override;
 	
-	void initGL() override;
 	void place(const QVector3D& qvPos, const QVector3D& qvSize) override;
 	void draw(const QMatrix4x4& qmWorld) override;
 	void invalidate() override;
+	THandle handle() override;
+	void onTextureReady() override;
+	void onTerrainReady() override;
 private:
 	bool m_bInvalidate = false;
+	bool m_bVisible = false;
 	std::pair<uint, uint> m_spIndex;
 	QVector3D m_qvPos, m_qvSize;
 	QPoint m_qpTileIndex;
 	uint m_uiZoomLevel;
-	ITileMapPtr_ m_pMap;
-	IGeoTexturePtr m_pTexture = nullptr;
-	IGeoTexturePtr m_pPrevTexture = nullptr;
-	
-	std::shared_ptr<QOpenGLVertexArrayObject> m_pVAO;
-	std::shared_ptr <QOpenGLBuffer> m_pVBO, m_pEBO;
-	std::shared_ptr<QOpenGLShaderProgram> m_pShaders;
-	int m_nWorldMatrixLoc, m_nPosLoc, m_nSizeLoc;
+	ITileMap* m_pMap = nullptr;
+	THandle m_hTile = 0;
+	//One per map layer, bottom to top. Empty where the layer has no imagery at this zoom
+	std::vector<IGeoTexturePtr> m_vTextures;
+	QString m_qsQuadKey;
+	//Terrain: metres per texture pixel at the tile, screen pixels per world unit
+	float m_fResolution = 1.f;
+	float m_fPixelScale = 0.f;
 private:
-	bool InitGLBuffers();
-	bool InitShaders();
-	void onTextureReady();
-private:
-	std::shared_ptr<GLuint[]>  InitIndexBuffer();
-	std::shared_ptr<GLfloat[]>  InitVertexBuffer();
 	void invalidateTexture();
+	void releaseTexture();
 };
 
 class CTileCircularBuffer : public ITileCircularBuffer {
 public:
 	explicit CTileCircularBuffer(bool bVertical) : m_bVertical(bVertical) {};
 protected: //ITileCircularBuffer
-	void addFirst(ITilePtr pTile) override;
-	void addLast(ITilePtr pTile) override;
+	void addFirst(const THandle& hTile) override;
+	void addLast(const THandle& hTile) override;
 	ITileCircularBuffer& operator >> (const uint& uiCount) override;
 	ITileCircularBuffer& operator << (const uint& uiCount) override;
-	std::vector<ITilePtr_>::const_iterator begin() override;
-	std::vector<ITilePtr_>::const_iterator end() override;
-	std::vector<ITilePtr_>::reverse_iterator rbegin() override;
-	std::vector<ITilePtr_>::reverse_iterator rend() override;
-	ITilePtr at(const size_t& szIdx) override;
+	std::vector<THandle>::const_iterator begin() override;
+	std::vector<THandle>::const_iterator end() override;
+	std::vector<THandle>::reverse_iterator rbegin() override;
+	std::vector<THandle>::reverse_iterator rend() override;
+	ITile* at(const size_t& szIdx) override;
 	bool empty() override;
 	size_t size() override;
 	void rebuild() override;
 private:
-	std::vector<ITilePtr_> m_vTiles;
+	std::vector<THandle> m_vTiles;
 	bool m_bVertical;
 };
 
+class CTileRegistry : public ITileRegistry {
+public:
+	static ITileRegistryPtr get();
+protected: //ITileRegistry
+	THandle add(ITile* pTile) override;
+	void remove(const THandle& hTile) override;
+	ITile* resolve(const THandle& hTile) override;
+private:
+	CTileRegistry() = default;
+	static ITileRegistryPtr m_pRegistry;
+	//A few maps with 60 tiles each, the reserve covers every view and offscreen renderer
+	CHandlePool<ITile*> m_Tiles{ 1024 };
+};
+
 class CTileMap : public ITileMap, public std::enable_shared_from_this<CTileMap> {
 public:
 	explicit CTileMap(IGlobalRendererPtr pRenderer);
+	//Screen rect of a tile clipped to the viewport. The projected size is not clipped, and unbounded if a corner is behind the camera
+	static bool getFootprint(const QMatrix4x4& qmWorld, const QVector3D& qvPos, const QVector3D& qvSize,
+		const QSizeF& qsViewport, QRectF& qrFootprint, QSizeF* pqsProjected = nullptr);
 protected: //ITileMap
 	void init() override;
 	void initGL() override;
 	void draw(const QMatrix4x4& qmWorld) override;
+	void cull(const QMatrix4x4& qmWorld) override;
 	bool detail(const uint& uiZoomLevel) override;
 	void move() override;
 	void rebuild() override;
+	uint pending() override;
+	TMercatorTransform getMercatorTransform() override;
 	IGlobalRendererPtr renderer() override;
 private:
 	std::vector<ITileCircularBufferPtr> m_vCols;
 	std::vector<ITileCircularBufferPtr> m_vRows;
 	std::vector<ITilePtr> m_vTiles;
+	std::shared_ptr<QOpenGLVertexArrayObject> m_pVAO;
+	//Scratch buffers for the corner conversions, kept so that panning does not allocate
+	std::vector<QPointF> m_vScreen;
+	std::vector<QVector3D> m_vWorld;
 	float m_dbTileWidth = 0.0; 
 	float m_dbTileHeight = 0.0;
 	IGlobalRendererPtr_ m_pGlobal;
 	uint m_uiZoomLevel = 1u;
 	std::pair<uint, uint> m_upZoomLevels;	
+	std::pair<int, int> m_spTileIdx0;
+	uint m_uiVisible = 0u;
+	uint m_uiCulled = 0u;
+	//Views draw one after another, each one keeps its own counts
+	QString m_qsStats = CStatistics::instance("tiles");
+	CStatCounter m_statVisible{ m_qsStats + ".visible" };
+	CStatCounter m_statCulled{ m_qsStats + ".culled" };
 	void rebuildTileGeometry();
 private:
 	void checkLeftBorder(const float& dbScreenX);
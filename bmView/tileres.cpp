@@ -0,0 +1,249 @@
+#include "tileres.h"
+#include "consts.h"
+#include "stats.h"
+
+ITileResourcesPtr CTileResources::m_pResources = nullptr;
+
+ITileResourcesPtr CTileResources::get()
+{
+	if (!m_pResources)
+		m_pResources = ITileResourcesPtr(new CTileResources());
+
+	return m_pResources;
+}
+
+bool CTileResources::initGL()
+{
+	//All views live in one share group, so buffers and program are created by the first one
+	if (m_bInit)
+		return true;
+
+	//Startup cost of the first view. Programs come from the shader disk cache after the first run
+	QElapsedTimer timer;
+	timer.start();
+	if (!InitGLBuffers())
+		return false;
+
+	auto nBuffers = timer.nsecsElapsed();
+	if (!InitShaders())
+		return false;
+
+	auto pStats = CStatistics::get();
+	pStats->set("startup.buffers.us", nBuffers / 1000);
+	pStats->set("startup.programs.us", (timer.nsecsElapsed() - nBuffers) / 1000);
+
+	m_bInit = true;
+	return true;
+}
+
+void CTileResources::bindVertexBuffers()
+{
+	auto* pFunc = QOpenGLContext::currentContext()->functions();
+
+	m_pEBO->bind();
+	m_pVBO->bind();
+
+	//Coordinates
+	pFunc->glEnableVertexAttribArray(0);
+	//Texture coordinates
+	pFunc->glEnableVertexAttribArray(1);
+	//Skirt flag
+	pFunc->glEnableVertexAttribArray(2);
+
+	pFunc->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), nullptr);
+	pFunc->glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), reinterpret_cast<void*>(2 * sizeof(GLfloat)));
+	pFunc->glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), reinterpret_cast<void*>(4 * sizeof(GLfloat)));
+}
+
+void CTileResources::bindShaders(const QMatrix4x4& qmWorld)
+{
+	m_pShaders->bind();
+	m_pShaders->setUniformValue(m_nWorldMatrixLoc, qmWorld);
+}
+
+void CTileResources::setGeometry(const QVector3D& qvPos, const QVector3D& qvSize)
+{
+	m_pShaders->setUniformValue(m_nPosLoc, qvPos);
+	m_pShaders->setUniformValue(m_nSizeLoc, qvSize);
+}
+
+void CTileResources::setLayers(const QVector4D& qvOpacity)
+{
+	m_pShaders->setUniformValue(m_nOpacityLoc, qvOpacity);
+}
+
+void CTileResources::setTerrain(const float& fHeightScale, const float& fSkirt)
+{
+	m_pShaders->setUniformValue(m_nHeightScaleLoc, fHeightScale);
+	m_pShaders->setUniformValue(m_nSkirtLoc, fSkirt);
+}
+
+void CTileResources::setTerrainLimit(const float& fMaxHeight)
+{
+	m_pShaders->setUniformValue(m_nMaxHeightLoc, fMaxHeight);
+}
+
+void CTileResources::drawQuad()
+{
+	draw(m_Quad);
+}
+
+void CTileResources::drawGrid(const uint& uiLevel)
+{
+	draw(m_vGrids[std::min<size_t>(uiLevel, m_vGrids.size() - 1)]);
+}
+
+void CTileResources::releaseTexture(std::shared_ptr<QOpenGLTexture> pTexture)
+{
+	if (pTexture)
+		m_vReleased.push_back(pTexture);
+}
+
+void CTileResources::collect()
+{
+	//Textures are dropped outside of paintGL, here we finally have a current context to free them
+	m_vReleased.clear();
+}
+
+bool CTileResources::InitGLBuffers()
+{
+	//0) Flat quad first, then the terrain grids of every level. One buffer pair serves them all, so one VAO does too
+	std::vector<GLfloat> vVertices;
+	std::vector<GLuint> vIndices;
+	InitQuad(vVertices, vIndices);
+	for (uint i = 0; i <= guiTerrainLevels; ++i)
+		InitGrid(i, vVertices, vIndices);
+
+	//1) Create & allocate index buffer
+	m_pEBO = std::make_shared<QOpenGLBuffer>(QOpenGLBuffer::IndexBuffer);
+	if (!m_pEBO->create())
+		return false;
+
+	m_pEBO->bind();
+	m_pEBO->setUsagePattern(QOpenGLBuffer::StaticDraw);
+	m_pEBO->allocate(vIndices.data(), (int)(vIndices.size() * sizeof(GLuint)));
+
+	//2) Create and allocate vertex buffer
+	m_pVBO = std::make_shared<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
+	if (!m_pVBO->create())
+		return false;
+
+	m_pVBO->bind();
+	m_pVBO->setUsagePattern(QOpenGLBuffer::StaticDraw);
+	m_pVBO->allocate(vVertices.data(), (int)(vVertices.size() * sizeof(GLfloat)));
+
+	return true;
+}
+
+bool CTileResources::InitShaders()
+{
+	//Linked binaries are kept in the Qt shader disk cache, a warm start skips compiling and linking
+	m_pShaders = std::make_shared<QOpenGLShaderProgram>();
+	if (!m_pShaders->addCacheableShaderFromSourceCode(QOpenGLShader::Vertex, gwTileVS)) {
+		auto sError = m_pShaders->log();
+		return false;
+	}
+
+	if (!m_pShaders->addCacheableShaderFromSourceCode(QOpenGLShader::Fragment, gwTileFS)) {
+		auto sError = m_pShaders->log();
+		return false;
+	}
+
+	m_pShaders->bindAttributeLocation("position", 0);
+	m_pShaders->bindAttributeLocation("texCoord", 1);
+
+	if (!m_pShaders->link()) {
+		return false;
+	}
+
+	m_pShaders->bind();
+
+	m_nWorldMatrixLoc = m_pShaders->uniformLocation("world");
+	m_nPosLoc = m_pShaders->uniformLocation("pos");
+	m_nSizeLoc = m_pShaders->uniformLocation("size");
+	m_nOpacityLoc = m_pShaders->uniformLocation("opacity");
+	m_nHeightScaleLoc = m_pShaders->uniformLocation("height_scale");
+	m_nSkirtLoc = m_pShaders->uniformLocation("skirt_depth");
+	m_nMaxHeightLoc = m_pShaders->uniformLocation("max_height");
+
+	//Layer N always samples texture unit N
+	for (size_t i = 0; i < gszMaxLayers; ++i)
+		m_pShaders->setUniformValue(qPrintable(QString("layer%1").arg(i)), (GLint)i);
+
+	//Heights take the unit after the layers
+	m_pShaders->setUniformValue("heights", (GLint)gszMaxLayers);
+	m_pShaders->setUniformValue("grid", (GLfloat)giTerrainGrid);
+	m_pShaders->setUniformValue(m_nHeightScaleLoc, 0.f);
+
+	return true;
+}
+
+void CTileResources::InitQuad(std::vector<GLfloat>& vVertices, std::vector<GLuint>& vIndices)
+{
+	auto uiBase = (GLuint)(vVertices.size() / 5);
+	for (size_t i = 0; i < 4; ++i) {
+		auto szVertIdx = 2 * i;
+		vVertices.insert(vVertices.end(), { gfRectMatrix[szVertIdx], gfRectMatrix[szVertIdx + 1],
+			gfRectMatrix[szVertIdx], gfRectMatrix[szVertIdx + 1], 0.f });
+	}
+
+	//0 - 1 - 2 - 0 - 2 - 3
+	m_Quad.szOffset = vIndices.size();
+	vIndices.insert(vIndices.end(), { uiBase, uiBase + 1, uiBase + 2, uiBase, uiBase + 2, uiBase + 3 });
+	m_Quad.nCount = 6;
+}
+
+void CTileResources::InitGrid(const uint& uiLevel, std::vector<GLfloat>& vVertices, std::vector<GLuint>& vIndices)
+{
+	//0) (N + 1) x (N + 1) vertices row by row from the bottom, positions and texture coordinates are the same
+	GLuint uiCells = 1u << uiLevel;
+	GLuint uiSide = uiCells + 1;
+	auto uiBase = (GLuint)(vVertices.size() / 5);
+	for (GLuint r = 0; r < uiSide; ++r) {
+		for (GLuint c = 0; c < uiSide; ++c) {
+			GLfloat fX = (GLfloat)c / uiCells;
+			GLfloat fY = (GLfloat)r / uiCells;
+			vVertices.insert(vVertices.end(), { fX, fY, fX, fY, 0.f });
+		}
+	}
+
+	TMeshRange range;
+	range.szOffset = vIndices.size();
+	for (GLuint r = 0; r < uiCells; ++r) {
+		for (GLuint c = 0; c < uiCells; ++c) {
+			GLuint v0 = uiBase + r * uiSide + c;
+			vIndices.insert(vIndices.end(), { v0, v0 + 1, v0 + uiSide + 1, v0, v0 + uiSide + 1, v0 + uiSide });
+		}
+	}
+
+	//1) Skirts: each edge gets a copy of its vertices that the shader pulls down. They hide the cracks
+	//against neighbours drawn with another level or another height scale
+	auto edge = [&](GLuint uiFirst, GLuint uiStep) {
+		auto uiSkirt = (GLuint)(vVertices.size() / 5);
+		for (GLuint k = 0; k < uiSide; ++k) {
+			auto itVertex = vVertices.begin() + 5 * (uiFirst + k * uiStep);
+			std::array<GLfloat, 5> aVertex = { itVertex[0], itVertex[1], itVertex[2], itVertex[3], 1.f };
+			vVertices.insert(vVertices.end(), aVertex.begin(), aVertex.end());
+		}
+
+		for (GLuint k = 0; k < uiCells; ++k) {
+			GLuint e0 = uiFirst + k * uiStep, e1 = e0 + uiStep;
+			GLuint s0 = uiSkirt + k, s1 = s0 + 1;
+			vIndices.insert(vIndices.end(), { e0, e1, s1, e0, s1, s0 });
+		}
+	};
+
+	edge(uiBase, 1);
+	edge(uiBase + uiCells * uiSide, 1);
+	edge(uiBase, uiSide);
+	edge(uiBase + uiCells, uiSide);
+
+	range.nCount = (GLsizei)(vIndices.size() - range.szOffset);
+	m_vGrids.push_back(range);
+}
+
+void CTileResources::draw(const TMeshRange& range)
+{
+	auto* pFunc = QOpenGLContext::currentContext()->functions();
+	pFunc->glDrawElements(GL_TRIANGLES, range.nCount, GL_UNSIGNED_INT, reinterpret_cast<void*>(range.szOffset * sizeof(GLuint)));
+}
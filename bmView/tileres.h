@@ -0,0 +1,41 @@
+#pragma once
+#include "intfs.h"
+
+class CTileResources : public ITileResources {
+public:
+	static ITileResourcesPtr get();
+protected: //ITileResources
+	bool initGL() override;
+	void bindVertexBuffers() override;
+	void bindShaders(const QMatrix4x4& qmWorld) override;
+	void setGeometry(const QVector3D& qvPos, const QVector3D& qvSize) override;
+	void setLayers(const QVector4D& qvOpacity) override;
+	void setTerrain(const float& fHeightScale, const float& fSkirt) override;
+	void setTerrainLimit(const float& fMaxHeight) override;
+	void drawQuad() override;
+	void drawGrid(const uint& uiLevel) override;
+	void releaseTexture(std::shared_ptr<QOpenGLTexture> pTexture) override;
+	void collect() override;
+private:
+	CTileResources() = default;
+	static ITileResourcesPtr m_pResources;
+	bool m_bInit = false;
+	std::shared_ptr<QOpenGLBuffer> m_pVBO, m_pEBO;
+	std::shared_ptr<QOpenGLShaderProgram> m_pShaders;
+	int m_nWorldMatrixLoc, m_nPosLoc, m_nSizeLoc, m_nOpacityLoc;
+	int m_nHeightScaleLoc, m_nSkirtLoc, m_nMaxHeightLoc;
+	//Index ranges of the quad and the terrain grids in the shared buffers
+	struct TMeshRange {
+		size_t szOffset = 0;
+		GLsizei nCount = 0;
+	};
+	TMeshRange m_Quad;
+	std::vector<TMeshRange> m_vGrids;
+	std::vector<std::shared_ptr<QOpenGLTexture>> m_vReleased;
+private:
+	bool InitGLBuffers();
+	bool InitShaders();
+	void InitQuad(std::vector<GLfloat>& vVertices, std::vector<GLuint>& vIndices);
+	void InitGrid(const uint& uiLevel, std::vector<GLfloat>& vVertices, std::vector<GLuint>& vIndices);
+	void draw(const TMeshRange& range);
+};
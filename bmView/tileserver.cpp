@@ -0,0 +1,94 @@
+#include "tileserver.h"
+#include "stats.h"
+
+CTileStandInServer::CTileStandInServer(const QString& qsAddress, const double& dbFailRate, const uint& uiLatency) :
+	m_qsAddress(qsAddress), m_dbFailRate(dbFailRate), m_uiLatency(uiLatency)
+{
+}
+
+CTileStandInServer::~CTileStandInServer()
+{
+	stop();
+}
+
+bool CTileStandInServer::start()
+{
+	try {
+		m_pListener = std::make_unique<web::http::experimental::listener::http_listener>(
+			utility::conversions::to_string_t(m_qsAddress.toStdString()));
+		m_pListener->support(web::http::methods::GET, [this](web::http::http_request request) {
+			handle(request);
+		});
+
+		m_pListener->open().wait();
+		qInfo().noquote() << QString("Serving tiles at %1/{quadkey}").arg(m_qsAddress);
+		return true;
+	}
+	catch (const std::exception& e) {
+		qCritical() << "Cannot listen at" << m_qsAddress << e.what();
+		m_pListener.reset();
+		return false;
+	}
+}
+
+void CTileStandInServer::stop()
+{
+	if (!m_pListener)
+		return;
+
+	m_pListener->close().wait();
+	m_pListener.reset();
+}
+
+void CTileStandInServer::handle(web::http::http_request request)
+{
+	//0) Last path segment is the quadkey
+	auto vPath = web::uri::split_path(request.relative_uri().path());
+	auto qsQuadKey = vPath.empty() ? QString() : QString::fromStdString(utility::conversions::to_utf8string(vPath.back()));
+	if (qsQuadKey.isEmpty() || qsQuadKey.contains(QRegularExpression("[^0-3]"))) {
+		request.reply(web::http::status_codes::NotFound);
+		return;
+	}
+
+	//1) Simulated network
+	if (m_uiLatency)
+		std::this_thread::sleep_for(std::chrono::milliseconds(m_uiLatency));
+
+	if (QRandomGenerator::global()->generateDouble() < m_dbFailRate) {
+		++m_uiFailed;
+		CStatistics::get()->add("standin.failed", 1);
+		request.reply(web::http::status_codes::ServiceUnavailable);
+		return;
+	}
+
+	//2) Tile body
+	auto qbData = render(qsQuadKey);
+	web::http::http_response response(web::http::status_codes::OK);
+	response.headers().set_content_type(U("image/png"));
+	response.set_body(std::vector<unsigned char>(qbData.begin(), qbData.end()));
+	request.reply(response);
+
+	++m_uiServed;
+	CStatistics::get()->add("standin.served", 1);
+}
+
+QByteArray CTileStandInServer::render(const QString& qsQuadKey)
+{
+	//Colour depends on the quadkey, so neighbouring tiles and zoom levels are easy to tell apart
+	auto uiHash = qHash(qsQuadKey);
+	QImage img(256, 256, QImage::Format_RGB32);
+	img.fill(QColor::fromHsv(uiHash % 360, 90, 200));
+
+	QPainter painter(&img);
+	painter.setPen(Qt::black);
+	painter.drawRect(0, 0, 255, 255);
+	painter.drawText(img.rect(), Qt::AlignCenter | Qt::TextWrapAnywhere, qsQuadKey);
+	painter.end();
+
+	QByteArray qbData;
+	QBuffer buffer(&qbData);
+	buffer.open(QIODevice::WriteOnly);
+	img.save(&buffer, "PNG");
+
+	return qbData;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "intfs.h"
+
+//Stand-in for the imagery server: generated tiles, configurable latency and failures
+class CTileStandInServer {
+public:
+	CTileStandInServer(const QString& qsAddress, const double& dbFailRate, const uint& uiLatency);
+	~CTileStandInServer();
+	bool start();
+	void stop();
+private:
+	std::unique_ptr<web::http::experimental::listener::http_listener> m_pListener;
+	QString m_qsAddress;
+	double m_dbFailRate;
+	uint m_uiLatency;
+	std::atomic<quint64> m_uiServed{ 0 };
+	std::atomic<quint64> m_uiFailed{ 0 };
+private:
+	void handle(web::http::http_request request);
+	static QByteArray render(const QString& qsQuadKey);
+};
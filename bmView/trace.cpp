@@ -0,0 +1,219 @@
+#include "trace.h"
+#include "consts.h"
+
+std::atomic<bool> CTracer::m_bEnabled{ false };
+std::chrono::steady_clock::time_point CTracer::m_Start = std::chrono::steady_clock::now();
+std::mutex CTracer::m_Lock;
+std::vector<std::shared_ptr<CTracer::TBuffer>> CTracer::m_vBuffers;
+
+namespace {
+	//Length in the top 6 bits, two bits per digit below
+	const int nKeyLengthShift = 58;
+	const int nMaxKeyLength = 29;
+
+	QString unpack(const quint64& nKey)
+	{
+		QString qsKey;
+		int nLength = (int)(nKey >> nKeyLengthShift);
+		for (int i = nLength - 1; i >= 0; --i)
+			qsKey += QChar('0' + (int)((nKey >> (2 * i)) & 3));
+
+		return qsKey;
+	}
+
+	QString toJson(const TTraceEvent& event, const uint& uiThread)
+	{
+		auto qsTime = QString::number(event.nTime / 1000.0, 'f', 3);
+		if (ETracePhase::Complete == event.ePhase) {
+			return QString("{\"name\":\"%1\",\"cat\":\"thread\",\"ph\":\"X\",\"pid\":1,\"tid\":%2,\"ts\":%3,\"dur\":%4}")
+				.arg(event.szName).arg(uiThread).arg(qsTime).arg(QString::number(event.nDuration / 1000.0, 'f', 3));
+		}
+
+		//Async events of one texture share a track, nested by time
+		auto qsEvent = QString("{\"name\":\"%1\",\"cat\":\"tile\",\"ph\":\"%2\",\"pid\":1,\"tid\":%3,\"ts\":%4,\"id\":\"0x%5\"")
+			.arg(event.szName).arg(QLatin1Char((char)event.ePhase)).arg(uiThread).arg(qsTime).arg(event.nId, 0, 16);
+		if (0 != event.nKey)
+			qsEvent += QString(",\"args\":{\"quadkey\":\"%1\"}").arg(unpack(event.nKey));
+
+		return qsEvent + "}";
+	}
+}
+
+void CTracer::setEnabled(const bool& bEnabled)
+{
+	if (bEnabled)
+		m_Start = std::chrono::steady_clock::now();
+
+	m_bEnabled = bEnabled;
+}
+
+bool CTracer::enabled()
+{
+	return m_bEnabled.load(std::memory_order_relaxed);
+}
+
+qint64 CTracer::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_Start).count();
+}
+
+void CTracer::begin(const char* szName, const quint64& nId, const quint64& nKey)
+{
+	if (!enabled())
+		return;
+
+	TTraceEvent event;
+	event.szName = szName;
+	event.ePhase = ETracePhase::AsyncBegin;
+	event.nTime = now();
+	event.nId = nId;
+	event.nKey = nKey;
+	record(event);
+}
+
+void CTracer::end(const char* szName, const quint64& nId)
+{
+	if (!enabled())
+		return;
+
+	TTraceEvent event;
+	event.szName = szName;
+	event.ePhase = ETracePhase::AsyncEnd;
+	event.nTime = now();
+	event.nId = nId;
+	record(event);
+}
+
+void CTracer::mark(const char* szName, const quint64& nId, const quint64& nKey)
+{
+	if (!enabled())
+		return;
+
+	TTraceEvent event;
+	event.szName = szName;
+	event.ePhase = ETracePhase::AsyncInstant;
+	event.nTime = now();
+	event.nId = nId;
+	event.nKey = nKey;
+	record(event);
+}
+
+void CTracer::complete(const char* szName, const qint64& nStart)
+{
+	if (!enabled())
+		return;
+
+	TTraceEvent event;
+	event.szName = szName;
+	event.ePhase = ETracePhase::Complete;
+	event.nTime = nStart;
+	event.nDuration = now() - nStart;
+	record(event);
+}
+
+void CTracer::setThreadName(const QString& qsName)
+{
+	if (!enabled())
+		return;
+
+	auto pBuffer = buffer();
+	std::lock_guard<std::mutex> lock(m_Lock);
+	pBuffer->qsName = qsName;
+}
+
+quint64 CTracer::pack(const QString& qsQuadKey)
+{
+	if (qsQuadKey.length() > nMaxKeyLength)
+		return 0;
+
+	quint64 nKey = 0;
+	for (auto it : qsQuadKey)
+		nKey = (nKey << 2) | (quint64)((it.unicode() - '0') & 3);
+
+	return nKey | ((quint64)qsQuadKey.length() << nKeyLengthShift);
+}
+
+bool CTracer::write(const QString& qsPath)
+{
+	QFile file(qsPath);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+
+	std::vector<std::shared_ptr<TBuffer>> vBuffers;
+	std::vector<QString> vNames;
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		vBuffers = m_vBuffers;
+		for (const auto& it : vBuffers)
+			vNames.push_back(it->qsName);
+	}
+
+	QTextStream stream(&file);
+	stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+	bool bFirst = true;
+	auto separate = [&] {
+		if (!bFirst)
+			stream << ",\n";
+
+		bFirst = false;
+	};
+
+	std::vector<TTraceEvent> vEvents;
+	const size_t szMask = gszTraceEvents - 1;
+	for (size_t i = 0; i < vBuffers.size(); ++i) {
+		const auto& pBuffer = vBuffers[i];
+
+		//0) Thread names label the tracks
+		separate();
+		stream << QString("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%1,\"args\":{\"name\":\"%2\"}}")
+			.arg(pBuffer->uiThread).arg(vNames[i]);
+
+		//1) Ring is copied first, then whatever its thread overwrote in the meantime is dropped
+		auto szHead = pBuffer->szHead.load(std::memory_order_acquire);
+		auto szFirst = (szHead > gszTraceEvents) ? szHead - gszTraceEvents : 0;
+		vEvents.clear();
+		for (auto szPos = szFirst; szPos < szHead; ++szPos)
+			vEvents.push_back(pBuffer->pEvents[szPos & szMask]);
+
+		auto szNow = pBuffer->szHead.load(std::memory_order_acquire);
+		size_t szSkip = (szNow > szFirst + gszTraceEvents) ? std::min(szNow - gszTraceEvents - szFirst, vEvents.size()) : 0;
+
+		for (auto it = vEvents.begin() + szSkip; it != vEvents.end(); ++it) {
+			separate();
+			stream << toJson(*it, pBuffer->uiThread);
+		}
+	}
+
+	stream << "\n]}\n";
+	stream.flush();
+	return QTextStream::Ok == stream.status();
+}
+
+CTracer::TBuffer* CTracer::buffer()
+{
+	thread_local TBuffer* pBuffer = nullptr;
+	if (pBuffer)
+		return pBuffer;
+
+	//First event of the thread. Rings outlive their threads, so a late write still finds them
+	auto pNew = std::make_shared<TBuffer>();
+	pNew->pEvents.reset(new TTraceEvent[gszTraceEvents]);
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	pNew->uiThread = (uint)m_vBuffers.size() + 1;
+	pNew->qsName = QString("thread %1").arg(pNew->uiThread);
+	m_vBuffers.push_back(pNew);
+	pBuffer = pNew.get();
+
+	return pBuffer;
+}
+
+void CTracer::record(const TTraceEvent& event)
+{
+	//Only the owning thread moves the head
+	auto pBuffer = buffer();
+	auto szHead = pBuffer->szHead.load(std::memory_order_relaxed);
+	pBuffer->pEvents[szHead & (gszTraceEvents - 1)] = event;
+	pBuffer->szHead.store(szHead + 1, std::memory_order_release);
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "intfs.h"
+
+//Phases of the Chrome trace event format
+enum class ETracePhase : char {
+	Complete = 'X',
+	AsyncBegin = 'b',
+	AsyncEnd = 'e',
+	AsyncInstant = 'n'
+};
+
+//Fixed size, recording is one copy into a preallocated slot. Names must be string literals
+struct TTraceEvent {
+	const char* szName = nullptr;
+	ETracePhase ePhase = ETracePhase::Complete;
+	//ns since tracing was enabled
+	qint64 nTime = 0;
+	qint64 nDuration = 0;
+	//Async track, the texture handle for tile spans
+	quint64 nId = 0;
+	//Quadkey packed by CTracer::pack, 0 - none
+	quint64 nKey = 0;
+};
+
+//Opt-in trace of the tile pipeline and the frames, written as a trace event JSON file for Perfetto.
+//Every thread records into its own ring, so recording takes no lock; a full ring overwrites its oldest events
+class CTracer {
+public:
+	//Before the threads that record start
+	static void setEnabled(const bool& bEnabled);
+	static bool enabled();
+	static qint64 now();
+	//Spans of one tile texture. They may begin and end on different threads
+	static void begin(const char* szName, const quint64& nId, const quint64& nKey = 0);
+	static void end(const char* szName, const quint64& nId);
+	static void mark(const char* szName, const quint64& nId, const quint64& nKey = 0);
+	//Span on the calling thread from nStart till now
+	static void complete(const char* szName, const qint64& nStart);
+	static void setThreadName(const QString& qsName);
+	static quint64 pack(const QString& qsQuadKey);
+	//Whatever the rings still hold. Meant for shutdown, events recorded meanwhile may be left out
+	static bool write(const QString& qsPath);
+private:
+	struct TBuffer {
+		uint uiThread = 0;
+		QString qsName;
+		std::unique_ptr<TTraceEvent[]> pEvents;
+		std::atomic<size_t> szHead{ 0 };
+	};
+	static std::atomic<bool> m_bEnabled;
+	static std::chrono::steady_clock::time_point m_Start;
+	static std::mutex m_Lock;
+	static std::vector<std::shared_ptr<TBuffer>> m_vBuffers;
+	static TBuffer* buffer();
+	static void record(const TTraceEvent& event);
+};
+
+//Complete event for the enclosing scope
+class CTraceScope {
+public:
+	explicit CTraceScope(const char* szName) : m_szName(szName), m_nStart(CTracer::enabled() ? CTracer::now() : -1) {};
+	~CTraceScope() { if (m_nStart >= 0) CTracer::complete(m_szName, m_nStart); };
+private:
+	const char* m_szName;
+	qint64 m_nStart;
+};